@@ -381,6 +381,13 @@ void ProtocolAdmin::parsePacket(NetworkMessage& msg)
 
 				break;
 			}
+			case CMD_SLOW_CONNECTIONS:
+			{
+				uint16_t count = msg.GetU16();
+				g_dispatcher.addTask(
+					createTask(boost::bind(&ProtocolAdmin::adminCommandSlowConnections, this, count)));
+				break;
+			}
 			default:
 			{
 				output->AddByte(AP_MSG_COMMAND_FAILED);
@@ -611,6 +618,52 @@ void ProtocolAdmin::adminCommandRelationalSaveServer()
 	}
 }
 
+static std::string formatDelay(int64_t delay)
+{
+	if(delay < 0){
+		return "-";
+	}
+
+	std::ostringstream ss;
+	ss << delay / 1000;
+	return ss.str();
+}
+
+void ProtocolAdmin::adminCommandSlowConnections(uint16_t count)
+{
+	// The reply has to fit in a single message
+	std::vector<ConnectionInfo> connections;
+	ConnectionManager::getInstance()->getSlowestConnections(std::min<uint16_t>(count, 50), connections);
+
+	std::ostringstream ss;
+	ss << "ip              name                  age(s)  in(B)     out(B)    msgs in/out    queue(B)  first(ms)  login(ms)  write(ms)" << std::endl;
+	for(std::vector<ConnectionInfo>::const_iterator it = connections.begin(); it != connections.end(); ++it){
+		std::ostringstream messages;
+		messages << it->messagesIn << "/" << it->messagesOut;
+
+		ss << std::left << std::setw(16) << convertIPToString(it->ip)
+			<< std::setw(22) << (it->name.empty() ? "-" : it->name.substr(0, 21))
+			<< std::right << std::setw(6) << it->age / 1000000 << "  "
+			<< std::left << std::setw(10) << it->bytesIn
+			<< std::setw(10) << it->bytesOut
+			<< std::setw(15) << messages.str()
+			<< std::setw(10) << it->maxQueuedBytes
+			<< std::setw(11) << formatDelay(it->firstPacketDelay)
+			<< std::setw(11) << formatDelay(it->placementDelay)
+			<< it->maxWriteTime / 1000 << std::endl;
+	}
+
+	addLogLine(this, LOGTYPE_EVENT, 1, "dumped slowest connections");
+
+	OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, false);
+	if(output){
+		TRACK_MESSAGE(output);
+		output->AddByte(AP_MSG_COMMAND_OK);
+		output->AddString(ss.str());
+		OutputMessagePool::getInstance()->send(output);
+	}
+}
+
 /////////////////////////////////////////////
 
 AdminProtocolConfig::AdminProtocolConfig()
@@ -118,7 +118,8 @@ enum{
 	CMD_SAVE_SERVER = 13,
 	CMD_SEND_MAIL = 14,
 	CMD_SHALLOW_SAVE_SERVER = 15,
-	CMD_RELATIONAL_SAVE_SERVER = 16
+	CMD_RELATIONAL_SAVE_SERVER = 16,
+	CMD_SLOW_CONNECTIONS = 17
 };
 
 
@@ -203,6 +204,7 @@ protected:
 	void adminCommandShutdownServer();
 	void adminCommandSendMail(const std::string& xmlData);
 	void adminCommandKickPlayer(const std::string& name);
+	void adminCommandSlowConnections(uint16_t count);
 
 	Item* createMail(const std::string& xmlData, std::string& name, uint32_t& depotId);
 
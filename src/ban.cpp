@@ -28,16 +28,299 @@
 
 extern ConfigManager g_config;
 
-bool BanManager::clearTemporaryBans() const
+IpBanTrie::IpBanTrie()
+{
+	addNode(0, 0, false, 0);
+}
+
+int32_t IpBanTrie::getPrefixLength(uint32_t mask)
+{
+	for(uint32_t length = 0; length <= 32; ++length){
+		if(getMask(length) == mask){
+			return length;
+		}
+	}
+	return -1;
+}
+
+uint32_t IpBanTrie::getMask(uint32_t length)
+{
+	return length == 0 ? 0 : 0xFFFFFFFF << (32 - length);
+}
+
+uint32_t IpBanTrie::getBit(uint32_t prefix, uint32_t position)
+{
+	return (prefix >> (31 - position)) & 1;
+}
+
+bool IpBanTrie::isActive(bool banned, int32_t expires, int32_t now)
+{
+	return banned && (expires <= 0 || expires >= now);
+}
+
+uint32_t IpBanTrie::addNode(uint32_t prefix, uint32_t length, bool banned, int32_t expires)
+{
+	Node node;
+	node.prefix = prefix & getMask(length);
+	node.length = (uint8_t)length;
+	node.banned = banned;
+	node.expires = expires;
+	node.child[0] = 0;
+	node.child[1] = 0;
+	m_nodes.push_back(node);
+	return (uint32_t)m_nodes.size() - 1;
+}
+
+void IpBanTrie::addBan(uint32_t ip, uint32_t mask, int32_t expires)
+{
+	int32_t length = getPrefixLength(ntohl(mask));
+	if(length < 0){
+		Entry entry;
+		entry.ip = ip;
+		entry.mask = mask;
+		entry.expires = expires;
+		m_otherMasks.push_back(entry);
+		return;
+	}
+
+	uint32_t prefix = ntohl(ip) & getMask(length);
+	uint32_t index = 0;
+	while(true){
+		if(m_nodes[index].length == length){
+			// several bans of the same range, the longest one counts
+			Node& node = m_nodes[index];
+			if(!node.banned || node.expires > 0){
+				node.expires = (!node.banned || expires <= 0 ? expires : std::max(node.expires, expires));
+			}
+			node.banned = true;
+			return;
+		}
+
+		uint32_t bit = getBit(prefix, m_nodes[index].length);
+		uint32_t childIndex = m_nodes[index].child[bit];
+		if(childIndex == 0){
+			uint32_t leaf = addNode(prefix, length, true, expires);
+			m_nodes[index].child[bit] = leaf;
+			return;
+		}
+
+		const Node& child = m_nodes[childIndex];
+		uint32_t maxCommon = std::min<uint32_t>(child.length, length);
+		uint32_t common = 0;
+		uint32_t diff = child.prefix ^ prefix;
+		while(common < maxCommon && getBit(diff, common) == 0){
+			++common;
+		}
+
+		if(common == child.length){
+			index = childIndex;
+			continue;
+		}
+
+		uint32_t childBit = getBit(child.prefix, common);
+		uint32_t split;
+		if(common == (uint32_t)length){
+			// the new range contains the child
+			split = addNode(prefix, length, true, expires);
+		}
+		else{
+			split = addNode(prefix, common, false, 0);
+			uint32_t leaf = addNode(prefix, length, true, expires);
+			m_nodes[split].child[childBit ^ 1] = leaf;
+		}
+		m_nodes[split].child[childBit] = childIndex;
+		m_nodes[index].child[bit] = split;
+		return;
+	}
+}
+
+uint32_t IpBanTrie::removeBans(uint32_t ip, uint32_t mask, int32_t now)
+{
+	uint32_t removed = 0;
+	for(std::vector<Entry>::iterator it = m_otherMasks.begin(); it != m_otherMasks.end();){
+		if((ip & mask & it->mask) == (it->ip & it->mask & mask)){
+			it = m_otherMasks.erase(it);
+			++removed;
+		}
+		else{
+			++it;
+		}
+	}
+
+	// Nodes are only unmarked, the trie is rebuilt on the next load
+	int32_t length = getPrefixLength(ntohl(mask));
+	if(length < 0){
+		// the ranges of the trie that share the bits of mask
+		for(std::vector<Node>::iterator it = m_nodes.begin(); it != m_nodes.end(); ++it){
+			uint32_t nodeMask = htonl(getMask(it->length));
+			if(it->banned && (ip & mask & nodeMask) == (htonl(it->prefix) & nodeMask & mask)){
+				it->banned = false;
+				++removed;
+			}
+		}
+		return removed;
+	}
+
+	uint32_t prefix = ntohl(ip) & getMask(length);
+	uint32_t index = 0;
+	while(true){
+		Node& node = m_nodes[index];
+		if(node.length >= length){
+			if(((prefix ^ node.prefix) & getMask(length)) == 0){
+				removed += removeSubtree(index);
+			}
+			break;
+		}
+
+		if(((prefix ^ node.prefix) & getMask(node.length)) != 0){
+			break;
+		}
+
+		if(node.banned){
+			node.banned = false;
+			++removed;
+		}
+
+		index = node.child[getBit(prefix, node.length)];
+		if(index == 0){
+			break;
+		}
+	}
+	return removed;
+}
+
+uint32_t IpBanTrie::removeSubtree(uint32_t index)
+{
+	uint32_t removed = 0;
+	std::vector<uint32_t> pending(1, index);
+	while(!pending.empty()){
+		Node& node = m_nodes[pending.back()];
+		pending.pop_back();
+		if(node.banned){
+			node.banned = false;
+			++removed;
+		}
+		for(uint32_t i = 0; i < 2; ++i){
+			if(node.child[i] != 0){
+				pending.push_back(node.child[i]);
+			}
+		}
+	}
+	return removed;
+}
+
+bool IpBanTrie::hasActiveBan(uint32_t index, int32_t now) const
+{
+	std::vector<uint32_t> pending(1, index);
+	while(!pending.empty()){
+		const Node& node = m_nodes[pending.back()];
+		pending.pop_back();
+		if(isActive(node.banned, node.expires, now)){
+			return true;
+		}
+		for(uint32_t i = 0; i < 2; ++i){
+			if(node.child[i] != 0){
+				pending.push_back(node.child[i]);
+			}
+		}
+	}
+	return false;
+}
+
+bool IpBanTrie::isBanned(uint32_t ip, uint32_t mask, int32_t now) const
+{
+	for(std::vector<Entry>::const_iterator it = m_otherMasks.begin(); it != m_otherMasks.end(); ++it){
+		if((ip & mask & it->mask) == (it->ip & it->mask & mask) && isActive(true, it->expires, now)){
+			return true;
+		}
+	}
+
+	int32_t length = getPrefixLength(ntohl(mask));
+	if(length < 0){
+		for(std::vector<Node>::const_iterator it = m_nodes.begin(); it != m_nodes.end(); ++it){
+			uint32_t nodeMask = htonl(getMask(it->length));
+			if(isActive(it->banned, it->expires, now) && (ip & mask & nodeMask) == (htonl(it->prefix) & nodeMask & mask)){
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// A ban matches when its range contains ip/mask or lies inside it
+	uint32_t prefix = ntohl(ip) & getMask(length);
+	uint32_t index = 0;
+	while(true){
+		const Node& node = m_nodes[index];
+		if(node.length >= length){
+			return ((prefix ^ node.prefix) & getMask(length)) == 0 && hasActiveBan(index, now);
+		}
+
+		if(((prefix ^ node.prefix) & getMask(node.length)) != 0){
+			return false;
+		}
+
+		if(isActive(node.banned, node.expires, now)){
+			return true;
+		}
+
+		index = node.child[getBit(prefix, node.length)];
+		if(index == 0){
+			return false;
+		}
+	}
+}
+
+BanManager::BanManager()
+{
+	ipBans.reset(new IpBanTrie());
+}
+
+IpBanTrie_ptr BanManager::getIpBans() const
+{
+	return boost::atomic_load(&ipBans);
+}
+
+void BanManager::setIpBans(IpBanTrie_ptr trie)
+{
+	boost::atomic_store(&ipBans, trie);
+}
+
+bool BanManager::loadIpBans()
 {
 	DatabaseDriver* db = DatabaseDriver::instance();
 	DBQuery query;
-	return db->executeQuery("UPDATE `bans` SET `active` = 0 WHERE `expires` = 0");
+	query << "SELECT `ip`, `mask`, `expires` "
+			 "FROM `ip_bans` "
+			 "INNER JOIN `bans` ON `bans`.`id` = `ip_bans`.`ban_id` "
+			 "WHERE `active` = 1";
+
+	boost::mutex::scoped_lock lockClass(ipBanLock);
+	boost::shared_ptr<IpBanTrie> trie(new IpBanTrie());
+	for(DBResult_ptr result = db->storeQuery(query.str()); result; result = result->advance()){
+		trie->addBan(result->getDataUInt("ip"), result->getDataUInt("mask"), (int32_t)result->getDataLong("expires"));
+	}
+
+	setIpBans(trie);
+	return true;
+}
+
+bool BanManager::clearTemporaryBans()
+{
+	DatabaseDriver* db = DatabaseDriver::instance();
+	DBQuery query;
+	if(!db->executeQuery("UPDATE `bans` SET `active` = 0 WHERE `expires` = 0")){
+		return false;
+	}
+	return loadIpBans();
 }
 
 bool BanManager::acceptConnection(uint32_t clientip)
 {
 	if(clientip == 0) return false;
+	if(isIpBanished(clientip)){
+		return false;
+	}
+
 	banLock.lock();
 
 	uint64_t currentTime = OTSYS_TIME();
@@ -102,22 +385,8 @@ bool BanManager::isIpBanished(uint32_t clientip, uint32_t mask /*= 0xFFFFFFFF*/)
 	if(clientip == 0){
 		return false;
 	}
-	
-	DatabaseDriver* db = DatabaseDriver::instance();
 
-	DBQuery query;
-	query << "SELECT COUNT(*) AS `count` "
-			 "FROM `ip_bans` "
-			 "INNER JOIN `bans` ON `bans`.`id` = `ip_bans`.`ban_id` "
-			 "WHERE " << "((" << clientip << " & " << mask << " & `mask`) = (`ip` & `mask` & " << mask << ")) AND `active` = 1 AND (`expires` >= unix_timestamp(now()) OR `expires` <= 0)";
-
-	DBResult_ptr result;
-	if(!(result = db->storeQuery(query.str()))){
-		return false;
-	}
-
-	int t = result->getDataInt("count");
-	return t > 0;
+	return getIpBans()->isBanned(clientip, mask, (int32_t)std::time(NULL));
 }
 
 bool BanManager::isPlayerBanished(uint32_t playerId) const
@@ -205,7 +474,7 @@ void BanManager::addLoginAttempt(uint32_t clientip, bool isSuccess)
 }
 
 bool BanManager::addIpBan(uint32_t ip, uint32_t mask, int32_t time,
-uint32_t adminid, std::string comment) const
+uint32_t adminid, std::string comment)
 {
 	if(ip == 0 || mask == 0){
 		return false;
@@ -240,7 +509,11 @@ uint32_t adminid, std::string comment) const
 	if(!stmt.execute()){
 		return false;
 	}
-	
+
+	boost::mutex::scoped_lock lockClass(ipBanLock);
+	boost::shared_ptr<IpBanTrie> trie(new IpBanTrie(*getIpBans()));
+	trie->addBan(ip, mask, time);
+	setIpBans(trie);
 	return true;
 }
 
@@ -360,7 +633,7 @@ std::string statement, uint32_t reason, ViolationAction action) const
 	return false;
 }
 
-bool BanManager::removeIpBans(uint32_t ip, uint32_t mask) const
+bool BanManager::removeIpBans(uint32_t ip, uint32_t mask)
 {
 	if(!isIpBanished(ip, mask)){
 		return false;
@@ -382,6 +655,10 @@ bool BanManager::removeIpBans(uint32_t ip, uint32_t mask) const
 		}
 	}
 
+	boost::mutex::scoped_lock lockClass(ipBanLock);
+	boost::shared_ptr<IpBanTrie> trie(new IpBanTrie(*getIpBans()));
+	trie->removeBans(ip, mask, (int32_t)std::time(NULL));
+	setIpBans(trie);
 	return true;
 }
 
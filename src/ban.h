@@ -22,7 +22,10 @@
 #define __OTSERV_BAN_H__
 
 #include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/shared_ptr.hpp>
 #include <stdint.h>
+#include <vector>
 #include "enums.h"
 
 enum BanType_t {
@@ -61,12 +64,60 @@ struct ConnectBlock {
 typedef std::map<uint32_t, LoginBlock > IpLoginMap;
 typedef std::map<uint32_t, ConnectBlock > IpConnectMap;
 
+// Compressed binary trie of the active IP bans. Addresses and masks are
+// passed as stored in the database (network byte order). Bans whose mask
+// is not a prefix mask are kept in a plain list.
+// A trie is never changed once it is published, see BanManager.
+class IpBanTrie {
+public:
+	IpBanTrie();
+
+	void addBan(uint32_t ip, uint32_t mask, int32_t expires);
+	// Lifts the bans that overlap ip/mask, returns how many were lifted
+	uint32_t removeBans(uint32_t ip, uint32_t mask, int32_t now);
+	// Same match as the ip_bans query, bans expiring before now are ignored
+	bool isBanned(uint32_t ip, uint32_t mask, int32_t now) const;
+
+	uint32_t getNodeCount() const {return (uint32_t)m_nodes.size();}
+
+protected:
+	struct Node {
+		uint32_t prefix; // host byte order, bits past length are zero
+		uint8_t length;
+		bool banned;
+		int32_t expires; // <= 0 never expires
+		uint32_t child[2]; // 0 is none, the root is never a child
+	};
+
+	struct Entry {
+		uint32_t ip;
+		uint32_t mask;
+		int32_t expires;
+	};
+
+	static int32_t getPrefixLength(uint32_t mask);
+	static uint32_t getMask(uint32_t length);
+	static uint32_t getBit(uint32_t prefix, uint32_t position);
+	static bool isActive(bool banned, int32_t expires, int32_t now);
+
+	uint32_t addNode(uint32_t prefix, uint32_t length, bool banned, int32_t expires);
+	bool hasActiveBan(uint32_t index, int32_t now) const;
+	uint32_t removeSubtree(uint32_t index);
+
+	std::vector<Node> m_nodes;
+	std::vector<Entry> m_otherMasks;
+};
+
+typedef boost::shared_ptr<const IpBanTrie> IpBanTrie_ptr;
+
 class BanManager {
 public:
-	BanManager() {}
+	BanManager();
 	~BanManager() {}
 
-	bool clearTemporaryBans() const;
+	// Reads the active IP bans into memory, done at startup
+	bool loadIpBans();
+	bool clearTemporaryBans();
 	bool acceptConnection(uint32_t clientip);
 
 	bool isIpDisabled(uint32_t clientip);
@@ -76,7 +127,7 @@ public:
 	bool isAccountBanished(uint32_t accountId) const;
 
 	void addLoginAttempt(uint32_t clientip, bool isSuccess);
-	bool addIpBan(uint32_t ip, uint32_t mask, int32_t time, uint32_t adminid, std::string comment) const;
+	bool addIpBan(uint32_t ip, uint32_t mask, int32_t time, uint32_t adminid, std::string comment);
 	bool addPlayerBan(uint32_t playerId, int32_t time, uint32_t adminid, std::string comment,
 		std::string statement, uint32_t reason, ViolationAction action) const;
 	bool addPlayerBan(const std::string& name, int32_t time, uint32_t adminid, std::string comment,
@@ -88,7 +139,7 @@ public:
 	bool addAccountNotation(uint32_t account, uint32_t adminid, std::string comment,
 		std::string statement, uint32_t reason, ViolationAction action) const;
 
-	bool removeIpBans(uint32_t ip, uint32_t mask = 0xFFFFFFFF) const;
+	bool removeIpBans(uint32_t ip, uint32_t mask = 0xFFFFFFFF);
 	bool removePlayerBans(uint32_t guid) const;
 	bool removePlayerBans(const std::string& name) const;
 	bool removeAccountBans(uint32_t accno) const;
@@ -101,6 +152,14 @@ protected:
 
 	IpLoginMap ipLoginMap;
 	IpConnectMap ipConnectMap;
+
+	// Lookups read the current trie without taking banLock, changes are
+	// made on a copy under ipBanLock and then published
+	IpBanTrie_ptr getIpBans() const;
+	void setIpBans(IpBanTrie_ptr ipBans);
+
+	boost::mutex ipBanLock;
+	IpBanTrie_ptr ipBans;
 };
 
 #endif
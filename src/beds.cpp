@@ -234,7 +234,7 @@ void BedItem::wakeUp()
 			regeneratePlayer(player);
 
 			if(player->isOffline()){
-				IOPlayer::instance()->savePlayer(player);
+				IOPlayer::instance()->savePlayerAsync(player);
 				delete player;
 				player = NULL;
 			}
@@ -99,6 +99,19 @@ bool ConfigManager::loadFile(const std::string& _filename)
 		m_confString[SQL_DB] = getGlobalString(L, "database_schema");
 		m_confString[SQL_TYPE] = getGlobalString(L, "database_type", "sqlite");
 		m_confInteger[SQL_PORT] = getGlobalNumber(L, "database_port");
+		m_confInteger[SQLITE_TUNED] = getGlobalBoolean(L, "sqlite_tuned", false);
+		m_confInteger[SQLITE_MMAP_SIZE] = getGlobalNumber(L, "sqlite_mmap_size", 256 * 1024 * 1024);
+		m_confString[PACKET_TRACE_FILE] = getGlobalString(L, "packet_trace_file", "");
+		m_confInteger[LOGIN_WORKER_THREADS] = getGlobalNumber(L, "login_worker_threads", 2);
+		m_confInteger[LOGIN_QUEUE_SIZE] = getGlobalNumber(L, "login_queue_size", 256);
+		m_confInteger[NETWORK_THREADS] = getGlobalNumber(L, "network_threads", 1);
+		m_confInteger[DATABASE_WORKER_THREADS] = getGlobalNumber(L, "database_worker_threads", 1);
+		m_confInteger[DATABASE_CONNECTIONS] = getGlobalNumber(L, "database_connections", 0);
+		m_confInteger[SEND_QUEUE_LIMIT_BYTES] = getGlobalNumber(L, "send_queue_limit_bytes", 256 * 1024);
+		m_confInteger[SEND_QUEUE_LIMIT_MESSAGES] = getGlobalNumber(L, "send_queue_limit_messages", 64);
+		m_confString[PLAYER_JOURNAL_FILE] = getGlobalString(L, "player_journal_file", "");
+		m_confInteger[PLAYER_JOURNAL_INTERVAL] = getGlobalNumber(L, "player_journal_interval", 10 * 1000);
+		m_confInteger[PLAYER_JOURNAL_FLUSH_INTERVAL] = getGlobalNumber(L, "player_journal_flush_interval", 1000);
 	}
 
 	m_confString[LOGIN_MSG] = getGlobalString(L, "loginmsg", "Welcome.");
@@ -108,6 +121,8 @@ bool ConfigManager::loadFile(const std::string& _filename)
 	m_confString[URL] = getGlobalString(L, "url");
 	m_confString[LOCATION] = getGlobalString(L, "location");
 	m_confString[MAP_STORAGE_TYPE] = getGlobalString(L, "map_store_type", "relational");
+	m_confString[PLAYER_STORAGE_TYPE] = getGlobalString(L, "player_storage_type", "relational");
+	m_confInteger[MAP_SAVE_THREADS] = getGlobalNumber(L, "map_save_threads", 0);
 	m_confInteger[LOGIN_TRIES] = getGlobalNumber(L, "maximum_login_tries", 5);
 	m_confInteger[RETRY_TIMEOUT] = getGlobalNumber(L, "login_retry_timeout", 30 * 1000);
 	m_confInteger[LOGIN_TIMEOUT] = getGlobalNumber(L, "login_unlock_timeout", 5 * 1000);
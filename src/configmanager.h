@@ -55,6 +55,9 @@ public:
 		SQL_DB,
 		SQL_TYPE,
 		MAP_STORAGE_TYPE,
+		PLAYER_STORAGE_TYPE,
+		PACKET_TRACE_FILE,
+		PLAYER_JOURNAL_FILE,
 		LAST_STRING_CONFIG /* this must be the last one */
 	};
 
@@ -139,6 +142,18 @@ public:
 		RATES_FOR_PLAYER_KILLING,
 		RATE_EXPERIENCE_PVP,
 		ADDONS_ONLY_FOR_PREMIUM,
+		LOGIN_WORKER_THREADS,
+		LOGIN_QUEUE_SIZE,
+		NETWORK_THREADS,
+		DATABASE_WORKER_THREADS,
+		DATABASE_CONNECTIONS,
+		SEND_QUEUE_LIMIT_BYTES,
+		SEND_QUEUE_LIMIT_MESSAGES,
+		PLAYER_JOURNAL_INTERVAL,
+		PLAYER_JOURNAL_FLUSH_INTERVAL,
+		MAP_SAVE_THREADS,
+		SQLITE_TUNED,
+		SQLITE_MMAP_SIZE,
 		LAST_INTEGER_CONFIG /* this must be the last one */
 	};
 
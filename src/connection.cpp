@@ -29,6 +29,12 @@
 #include "server.h"
 #include "singleton.h"
 #include "tools.h"
+#include "configmanager.h"
+#ifdef __USE_IO_URING__
+#include "iouring.h"
+#endif
+
+extern ConfigManager g_config;
 
 bool Connection::m_logError = true;
 
@@ -36,6 +42,31 @@ bool Connection::m_logError = true;
 uint32_t Connection::connectionCount = 0;
 #endif
 
+Histogram::Histogram()
+{
+	for(uint32_t i = 0; i < bucket_count; ++i){
+		m_buckets[i] = 0;
+	}
+}
+
+void Histogram::add(uint64_t value)
+{
+	uint32_t bucket = 0;
+	while(value > 0 && bucket < bucket_count - 1){
+		value >>= 1;
+		++bucket;
+	}
+
+	m_buckets[bucket].fetch_add(1, boost::memory_order_relaxed);
+}
+
+void Histogram::getBuckets(uint64_t buckets[bucket_count]) const
+{
+	for(uint32_t i = 0; i < bucket_count; ++i){
+		buckets[i] = m_buckets[i].load(boost::memory_order_relaxed);
+	}
+}
+
 ConnectionManager* ConnectionManager::getInstance()
 {
 	static Singleton<ConnectionManager> instance;
@@ -66,6 +97,17 @@ void ConnectionManager::releaseConnection(Connection_ptr connection)
 		std::find(m_connections.begin(), m_connections.end(), connection);
 
 	if(it != m_connections.end()){
+		#ifdef __DEBUG_NET__
+		std::cout << "Connection closed after " << (OTSYS_TIME_US() - connection->m_acceptTime) / 1000 << " ms, "
+			<< connection->m_bytesIn << " bytes in, " << connection->m_bytesOut << " bytes out, "
+			<< "first packet " << connection->m_firstPacketDelay << " us, placement " << connection->m_placementDelay << " us, "
+			<< "longest write " << connection->m_maxWriteTime << " us" << std::endl;
+		#endif
+
+		// Login and status connections never queue anything
+		if(connection->m_placementDelay >= 0){
+			m_histograms[HISTOGRAM_QUEUE_HIGH_WATER].add(connection->m_maxQueuedBytes);
+		}
 		m_connections.erase(it);
 	}
 	else{
@@ -73,6 +115,47 @@ void ConnectionManager::releaseConnection(Connection_ptr connection)
 	}
 }
 
+void ConnectionManager::getSendQueueStats(SendQueueStats& stats)
+{
+	boost::recursive_mutex::scoped_lock lockClass(m_connectionManagerLock);
+	stats.connections = m_connections.size();
+	for(std::list<Connection_ptr>::iterator it = m_connections.begin(); it != m_connections.end(); ++it){
+		const Connection_ptr& connection = *it;
+		uint32_t bytes = connection->m_queuedBytes.load(boost::memory_order_relaxed);
+		uint32_t messages = connection->m_queuedMessages.load(boost::memory_order_relaxed);
+		stats.queuedBytes += bytes;
+		stats.queuedMessages += messages;
+		stats.maxQueuedBytes = std::max(stats.maxQueuedBytes, bytes);
+		if(bytes > Connection::getSendQueueLimitBytes() || messages > Connection::getSendQueueLimitMessages()){
+			++stats.backlogged;
+			// Every queued message holds a whole pool buffer
+			stats.backloggedMemory += (uint64_t)messages * sizeof(OutputMessage);
+		}
+	}
+	stats.droppedUpdates = m_droppedUpdates.load(boost::memory_order_relaxed);
+	stats.overflows = m_overflows.load(boost::memory_order_relaxed);
+}
+
+static bool compareWriteTime(const ConnectionInfo& a, const ConnectionInfo& b)
+{
+	return a.maxWriteTime > b.maxWriteTime;
+}
+
+void ConnectionManager::getSlowestConnections(uint32_t count, std::vector<ConnectionInfo>& connections)
+{
+	boost::recursive_mutex::scoped_lock lockClass(m_connectionManagerLock);
+	connections.resize(m_connections.size());
+	std::vector<ConnectionInfo>::iterator info = connections.begin();
+	for(std::list<Connection_ptr>::iterator it = m_connections.begin(); it != m_connections.end(); ++it, ++info){
+		(*it)->getInfo(*info);
+	}
+	lockClass.unlock();
+
+	count = std::min<uint32_t>(count, connections.size());
+	std::partial_sort(connections.begin(), connections.begin() + count, connections.end(), compareWriteTime);
+	connections.resize(count);
+}
+
 void ConnectionManager::closeAll()
 {
 	#ifdef __DEBUG_NET_DETAIL__
@@ -108,10 +191,25 @@ Connection::Connection(boost::asio::ip::tcp::socket* socket,
 	m_protocol = NULL;
 	m_pendingWrite = 0;
 	m_pendingRead = 0;
+	m_queuedBytes = 0;
+	m_queuedMessages = 0;
 	m_connectionState = CONNECTION_STATE_OPEN;
 	m_receivedFirst = false;
 	m_writeError = false;
 	m_readError = false;
+	m_acceptTime = OTSYS_TIME_US();
+	m_firstPacketDelay = -1;
+	m_placementDelay = -1;
+	m_bytesIn = 0;
+	m_bytesOut = 0;
+	m_messagesIn = 0;
+	m_messagesOut = 0;
+	m_maxQueuedBytes = 0;
+	m_writeStart = 0;
+	m_maxWriteTime = 0;
+#ifdef __USE_IO_URING__
+	m_ring = IoUring::get(io_service);
+#endif
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
 	connectionCount++;
@@ -196,6 +294,12 @@ void Connection::closeSocket()
 
 		m_pendingRead = 0;
 		m_pendingWrite = 0;
+		// The messages hold a reference to the connection
+		for(OutputMessageList::iterator it = m_pendingMessages.begin(); it != m_pendingMessages.end(); ++it){
+			m_queuedBytes -= (*it)->getMessageLength();
+		}
+		m_queuedMessages -= m_pendingMessages.size();
+		m_pendingMessages.clear();
 
 		try{
 			boost::system::error_code error;
@@ -277,6 +381,35 @@ void Connection::deleteConnectionTask()
 	}
 }
 
+template <typename Handler>
+void Connection::asyncRead(char* buffer, size_t size, Handler handler)
+{
+#ifdef __USE_IO_URING__
+	if(m_ring){
+		m_ring->asyncRead(m_socket->native_handle(), buffer, size, handler);
+		return;
+	}
+#endif
+	boost::asio::async_read(getHandle(), boost::asio::buffer(buffer, size), handler);
+}
+
+template <typename Handler>
+void Connection::asyncWrite(const boost::asio::const_buffer* buffers, size_t count, Handler handler)
+{
+#ifdef __USE_IO_URING__
+	if(m_ring){
+		m_ring->asyncWrite(m_socket->native_handle(), buffers, count, handler);
+		return;
+	}
+#endif
+	if(count == 1){
+		boost::asio::async_write(getHandle(), boost::asio::buffer(buffers[0]), handler);
+	}
+	else{
+		boost::asio::async_write(getHandle(), std::vector<boost::asio::const_buffer>(buffers, buffers + count), handler);
+	}
+}
+
 void Connection::acceptConnection(Protocol* protocol)
 {
 	m_protocol = protocol;
@@ -293,8 +426,7 @@ void Connection::acceptConnection()
 		m_readTimer.async_wait( boost::bind(&Connection::handleReadTimeout, boost::weak_ptr<Connection>(shared_from_this()), boost::asio::placeholders::error));
 
 		// Read size of the first packet
-		boost::asio::async_read(getHandle(),
-			boost::asio::buffer(m_msg.getBuffer(), NetworkMessage::header_length),
+		asyncRead(m_msg.getBuffer(), NetworkMessage::header_length,
 			boost::bind(&Connection::parseHeader, shared_from_this(), boost::asio::placeholders::error));
 	}
 	catch(boost::system::system_error& e){
@@ -332,7 +464,7 @@ void Connection::parseHeader(const boost::system::error_code& error)
 
 		// Read packet content
 		m_msg.setMessageLength(size + NetworkMessage::header_length);
-		boost::asio::async_read(getHandle(), boost::asio::buffer(m_msg.getBodyBuffer(), size),
+		asyncRead(m_msg.getBodyBuffer(), size,
 			boost::bind(&Connection::parsePacket, shared_from_this(), boost::asio::placeholders::error));
 	}
 	catch(boost::system::system_error& e){
@@ -362,6 +494,8 @@ void Connection::parsePacket(const boost::system::error_code& error)
 	}
 
 	--m_pendingRead;
+	m_bytesIn += m_msg.getMessageLength();
+	++m_messagesIn;
 
 	//Check packet checksum
 	uint32_t recvChecksum = m_msg.PeekU32();
@@ -377,6 +511,8 @@ void Connection::parsePacket(const boost::system::error_code& error)
 
 	if(!m_receivedFirst){
 		m_receivedFirst = true;
+		m_firstPacketDelay = OTSYS_TIME_US() - m_acceptTime;
+		ConnectionManager::getInstance()->getHistogram(ConnectionManager::HISTOGRAM_FIRST_PACKET).add(m_firstPacketDelay);
 		// First message received
 		if(!m_protocol){ // Game protocol has already been created at this point
 			m_protocol = m_service_port->make_protocol(recvChecksum == checksum, m_msg);
@@ -405,8 +541,7 @@ void Connection::parsePacket(const boost::system::error_code& error)
 			boost::asio::placeholders::error));
 
 		// Wait to the next packet
-		boost::asio::async_read(getHandle(),
-			boost::asio::buffer(m_msg.getBuffer(), NetworkMessage::header_length),
+		asyncRead(m_msg.getBuffer(), NetworkMessage::header_length,
 			boost::bind(&Connection::parseHeader, shared_from_this(), boost::asio::placeholders::error));
 	}
 	catch(boost::system::system_error& e){
@@ -448,9 +583,8 @@ bool Connection::send(OutputMessage_ptr msg)
 		std::cout << "Connection::send Adding to queue " << msg->getMessageLength() << std::endl;
 		#endif
 
-		TRACK_MESSAGE(msg);
-		OutputMessagePool* outputPool = OutputMessagePool::getInstance();
-		outputPool->addToAutoSend(msg);
+		queueMessage(msg);
+		checkSendQueue();
 	}
 
 	m_connectionLock.unlock();
@@ -461,14 +595,20 @@ void Connection::internalSend(OutputMessage_ptr msg)
 {
 	TRACK_MESSAGE(msg);
 
+	// counted until the write completes, like the messages of internalSendPending
+	m_queuedBytes += msg->getMessageLength();
+	++m_queuedMessages;
+	m_maxQueuedBytes = std::max<uint32_t>(m_maxQueuedBytes, m_queuedBytes);
+
 	try{
 		++m_pendingWrite;
+		m_writeStart = OTSYS_TIME_US();
 		m_writeTimer.expires_from_now(boost::posix_time::seconds(Connection::write_timeout));
 		m_writeTimer.async_wait( boost::bind(&Connection::handleWriteTimeout, boost::weak_ptr<Connection>(shared_from_this()),
 			boost::asio::placeholders::error));
 
-		boost::asio::async_write(getHandle(),
-			boost::asio::buffer(msg->getOutputBuffer(), msg->getMessageLength()),
+		boost::asio::const_buffer buffer(msg->getOutputBuffer(), msg->getMessageLength());
+		asyncWrite(&buffer, 1,
 			boost::bind(&Connection::onWriteOperation, shared_from_this(), msg, boost::asio::placeholders::error));
 	}
 	catch(boost::system::system_error& e){
@@ -479,6 +619,124 @@ void Connection::internalSend(OutputMessage_ptr msg)
 	}
 }
 
+bool Connection::send(const OutputMessageList& msgs)
+{
+	boost::recursive_mutex::scoped_lock lockClass(m_connectionLock);
+	if(m_connectionState != CONNECTION_STATE_OPEN || m_writeError){
+		return false;
+	}
+
+	for(OutputMessageList::const_iterator it = msgs.begin(); it != msgs.end(); ++it){
+		queueMessage(*it);
+	}
+
+	if(m_pendingWrite == 0){
+		internalSendPending();
+	}
+	else{
+		checkSendQueue();
+	}
+	return true;
+}
+
+void Connection::queueMessage(OutputMessage_ptr msg)
+{
+	msg->getProtocol()->onSendMessage(msg);
+	TRACK_MESSAGE(msg);
+
+	m_pendingMessages.push_back(msg);
+	m_queuedBytes += msg->getMessageLength();
+	++m_queuedMessages;
+	m_maxQueuedBytes = std::max<uint32_t>(m_maxQueuedBytes, m_queuedBytes);
+}
+
+void Connection::checkSendQueue()
+{
+	// Above the limit ProtocolGame drops optional updates, a client that
+	// still does not catch up holds too much of the pool and is dropped
+	if(m_queuedBytes > 2 * getSendQueueLimitBytes() || m_queuedMessages > 2 * getSendQueueLimitMessages()){
+		#ifdef __DEBUG_NET__
+		std::cout << "Connection::checkSendQueue closing slow connection, " << m_queuedBytes.load() << " bytes queued" << std::endl;
+		#endif
+		ConnectionManager::getInstance()->onSendQueueOverflow();
+		closeConnection();
+	}
+}
+
+bool Connection::isBacklogged() const
+{
+	return m_queuedBytes.load(boost::memory_order_relaxed) > getSendQueueLimitBytes() ||
+		m_queuedMessages.load(boost::memory_order_relaxed) > getSendQueueLimitMessages();
+}
+
+uint32_t Connection::getSendQueueLimitBytes()
+{
+	return (uint32_t)g_config.getNumber(ConfigManager::SEND_QUEUE_LIMIT_BYTES);
+}
+
+uint32_t Connection::getSendQueueLimitMessages()
+{
+	return (uint32_t)g_config.getNumber(ConfigManager::SEND_QUEUE_LIMIT_MESSAGES);
+}
+
+void Connection::internalSendPending()
+{
+	boost::shared_ptr<OutputMessageList> msgs(new OutputMessageList());
+	msgs->swap(m_pendingMessages);
+
+	std::vector<boost::asio::const_buffer> buffers;
+	buffers.reserve(msgs->size());
+	for(OutputMessageList::iterator it = msgs->begin(); it != msgs->end(); ++it){
+		buffers.push_back(boost::asio::buffer((*it)->getOutputBuffer(), (*it)->getMessageLength()));
+	}
+
+	try{
+		++m_pendingWrite;
+		m_writeStart = OTSYS_TIME_US();
+		m_writeTimer.expires_from_now(boost::posix_time::seconds(Connection::write_timeout));
+		m_writeTimer.async_wait( boost::bind(&Connection::handleWriteTimeout, boost::weak_ptr<Connection>(shared_from_this()),
+			boost::asio::placeholders::error));
+
+		// One gathered write, the messages stay alive until it completes
+		asyncWrite(&buffers[0], buffers.size(),
+			boost::bind(&Connection::onWriteMessagesOperation, shared_from_this(), msgs, boost::asio::placeholders::error));
+	}
+	catch(boost::system::system_error& e){
+		if(m_logError){
+			LOG_MESSAGE("NETWORK", LOGTYPE_ERROR, 1, e.what());
+			m_logError = false;
+		}
+	}
+}
+
+bool Connection::send(SharedBuffer_ptr buffer)
+{
+	boost::recursive_mutex::scoped_lock lockClass(m_connectionLock);
+	if(m_connectionState != CONNECTION_STATE_OPEN || m_writeError || m_pendingWrite != 0){
+		return false;
+	}
+
+	try{
+		++m_pendingWrite;
+		m_writeStart = OTSYS_TIME_US();
+		m_writeTimer.expires_from_now(boost::posix_time::seconds(Connection::write_timeout));
+		m_writeTimer.async_wait( boost::bind(&Connection::handleWriteTimeout, boost::weak_ptr<Connection>(shared_from_this()),
+			boost::asio::placeholders::error));
+
+		// The buffer is kept alive by the handler, no copy is made
+		boost::asio::const_buffer data(buffer->data(), buffer->size());
+		asyncWrite(&data, 1,
+			boost::bind(&Connection::onWriteBufferOperation, shared_from_this(), buffer, boost::asio::placeholders::error));
+	}
+	catch(boost::system::system_error& e){
+		if(m_logError){
+			LOG_MESSAGE("NETWORK", LOGTYPE_ERROR, 1, e.what());
+			m_logError = false;
+		}
+	}
+	return true;
+}
+
 uint32_t Connection::getIP() const
 {
 	//Ip is expressed in network byte order
@@ -493,6 +751,38 @@ uint32_t Connection::getIP() const
 	}
 }
 
+void Connection::onPlayerPlaced(const std::string& name)
+{
+	//dispatcher thread
+	boost::recursive_mutex::scoped_lock lockClass(m_connectionLock);
+	m_name = name;
+	if(m_firstPacketDelay >= 0){
+		m_placementDelay = OTSYS_TIME_US() - m_acceptTime - m_firstPacketDelay;
+		ConnectionManager::getInstance()->getHistogram(ConnectionManager::HISTOGRAM_PLACEMENT).add(m_placementDelay);
+	}
+}
+
+void Connection::getInfo(ConnectionInfo& info)
+{
+	boost::recursive_mutex::scoped_lock lockClass(m_connectionLock);
+	info.ip = m_socket ? getIP() : 0;
+	info.name = m_name;
+	info.age = OTSYS_TIME_US() - m_acceptTime;
+	info.bytesIn = m_bytesIn;
+	info.bytesOut = m_bytesOut;
+	info.messagesIn = m_messagesIn;
+	info.messagesOut = m_messagesOut;
+	info.maxQueuedBytes = m_maxQueuedBytes;
+	info.firstPacketDelay = m_firstPacketDelay;
+	info.placementDelay = m_placementDelay;
+	info.maxWriteTime = m_maxWriteTime;
+}
+
+void Connection::post(const boost::function<void (void)>& handler)
+{
+	m_io_service.post(handler);
+}
+
 int32_t Connection::addRef()
 {
 	return ++m_refCount;
@@ -513,8 +803,62 @@ void Connection::onWriteOperation(OutputMessage_ptr msg, const boost::system::er
 	m_writeTimer.cancel();
 
 	TRACK_MESSAGE(msg);
+	m_queuedBytes -= msg->getMessageLength();
+	--m_queuedMessages;
+	if(!error){
+		m_bytesOut += msg->getMessageLength();
+		++m_messagesOut;
+	}
 	msg.reset();
 
+	onWriteComplete(error);
+	m_connectionLock.unlock();
+}
+
+void Connection::onWriteMessagesOperation(boost::shared_ptr<OutputMessageList> msgs, const boost::system::error_code& error)
+{
+	m_connectionLock.lock();
+	m_writeTimer.cancel();
+
+	uint32_t bytes = 0;
+	for(OutputMessageList::iterator it = msgs->begin(); it != msgs->end(); ++it){
+		bytes += (*it)->getMessageLength();
+	}
+	m_queuedBytes -= bytes;
+	m_queuedMessages -= msgs->size();
+	if(!error){
+		m_bytesOut += bytes;
+		m_messagesOut += msgs->size();
+	}
+	msgs.reset();
+
+	onWriteComplete(error);
+	m_connectionLock.unlock();
+}
+
+void Connection::onWriteBufferOperation(SharedBuffer_ptr buffer, const boost::system::error_code& error)
+{
+	m_connectionLock.lock();
+	m_writeTimer.cancel();
+
+	if(!error){
+		m_bytesOut += buffer->size();
+		++m_messagesOut;
+	}
+	buffer.reset();
+
+	onWriteComplete(error);
+	m_connectionLock.unlock();
+}
+
+void Connection::onWriteComplete(const boost::system::error_code& error)
+{
+	boost::recursive_mutex::scoped_lock lockClass(m_connectionLock);
+
+	uint32_t writeTime = (uint32_t)(OTSYS_TIME_US() - m_writeStart);
+	m_maxWriteTime = std::max(m_maxWriteTime, writeTime);
+	ConnectionManager::getInstance()->getHistogram(ConnectionManager::HISTOGRAM_WRITE_TIME).add(writeTime);
+
 	if(error){
 		handleWriteError(error);
 	}
@@ -522,12 +866,15 @@ void Connection::onWriteOperation(OutputMessage_ptr msg, const boost::system::er
 	if(m_connectionState != CONNECTION_STATE_OPEN || m_writeError){
 		closeSocket();
 		closeConnection();
-		m_connectionLock.unlock();
 		return;
 	}
 
 	--m_pendingWrite;
-	m_connectionLock.unlock();
+
+	// Messages flushed while this write was in progress
+	if(m_pendingWrite == 0 && !m_pendingMessages.empty()){
+		internalSendPending();
+	}
 }
 
 void Connection::handleReadError(const boost::system::error_code& error)
@@ -26,6 +26,10 @@
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/function.hpp>
+#include <boost/atomic.hpp>
+#include <vector>
 #include "networkmessage.h"
 
 class OutputMessage;
@@ -33,11 +37,14 @@ class Connection;
 class ServiceBase;
 class ServicePort;
 class Protocol;
+class IoUring;
 
 typedef boost::shared_ptr<OutputMessage> OutputMessage_ptr;
+typedef std::vector<OutputMessage_ptr> OutputMessageList;
 typedef boost::shared_ptr<Connection> Connection_ptr;
 typedef boost::shared_ptr<ServiceBase> Service_ptr;
 typedef boost::shared_ptr<ServicePort> ServicePort_ptr;
+typedef boost::shared_ptr<const std::string> SharedBuffer_ptr;
 
 #ifdef __DEBUG_NET__
 #define PRINT_ASIO_ERROR(desc) \
@@ -47,9 +54,67 @@ typedef boost::shared_ptr<ServicePort> ServicePort_ptr;
 #define PRINT_ASIO_ERROR(desc)
 #endif
 
+// Output waiting for slow clients, summed over all connections
+struct SendQueueStats {
+	SendQueueStats() : connections(0), backlogged(0), queuedMessages(0), queuedBytes(0),
+		maxQueuedBytes(0), backloggedMemory(0), droppedUpdates(0), overflows(0) {}
+
+	uint32_t connections;
+	uint32_t backlogged;
+	uint64_t queuedMessages;
+	uint64_t queuedBytes;
+	uint32_t maxQueuedBytes;
+	uint64_t backloggedMemory; // pool memory held by backlogged connections
+	uint64_t droppedUpdates;
+	uint64_t overflows;
+};
+
+// Power of two buckets, bucket 0 counts the zeros, bucket i the values
+// in [2^(i-1), 2^i) and the last one everything above. The network
+// threads add without a lock, a read may mix buckets of different adds.
+class Histogram
+{
+public:
+	enum { bucket_count = 32 };
+
+	Histogram();
+
+	void add(uint64_t value);
+	void getBuckets(uint64_t buckets[bucket_count]) const;
+
+protected:
+	boost::atomic<uint64_t> m_buckets[bucket_count];
+};
+
+// What a connection did so far, the times are in microseconds and -1
+// until the event happened
+struct ConnectionInfo {
+	uint32_t ip;
+	std::string name; // of the player, once placed
+	int64_t age;
+	uint64_t bytesIn;
+	uint64_t bytesOut;
+	uint32_t messagesIn;
+	uint32_t messagesOut;
+	uint32_t maxQueuedBytes;
+	int64_t firstPacketDelay; // from the accept
+	int64_t placementDelay; // from the first packet, the login request
+	uint32_t maxWriteTime;
+};
+
 class ConnectionManager
 {
 public:
+	enum ConnectionHistogram_t {
+		HISTOGRAM_FIRST_PACKET, // accept to first packet, us
+		HISTOGRAM_PLACEMENT, // login request to placement on the map, us
+		HISTOGRAM_WRITE_TIME, // every write, us
+		HISTOGRAM_QUEUE_HIGH_WATER, // largest send queue of a game connection, bytes
+		HISTOGRAM_COUNT
+	};
+
+	ConnectionManager() : m_droppedUpdates(0), m_overflows(0) {}
+
 	static ConnectionManager* getInstance();
 
 	Connection_ptr createConnection(boost::asio::ip::tcp::socket* socket,
@@ -57,9 +122,21 @@ public:
 	void releaseConnection(Connection_ptr connection);
 	void closeAll();
 
+	void getSendQueueStats(SendQueueStats& stats);
+	void onUpdateDropped() {++m_droppedUpdates;}
+	void onSendQueueOverflow() {++m_overflows;}
+
+	// Open connections, the ones with the longest write first
+	void getSlowestConnections(uint32_t count, std::vector<ConnectionInfo>& connections);
+	Histogram& getHistogram(ConnectionHistogram_t type) {return m_histograms[type];}
+
 protected:
 	std::list<Connection_ptr> m_connections;
 	boost::recursive_mutex m_connectionManagerLock;
+
+	boost::atomic<uint32_t> m_droppedUpdates;
+	boost::atomic<uint32_t> m_overflows;
+	Histogram m_histograms[HISTOGRAM_COUNT];
 };
 
 class Connection : public boost::enable_shared_from_this<Connection>, boost::noncopyable
@@ -94,9 +171,26 @@ public:
 	void acceptConnection();
 
 	bool send(OutputMessage_ptr msg);
+	// Finalises the messages and writes them together, they are queued
+	// behind the write in progress if there is one
+	bool send(const OutputMessageList& msgs);
+
+	// More output is waiting than send_queue_limit_bytes/messages allow,
+	// at twice the limit the connection is closed
+	bool isBacklogged() const;
+	// Writes an immutable buffer shared between connections as it is,
+	// without length header or encryption. Fails if a write is pending.
+	bool send(SharedBuffer_ptr buffer);
 
 	uint32_t getIP() const;
 
+	// The game protocol placed the player on the map
+	void onPlayerPlaced(const std::string& name);
+	void getInfo(ConnectionInfo& info);
+
+	// Runs the handler on the network thread of this connection
+	void post(const boost::function<void (void)>& handler);
+
 	int32_t addRef();
 	int32_t unRef();
 
@@ -105,6 +199,9 @@ private:
 	void parsePacket(const boost::system::error_code& error);
 
 	void onWriteOperation(OutputMessage_ptr msg, const boost::system::error_code& error);
+	void onWriteMessagesOperation(boost::shared_ptr<OutputMessageList> msgs, const boost::system::error_code& error);
+	void onWriteBufferOperation(SharedBuffer_ptr buffer, const boost::system::error_code& error);
+	void onWriteComplete(const boost::system::error_code& error);
 
 	void onStopOperation();
 	void handleReadError(const boost::system::error_code& error);
@@ -120,13 +217,28 @@ private:
 	void onReadTimeout();
 	void onWriteTimeout();
 
+	// Through the io_uring of the network thread if it has one
+	template <typename Handler>
+	void asyncRead(char* buffer, size_t size, Handler handler);
+	template <typename Handler>
+	void asyncWrite(const boost::asio::const_buffer* buffers, size_t count, Handler handler);
+
 	void internalSend(OutputMessage_ptr msg);
+	void internalSendPending();
+	void queueMessage(OutputMessage_ptr msg);
+	void checkSendQueue();
+
+	static uint32_t getSendQueueLimitBytes();
+	static uint32_t getSendQueueLimitMessages();
 
 	NetworkMessage m_msg;
 	boost::asio::ip::tcp::socket* m_socket;
 	boost::asio::deadline_timer m_readTimer;
 	boost::asio::deadline_timer m_writeTimer;
 	boost::asio::io_service& m_io_service;
+#ifdef __USE_IO_URING__
+	IoUring* m_ring;
+#endif
 	ServicePort_ptr m_service_port;
 	bool m_receivedFirst;
 	bool m_writeError;
@@ -134,8 +246,27 @@ private:
 
 	int32_t m_pendingWrite;
 	int32_t m_pendingRead;
+	OutputMessageList m_pendingMessages;
+	// Written or waiting to be written, changed under m_connectionLock and
+	// read without it by isBacklogged and the send queue statistics
+	boost::atomic<uint32_t> m_queuedBytes;
+	boost::atomic<uint32_t> m_queuedMessages;
 	ConnectionState_t m_connectionState;
 	uint32_t m_refCount;
+
+	// Lifecycle, for ConnectionInfo
+	int64_t m_acceptTime;
+	int64_t m_firstPacketDelay;
+	int64_t m_placementDelay;
+	uint64_t m_bytesIn;
+	uint64_t m_bytesOut;
+	uint32_t m_messagesIn;
+	uint32_t m_messagesOut;
+	uint32_t m_maxQueuedBytes;
+	int64_t m_writeStart;
+	uint32_t m_maxWriteTime;
+	std::string m_name;
+
 	static bool m_logError;
 	boost::recursive_mutex m_connectionLock;
 
@@ -0,0 +1,107 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include "cryptopool.h"
+
+#if defined __EXCEPTION_TRACER__
+#include "exception.h"
+#endif
+
+CryptoPool::CryptoPool()
+{
+	m_maxQueueSize = 0;
+	m_running = false;
+}
+
+void CryptoPool::start(uint32_t threads, uint32_t maxQueueSize)
+{
+	assert(!m_running);
+	m_maxQueueSize = std::max<uint32_t>(1, maxQueueSize);
+	m_running = true;
+	for(uint32_t i = 0; i < std::max<uint32_t>(1, threads); ++i){
+		m_threads.create_thread(boost::bind(&CryptoPool::workerThread, (void*)this));
+	}
+}
+
+void CryptoPool::shutdownAndWait()
+{
+	std::deque<Job> dropped;
+	m_jobLock.lock();
+	m_running = false;
+	dropped.swap(m_jobList);
+	m_jobLock.unlock();
+
+	m_jobSignal.notify_all();
+	m_threads.join_all();
+
+	for(std::deque<Job>::iterator it = dropped.begin(); it != dropped.end(); ++it){
+		if(it->cancel){
+			it->cancel();
+		}
+	}
+}
+
+bool CryptoPool::addJob(const boost::function<void (void)>& job,
+	const boost::function<void (void)>& cancel /*= boost::function<void (void)>()*/)
+{
+	boost::mutex::scoped_lock lockClass(m_jobLock);
+	if(!m_running || m_jobList.size() >= m_maxQueueSize){
+		return false;
+	}
+
+	m_jobList.push_back(Job(job, cancel));
+	lockClass.unlock();
+
+	m_jobSignal.notify_one();
+	return true;
+}
+
+void CryptoPool::workerThread(void* p)
+{
+	CryptoPool* pool = (CryptoPool*)p;
+	#if defined __EXCEPTION_TRACER__
+	ExceptionHandler cryptoExceptionHandler;
+	cryptoExceptionHandler.InstallHandler();
+	#endif
+
+	boost::unique_lock<boost::mutex> jobLockUnique(pool->m_jobLock);
+	while(true){
+		while(pool->m_running && pool->m_jobList.empty()){
+			pool->m_jobSignal.wait(jobLockUnique);
+		}
+
+		if(!pool->m_running){
+			break;
+		}
+
+		boost::function<void (void)> job = pool->m_jobList.front().function;
+		pool->m_jobList.pop_front();
+		jobLockUnique.unlock();
+
+		job();
+
+		jobLockUnique.lock();
+	}
+
+	#if defined __EXCEPTION_TRACER__
+	cryptoExceptionHandler.RemoveHandler();
+	#endif
+}
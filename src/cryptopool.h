@@ -0,0 +1,66 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Worker threads for the CPU heavy part of logins
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_CRYPTOPOOL_H__
+#define __OTSERV_CRYPTOPOOL_H__
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <deque>
+
+// Runs RSA decryption and password hashing of logins, so a burst of
+// logins does not stall the network thread. The queue is bounded, a
+// job that does not fit is refused and the caller drops the login.
+class CryptoPool{
+public:
+	CryptoPool();
+	~CryptoPool() {}
+
+	void start(uint32_t threads, uint32_t maxQueueSize);
+	// The jobs still queued are dropped, their cancel functions run instead
+	void shutdownAndWait();
+
+	// cancel runs instead of job when the pool shuts down before it started
+	bool addJob(const boost::function<void (void)>& job,
+		const boost::function<void (void)>& cancel = boost::function<void (void)>());
+
+protected:
+	struct Job{
+		Job(const boost::function<void (void)>& _function, const boost::function<void (void)>& _cancel)
+			: function(_function), cancel(_cancel) {}
+
+		boost::function<void (void)> function;
+		boost::function<void (void)> cancel;
+	};
+
+	static void workerThread(void* p);
+
+	boost::thread_group m_threads;
+	boost::mutex m_jobLock;
+	boost::condition_variable m_jobSignal;
+
+	std::deque<Job> m_jobList;
+	uint32_t m_maxQueueSize;
+	bool m_running;
+};
+
+extern CryptoPool g_cryptoPool;
+
+#endif
@@ -20,6 +20,7 @@
 #include "otpch.h"
 
 #include "database_driver.h"
+#include "database_pool.h"
 
 #ifdef __USE_MYSQL__
 #include "database_driver_mysql.h"
@@ -37,30 +38,32 @@
 #include "configmanager.h"
 extern ConfigManager g_config;
 
-boost::recursive_mutex DBQuery::database_lock;
-
-DatabaseDriver* DatabaseDriver::_instance = NULL;
-
 DatabaseDriver* DatabaseDriver::instance(){
-	if(!_instance){
+	DatabasePool* pool = DatabasePool::instance();
+	if(pool->getSize() == 0){
+		return NULL;
+	}
+	return pool;
+}
+
+DatabaseDriver* DatabaseDriver::createDriver(){
 #ifdef __USE_MYSQL__
-		if(g_config.getString(ConfigManager::SQL_TYPE) == "mysql")
-			_instance = new DatabaseMySQL;
+	if(g_config.getString(ConfigManager::SQL_TYPE) == "mysql")
+		return new DatabaseMySQL;
 #endif
 #ifdef __USE_ODBC__
-		if(g_config.getString(ConfigManager::SQL_TYPE) == "odbc")
-			_instance = new DatabaseODBC;
+	if(g_config.getString(ConfigManager::SQL_TYPE) == "odbc")
+		return new DatabaseODBC;
 #endif
 #ifdef __USE_SQLITE__
-		if(g_config.getString(ConfigManager::SQL_TYPE) == "sqlite")
-			_instance = new DatabaseSQLite;
+	if(g_config.getString(ConfigManager::SQL_TYPE) == "sqlite")
+		return new DatabaseSQLite;
 #endif
 #ifdef __USE_PGSQL__
-		if(g_config.getString(ConfigManager::SQL_TYPE) == "pgsql")
-			_instance = new DatabasePgSQL;
+	if(g_config.getString(ConfigManager::SQL_TYPE) == "pgsql")
+		return new DatabasePgSQL;
 #endif
-	}
-	return _instance;
+	return NULL;
 }
 
 bool DatabaseDriver::executeQuery(DBQuery &query)
@@ -83,6 +86,33 @@ DBResult_ptr DatabaseDriver::storeQuery(DBQuery &query)
 	return storeQuery(query.str());
 }
 
+DBStatement* DatabaseDriver::prepareStatement(const std::string &query)
+{
+	StatementMap::iterator it = m_statements.find(query);
+	if(it != m_statements.end()){
+		return it->second;
+	}
+
+	DBStatement* statement = internalPrepare(query);
+	if(statement){
+		m_statements[query] = statement;
+	}
+	return statement;
+}
+
+DBStatement* DatabaseDriver::internalPrepare(const std::string &query)
+{
+	return new DBEmulatedStatement(this, query);
+}
+
+void DatabaseDriver::clearStatements()
+{
+	for(StatementMap::iterator it = m_statements.begin(); it != m_statements.end(); ++it){
+		delete it->second;
+	}
+	m_statements.clear();
+}
+
 void DatabaseDriver::freeResult(DBResult *res)
 {
 	throw std::runtime_error("No database driver loaded, yet a DBResult was freed.");
@@ -98,16 +128,314 @@ DBResult_ptr DatabaseDriver::verifyResult(DBResult_ptr result)
 	}
 }
 
+// DBResult
+
+int32_t DBResult::getDataInt(const std::string &s)
+{
+	int32_t column = getColumnIndex(s);
+	if(column < 0){
+		std::cout << "Error during getDataInt(" << s << ")." << std::endl;
+		return 0;
+	}
+	return getDataInt((uint32_t)column);
+}
+
+uint32_t DBResult::getDataUInt(const std::string &s)
+{
+	int32_t column = getColumnIndex(s);
+	if(column < 0){
+		std::cout << "Error during getDataUInt(" << s << ")." << std::endl;
+		return 0;
+	}
+	return getDataUInt((uint32_t)column);
+}
+
+int64_t DBResult::getDataLong(const std::string &s)
+{
+	int32_t column = getColumnIndex(s);
+	if(column < 0){
+		std::cout << "Error during getDataLong(" << s << ")." << std::endl;
+		return 0;
+	}
+	return getDataLong((uint32_t)column);
+}
+
+std::string DBResult::getDataString(const std::string &s)
+{
+	int32_t column = getColumnIndex(s);
+	if(column < 0){
+		std::cout << "Error during getDataString(" << s << ")." << std::endl;
+		return std::string("");
+	}
+	return getDataString((uint32_t)column);
+}
+
+const char* DBResult::getDataStream(const std::string &s, unsigned long &size)
+{
+	int32_t column = getColumnIndex(s);
+	if(column < 0){
+		std::cout << "Error during getDataStream(" << s << ")." << std::endl;
+		size = 0;
+		return NULL;
+	}
+	return getDataStream((uint32_t)column, size);
+}
+
+bool DBResult::getColumnIndexes(const char* const* names, int32_t* indexes)
+{
+	bool found = true;
+	for(; *names; ++names, ++indexes){
+		*indexes = getColumnIndex(*names);
+		if(*indexes < 0){
+			std::cout << "Error during getColumnIndexes(" << *names << ")." << std::endl;
+			found = false;
+		}
+	}
+	return found;
+}
+
+// DBStoredResult
+
+boost::shared_ptr<DBStoredResult> DBStoredResult::create(const std::vector<std::string>& names)
+{
+	boost::shared_ptr<DBStoredResult> stored(new DBStoredResult());
+	for(uint32_t i = 0; i < names.size(); ++i){
+		stored->m_listNames[names[i]] = i;
+	}
+	return stored;
+}
+
+DBResult_ptr DBStoredResult::copy(DBResult_ptr result, const char* const* blobs /*= NULL*/)
+{
+	if(!result){
+		return DBResult_ptr();
+	}
+
+	boost::shared_ptr<DBStoredResult> stored(new DBStoredResult());
+
+	std::vector<std::string> names;
+	result->getColumnNames(names);
+	std::vector<int32_t> columns(names.size());
+	std::vector<bool> isBlob(names.size(), false);
+	for(uint32_t i = 0; i < names.size(); ++i){
+		stored->m_listNames[names[i]] = i;
+		columns[i] = result->getColumnIndex(names[i]);
+		for(const char* const* blob = blobs; blob && *blob; ++blob){
+			if(names[i] == *blob){
+				isBlob[i] = true;
+			}
+		}
+	}
+
+	for(; result; result = result->advance()){
+		for(uint32_t i = 0; i < names.size(); ++i){
+			if(columns[i] < 0){
+				stored->m_fields.push_back(std::string());
+			}
+			else if(isBlob[i]){
+				unsigned long size = 0;
+				const char* data = result->getDataStream((uint32_t)columns[i], size);
+				stored->m_fields.push_back(data ? std::string(data, size) : std::string());
+			}
+			else{
+				stored->m_fields.push_back(result->getDataString((uint32_t)columns[i]));
+			}
+		}
+	}
+
+	return stored;
+}
+
+int32_t DBStoredResult::getColumnIndex(const std::string &s)
+{
+	listNames_t::const_iterator it = m_listNames.find(s);
+	return it != m_listNames.end() ? (int32_t)it->second : -1;
+}
+
+const std::string* DBStoredResult::getField(uint32_t column) const
+{
+	if(column >= m_listNames.size() || (m_row + 1) * m_listNames.size() > m_fields.size()){
+		return NULL;
+	}
+
+	return &m_fields[m_row * m_listNames.size() + column];
+}
+
+int32_t DBStoredResult::getDataInt(uint32_t column)
+{
+	const std::string* value = getField(column);
+	return value ? atoi(value->c_str()) : 0;
+}
+
+uint32_t DBStoredResult::getDataUInt(uint32_t column)
+{
+	const std::string* value = getField(column);
+	return value ? (uint32_t)strtoul(value->c_str(), NULL, 10) : 0;
+}
+
+int64_t DBStoredResult::getDataLong(uint32_t column)
+{
+	const std::string* value = getField(column);
+	return value ? atoll(value->c_str()) : 0;
+}
+
+std::string DBStoredResult::getDataString(uint32_t column)
+{
+	const std::string* value = getField(column);
+	return value ? *value : std::string("");
+}
+
+const char* DBStoredResult::getDataStream(uint32_t column, unsigned long &size)
+{
+	const std::string* value = getField(column);
+	if(!value){
+		size = 0;
+		return NULL;
+	}
+
+	size = value->size();
+	return value->data();
+}
+
+boost::string_view DBStoredResult::getDataView(uint32_t column)
+{
+	const std::string* value = getField(column);
+	return value ? boost::string_view(*value) : boost::string_view();
+}
+
+void DBStoredResult::getColumnNames(std::vector<std::string>& names)
+{
+	for(listNames_t::const_iterator it = m_listNames.begin(); it != m_listNames.end(); ++it){
+		names.push_back(it->first);
+	}
+}
+
+DBResult_ptr DBStoredResult::advance()
+{
+	if(!empty()){
+		++m_row;
+	}
+	return empty() ? DBResult_ptr() : shared_from_this();
+}
+
+bool DBStoredResult::empty()
+{
+	return m_listNames.empty() || (m_row + 1) * m_listNames.size() > m_fields.size();
+}
+
+// DBStatement
+
+DBStatement::Param& DBStatement::getParam(uint32_t index)
+{
+	if(index >= m_params.size()){
+		m_params.resize(index + 1);
+	}
+	return m_params[index];
+}
+
+void DBStatement::bindInt(uint32_t index, int64_t value)
+{
+	Param& param = getParam(index);
+	param.type = DBBIND_INT;
+	param.number = value;
+	param.data.clear();
+}
+
+void DBStatement::bindString(uint32_t index, const std::string& value)
+{
+	Param& param = getParam(index);
+	param.type = DBBIND_STRING;
+	param.data = value;
+}
+
+void DBStatement::bindBlob(uint32_t index, const char* value, uint32_t length)
+{
+	Param& param = getParam(index);
+	param.type = DBBIND_BLOB;
+	param.data.assign(value, length);
+}
+
+// DBEmulatedStatement
+
+std::string DBEmulatedStatement::buildQuery()
+{
+	std::ostringstream query;
+	uint32_t index = 0;
+	char quote = 0;
+	for(std::string::const_iterator it = m_query.begin(); it != m_query.end(); ++it){
+		if(quote){
+			if(*it == quote){
+				quote = 0;
+			}
+			query << *it;
+		}
+		else if(*it == '\'' || *it == '"' || *it == '`'){
+			quote = *it;
+			query << *it;
+		}
+		else if(*it == '?'){
+			if(index >= m_params.size()){
+				query << "NULL";
+			}
+			else{
+				const Param& param = m_params[index];
+				if(param.type == DBBIND_INT){
+					query << param.number;
+				}
+				else if(param.type == DBBIND_STRING){
+					query << m_db->escapeString(param.data);
+				}
+				else{
+					query << m_db->escapeBlob(param.data.data(), param.data.length());
+				}
+			}
+			++index;
+		}
+		else{
+			query << *it;
+		}
+	}
+	return query.str();
+}
+
+bool DBEmulatedStatement::execute()
+{
+	return m_db->executeQuery(buildQuery());
+}
+
+DBResult_ptr DBEmulatedStatement::query()
+{
+	return m_db->storeQuery(buildQuery());
+}
+
 // DBQuery
 
 DBQuery::DBQuery()
 {
-	database_lock.lock();
+	DatabasePool::instance()->lease();
 }
 
 DBQuery::~DBQuery()
 {
-	database_lock.unlock();
+	DatabasePool::instance()->release();
+}
+
+// DBTransaction
+
+DBTransaction::DBTransaction(DatabaseDriver* database)
+{
+	DatabasePool::instance()->lease();
+	m_database = database;
+	m_state = STATE_NO_START;
+	m_depth = 0;
+}
+
+DBTransaction::~DBTransaction()
+{
+	if(m_state == STATE_START){
+		m_database->rollback(m_depth);
+	}
+	DatabasePool::instance()->release();
 }
 
 // DBInsert
@@ -22,19 +22,26 @@
 #define __OTSERV_DATABASE_DRIVER_H__
 
 #include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
-#include <boost/thread/recursive_mutex.hpp>
+#include <boost/utility/string_view.hpp>
 #include "definitions.h"
 
 class DatabaseDriver;
 class DBResult;
 class DBQuery;
+class DBStatement;
 
 typedef boost::shared_ptr<DBResult> DBResult_ptr;
 
 enum DBParam_t{
-	DBPARAM_MULTIINSERT = 1
+	DBPARAM_MULTIINSERT = 1,
+	// a transaction begun inside another one is a savepoint of it, and
+	// writes queued together may share one transaction
+	DBPARAM_BATCHWRITES = 2
 };
 
 class DatabaseDriver
@@ -43,9 +50,9 @@ public:
 	/**
 	* Singleton implementation.
 	*
-	* Returns instance of database handler. Don't create database (or drivers) instances in your code - instead of it use Database::instance(). This method stores static instance of connection class internaly to make sure exacly one instance of connection is created for entire system.
+	* Returns instance of database handler. Don't create database (or drivers) instances in your code - instead of it use Database::instance(). The handler is the DatabasePool, which runs every call on the connection the calling thread leased with its DBQuery.
 	*
-	* @return database connection handler singleton
+	* @return database connection handler singleton (null if the database type is unknown)
 	*/
 	static DatabaseDriver* instance();
 
@@ -59,6 +66,15 @@ public:
 	*/
 	virtual bool getParam(DBParam_t param) { return false; }
 
+	/**
+	* Makes commits durable.
+	*
+	* Drivers that don't sync every commit to disk write the ones before out.
+	*
+	* @return true on success, false on error
+	*/
+	virtual bool sync() { return true; }
+
 	/**
 	* Database connected.
 	*
@@ -74,14 +90,16 @@ protected:
 	*
 	* Methods for starting, committing and rolling back transaction. Each of the returns boolean value.
 	*
+	* @param uint32_t depth transactions that were open on the connection when this one began, drivers that don't nest transactions set 0
 	* @return true on success, false on error
 	* @note
 	*	If your database system doesn't support transactions you should return true - it's not feature test, code should work without transaction, just will lack integrity.
 	*/
 	friend class DBTransaction;
-	virtual bool beginTransaction() = 0;
-	virtual bool rollback() = 0;
-	virtual bool commit() = 0;
+	friend class DatabasePool;
+	virtual bool beginTransaction(uint32_t& depth) = 0;
+	virtual bool rollback(uint32_t depth) = 0;
+	virtual bool commit(uint32_t depth) = 0;
 
 public:
 	/**
@@ -113,6 +131,16 @@ public:
 	DBResult_ptr storeQuery(const std::string &query);
 	DBResult_ptr storeQuery(DBQuery &query);
 
+	/**
+	* Prepared statement.
+	*
+	* Returns the statement of query, which has a ? in place of every value. Statements are prepared once per connection and kept, so the same query string always returns the same statement. The caller has to hold a DBQuery while it binds and runs the statement.
+	*
+	* @param std::string query with ? placeholders
+	* @return statement (null on error)
+	*/
+	virtual DBStatement* prepareStatement(const std::string &query);
+
 	/**
 	* Escapes string for query.
 	*
@@ -148,15 +176,33 @@ protected:
 	virtual bool internalQuery(const std::string &query) = 0;
 	virtual DBResult_ptr internalSelectQuery(const std::string &query) = 0;
 
+	/**
+	 * Prepares a statement on the connection, the default substitutes the
+	 * escaped values into the query text
+	 */
+	virtual DBStatement* internalPrepare(const std::string &query);
+
+	/**
+	 * Tests the connection and reconnects if it was lost
+	 *
+	 * @return whether the connection works now
+	 */
+	virtual bool checkConnection() { return m_connected; }
+
+	// Opens a connection of the configured database type
+	static DatabaseDriver* createDriver();
+
 	DatabaseDriver() : m_connected(false) {};
 	virtual ~DatabaseDriver() {};
 
 	DBResult_ptr verifyResult(DBResult_ptr result);
+	// Drivers call this before closing the connection
+	void clearStatements();
 
 	bool m_connected;
 
-private:
-	static DatabaseDriver* _instance;
+	typedef std::map<std::string, DBStatement*> StatementMap;
+	StatementMap m_statements;
 };
 
 class DBResult : public boost::enable_shared_from_this<DBResult>
@@ -166,27 +212,55 @@ public:
 	*\return The Integer value of the selected field and row
 	*\param s The name of the field
 	*/
-	virtual int32_t getDataInt(const std::string &s) { return 0; }
+	virtual int32_t getDataInt(const std::string &s);
 	/** Get the Unsigned Integer value of a field in database
 	*\return The Integer value of the selected field and row
 	*\param s The name of the field
 	*/
-	virtual uint32_t getDataUInt(const std::string &s) { return 0; }
+	virtual uint32_t getDataUInt(const std::string &s);
 	/** Get the Long value of a field in database
 	*\return The Long value of the selected field and row
 	*\param s The name of the field
 	*/
-	virtual int64_t getDataLong(const std::string &s) { return 0; }
+	virtual int64_t getDataLong(const std::string &s);
 	/** Get the String of a field in database
 	*\return The String of the selected field and row
 	*\param s The name of the field
 	*/
-	virtual std::string getDataString(const std::string &s) { return "''"; }
+	virtual std::string getDataString(const std::string &s);
 	/** Get the blob of a field in database
 	*\return a PropStream that is initiated with the blob data field, if not exist it returns NULL.
 	*\param s The name of the field
 	*/
-	virtual const char* getDataStream(const std::string &s, unsigned long &size) { return 0; }
+	virtual const char* getDataStream(const std::string &s, unsigned long &size);
+	/** Get the names of all fields of the result
+	*\param names Receives the field names, in no particular order
+	*/
+	virtual void getColumnNames(std::vector<std::string>& names) {}
+
+	/** Get the index of a field, for the accessors below that take one
+	*\return The index of the field, -1 if the result has no such field
+	*\param s The name of the field
+	*/
+	virtual int32_t getColumnIndex(const std::string &s) { return -1; }
+	/** Get the indexes of several fields at once, before reading many rows
+	*\return false if a field is missing, its index is then -1
+	*\param names NULL terminated list of field names
+	*\param indexes Receives one index per name
+	*/
+	bool getColumnIndexes(const char* const* names, int32_t* indexes);
+
+	// The same accessors by index, without a lookup per field
+	virtual int32_t getDataInt(uint32_t column) { return 0; }
+	virtual uint32_t getDataUInt(uint32_t column) { return 0; }
+	virtual int64_t getDataLong(uint32_t column) { return 0; }
+	virtual std::string getDataString(uint32_t column) { return std::string(); }
+	virtual const char* getDataStream(uint32_t column, unsigned long &size) { size = 0; return NULL; }
+	/** Get a field without copying it, text or blob
+	*\return The field of the current row, valid until advance() or until the result is released
+	*\param column The index of the field
+	*/
+	virtual boost::string_view getDataView(uint32_t column) { return boost::string_view(); }
 
 	/**
 	* Moves to next result in set.
@@ -207,22 +281,150 @@ protected:
 };
 
 /**
- * Thread locking hack.
+ * Result kept in memory.
  *
- * By using this class for your queries you lock and unlock database for threads.
+ * Copies all rows of a result, so they can be read after the database lock
+ * is released and on another thread than the one that ran the query.
 */
-class DBQuery : public std::ostringstream
+class DBStoredResult : public DBResult
 {
-	friend class DatabaseDriver;
+public:
+	/**
+	* Reads the remaining rows of result, the current row included.
+	*
+	* @param DBResult_ptr result to copy
+	* @param const char* const* NULL terminated list of the fields that hold binary data
+	* @return the copy (null if result is null)
+	*/
+	static DBResult_ptr copy(DBResult_ptr result, const char* const* blobs = NULL);
+
+	/**
+	* Builds a result row by row, for drivers that fetch all rows at once.
+	*
+	* @param std::vector<std::string> column names
+	* @return the empty result, call addField for every field of every row
+	*/
+	static boost::shared_ptr<DBStoredResult> create(const std::vector<std::string>& names);
+	void addField(const std::string& value) {m_fields.push_back(value);}
+
+	virtual ~DBStoredResult() {};
+
+	virtual void getColumnNames(std::vector<std::string>& names);
+	virtual int32_t getColumnIndex(const std::string &s);
+
+	virtual int32_t getDataInt(uint32_t column);
+	virtual uint32_t getDataUInt(uint32_t column);
+	virtual int64_t getDataLong(uint32_t column);
+	virtual std::string getDataString(uint32_t column);
+	virtual const char* getDataStream(uint32_t column, unsigned long &size);
+	virtual boost::string_view getDataView(uint32_t column);
+
+	virtual DBResult_ptr advance();
+	virtual bool empty();
+
+protected:
+	DBStoredResult() : m_row(0) {};
+
+	const std::string* getField(uint32_t column) const;
+
+	typedef std::map<const std::string, uint32_t> listNames_t;
+	listNames_t m_listNames;
+
+	// row after row, m_listNames.size() fields each
+	std::vector<std::string> m_fields;
+	size_t m_row;
+};
+
+enum DBBindType_t{
+	DBBIND_INT,
+	DBBIND_STRING,
+	DBBIND_BLOB
+};
 
+/**
+ * Prepared statement.
+ *
+ * Values are bound by the index of their ? in the query, counting from 0,
+ * and stay bound until they are bound again. Get statements from
+ * DatabaseDriver::prepareStatement, they belong to the driver.
+*/
+class DBStatement
+{
+public:
+	virtual ~DBStatement() {};
+
+	void bindInt(uint32_t index, int64_t value);
+	void bindString(uint32_t index, const std::string& value);
+	void bindBlob(uint32_t index, const char* value, uint32_t length);
+
+	/**
+	* Runs a statement that returns no rows (INSERT, UPDATE, DELETE...).
+	*
+	* @return true on success, false on error
+	*/
+	virtual bool execute() = 0;
+
+	/**
+	* Runs a statement that returns rows (mostly SELECT).
+	*
+	* The result has to be released before the statement is run again.
+	*
+	* @return results object (null on error or if there are no rows)
+	*/
+	virtual DBResult_ptr query() = 0;
+
+	const std::string& getQuery() const {return m_query;}
+
+protected:
+	DBStatement(const std::string& query) : m_query(query) {};
+
+	struct Param{
+		Param() : type(DBBIND_INT), number(0) {}
+
+		DBBindType_t type;
+		int64_t number;
+		std::string data;
+	};
+
+	Param& getParam(uint32_t index);
+
+	std::string m_query;
+	std::vector<Param> m_params;
+};
+
+/**
+ * Statement for drivers without a native API.
+ *
+ * Every run substitutes the escaped values for the ? outside of quotes and
+ * sends the query as text.
+*/
+class DBEmulatedStatement : public DBStatement
+{
+public:
+	DBEmulatedStatement(DatabaseDriver* db, const std::string& query) : DBStatement(query), m_db(db) {};
+	virtual ~DBEmulatedStatement() {};
+
+	virtual bool execute();
+	virtual DBResult_ptr query();
+
+protected:
+	std::string buildQuery();
+
+	DatabaseDriver* m_db;
+};
+
+/**
+ * Connection lease.
+ *
+ * While a thread holds a DBQuery, the calls it makes on the database handler all run on one connection, which no other thread uses until the last DBQuery of the thread is gone.
+*/
+class DBQuery : public std::ostringstream
+{
 public:
 	DBQuery();
 	~DBQuery();
 
 	void reset() {str("");}
-
-protected:
-	static boost::recursive_mutex database_lock;
 };
 
 /**
@@ -280,33 +482,31 @@ protected:
 	std::ostringstream m_buf;
 };
 
+/**
+ * Transaction.
+ *
+ * Leases a connection like DBQuery does, so the transaction runs on one connection from begin to commit.
+*/
 class DBTransaction
 {
 public:
-	DBTransaction(DatabaseDriver* database)
-	{
-		m_database = database;
-		m_state = STATE_NO_START;
-	}
-
-	~DBTransaction()
-	{
-		if(m_state == STATE_START){
-			m_database->rollback();
-		}
-	}
+	DBTransaction(DatabaseDriver* database);
+	~DBTransaction();
 
 	bool begin()
 	{
+		if(!m_database->beginTransaction(m_depth))
+			return false;
+
 		m_state = STATE_START;
-		return m_database->beginTransaction();
+		return true;
 	}
 
 	bool commit()
 	{
 		if(m_state == STATE_START){
 			m_state = STEATE_COMMIT;
-			return m_database->commit();
+			return m_database->commit(m_depth);
 		}
 		else{
 			return false;
@@ -320,6 +520,8 @@ private:
 		STEATE_COMMIT
 	};
 	TransactionStates_t m_state;
+	// transactions open on the connection when this one began
+	uint32_t m_depth;
 	DatabaseDriver* m_database;
 };
 
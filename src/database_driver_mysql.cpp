@@ -64,11 +64,9 @@ DatabaseMySQL::DatabaseMySQL()
 	m_connected = true;
 
 	if(g_config.getString(ConfigManager::MAP_STORAGE_TYPE) == "binary"){
-		DBQuery query;
-		query << "SHOW variables LIKE 'max_allowed_packet';";
-
+		// no DBQuery, the connection is not part of the pool yet
 		DBResult_ptr result;
-		if((result = storeQuery(query.str()))){
+		if((result = storeQuery("SHOW variables LIKE 'max_allowed_packet';"))){
 			int32_t max_query = result->getDataInt("Value");
 
 			if(max_query < 16777216){
@@ -82,9 +80,27 @@ DatabaseMySQL::DatabaseMySQL()
 
 DatabaseMySQL::~DatabaseMySQL()
 {
+	clearStatements();
 	mysql_close(&m_handle);
 }
 
+bool DatabaseMySQL::checkConnection()
+{
+	// mysql_ping reconnects by itself, the new session has none of the
+	// statements prepared on the old one
+	unsigned long threadId = mysql_thread_id(&m_handle);
+	if(mysql_ping(&m_handle) != 0){
+		m_connected = false;
+		return false;
+	}
+
+	if(mysql_thread_id(&m_handle) != threadId){
+		clearStatements();
+	}
+	m_connected = true;
+	return true;
+}
+
 bool DatabaseMySQL::getParam(DBParam_t param)
 {
 	switch(param){
@@ -97,12 +113,13 @@ bool DatabaseMySQL::getParam(DBParam_t param)
 	}
 }
 
-bool DatabaseMySQL::beginTransaction()
+bool DatabaseMySQL::beginTransaction(uint32_t& depth)
 {
+	depth = 0;
 	return executeQuery("BEGIN");
 }
 
-bool DatabaseMySQL::rollback()
+bool DatabaseMySQL::rollback(uint32_t depth)
 {
 	if(!m_connected)
 		return false;
@@ -119,7 +136,7 @@ bool DatabaseMySQL::rollback()
 	return true;
 }
 
-bool DatabaseMySQL::commit()
+bool DatabaseMySQL::commit(uint32_t depth)
 {
 	if(!m_connected)
 		return false;
@@ -209,6 +226,19 @@ DBResult_ptr DatabaseMySQL::internalSelectQuery(const std::string &query)
 	return verifyResult(res);
 }
 
+DBStatement* DatabaseMySQL::internalPrepare(const std::string &query)
+{
+	if(!m_connected)
+		return NULL;
+
+	MySQLStatement* statement = new MySQLStatement(this, query);
+	if(!statement->prepare()){
+		delete statement;
+		return NULL;
+	}
+	return statement;
+}
+
 uint64_t DatabaseMySQL::getLastInsertedRowID()
 {
 	return (uint64_t)mysql_insert_id(&m_handle);
@@ -242,90 +272,236 @@ void DatabaseMySQL::freeResult(DBResult* res)
 	delete (MySQLResult*)res;
 }
 
-/** MySQLResult definitions */
+/** MySQLStatement definitions */
 
-int32_t MySQLResult::getDataInt(const std::string &s)
+MySQLStatement::MySQLStatement(DatabaseMySQL* db, const std::string& query) :
+	DBStatement(query), m_db(db), m_handle(NULL)
 {
-	listNames_t::iterator it = m_listNames.find(s);
-	if(it != m_listNames.end() ){
-		if(m_row[it->second] == NULL){
-			return 0;
-		}
-		else{
-			return atoi(m_row[it->second]);
-		}
+}
+
+MySQLStatement::~MySQLStatement()
+{
+	close();
+}
+
+void MySQLStatement::close()
+{
+	if(m_handle){
+		mysql_stmt_close(m_handle);
+		m_handle = NULL;
+	}
+}
+
+bool MySQLStatement::prepare()
+{
+	close();
+
+	m_handle = mysql_stmt_init(&m_db->m_handle);
+	if(!m_handle){
+		std::cout << "mysql_stmt_init(): MYSQL ERROR: " << mysql_error(&m_db->m_handle) << std::endl;
+		return false;
 	}
 
-	std::cout << "Error during getDataInt(" << s << ")." << std::endl;
-	return 0; // Failed
+	if(mysql_stmt_prepare(m_handle, m_query.c_str(), m_query.length()) != 0){
+		std::cout << "mysql_stmt_prepare(): " << m_query.substr(0, 256) << ": MYSQL ERROR: " << mysql_stmt_error(m_handle) << std::endl;
+		close();
+		return false;
+	}
+	return true;
 }
 
-uint32_t MySQLResult::getDataUInt(const std::string &s)
+bool MySQLStatement::run()
 {
-	listNames_t::iterator it = m_listNames.find(s);
-	if(it != m_listNames.end() ){
-		if(m_row[it->second] == NULL){
-			return 0;
+	if(!m_db->m_connected)
+		return false;
+
+	#ifdef __DEBUG_SQL__
+	std::cout << "MYSQL STATEMENT: " << m_query << std::endl;
+	#endif
+
+	// the statement is lost with the connection, the reconnect needs a new one
+	if(!m_handle && !prepare())
+		return false;
+
+	if(mysql_stmt_param_count(m_handle) != m_params.size()){
+		std::cout << "MySQLStatement::run(): " << m_query.substr(0, 256) << ": expected " << mysql_stmt_param_count(m_handle) <<
+			" values, " << m_params.size() << " bound." << std::endl;
+		return false;
+	}
+
+	std::vector<MYSQL_BIND> binds(m_params.size());
+	if(!binds.empty()){
+		memset(&binds[0], 0, sizeof(MYSQL_BIND) * binds.size());
+	}
+
+	for(uint32_t i = 0; i < m_params.size(); ++i){
+		Param& param = m_params[i];
+		if(param.type == DBBIND_INT){
+			binds[i].buffer_type = MYSQL_TYPE_LONGLONG;
+			binds[i].buffer = &param.number;
 		}
 		else{
-			std::istringstream os(m_row[it->second]);
-			uint32_t res;
-			os >> res;
-			return res;
+			binds[i].buffer_type = (param.type == DBBIND_STRING ? MYSQL_TYPE_STRING : MYSQL_TYPE_BLOB);
+			binds[i].buffer = (void*)param.data.data();
+			binds[i].buffer_length = param.data.length();
 		}
 	}
 
-	std::cout << "Error during getDataInt(" << s << ")." << std::endl;
-	return 0; // Failed
+	if((!binds.empty() && mysql_stmt_bind_param(m_handle, &binds[0]) != 0) || mysql_stmt_execute(m_handle) != 0){
+		std::cout << "mysql_stmt_execute(): " << m_query.substr(0, 256) << ": MYSQL ERROR: " << mysql_stmt_error(m_handle) << std::endl;
+		int error = mysql_stmt_errno(m_handle);
+
+		if(error == CR_SERVER_LOST || error == CR_SERVER_GONE_ERROR){
+			close();
+		}
+
+		return false;
+	}
+	return true;
+}
+
+bool MySQLStatement::execute()
+{
+	return run();
 }
 
-int64_t MySQLResult::getDataLong(const std::string &s)
+DBResult_ptr MySQLStatement::query()
 {
-	listNames_t::iterator it = m_listNames.find(s);
-	if(it != m_listNames.end()){
-		if(m_row[it->second] == NULL){
-			return 0;
-		}
-		else{
-			return atoll(m_row[it->second]);
+	if(!run())
+		return DBResult_ptr();
+
+	MYSQL_RES* meta = mysql_stmt_result_metadata(m_handle);
+	if(!meta){
+		std::cout << "mysql_stmt_result_metadata(): " << m_query.substr(0, 256) << ": MYSQL ERROR: " << mysql_stmt_error(m_handle) << std::endl;
+		return DBResult_ptr();
+	}
+
+	uint32_t fields = mysql_num_fields(meta);
+	MYSQL_FIELD* field = mysql_fetch_fields(meta);
+	std::vector<std::string> names;
+	for(uint32_t i = 0; i < fields; ++i){
+		names.push_back(field[i].name);
+	}
+	mysql_free_result(meta);
+
+	if(mysql_stmt_store_result(m_handle) != 0){
+		std::cout << "mysql_stmt_store_result(): " << m_query.substr(0, 256) << ": MYSQL ERROR: " << mysql_stmt_error(m_handle) << std::endl;
+		return DBResult_ptr();
+	}
+
+	// every column is read as text, like the rows of mysql_store_result
+	if(m_buffers.size() < fields){
+		m_buffers.resize(fields, std::vector<char>(64));
+	}
+
+	std::vector<MYSQL_BIND> binds(fields);
+	std::vector<unsigned long> lengths(fields);
+	std::vector<my_bool> nulls(fields);
+	if(fields != 0){
+		memset(&binds[0], 0, sizeof(MYSQL_BIND) * fields);
+	}
+
+	for(uint32_t i = 0; i < fields; ++i){
+		binds[i].buffer_type = MYSQL_TYPE_STRING;
+		binds[i].buffer = &m_buffers[i][0];
+		binds[i].buffer_length = m_buffers[i].size();
+		binds[i].length = &lengths[i];
+		binds[i].is_null = &nulls[i];
+	}
+
+	boost::shared_ptr<DBStoredResult> result = DBStoredResult::create(names);
+	if(fields != 0 && mysql_stmt_bind_result(m_handle, &binds[0]) == 0){
+		int ret;
+		while((ret = mysql_stmt_fetch(m_handle)) == 0 || ret == MYSQL_DATA_TRUNCATED){
+			for(uint32_t i = 0; i < fields; ++i){
+				if(nulls[i]){
+					result->addField(std::string());
+					continue;
+				}
+
+				if(lengths[i] > m_buffers[i].size()){
+					// grows the buffer and reads the column again
+					m_buffers[i].resize(lengths[i]);
+					binds[i].buffer = &m_buffers[i][0];
+					binds[i].buffer_length = m_buffers[i].size();
+					mysql_stmt_fetch_column(m_handle, &binds[i], i, 0);
+					mysql_stmt_bind_result(m_handle, &binds[0]);
+				}
+				result->addField(std::string(&m_buffers[i][0], lengths[i]));
+			}
 		}
 	}
+	mysql_stmt_free_result(m_handle);
 
-	std::cout << "Error during getDataLong(" << s << ")." << std::endl;
-	return 0; // Failed
+	if(result->empty())
+		return DBResult_ptr();
+	return result;
 }
 
-std::string MySQLResult::getDataString(const std::string &s)
+/** MySQLResult definitions */
+
+int32_t MySQLResult::getColumnIndex(const std::string &s)
 {
 	listNames_t::iterator it = m_listNames.find(s);
-	if(it != m_listNames.end() ){
-		if(m_row[it->second] == NULL)
-			return std::string("");
-		else
-			return std::string(m_row[it->second]);
-	}
+	return it != m_listNames.end() ? (int32_t)it->second : -1;
+}
 
-	std::cout << "Error during getDataString(" << s << ")." << std::endl;
-	return std::string(""); // Failed
+const char* MySQLResult::getField(uint32_t column) const
+{
+	if(!m_row || column >= m_columns)
+		return NULL;
+
+	return m_row[column];
 }
 
-const char* MySQLResult::getDataStream(const std::string &s, unsigned long &size)
+int32_t MySQLResult::getDataInt(uint32_t column)
 {
-	listNames_t::iterator it = m_listNames.find(s);
-	if(it != m_listNames.end() ){
-		if(m_row[it->second] == NULL){
-			size = 0;
-			return NULL;
-		}
-		else{
-			size = mysql_fetch_lengths(m_handle)[it->second];
-			return m_row[it->second];
-		}
-	}
+	const char* value = getField(column);
+	return value ? atoi(value) : 0;
+}
+
+uint32_t MySQLResult::getDataUInt(uint32_t column)
+{
+	const char* value = getField(column);
+	return value ? (uint32_t)strtoul(value, NULL, 10) : 0;
+}
+
+int64_t MySQLResult::getDataLong(uint32_t column)
+{
+	const char* value = getField(column);
+	return value ? atoll(value) : 0;
+}
 
-	std::cout << "Error during getDataStream(" << s << ")." << std::endl;
-	size = 0;
-	return NULL;
+std::string MySQLResult::getDataString(uint32_t column)
+{
+	const char* value = getField(column);
+	if(!value)
+		return std::string("");
+
+	return std::string(value, mysql_fetch_lengths(m_handle)[column]);
+}
+
+const char* MySQLResult::getDataStream(uint32_t column, unsigned long &size)
+{
+	const char* value = getField(column);
+	size = value ? mysql_fetch_lengths(m_handle)[column] : 0;
+	return value;
+}
+
+boost::string_view MySQLResult::getDataView(uint32_t column)
+{
+	const char* value = getField(column);
+	if(!value)
+		return boost::string_view();
+
+	return boost::string_view(value, mysql_fetch_lengths(m_handle)[column]);
+}
+
+void MySQLResult::getColumnNames(std::vector<std::string>& names)
+{
+	for(listNames_t::iterator it = m_listNames.begin(); it != m_listNames.end(); ++it){
+		names.push_back(it->first);
+	}
 }
 
 DBResult_ptr MySQLResult::advance()
@@ -344,11 +520,13 @@ MySQLResult::MySQLResult(MYSQL_RES* res)
 	m_handle = res;
 	m_listNames.clear();
 
+	m_row = NULL;
+	m_columns = 0;
+
 	MYSQL_FIELD* field;
-	int32_t i = 0;
 	while((field = mysql_fetch_field(m_handle))){
-		m_listNames[field->name] = i;
-		i++;
+		m_listNames[field->name] = m_columns;
+		m_columns++;
 	}
 }
 
@@ -35,15 +35,17 @@
 
 class DatabaseMySQL : public DatabaseDriver
 {
+	friend class MySQLStatement;
+
 public:
 	DatabaseMySQL();
 	virtual ~DatabaseMySQL();
 
 	virtual bool getParam(DBParam_t param);
 
-	virtual bool beginTransaction();
-	virtual bool rollback();
-	virtual bool commit();
+	virtual bool beginTransaction(uint32_t& depth);
+	virtual bool rollback(uint32_t depth);
+	virtual bool commit(uint32_t depth);
 
 	virtual uint64_t getLastInsertedRowID();
 
@@ -51,23 +53,51 @@ public:
 	virtual std::string escapeBlob(const char* s, uint32_t length);
 
 protected:
+	virtual bool checkConnection();
 	virtual bool internalQuery(const std::string &query);
 	virtual DBResult_ptr internalSelectQuery(const std::string &query);
+	virtual DBStatement* internalPrepare(const std::string &query);
 	virtual void freeResult(DBResult *res);
 
 	MYSQL m_handle;
 };
 
+class MySQLStatement : public DBStatement
+{
+public:
+	MySQLStatement(DatabaseMySQL* db, const std::string& query);
+	virtual ~MySQLStatement();
+
+	bool prepare();
+
+	virtual bool execute();
+	virtual DBResult_ptr query();
+
+protected:
+	bool run();
+	void close();
+
+	DatabaseMySQL* m_db;
+	MYSQL_STMT* m_handle;
+
+	// Column buffers of the results, they only grow
+	std::vector<std::vector<char> > m_buffers;
+};
+
 class MySQLResult : public DBResult
 {
 	friend class DatabaseMySQL;
 
 public:
-	virtual int32_t getDataInt(const std::string &s);
-	virtual uint32_t getDataUInt(const std::string &s);
-	virtual int64_t getDataLong(const std::string &s);
-	virtual std::string getDataString(const std::string &s);
-	virtual const char* getDataStream(const std::string &s, unsigned long &size);
+	virtual void getColumnNames(std::vector<std::string>& names);
+	virtual int32_t getColumnIndex(const std::string &s);
+
+	virtual int32_t getDataInt(uint32_t column);
+	virtual uint32_t getDataUInt(uint32_t column);
+	virtual int64_t getDataLong(uint32_t column);
+	virtual std::string getDataString(uint32_t column);
+	virtual const char* getDataStream(uint32_t column, unsigned long &size);
+	virtual boost::string_view getDataView(uint32_t column);
 
 	virtual DBResult_ptr advance();
 	virtual bool empty();
@@ -76,11 +106,15 @@ protected:
 	MySQLResult(MYSQL_RES* res);
 	virtual ~MySQLResult();
 
+	// The value of a field of the current row, NULL if it is NULL
+	const char* getField(uint32_t column) const;
+
 	typedef std::map<const std::string, uint32_t> listNames_t;
 	listNames_t m_listNames;
 
 	MYSQL_RES* m_handle;
 	MYSQL_ROW m_row;
+	uint32_t m_columns;
 };
 
 #endif
@@ -101,6 +101,7 @@ DatabaseODBC::DatabaseODBC()
 
 DatabaseODBC::~DatabaseODBC()
 {
+	clearStatements();
 	if(m_connected){
 		SQLDisconnect(m_handle);
 		SQLFreeHandle(SQL_HANDLE_DBC, m_handle);
@@ -123,20 +124,21 @@ bool DatabaseODBC::getParam(DBParam_t param)
 	}
 }
 
-bool DatabaseODBC::beginTransaction()
+bool DatabaseODBC::beginTransaction(uint32_t& depth)
 {
+	depth = 0;
 	return true;
 	// return executeQuery("BEGIN");
 }
 
-bool DatabaseODBC::rollback()
+bool DatabaseODBC::rollback(uint32_t depth)
 {
 	return true;
 	// SQL_RETURN ret = SQLTransact(m_env, m_handle, SQL_ROLLBACK);
 	// return RETURN_SUCCESS(ret);
 }
 
-bool DatabaseODBC::commit()
+bool DatabaseODBC::commit(uint32_t depth)
 {
 	return true;
 	// SQL_RETURN ret = SQLTransact(m_env, m_handle, SQL_COMMIT);
@@ -366,6 +368,13 @@ const char* ODBCResult::getDataStream(const std::string &s, unsigned long &size)
 	return 0; // Failed
 }
 
+void ODBCResult::getColumnNames(std::vector<std::string>& names)
+{
+	for(listNames_t::iterator it = m_listNames.begin(); it != m_listNames.end(); ++it){
+		names.push_back(it->first);
+	}
+}
+
 bool ODBCResult::advance()
 {
 	SQLRETURN ret = SQLFetch(m_handle);
@@ -55,9 +55,9 @@ public:
 
 	virtual bool getParam(DBParam_t param);
 
-	virtual bool beginTransaction();
-	virtual bool rollback();
-	virtual bool commit();
+	virtual bool beginTransaction(uint32_t& depth);
+	virtual bool rollback(uint32_t depth);
+	virtual bool commit(uint32_t depth);
 
 	virtual bool executeQuery(const std::string &query);
 
@@ -85,6 +85,7 @@ public:
 	virtual int64_t getDataLong(const std::string &s);
 	virtual std::string getDataString(const std::string &s);
 	virtual const char* getDataStream(const std::string &s, unsigned long &size);
+	virtual void getColumnNames(std::vector<std::string>& names);
 
 	virtual DBResult_ptr advance();
 	virtual bool empty();o
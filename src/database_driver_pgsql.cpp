@@ -27,6 +27,9 @@
 #include "configmanager.h"
 extern ConfigManager g_config;
 
+// BYTEAOID of catalog/pg_type.h, which is not installed along with libpq
+static const Oid PGSQL_BYTEA_OID = 17;
+
 /** DatabasePgSQL definitions */
 
 DatabasePgSQL::DatabasePgSQL()
@@ -35,6 +38,7 @@ DatabasePgSQL::DatabasePgSQL()
 	std::stringstream dns;
 	dns << "host='" << g_config.getString(ConfigManager::SQL_HOST) << "' dbname='" << g_config.getString(ConfigManager::SQL_DB) << "' user='" << g_config.getString(ConfigManager::SQL_USER) << "' password='" << g_config.getString(ConfigManager::SQL_PASS) << "' port='" << g_config.getNumber(ConfigManager::SQL_PORT) << "'";
 
+	m_statementCount = 0;
 	m_handle = PQconnectdb(dns.str().c_str());
 	m_connected = PQstatus(m_handle) == CONNECTION_OK;
 
@@ -44,9 +48,29 @@ DatabasePgSQL::DatabasePgSQL()
 
 DatabasePgSQL::~DatabasePgSQL()
 {
+	clearStatements();
 	PQfinish(m_handle);
 }
 
+bool DatabasePgSQL::checkConnection()
+{
+	if(PQstatus(m_handle) == CONNECTION_OK){
+		PGresult* res = PQexec(m_handle, "SELECT 1");
+		bool alive = PQresultStatus(res) == PGRES_TUPLES_OK;
+		PQclear(res);
+		if(alive){
+			m_connected = true;
+			return true;
+		}
+	}
+
+	// the prepared statements are gone along with the session
+	clearStatements();
+	PQreset(m_handle);
+	m_connected = PQstatus(m_handle) == CONNECTION_OK;
+	return m_connected;
+}
+
 bool DatabasePgSQL::getParam(DBParam_t param)
 {
 	switch(param){
@@ -59,17 +83,18 @@ bool DatabasePgSQL::getParam(DBParam_t param)
 	}
 }
 
-bool DatabasePgSQL::beginTransaction()
+bool DatabasePgSQL::beginTransaction(uint32_t& depth)
 {
+	depth = 0;
 	return executeQuery("BEGIN");
 }
 
-bool DatabasePgSQL::rollback()
+bool DatabasePgSQL::rollback(uint32_t depth)
 {
 	return executeQuery("ROLLBACK");
 }
 
-bool DatabasePgSQL::commit()
+bool DatabasePgSQL::commit(uint32_t depth)
 {
 	return executeQuery("COMMIT");
 }
@@ -122,6 +147,44 @@ DBResult_ptr DatabasePgSQL::internalSelectQuery(const std::string &query)
 	return verifyResult(results);
 }
 
+DBStatement* DatabasePgSQL::internalPrepare(const std::string &query)
+{
+	if(!m_connected)
+		return NULL;
+
+	// PostgreSQL numbers its placeholders
+	std::ostringstream buf;
+	std::string parsed = _parse(query);
+	uint32_t index = 0;
+	bool inString = false;
+	for(uint32_t a = 0; a < parsed.length(); a++){
+		if(parsed[a] == '\''){
+			inString = !inString;
+		}
+
+		if(parsed[a] == '?' && !inString){
+			buf << "$" << ++index;
+		}
+		else{
+			buf << parsed[a];
+		}
+	}
+
+	std::ostringstream name;
+	name << "ots_stmt_" << ++m_statementCount;
+
+	PGresult* res = PQprepare(m_handle, name.str().c_str(), buf.str().c_str(), 0, NULL);
+	ExecStatusType stat = PQresultStatus(res);
+	PQclear(res);
+
+	if(stat != PGRES_COMMAND_OK){
+		std::cout << "PQprepare(): " << query << ": " << PQerrorMessage(m_handle) << std::endl;
+		return NULL;
+	}
+
+	return new PgSQLStatement(this, query, name.str());
+}
+
 uint64_t DatabasePgSQL::getLastInsertedRowID()
 {
 	if(!m_connected)
@@ -207,39 +270,140 @@ void DatabasePgSQL::freeResult(DBResult* res)
 	delete (PgSQLResult*)res;
 }
 
-/** PgSQLResult definitions */
+/** PgSQLStatement definitions */
 
-int32_t PgSQLResult::getDataInt(const std::string &s)
+PgSQLStatement::PgSQLStatement(DatabasePgSQL* db, const std::string& query, const std::string& name) :
+	DBStatement(query), m_db(db), m_name(name)
 {
-	return atoi( PQgetvalue(m_handle, m_cursor, PQfnumber(m_handle, s.c_str() ) ) );
 }
 
-int32_t PgSQLResult::getDataInt(const std::string &s)
+PGresult* PgSQLStatement::run()
 {
-	std::istringstream os(PQgetvalue(m_handle, m_cursor, PQfnumber(m_handle, s.c_str() ) ) );
-	uint32_t res;
-	os >> res;
+	if(!m_db->m_connected)
+		return NULL;
+
+	#ifdef __DEBUG_SQL__
+	std::cout << "PGSQL STATEMENT: " << m_query << std::endl;
+	#endif
+
+	// numbers are sent as text, blobs in binary so they need no escaping
+	std::vector<std::string> numbers(m_params.size());
+	std::vector<const char*> values(m_params.size());
+	std::vector<int> lengths(m_params.size());
+	std::vector<int> formats(m_params.size());
+	for(uint32_t i = 0; i < m_params.size(); ++i){
+		const Param& param = m_params[i];
+		if(param.type == DBBIND_INT){
+			std::ostringstream number;
+			number << param.number;
+			numbers[i] = number.str();
+			values[i] = numbers[i].c_str();
+		}
+		else{
+			values[i] = param.data.c_str();
+			lengths[i] = param.data.length();
+			formats[i] = (param.type == DBBIND_BLOB ? 1 : 0);
+		}
+	}
+
+	PGresult* res = PQexecPrepared(m_db->m_handle, m_name.c_str(), m_params.size(),
+		values.empty() ? NULL : &values[0], lengths.empty() ? NULL : &lengths[0], formats.empty() ? NULL : &formats[0], 0);
+	ExecStatusType stat = PQresultStatus(res);
+
+	if(stat != PGRES_COMMAND_OK && stat != PGRES_TUPLES_OK){
+		std::cout << "PQexecPrepared(): " << m_query << ": " << PQresultErrorMessage(res) << std::endl;
+		PQclear(res);
+		return NULL;
+	}
 	return res;
 }
 
-int64_t PgSQLResult::getDataLong(const std::string &s)
+bool PgSQLStatement::execute()
+{
+	PGresult* res = run();
+	if(!res)
+		return false;
+
+	PQclear(res);
+	return true;
+}
+
+DBResult_ptr PgSQLStatement::query()
+{
+	PGresult* res = run();
+	if(!res)
+		return DBResult_ptr();
+
+	DBResult_ptr results(new PgSQLResult(res), boost::bind(&DatabasePgSQL::freeResult, m_db, _1));
+	return m_db->verifyResult(results);
+}
+
+/** PgSQLResult definitions */
+
+int32_t PgSQLResult::getColumnIndex(const std::string &s)
+{
+	return PQfnumber(m_handle, s.c_str());
+}
+
+int32_t PgSQLResult::getDataInt(uint32_t column)
 {
-	return ATOI64( PQgetvalue(m_handle, m_cursor, PQfnumber(m_handle, s.c_str() ) ) );
+	return atoi(PQgetvalue(m_handle, m_cursor, column));
 }
 
-std::string PgSQLResult::getDataString(const std::string &s)
+uint32_t PgSQLResult::getDataUInt(uint32_t column)
 {
-	return std::string( PQgetvalue(m_handle, m_cursor, PQfnumber(m_handle, s.c_str() ) ) );
+	return (uint32_t)strtoul(PQgetvalue(m_handle, m_cursor, column), NULL, 10);
 }
 
-const char* PgSQLResult::getDataStream(const std::string &s, unsigned long &size)
+int64_t PgSQLResult::getDataLong(uint32_t column)
 {
-	std::string buf = PQgetvalue(m_handle, m_cursor, PQfnumber(m_handle, s.c_str() ) );
-	unsigned char* temp = PQunescapeBytea( (const unsigned char*)buf.c_str(), (size_t*)&size);
-	char* value = new char[buf.size()];
-	strcpy(value, (char*)temp);
+	return ATOI64(PQgetvalue(m_handle, m_cursor, column));
+}
+
+std::string PgSQLResult::getDataString(uint32_t column)
+{
+	return std::string(PQgetvalue(m_handle, m_cursor, column), PQgetlength(m_handle, m_cursor, column));
+}
+
+const std::string* PgSQLResult::unescape(uint32_t column)
+{
+	if(column >= m_streams.size())
+		return NULL;
+
+	size_t length = 0;
+	unsigned char* temp = PQunescapeBytea((const unsigned char*)PQgetvalue(m_handle, m_cursor, column), &length);
+	if(!temp)
+		return NULL;
+
+	m_streams[column].assign((const char*)temp, length);
 	PQfreemem(temp);
-	return value;
+	return &m_streams[column];
+}
+
+const char* PgSQLResult::getDataStream(uint32_t column, unsigned long &size)
+{
+	const std::string* value = unescape(column);
+	size = value ? value->size() : 0;
+	return value ? value->data() : NULL;
+}
+
+boost::string_view PgSQLResult::getDataView(uint32_t column)
+{
+	// bytea is the only type that arrives escaped
+	if(PQftype(m_handle, column) == PGSQL_BYTEA_OID){
+		const std::string* value = unescape(column);
+		return value ? boost::string_view(*value) : boost::string_view();
+	}
+
+	return boost::string_view(PQgetvalue(m_handle, m_cursor, column), PQgetlength(m_handle, m_cursor, column));
+}
+
+void PgSQLResult::getColumnNames(std::vector<std::string>& names)
+{
+	int32_t fields = PQnfields(m_handle);
+	for(int32_t i = 0; i < fields; ++i){
+		names.push_back(PQfname(m_handle, i));
+	}
 }
 
 DBResult_ptr PgSQLResult::advance()
@@ -261,6 +425,7 @@ PgSQLResult::PgSQLResult(PGresult* results)
 	m_handle = results;
 	m_cursor = -1;
 	m_rows = PQntuples(m_handle) - 1;
+	m_streams.resize(PQnfields(m_handle));
 }
 
 PgSQLResult::~PgSQLResult()
@@ -29,15 +29,17 @@
 
 class DatabasePgSQL : public DatabaseDriver
 {
+	friend class PgSQLStatement;
+
 public:
 	DatabasePgSQL();
 	virtual ~DatabasePgSQL();
 
 	virtual bool getParam(DBParam_t param);
 
-	virtual bool beginTransaction();
-	virtual bool rollback();
-	virtual bool commit();
+	virtual bool beginTransaction(uint32_t& depth);
+	virtual bool rollback(uint32_t depth);
+	virtual bool commit(uint32_t depth);
 
 	virtual bool executeQuery(const std::string &query);
 
@@ -47,25 +49,49 @@ public:
 	virtual std::string escapeBlob(const char* s, uint32_t length);
 
 protected:
+	virtual bool checkConnection();
 	virtual bool internalQuery(const std::string &query);
 	virtual DBResult_ptr internalSelectQuery(const std::string &query);
+	virtual DBStatement* internalPrepare(const std::string &query);
 	virtual void freeResult(DBResult *res);
 
 	std::string _parse(const std::string &s);
 
 	PGconn* m_handle;
+	uint32_t m_statementCount;
+};
+
+class PgSQLStatement : public DBStatement
+{
+public:
+	PgSQLStatement(DatabasePgSQL* db, const std::string& query, const std::string& name);
+	virtual ~PgSQLStatement() {};
+
+	virtual bool execute();
+	virtual DBResult_ptr query();
+
+protected:
+	PGresult* run();
+
+	DatabasePgSQL* m_db;
+	std::string m_name;
 };
 
 class PgSQLResult : public DBResult
 {
 	friend class DatabasePgSQL;
+	friend class PgSQLStatement;
 
 public:
-	virtual int32_t getDataInt(const std::string &s);
-	virtual uint32_t getDataUInt(const std::string &s);
-	virtual int64_t getDataLong(const std::string &s);
-	virtual std::string getDataString(const std::string &s);
-	virtual const char* getDataStream(const std::string &s, unsigned long &size);
+	virtual void getColumnNames(std::vector<std::string>& names);
+	virtual int32_t getColumnIndex(const std::string &s);
+
+	virtual int32_t getDataInt(uint32_t column);
+	virtual uint32_t getDataUInt(uint32_t column);
+	virtual int64_t getDataLong(uint32_t column);
+	virtual std::string getDataString(uint32_t column);
+	virtual const char* getDataStream(uint32_t column, unsigned long &size);
+	virtual boost::string_view getDataView(uint32_t column);
 
 	virtual DBResult_ptr advance();
 	virtual bool empty();
@@ -74,8 +100,13 @@ protected:
 	PgSQLResult(PGresult* results);
 	virtual ~PgSQLResult();
 
+	// Unescapes a bytea field of the current row into m_streams
+	const std::string* unescape(uint32_t column);
+
 	int32_t m_rows, m_cursor;
 	PGresult* m_handle;
+	// bytea fields arrive escaped, by column
+	std::vector<std::string> m_streams;
 };
 
 #endif
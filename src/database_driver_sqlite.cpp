@@ -42,6 +42,8 @@ extern ConfigManager g_config;
 DatabaseSQLite::DatabaseSQLite()
 {
 	m_connected = false;
+	m_tuned = false;
+	m_transactionDepth = 0;
 
 	// test for existence of database file;
 	// sqlite3_open will create a new one if it isn't there (which we don't want)
@@ -60,19 +62,44 @@ DatabaseSQLite::DatabaseSQLite()
 	}
 	else{
 		m_connected = true;
+		if(g_config.getNumber(ConfigManager::SQLITE_TUNED)){
+			m_tuned = tune();
+		}
 	}
 }
 
 DatabaseSQLite::~DatabaseSQLite()
 {
+	clearStatements();
 	sqlite3_close(m_handle);
 }
 
+bool DatabaseSQLite::tune()
+{
+	// the journal mode is kept in the file, the others are set for every
+	// connection
+	DBResult_ptr result = storeQuery("PRAGMA journal_mode = WAL");
+	if(!result || result->getDataString(0) != "wal"){
+		std::cout << "Failed to switch the SQLite database to WAL mode, sqlite_tuned is ignored." << std::endl;
+		return false;
+	}
+
+	std::ostringstream query;
+	query << "PRAGMA mmap_size = " << std::max<int64_t>(0, g_config.getNumber(ConfigManager::SQLITE_MMAP_SIZE));
+	return executeQuery("PRAGMA synchronous = NORMAL") && executeQuery(query.str());
+}
+
 bool DatabaseSQLite::getParam(DBParam_t param)
 {
 	switch(param){
 		case DBPARAM_MULTIINSERT:
-			return false;
+			// the 500 rows limit of compound selects applies to VALUES
+			// before 3.8.8, DBInsert may add more rows than that
+			return m_tuned && sqlite3_libversion_number() >= 3008008;
+			break;
+
+		case DBPARAM_BATCHWRITES:
+			return m_tuned;
 			break;
 
 		default:
@@ -80,19 +107,66 @@ bool DatabaseSQLite::getParam(DBParam_t param)
 	}
 }
 
-bool DatabaseSQLite::beginTransaction()
+bool DatabaseSQLite::sync()
+{
+	// synchronous = NORMAL leaves the last commits in a WAL that is not
+	// synced yet, a full checkpoint syncs it and copies it to the database
+	if(!m_tuned)
+		return true;
+
+	DBResult_ptr result = storeQuery("PRAGMA wal_checkpoint(FULL)");
+	return result && result->getDataInt(0) == 0;
+}
+
+std::string DatabaseSQLite::getSavepoint(uint32_t depth)
+{
+	std::ostringstream name;
+	name << "nested" << depth;
+	return name.str();
+}
+
+bool DatabaseSQLite::beginTransaction(uint32_t& depth)
 {
-	return executeQuery("BEGIN");
+	depth = m_transactionDepth;
+	if(!executeQuery(depth == 0 ? "BEGIN" : "SAVEPOINT " + getSavepoint(depth)))
+		return false;
+
+	m_transactionDepth = depth + 1;
+	return true;
 }
 
-bool DatabaseSQLite::rollback()
+bool DatabaseSQLite::rollback(uint32_t depth)
 {
+	// the transactions begun inside this one end with it
+	m_transactionDepth = depth;
+	if(depth > 0){
+		std::string savepoint = getSavepoint(depth);
+		return executeQuery("ROLLBACK TO " + savepoint) && executeQuery("RELEASE " + savepoint);
+	}
+
 	return executeQuery("ROLLBACK");
 }
 
-bool DatabaseSQLite::commit()
+bool DatabaseSQLite::commit(uint32_t depth)
 {
-	return executeQuery("COMMIT");
+	m_transactionDepth = depth;
+	if(depth > 0){
+		std::string savepoint = getSavepoint(depth);
+		if(executeQuery("RELEASE " + savepoint))
+			return true;
+
+		executeQuery("ROLLBACK TO " + savepoint);
+		executeQuery("RELEASE " + savepoint);
+		return false;
+	}
+
+	if(executeQuery("COMMIT"))
+		return true;
+
+	// a commit that failed may leave the transaction open
+	if(!sqlite3_get_autocommit(m_handle))
+		executeQuery("ROLLBACK");
+	return false;
 }
 
 std::string DatabaseSQLite::_parse(const std::string &s)
@@ -180,6 +254,24 @@ DBResult_ptr DatabaseSQLite::internalSelectQuery(const std::string &query)
 	return verifyResult(results);
 }
 
+DBStatement* DatabaseSQLite::internalPrepare(const std::string &query)
+{
+	boost::recursive_mutex::scoped_lock lockClass(sqliteLock);
+
+	if(!m_connected)
+		return NULL;
+
+	std::string buf = _parse(query);
+	sqlite3_stmt* stmt;
+	if( OTS_SQLITE3_PREPARE(m_handle, buf.c_str(), buf.length(), &stmt, NULL) != SQLITE_OK){
+		sqlite3_finalize(stmt);
+		std::cout << "OTS_SQLITE3_PREPARE(): SQLITE ERROR: " << sqlite3_errmsg(m_handle)  << " (" << buf << ")" << std::endl;
+		return NULL;
+	}
+
+	return new SQLiteStatement(this, query, stmt);
+}
+
 uint64_t DatabaseSQLite::getLastInsertedRowID()
 {
 	return (uint64_t)sqlite3_last_insert_rowid(m_handle);
@@ -223,61 +315,138 @@ void DatabaseSQLite::freeResult(DBResult* res)
 	delete (SQLiteResult*)res;
 }
 
+/** SQLiteStatement definitions */
+
+SQLiteStatement::SQLiteStatement(DatabaseSQLite* db, const std::string& query, sqlite3_stmt* stmt) :
+	DBStatement(query), m_db(db), m_handle(stmt)
+{
+}
+
+SQLiteStatement::~SQLiteStatement()
+{
+	sqlite3_finalize(m_handle);
+}
+
+bool SQLiteStatement::bindParams()
+{
+	sqlite3_reset(m_handle);
+	sqlite3_clear_bindings(m_handle);
+
+	for(uint32_t i = 0; i < m_params.size(); ++i){
+		const Param& param = m_params[i];
+		int ret;
+		if(param.type == DBBIND_INT){
+			ret = sqlite3_bind_int64(m_handle, i + 1, param.number);
+		}
+		else if(param.type == DBBIND_STRING){
+			ret = sqlite3_bind_text(m_handle, i + 1, param.data.data(), param.data.length(), SQLITE_TRANSIENT);
+		}
+		else{
+			ret = sqlite3_bind_blob(m_handle, i + 1, param.data.data(), param.data.length(), SQLITE_TRANSIENT);
+		}
+
+		if(ret != SQLITE_OK){
+			std::cout << "sqlite3_bind(): SQLITE ERROR: " << sqlite3_errmsg(m_db->m_handle) << " (" << m_query << ")" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool SQLiteStatement::execute()
+{
+	boost::recursive_mutex::scoped_lock lockClass(m_db->sqliteLock);
+
+	#ifdef __DEBUG_SQL__
+	std::cout << "SQLITE STATEMENT: " << m_query << std::endl;
+	#endif
+
+	if(!bindParams())
+		return false;
+
+	int ret = sqlite3_step(m_handle);
+	sqlite3_reset(m_handle);
+	if(ret != SQLITE_OK && ret != SQLITE_DONE && ret != SQLITE_ROW){
+		std::cout << "sqlite3_step(): SQLITE ERROR: " << sqlite3_errmsg(m_db->m_handle) << " (" << m_query << ")" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+DBResult_ptr SQLiteStatement::query()
+{
+	boost::recursive_mutex::scoped_lock lockClass(m_db->sqliteLock);
+
+	#ifdef __DEBUG_SQL__
+	std::cout << "SQLITE STATEMENT: " << m_query << std::endl;
+	#endif
+
+	if(!bindParams())
+		return DBResult_ptr();
+
+	DBResult_ptr results(new SQLiteResult(m_handle, true), boost::bind(&DatabaseSQLite::freeResult, m_db, _1));
+	return m_db->verifyResult(results);
+}
+
 /** SQLiteResult definitions */
 
-int32_t SQLiteResult::getDataInt(const std::string &s)
+int32_t SQLiteResult::getColumnIndex(const std::string &s)
 {
 	listNames_t::iterator it = m_listNames.find(s);
-	if(it != m_listNames.end() )
-		return sqlite3_column_int(m_handle, it->second);
+	return it != m_listNames.end() ? (int32_t)it->second : -1;
+}
 
-	std::cout << "Error during getDataInt(" << s << ")." << std::endl;
-	return 0; // Failed
+int32_t SQLiteResult::getDataInt(uint32_t column)
+{
+	return sqlite3_column_int(m_handle, column);
 }
 
-uint32_t SQLiteResult::getDataUInt(const std::string &s)
+uint32_t SQLiteResult::getDataUInt(uint32_t column)
 {
-	listNames_t::iterator it = m_listNames.find(s);
-	if(it != m_listNames.end() )
-		return (uint32_t)sqlite3_column_int64(m_handle, it->second);
+	return (uint32_t)sqlite3_column_int64(m_handle, column);
+}
 
-	std::cout << "Error during getDataInt(" << s << ")." << std::endl;
-	return 0; // Failed
+int64_t SQLiteResult::getDataLong(uint32_t column)
+{
+	return sqlite3_column_int64(m_handle, column);
 }
 
-int64_t SQLiteResult::getDataLong(const std::string &s)
+std::string SQLiteResult::getDataString(uint32_t column)
 {
-	listNames_t::iterator it = m_listNames.find(s);
-	if(it != m_listNames.end() )
-		return sqlite3_column_int64(m_handle, it->second);
+	const char* value = (const char*)sqlite3_column_text(m_handle, column);
+	if(!value)
+		return std::string("");
 
-	std::cout << "Error during getDataLong(" << s << ")." << std::endl;
-	return 0; // Failed
+	return std::string(value, sqlite3_column_bytes(m_handle, column));
 }
 
-std::string SQLiteResult::getDataString(const std::string &s)
+const char* SQLiteResult::getDataStream(uint32_t column, unsigned long &size)
 {
-	listNames_t::iterator it = m_listNames.find(s);
-	if(it != m_listNames.end() ){
-		std::string value = (const char*)sqlite3_column_text(m_handle, it->second);
-		return value;
-	}
+	const char* value = (const char*)sqlite3_column_blob(m_handle, column);
+	size = sqlite3_column_bytes(m_handle, column);
+	return value;
+}
 
-	std::cout << "Error during getDataString(" << s << ")." << std::endl;
-	return std::string(""); // Failed
+boost::string_view SQLiteResult::getDataView(uint32_t column)
+{
+	// a blob is returned as it is, text is converted if needed
+	const char* value;
+	if(sqlite3_column_type(m_handle, column) == SQLITE_BLOB)
+		value = (const char*)sqlite3_column_blob(m_handle, column);
+	else
+		value = (const char*)sqlite3_column_text(m_handle, column);
+
+	if(!value)
+		return boost::string_view();
+
+	return boost::string_view(value, sqlite3_column_bytes(m_handle, column));
 }
 
-const char* SQLiteResult::getDataStream(const std::string &s, unsigned long &size)
+void SQLiteResult::getColumnNames(std::vector<std::string>& names)
 {
-	listNames_t::iterator it = m_listNames.find(s);
-	if(it != m_listNames.end() ){
-		const char* value = (const char*)sqlite3_column_blob(m_handle, it->second);
-		size = sqlite3_column_bytes(m_handle, it->second);
-		return value;
+	for(listNames_t::iterator it = m_listNames.begin(); it != m_listNames.end(); ++it){
+		names.push_back(it->first);
 	}
-
-	std::cout << "Error during getDataStream(" << s << ")." << std::endl;
-	return NULL; // Failed
 }
 
 DBResult_ptr SQLiteResult::advance()
@@ -292,10 +461,11 @@ bool SQLiteResult::empty()
 	return !m_rowAvailable;
 }
 
-SQLiteResult::SQLiteResult(sqlite3_stmt* stmt)
+SQLiteResult::SQLiteResult(sqlite3_stmt* stmt, bool prepared /*= false*/)
 {
 	m_handle = stmt;
 	m_rowAvailable = false;
+	m_prepared = prepared;
 	m_listNames.clear();
 
 	int32_t fields = sqlite3_column_count(m_handle);
@@ -306,7 +476,10 @@ SQLiteResult::SQLiteResult(sqlite3_stmt* stmt)
 
 SQLiteResult::~SQLiteResult()
 {
-	sqlite3_finalize(m_handle);
+	if(m_prepared)
+		sqlite3_reset(m_handle);
+	else
+		sqlite3_finalize(m_handle);
 }
 
 #endif
@@ -29,15 +29,18 @@
 
 class DatabaseSQLite : public DatabaseDriver
 {
+	friend class SQLiteStatement;
+
 public:
 	DatabaseSQLite();
 	virtual ~DatabaseSQLite();
 
 	virtual bool getParam(DBParam_t param);
+	virtual bool sync();
 
-	virtual bool beginTransaction();
-	virtual bool rollback();
-	virtual bool commit();
+	virtual bool beginTransaction(uint32_t& depth);
+	virtual bool rollback(uint32_t depth);
+	virtual bool commit(uint32_t depth);
 
 	virtual uint64_t getLastInsertedRowID();
 
@@ -48,36 +51,66 @@ public:
 protected:
 	virtual bool internalQuery(const std::string &query);
 	virtual DBResult_ptr internalSelectQuery(const std::string &query);
+	virtual DBStatement* internalPrepare(const std::string &query);
 	virtual void freeResult(DBResult *res);
 
 	std::string _parse(const std::string &s);
+	// Journal mode, synchronous and memory map of sqlite_tuned
+	bool tune();
+	static std::string getSavepoint(uint32_t depth);
 
 	boost::recursive_mutex sqliteLock;
 	sqlite3* m_handle;
+	bool m_tuned;
+	// transactions begun and not finished, the inner ones are savepoints
+	uint32_t m_transactionDepth;
+};
+
+class SQLiteStatement : public DBStatement
+{
+public:
+	SQLiteStatement(DatabaseSQLite* db, const std::string& query, sqlite3_stmt* stmt);
+	virtual ~SQLiteStatement();
+
+	virtual bool execute();
+	virtual DBResult_ptr query();
+
+protected:
+	bool bindParams();
+
+	DatabaseSQLite* m_db;
+	sqlite3_stmt* m_handle;
 };
 
 class SQLiteResult : public DBResult
 {
 	friend class DatabaseSQLite;
+	friend class SQLiteStatement;
 
 public:
-	virtual int32_t getDataInt(const std::string &s);
-	virtual uint32_t getDataUInt(const std::string &s);
-	virtual int64_t getDataLong(const std::string &s);
-	virtual std::string getDataString(const std::string &s);
-	virtual const char* getDataStream(const std::string &s, unsigned long &size);
+	virtual void getColumnNames(std::vector<std::string>& names);
+	virtual int32_t getColumnIndex(const std::string &s);
+
+	virtual int32_t getDataInt(uint32_t column);
+	virtual uint32_t getDataUInt(uint32_t column);
+	virtual int64_t getDataLong(uint32_t column);
+	virtual std::string getDataString(uint32_t column);
+	virtual const char* getDataStream(uint32_t column, unsigned long &size);
+	virtual boost::string_view getDataView(uint32_t column);
 
 	virtual DBResult_ptr advance();
 	virtual bool empty();
 
 protected:
-	SQLiteResult(sqlite3_stmt* stmt);
+	// Results of a prepared statement only reset it, the statement owns the handle
+	SQLiteResult(sqlite3_stmt* stmt, bool prepared = false);
 	virtual ~SQLiteResult();
 
 	typedef std::map<const std::string, uint32_t> listNames_t;
 	listNames_t m_listNames;
 
 	bool m_rowAvailable;
+	bool m_prepared;
 	sqlite3_stmt* m_handle;
 };
 
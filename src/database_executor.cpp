@@ -0,0 +1,270 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include "database_executor.h"
+#include "database_driver.h"
+#include "tasks.h"
+
+#if defined __EXCEPTION_TRACER__
+#include "exception.h"
+#endif
+
+extern Dispatcher g_dispatcher;
+
+DatabaseExecutor::DatabaseExecutor()
+{
+	//
+}
+
+DatabaseExecutor::~DatabaseExecutor()
+{
+	for(std::vector<Worker*>::iterator it = m_workers.begin(); it != m_workers.end(); ++it){
+		delete *it;
+	}
+}
+
+void DatabaseExecutor::start(uint32_t threads, uint32_t writeBatch /*= 1*/)
+{
+	assert(m_workers.empty());
+	for(uint32_t i = 0; i < std::max<uint32_t>(1, threads); ++i){
+		m_workers.push_back(new Worker());
+		m_workers.back()->writeBatch = std::max<uint32_t>(1, writeBatch);
+	}
+
+	for(std::vector<Worker*>::iterator it = m_workers.begin(); it != m_workers.end(); ++it){
+		(*it)->thread = boost::thread(boost::bind(&DatabaseExecutor::executorThread, (void*)*it));
+	}
+}
+
+void DatabaseExecutor::shutdownAndWait()
+{
+	for(std::vector<Worker*>::iterator it = m_workers.begin(); it != m_workers.end(); ++it){
+		Worker* worker = *it;
+		worker->jobLock.lock();
+		worker->running = false;
+		worker->jobLock.unlock();
+
+		worker->jobSignal.notify_one();
+	}
+
+	for(std::vector<Worker*>::iterator it = m_workers.begin(); it != m_workers.end(); ++it){
+		(*it)->thread.join();
+	}
+}
+
+void DatabaseExecutor::addJob(const boost::function<void (void)>& job)
+{
+	addJob(0, job);
+}
+
+void DatabaseExecutor::addJob(const boost::function<void (void)>& job, const boost::function<void (void)>& callback)
+{
+	addJob(0, job, callback);
+}
+
+void DatabaseExecutor::addJob(uint32_t key, const boost::function<void (void)>& job)
+{
+	queueJob(key, Job(job, false));
+}
+
+void DatabaseExecutor::addWriteJob(const boost::function<void (void)>& job)
+{
+	queueJob(0, Job(job, true));
+}
+
+void DatabaseExecutor::addWriteJob(uint32_t key, const boost::function<void (void)>& job)
+{
+	queueJob(key, Job(job, true));
+}
+
+void DatabaseExecutor::queueJob(uint32_t key, const Job& job)
+{
+	assert(!m_workers.empty());
+	Worker* worker = m_workers[key % m_workers.size()];
+
+	boost::mutex::scoped_lock lockClass(worker->jobLock);
+	bool do_signal = worker->jobList.empty();
+	worker->jobList.push_back(job);
+	lockClass.unlock();
+
+	if(do_signal){
+		worker->jobSignal.notify_one();
+	}
+}
+
+void DatabaseExecutor::addJob(uint32_t key, const boost::function<void (void)>& job, const boost::function<void (void)>& callback)
+{
+	addJob(key, boost::bind(&DatabaseExecutor::runJob, job, callback));
+}
+
+void DatabaseExecutor::addExclusiveJob(const boost::function<void (void)>& job)
+{
+	addExclusiveJob(job, boost::function<void (void)>());
+}
+
+void DatabaseExecutor::addExclusiveJob(const boost::function<void (void)>& job, const boost::function<void (void)>& callback)
+{
+	assert(!m_workers.empty());
+	boost::shared_ptr<Barrier> barrier(new Barrier((uint32_t)m_workers.size()));
+	for(uint32_t i = 0; i < m_workers.size(); ++i){
+		addJob(i, boost::bind(&DatabaseExecutor::runExclusiveJob, barrier, job, callback));
+	}
+}
+
+uint32_t DatabaseExecutor::getPlayerKey(const std::string& name)
+{
+	// FNV-1a of the lower case name, names are case insensitive
+	uint32_t key = 2166136261u;
+	for(std::string::const_iterator it = name.begin(); it != name.end(); ++it){
+		key ^= (uint8_t)tolower(*it);
+		key *= 16777619u;
+	}
+	return key;
+}
+
+void DatabaseExecutor::waitForJobs(uint32_t key)
+{
+	Marker marker;
+	addJob(key, boost::bind(&DatabaseExecutor::signalMarker, &marker));
+
+	boost::unique_lock<boost::mutex> markerLockUnique(marker.lock);
+	while(!marker.done){
+		marker.signal.wait(markerLockUnique);
+	}
+}
+
+void DatabaseExecutor::signalMarker(Marker* marker)
+{
+	//database thread
+	boost::mutex::scoped_lock lockClass(marker->lock);
+	marker->done = true;
+	marker->signal.notify_one();
+}
+
+uint32_t DatabaseExecutor::getQueueSize()
+{
+	uint32_t size = 0;
+	for(std::vector<Worker*>::iterator it = m_workers.begin(); it != m_workers.end(); ++it){
+		boost::mutex::scoped_lock lockClass((*it)->jobLock);
+		size += (uint32_t)(*it)->jobList.size();
+	}
+	return size;
+}
+
+void DatabaseExecutor::runJob(boost::function<void (void)> job, boost::function<void (void)> callback)
+{
+	//database thread
+	job();
+	g_dispatcher.addTask(createTask(callback));
+}
+
+void DatabaseExecutor::runExclusiveJob(boost::shared_ptr<Barrier> barrier,
+	boost::function<void (void)> job, boost::function<void (void)> callback)
+{
+	//database thread
+	boost::unique_lock<boost::mutex> barrierLockUnique(barrier->lock);
+	if(--barrier->waiting > 0){
+		while(!barrier->done){
+			barrier->signal.wait(barrierLockUnique);
+		}
+		return;
+	}
+	barrierLockUnique.unlock();
+
+	// the last worker to get here runs it
+	job();
+	if(callback){
+		g_dispatcher.addTask(createTask(callback));
+	}
+
+	barrierLockUnique.lock();
+	barrier->done = true;
+	barrier->signal.notify_all();
+}
+
+void DatabaseExecutor::runWriteBatch(const std::vector<boost::function<void (void)> >& jobs)
+{
+	//database thread
+	{
+		DatabaseDriver* db = DatabaseDriver::instance();
+		DBTransaction transaction(db);
+		if(transaction.begin()){
+			for(std::vector<boost::function<void (void)> >::const_iterator it = jobs.begin(); it != jobs.end(); ++it){
+				(*it)();
+			}
+
+			if(transaction.commit()){
+				return;
+			}
+		}
+	}
+
+	// rolled back, the database holds what it held before the batch
+	std::cout << "[DatabaseExecutor::runWriteBatch] Batch of " << jobs.size() << " writes failed, writing them one by one." << std::endl;
+	for(std::vector<boost::function<void (void)> >::const_iterator it = jobs.begin(); it != jobs.end(); ++it){
+		(*it)();
+	}
+}
+
+void DatabaseExecutor::executorThread(void* p)
+{
+	Worker* worker = (Worker*)p;
+	#if defined __EXCEPTION_TRACER__
+	ExceptionHandler databaseExceptionHandler;
+	databaseExceptionHandler.InstallHandler();
+	#endif
+
+	std::vector<boost::function<void (void)> > batch;
+	boost::unique_lock<boost::mutex> jobLockUnique(worker->jobLock);
+	while(true){
+		while(worker->running && worker->jobList.empty()){
+			worker->jobSignal.wait(jobLockUnique);
+		}
+
+		if(worker->jobList.empty()){
+			// not running and nothing left to write
+			break;
+		}
+
+		bool write = worker->jobList.front().write;
+		batch.push_back(worker->jobList.front().function);
+		worker->jobList.pop_front();
+		while(write && batch.size() < worker->writeBatch && !worker->jobList.empty() && worker->jobList.front().write){
+			batch.push_back(worker->jobList.front().function);
+			worker->jobList.pop_front();
+		}
+		jobLockUnique.unlock();
+
+		if(batch.size() == 1){
+			batch.front()();
+		}
+		else{
+			runWriteBatch(batch);
+		}
+		batch.clear();
+
+		jobLockUnique.lock();
+	}
+
+	#if defined __EXCEPTION_TRACER__
+	databaseExceptionHandler.RemoveHandler();
+	#endif
+}
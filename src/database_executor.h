@@ -0,0 +1,130 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Runs database work off the dispatcher thread
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_DATABASE_EXECUTOR_H__
+#define __OTSERV_DATABASE_EXECUTOR_H__
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Write jobs sharing a transaction at most, when the database driver
+// batches writes
+#define DATABASE_WRITE_BATCH 64
+
+// Runs jobs that talk to the database on its own threads, callbacks are
+// handed back to the dispatcher as tasks. Every job has a key, jobs with
+// the same key run on the same worker in the order they were added, jobs
+// with different keys may run in parallel. Jobs still queued at shutdown
+// are run before the workers exit so no write is lost.
+//
+// Write jobs queued next to each other on a worker may be committed in one
+// transaction, the transactions of the jobs become savepoints of it. When
+// that transaction fails every job of it runs again on its own.
+class DatabaseExecutor{
+public:
+	DatabaseExecutor();
+	~DatabaseExecutor();
+
+	// Has to be called before the first job is added, up to writeBatch
+	// write jobs share a transaction, 1 commits each of them on its own
+	void start(uint32_t threads, uint32_t writeBatch = 1);
+	void shutdownAndWait();
+
+	void addJob(const boost::function<void (void)>& job);
+	// callback is run on the dispatcher thread once job has finished
+	void addJob(const boost::function<void (void)>& job, const boost::function<void (void)>& callback);
+	void addJob(uint32_t key, const boost::function<void (void)>& job);
+	void addJob(uint32_t key, const boost::function<void (void)>& job, const boost::function<void (void)>& callback);
+
+	// A job that only writes, it may run again if its batch fails and it
+	// is committed after it returned, so it has no callback
+	void addWriteJob(const boost::function<void (void)>& job);
+	void addWriteJob(uint32_t key, const boost::function<void (void)>& job);
+
+	// Runs job once every worker has run the jobs added before it, the
+	// workers wait while it runs, so it is ordered with the jobs of every key
+	void addExclusiveJob(const boost::function<void (void)>& job);
+	void addExclusiveJob(const boost::function<void (void)>& job, const boost::function<void (void)>& callback);
+
+	// A key that orders all the jobs of one player, by name because logins
+	// are fetched before the guid is known
+	static uint32_t getPlayerKey(const std::string& name);
+
+	// Blocks until the jobs of key added so far have run, never call it
+	// from a database worker or while holding a DBQuery
+	void waitForJobs(uint32_t key);
+
+	uint32_t getQueueSize();
+	uint32_t getWorkerCount() const {return (uint32_t)m_workers.size();}
+
+protected:
+	struct Job{
+		Job(const boost::function<void (void)>& _function, bool _write) : function(_function), write(_write) {}
+
+		boost::function<void (void)> function;
+		bool write;
+	};
+
+	struct Worker{
+		Worker() : running(true), writeBatch(1) {}
+
+		boost::thread thread;
+		boost::mutex jobLock;
+		boost::condition_variable jobSignal;
+		std::deque<Job> jobList;
+		bool running;
+		uint32_t writeBatch;
+	};
+
+	struct Marker{
+		Marker() : done(false) {}
+
+		boost::mutex lock;
+		boost::condition_variable signal;
+		bool done;
+	};
+
+	struct Barrier{
+		Barrier(uint32_t workers) : waiting(workers), done(false) {}
+
+		boost::mutex lock;
+		boost::condition_variable signal;
+		uint32_t waiting;
+		bool done;
+	};
+
+	void queueJob(uint32_t key, const Job& job);
+
+	static void executorThread(void* p);
+	static void runWriteBatch(const std::vector<boost::function<void (void)> >& jobs);
+	static void signalMarker(Marker* marker);
+	static void runExclusiveJob(boost::shared_ptr<Barrier> barrier,
+		boost::function<void (void)> job, boost::function<void (void)> callback);
+	static void runJob(boost::function<void (void)> job, boost::function<void (void)> callback);
+
+	std::vector<Worker*> m_workers;
+};
+extern DatabaseExecutor g_databaseExecutor;
+
+#endif
@@ -0,0 +1,261 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include "database_pool.h"
+#include "otsystem.h"
+
+#include "configmanager.h"
+extern ConfigManager g_config;
+
+DatabasePool* DatabasePool::_instance = NULL;
+
+DatabasePool* DatabasePool::instance()
+{
+	if(!_instance){
+		_instance = new DatabasePool();
+	}
+	return _instance;
+}
+
+DatabasePool::DatabasePool() : m_size(0), m_opening(0)
+{
+	// The first connection is opened right away, it tells whether the
+	// database can be reached at all
+	PooledConnection* connection = open();
+	if(!connection->driver){
+		delete connection;
+		return;
+	}
+
+	m_connected = connection->driver->isConnected();
+	m_connections.push_back(connection);
+	m_idle.push_back(connection);
+
+	int32_t size = g_config.getNumber(ConfigManager::DATABASE_CONNECTIONS);
+	if(size <= 0){
+		// one for every database worker and one for the game thread
+		size = std::max<int32_t>(1, g_config.getNumber(ConfigManager::DATABASE_WORKER_THREADS)) + 1;
+	}
+
+	std::string type = g_config.getString(ConfigManager::SQL_TYPE);
+	if(size > 1 && type != "mysql" && type != "pgsql"){
+		// SQLite lets one connection write to the file at a time and the
+		// ODBC driver is not thread safe, more connections would only wait
+		size = 1;
+	}
+	m_size = size;
+	m_stats.size = m_size;
+}
+
+DatabasePool::~DatabasePool()
+{
+	for(std::vector<PooledConnection*>::iterator it = m_connections.begin(); it != m_connections.end(); ++it){
+		delete (*it)->driver;
+		delete *it;
+	}
+}
+
+void DatabasePool::lease()
+{
+	if(m_size == 0){
+		return;
+	}
+
+	Lease* lease = m_lease.get();
+	if(!lease){
+		lease = new Lease();
+		m_lease.reset(lease);
+	}
+
+	if(lease->count++ == 0){
+		lease->connection = acquire();
+	}
+}
+
+void DatabasePool::release()
+{
+	if(m_size == 0){
+		return;
+	}
+
+	Lease* lease = m_lease.get();
+	assert(lease && lease->count > 0);
+	if(--lease->count > 0){
+		return;
+	}
+
+	PooledConnection* connection = lease->connection;
+	lease->connection = NULL;
+	connection->lastUse = OTSYS_TIME();
+
+	boost::mutex::scoped_lock lockClass(m_lock);
+	m_idle.push_back(connection);
+	--m_stats.leased;
+	lockClass.unlock();
+
+	m_signal.notify_one();
+}
+
+DatabasePool::PooledConnection* DatabasePool::acquire()
+{
+	boost::mutex::scoped_lock lockClass(m_lock);
+	++m_stats.leases;
+	if(m_idle.empty() && m_connections.size() + m_opening >= m_size){
+		int64_t start = OTSYS_TIME_US();
+		while(m_idle.empty()){
+			m_signal.wait(lockClass);
+		}
+
+		uint64_t waited = OTSYS_TIME_US() - start;
+		++m_stats.waits;
+		m_stats.waitTime += waited;
+		m_stats.maxWaitTime = std::max(m_stats.maxWaitTime, waited);
+	}
+	++m_stats.leased;
+
+	if(m_idle.empty()){
+		// below the size, open another connection instead of waiting
+		++m_opening;
+		lockClass.unlock();
+
+		PooledConnection* connection = open();
+
+		lockClass.lock();
+		--m_opening;
+		m_connections.push_back(connection);
+		return connection;
+	}
+
+	PooledConnection* connection = m_idle.back();
+	m_idle.pop_back();
+	lockClass.unlock();
+
+	check(connection);
+	return connection;
+}
+
+DatabasePool::PooledConnection* DatabasePool::open()
+{
+	PooledConnection* connection = new PooledConnection();
+	connection->driver = DatabaseDriver::createDriver();
+	connection->lastUse = OTSYS_TIME();
+	return connection;
+}
+
+void DatabasePool::check(PooledConnection* connection)
+{
+	// The server may have dropped a connection that failed or sat idle for
+	// a while, it is tested before it is used again
+	if(connection->driver->isConnected() && OTSYS_TIME() - connection->lastUse < DATABASE_CHECK_INTERVAL){
+		return;
+	}
+
+	bool replaced = false;
+	if(!connection->driver->checkConnection()){
+		std::cout << "[Warning] Lost the connection to the database, reconnecting." << std::endl;
+		delete connection->driver;
+		connection->driver = DatabaseDriver::createDriver();
+		replaced = true;
+		if(!connection->driver->isConnected()){
+			std::cout << "[Error] Unable to reconnect to the database." << std::endl;
+		}
+	}
+
+	boost::mutex::scoped_lock lockClass(m_lock);
+	++m_stats.checks;
+	if(replaced){
+		++m_stats.reconnects;
+	}
+	m_connected = connection->driver->isConnected();
+}
+
+void DatabasePool::getStats(DatabasePoolStats& stats)
+{
+	boost::mutex::scoped_lock lockClass(m_lock);
+	stats = m_stats;
+	stats.connections = (uint32_t)m_connections.size();
+}
+
+bool DatabasePool::getParam(DBParam_t param)
+{
+	ScopedLease connection(this);
+	return connection->getParam(param);
+}
+
+bool DatabasePool::sync()
+{
+	ScopedLease connection(this);
+	return connection->sync();
+}
+
+uint64_t DatabasePool::getLastInsertedRowID()
+{
+	ScopedLease connection(this);
+	return connection->getLastInsertedRowID();
+}
+
+std::string DatabasePool::escapeString(const std::string &s)
+{
+	ScopedLease connection(this);
+	return connection->escapeString(s);
+}
+
+std::string DatabasePool::escapeBlob(const char* s, uint32_t length)
+{
+	ScopedLease connection(this);
+	return connection->escapeBlob(s, length);
+}
+
+DBStatement* DatabasePool::prepareStatement(const std::string &query)
+{
+	ScopedLease connection(this);
+	return connection->prepareStatement(query);
+}
+
+bool DatabasePool::beginTransaction(uint32_t& depth)
+{
+	ScopedLease connection(this);
+	return connection->beginTransaction(depth);
+}
+
+bool DatabasePool::rollback(uint32_t depth)
+{
+	ScopedLease connection(this);
+	return connection->rollback(depth);
+}
+
+bool DatabasePool::commit(uint32_t depth)
+{
+	ScopedLease connection(this);
+	return connection->commit(depth);
+}
+
+bool DatabasePool::internalQuery(const std::string &query)
+{
+	ScopedLease connection(this);
+	return connection->executeQuery(query);
+}
+
+DBResult_ptr DatabasePool::internalSelectQuery(const std::string &query)
+{
+	ScopedLease connection(this);
+	return connection->storeQuery(query);
+}
@@ -0,0 +1,138 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Connections to the database, leased to one thread at a time
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_DATABASE_POOL_H__
+#define __OTSERV_DATABASE_POOL_H__
+
+#include "database_driver.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
+#include <vector>
+
+// Connections that were idle this long are tested before they are leased, ms
+#define DATABASE_CHECK_INTERVAL 60000
+
+struct DatabasePoolStats {
+	DatabasePoolStats() : size(0), connections(0), leased(0), leases(0),
+		waits(0), waitTime(0), maxWaitTime(0), checks(0), reconnects(0) {}
+
+	uint32_t size;
+	uint32_t connections; // open
+	uint32_t leased; // to a thread right now
+	uint64_t leases;
+	uint64_t waits; // leases that found every connection leased
+	uint64_t waitTime; // us
+	uint64_t maxWaitTime; // us
+	uint64_t checks;
+	uint64_t reconnects; // connections replaced after a failed check
+};
+
+/**
+ * Pool of database connections.
+ *
+ * DatabaseDriver::instance() returns the pool, every call on it runs on the
+ * connection leased to the calling thread. A thread leases a connection with
+ * its first DBQuery or DBTransaction and gives it back when the last of them
+ * is gone, so the queries, statements, results and transactions of one scope
+ * stay on one connection. Calls made without a DBQuery lease a connection
+ * for the call only.
+*/
+class DatabasePool : public DatabaseDriver
+{
+public:
+	// NULL until DatabaseDriver::instance() was called
+	static DatabasePool* instance();
+	virtual ~DatabasePool();
+
+	/**
+	* Leases a connection to the calling thread, or counts one more use of
+	* the connection it holds. Blocks while the other threads hold all of
+	* them.
+	*/
+	void lease();
+	// Gives the connection back once every lease() of the thread was released
+	void release();
+
+	uint32_t getSize() const {return m_size;}
+	void getStats(DatabasePoolStats& stats);
+
+	virtual bool getParam(DBParam_t param);
+	virtual bool sync();
+	virtual uint64_t getLastInsertedRowID();
+	virtual std::string escapeString(const std::string &s);
+	virtual std::string escapeBlob(const char* s, uint32_t length);
+	virtual DBStatement* prepareStatement(const std::string &query);
+
+protected:
+	friend class DatabaseDriver;
+	DatabasePool();
+
+	virtual bool beginTransaction(uint32_t& depth);
+	virtual bool rollback(uint32_t depth);
+	virtual bool commit(uint32_t depth);
+
+	virtual bool internalQuery(const std::string &query);
+	virtual DBResult_ptr internalSelectQuery(const std::string &query);
+
+	struct PooledConnection {
+		DatabaseDriver* driver;
+		int64_t lastUse; // ms
+	};
+
+	struct Lease {
+		Lease() : connection(NULL), count(0) {}
+
+		PooledConnection* connection;
+		uint32_t count;
+	};
+
+	// Leases a connection for one call made outside of a DBQuery
+	class ScopedLease {
+	public:
+		ScopedLease(DatabasePool* pool) : m_pool(pool) {m_pool->lease();}
+		~ScopedLease() {m_pool->release();}
+
+		DatabaseDriver* operator->() const {return m_pool->m_lease->connection->driver;}
+
+	private:
+		DatabasePool* m_pool;
+	};
+
+	PooledConnection* acquire();
+	PooledConnection* open();
+	void check(PooledConnection* connection);
+
+	uint32_t m_size;
+	boost::thread_specific_ptr<Lease> m_lease;
+
+	boost::mutex m_lock;
+	boost::condition_variable m_signal;
+	std::vector<PooledConnection*> m_connections;
+	// the connection released last is leased first
+	std::vector<PooledConnection*> m_idle;
+	uint32_t m_opening;
+
+	DatabasePoolStats m_stats;
+
+	static DatabasePool* _instance;
+};
+
+#endif
@@ -42,6 +42,9 @@
 #include "script_manager.h"
 #include "script_event.h"
 #include "configmanager.h"
+#include "database_executor.h"
+#include "iomapserialize.h"
+#include "player_journal.h"
 
 #if defined __EXCEPTION_TRACER__
 #include "exception.h"
@@ -100,6 +103,11 @@ void Game::start(ServiceManager* servicer)
 
 	waitingScriptEvent = g_scheduler.addEvent(createSchedulerTask(EVENT_SCRIPT_CLEANUP_INTERVAL,
 		boost::bind(&Game::scriptCleanup, this)));
+
+	if(PlayerJournal::getInstance()->isEnabled() && g_config.getNumber(ConfigManager::PLAYER_JOURNAL_INTERVAL) > 0){
+		g_scheduler.addEvent(createSchedulerTask(g_config.getNumber(ConfigManager::PLAYER_JOURNAL_INTERVAL),
+			boost::bind(&Game::journalPlayers, this)));
+	}
 }
 
 Game::~Game()
@@ -152,8 +160,9 @@ void Game::setGameState(GameState newState)
 
 				runShutdownScripts(true);
 
-				if (!saveGameState())
-					std::cout << "Could not save global game state." << std::endl;
+				// the players are gone, this writes the global storage
+				// after their logout saves
+				saveServer(SERVER_SAVE_SHALLOW);
 
 				g_dispatcher.addTask(createTask(
 					boost::bind(&Game::shutdown, this)));
@@ -178,42 +187,225 @@ void Game::setGameState(GameState newState)
 	}
 }
 
+// Built by saveServer on the dispatcher, the database thread only reads it
+struct Game::ServerSaveData{
+	ServerSaveData(ServerSaveType _type) : type(_type), captureTime(0), writeTime(0),
+		journalSequence(0), journalFile(0), saved(false), synced(false) {}
+
+	struct PlayerSave{
+		PlayerSaveData_ptr data;
+		// what the database holds before and after data is written
+		PlayerSaveData_ptr saved;
+		PlayerSaveData_ptr state;
+	};
+
+	ServerSaveType type;
+	int64_t captureTime; // us, the time the dispatcher spent
+	int64_t writeTime; // us
+	StorageMap globalStorage;
+	std::vector<PlayerSave> players;
+	// NULL for shallow saves
+	MapSaveData_ptr map;
+	// the last record of the players in the journal, and the journal file
+	// the records before the save went to
+	uint64_t journalSequence;
+	uint32_t journalFile;
+	bool saved;
+	// the save is on disk, the journal files before it can go
+	bool synced;
+};
+
 bool Game::saveServer(ServerSaveType saveType)
 {
-	std::string old_type = g_config.getString(ConfigManager::MAP_STORAGE_TYPE);
-	if (saveType == SERVER_SAVE_RELATIONAL){
-		g_config.setString(ConfigManager::MAP_STORAGE_TYPE, "relational");
-	}
-
+	// The game only waits while everything is copied, the database thread
+	// writes the copy. It is an exclusive job, so the logout saves and the
+	// logins queued from now on see what it wrote. Once a full save is
+	// written, the player journal no longer needs the records from before it.
+	int64_t start = OTSYS_TIME_US();
 
-	uint64_t start = OTSYS_TIME();
-
-	if (!saveGameState())
-		std::cout << "Could not save global game state." << std::endl;
+	ServerSaveData_ptr save(new ServerSaveData(saveType));
+	save->globalStorage = globalStorage;
 
 	for(AutoList<Player>::listiterator it = Player::listPlayer.list.begin();
 		it != Player::listPlayer.list.end();
 		++it)
 	{
-		it->second->loginPosition = it->second->getPosition();
-		IOPlayer::instance()->savePlayer(it->second, saveType == SERVER_SAVE_SHALLOW);
+		Player* player = it->second;
+		player->loginPosition = player->getPosition();
+
+		ServerSaveData::PlayerSave playerSave;
+		playerSave.data.reset(new PlayerSaveData());
+		if(!IOPlayer::instance()->prepareSave(player, *playerSave.data, saveType == SERVER_SAVE_SHALLOW)){
+			std::cout << "Error while saving player: " << player->getName() << std::endl;
+			// the journal files with the records of the player are deleted
+			// after the save, the next record holds everything
+			player->journalState.reset();
+			continue;
+		}
+
+		save->journalSequence = IOPlayer::instance()->journalPlayer(player, playerSave.data);
+
+		// the saves queued after this one compare with what it writes
+		playerSave.saved = player->savedState;
+		playerSave.state = IOPlayer::getSavedState(playerSave.data, playerSave.saved);
+		player->savedState = playerSave.state;
+		save->players.push_back(playerSave);
 	}
+	save->journalFile = PlayerJournal::getInstance()->rotate();
 
-	if(saveType == SERVER_SAVE_SHALLOW)
-		return true;
+	if(saveType != SERVER_SAVE_SHALLOW){
+		if(saveType == SERVER_SAVE_FULL){
+			Houses::getInstance()->payHouses();
+		}
+
+		std::string old_type = g_config.getString(ConfigManager::MAP_STORAGE_TYPE);
+		if(saveType == SERVER_SAVE_RELATIONAL){
+			g_config.setString(ConfigManager::MAP_STORAGE_TYPE, "relational");
+		}
+
+		save->map.reset(new MapSaveData());
+		bool prepared = IOMapSerialize::getInstance()->prepareSave(map, *save->map);
+		g_config.setString(ConfigManager::MAP_STORAGE_TYPE, old_type);
+
+		if(!prepared){
+			std::cout << "[Error] Could not save the houses." << std::endl;
+			save->map.reset();
+		}
+	}
+
+	save->captureTime = OTSYS_TIME_US() - start;
+	g_databaseExecutor.addExclusiveJob(boost::bind(&Game::writeServerSave, this, save),
+		boost::bind(&Game::onServerSaveWritten, this, save));
+	return true;
+}
+
+void Game::writeServerSave(ServerSaveData_ptr save)
+{
+	//database thread
+	int64_t start = OTSYS_TIME_US();
+	PlayerJournal::getInstance()->waitFlushed(save->journalSequence);
+	for(uint32_t tries = 0; tries < 3 && !save->saved; ++tries){
+		save->saved = writeServerSaveRows(*save);
+	}
+	if(save->saved && save->type != SERVER_SAVE_SHALLOW){
+		save->synced = DatabaseDriver::instance()->sync();
+	}
+	save->writeTime = OTSYS_TIME_US() - start;
+
+	if(!save->saved){
+		PlayerJournal::getInstance()->setUnwritten();
+		// the database holds what it held before, the saves queued after
+		// this one write everything
+		for(std::vector<ServerSaveData::PlayerSave>::iterator it = save->players.begin(); it != save->players.end(); ++it){
+			if(it->state){
+				it->state->unwritten = true;
+			}
+		}
+	}
+}
+
+bool Game::writeServerSaveRows(const ServerSaveData& save)
+{
+	//database thread
+	DatabaseDriver* db = DatabaseDriver::instance();
+	DBTransaction transaction(db);
+	if(!transaction.begin())
+		return false;
+
+	if(!writeGameState(save.globalStorage)){
+		std::cout << "Could not save global game state." << std::endl;
+		return false;
+	}
 
-	if(saveType == SERVER_SAVE_FULL){
-		Houses::getInstance()->payHouses();
+	for(std::vector<ServerSaveData::PlayerSave>::const_iterator it = save.players.begin(); it != save.players.end(); ++it){
+		const PlayerSaveData* saved = it->saved.get();
+		if(saved && saved->unwritten){
+			saved = NULL;
+		}
+
+		if(!IOPlayer::instance()->writePlayer(*it->data, saved, false)){
+			std::cout << "Error while saving player: " << it->data->name << std::endl;
+			return false;
+		}
+	}
+
+	if(save.map && !IOMapSerialize::getInstance()->writeMap(*save.map)){
+		std::cout << "Could not save the houses." << std::endl;
+		return false;
+	}
+
+	return transaction.commit();
+}
+
+void Game::onServerSaveWritten(ServerSaveData_ptr save)
+{
+	if(!save->saved){
+		for(std::vector<ServerSaveData::PlayerSave>::iterator it = save->players.begin(); it != save->players.end(); ++it){
+			if(it->state){
+				it->state->failed = true;
+			}
+		}
+
+		if(save->map){
+			IOMapSerialize::getInstance()->onSaveFailed(*save->map);
+		}
+
+		std::cout << "[Error] Server save failed, retrying in " << SERVER_SAVE_RETRY_INTERVAL / 1000 << "s." << std::endl;
+		g_scheduler.addEvent(createSchedulerTask(SERVER_SAVE_RETRY_INTERVAL,
+			boost::bind(&Game::saveServer, this, save->type)));
+		return;
 	}
 
-	bool ret = map->saveMap();
+	// a shallow save leaves out the storage, vips and items, the journal
+	// files keep them until a save writes them
+	if(save->synced){
+		PlayerJournal::getInstance()->checkpoint(save->journalFile);
+
+		// the next records compare with what this save wrote
+		std::map<uint32_t, PlayerSaveData_ptr> states;
+		for(std::vector<ServerSaveData::PlayerSave>::const_iterator it = save->players.begin(); it != save->players.end(); ++it){
+			if(it->state){
+				states[it->data->guid] = it->state;
+			}
+		}
+
+		for(AutoList<Player>::listiterator it = Player::listPlayer.list.begin();
+			it != Player::listPlayer.list.end();
+			++it)
+		{
+			std::map<uint32_t, PlayerSaveData_ptr>::const_iterator state = states.find(it->second->getGUID());
+			if(state != states.end()){
+				it->second->journalBase = state->second;
+			}
+		}
+	}
 
 	std::cout << "Notice: Server saved. Process took " <<
-		(OTSYS_TIME() - start)/(1000.) << "s." << std::endl;
+		save->writeTime / 1000000. << "s, the game waited " <<
+		save->captureTime / 1000. << "ms." << std::endl;
+}
+
+void Game::journalPlayers()
+{
+	// Only what changed since the last record of a player is written, the
+	// server saves in between count as records
+	for(AutoList<Player>::listiterator it = Player::listPlayer.list.begin();
+		it != Player::listPlayer.list.end();
+		++it)
+	{
+		Player* player = it->second;
+		player->loginPosition = player->getPosition();
 
-	g_config.setString(ConfigManager::MAP_STORAGE_TYPE, old_type);
+		PlayerSaveData_ptr data(new PlayerSaveData());
+		if(!IOPlayer::instance()->prepareSave(player, *data)){
+			player->journalState.reset();
+			continue;
+		}
+		IOPlayer::instance()->journalPlayer(player, data);
+	}
 
-	return ret;
+	g_scheduler.addEvent(createSchedulerTask(g_config.getNumber(ConfigManager::PLAYER_JOURNAL_INTERVAL),
+		boost::bind(&Game::journalPlayers, this)));
 }
 
 void Game::loadGameState()
@@ -230,30 +422,25 @@ void Game::loadGameState()
 	}
 }
 
-bool Game::saveGameState()
+bool Game::writeGameState(const StorageMap& storage)
 {
+	//database thread, the caller holds the transaction
 	DatabaseDriver* db = DatabaseDriver::instance();
-
-	DBQuery q;
-	DBTransaction transaction(db);
-	transaction.begin();
 	DBQuery query;
 
-	db->executeQuery("DELETE FROM `global_storage`");
+	if(!db->executeQuery("DELETE FROM `global_storage`"))
+		return false;
 
 	DBInsert global_stmt(db);
 	global_stmt.setQuery("INSERT INTO `global_storage` (`id`, `value`) VALUES ");
 
-	for(StorageMap::const_iterator giter = globalStorage.begin(); giter != globalStorage.end(); ++giter){
+	for(StorageMap::const_iterator giter = storage.begin(); giter != storage.end(); ++giter){
 		query << db->escapeString(giter->first) << ", " << db->escapeString(giter->second);
 		if(!global_stmt.addRowAndReset(query)){
 			return false;
 		}
 	}
-	if(!global_stmt.execute())
-		return false;
-
-	return transaction.commit();
+	return global_stmt.execute();
 }
 
 int Game::loadMap(std::string filename)
@@ -3313,6 +3500,8 @@ bool Game::playerWriteItem(uint32_t playerId, uint32_t windowTextId, const std::
 		writeItem->clearWrittenDate();
 	}
 
+	writeItem->onAttributesChanged();
+
 	uint16_t newId = Item::items[writeItem->getID()].writeOnceItemId;
 	if(newId != 0){
 		transformItem(player, writeItem, newId);
@@ -4055,22 +4244,37 @@ bool Game::playerRequestAddVip(uint32_t playerId, const std::string& vip_name)
 	if(!player || player->isRemoved())
 		return false;
 
-	std::string real_name;
-	real_name = vip_name;
-	uint32_t guid;
-	bool specialVip;
+	// Looked up on the database thread
+	VipLookup_ptr lookup(new VipLookup());
+	lookup->name = vip_name;
+	g_databaseExecutor.addJob(boost::bind(&Game::fetchVip, this, lookup),
+		boost::bind(&Game::onVipFetched, this, playerId, lookup));
+	return true;
+}
+
+void Game::fetchVip(VipLookup_ptr lookup)
+{
+	//database thread
+	lookup->found = IOPlayer::instance()->getGuidByNameEx(lookup->guid, lookup->specialVip, lookup->name);
+}
+
+void Game::onVipFetched(uint32_t playerId, VipLookup_ptr lookup)
+{
+	Player* player = getPlayerByID(playerId);
+	if(!player || player->isRemoved())
+		return;
 
-	if(!IOPlayer::instance()->getGuidByNameEx(guid, specialVip, real_name)){
+	if(!lookup->found){
 		player->sendTextMessage(MSG_STATUS_SMALL, "A player with that name does not exist.");
-		return false;
+		return;
 	}
-	if(specialVip && !player->hasFlag(PlayerFlag_SpecialVIP)){
+	if(lookup->specialVip && !player->hasFlag(PlayerFlag_SpecialVIP)){
 		player->sendTextMessage(MSG_STATUS_SMALL, "You can not add this player.");
-		return false;
+		return;
 	}
 
-	bool online = (getPlayerByName(real_name) != NULL);
-	return player->addVIP(guid, real_name, online);
+	bool online = (getPlayerByName(lookup->name) != NULL);
+	player->addVIP(lookup->guid, lookup->name, online);
 }
 
 bool Game::playerRequestRemoveVip(uint32_t playerId, uint32_t guid)
@@ -5200,52 +5404,91 @@ void Game::showUseHotkeyMessage(Player* player, Item* item)
 	player->sendTextMessage(MSG_INFO_DESCR, ss.str());
 }
 
-bool Game::playerViolationWindow(uint32_t playerId, std::string targetName, uint8_t reasonId, ViolationAction actionType,
+void Game::playerViolationWindow(uint32_t playerId, std::string targetName, uint8_t reasonId, ViolationAction actionType,
 		std::string comment, std::string statement, uint16_t channelId, bool ipBanishment)
 {
 	Player* player = getPlayerByID(playerId);
 	if(!player || player->isRemoved())
-		return false;
+		return;
 
 	uint32_t access = player->getViolationLevel();
 	if((ipBanishment && ((violationNames[access] & Action_IpBan) != Action_IpBan || (violationStatements[access] & Action_IpBan) != Action_IpBan)) ||
 		!(violationNames[access] & (1 << actionType) || violationStatements[access] & (1 << actionType)) || reasonId > violationReasons[access])
 	{
 		player->sendCancel("You do not have authorization for this action.");
-		return false;
+		return;
 	}
 
 	if(comment.size() > 1000){
 		std::stringstream ss;
 		ss << "The comment may not exceed 1000 characters.";
 		player->sendCancel(ss.str());
-		return false;
-	}
-
-	toLowerCaseString(targetName);
-	uint32_t guid = 0;
-	if(!IOPlayer::instance()->getGuidByName(guid, targetName)){
-		player->sendCancel("A player with this name does not exist.");
-		return false;
+		return;
 	}
 
-	uint32_t ip = 0;
-	std::string acc;
+	ViolationData_ptr violation(new ViolationData());
+	violation->playerId = playerId;
+	violation->adminGuid = player->getGUID();
+	violation->adminName = player->getName();
+	violation->targetName = targetName;
+	violation->reasonId = reasonId;
+	violation->actionType = actionType;
+	violation->comment = comment;
+	violation->statement = statement;
+	violation->ipBanishment = ipBanishment;
+	toLowerCaseString(violation->targetName);
 
-	Player* targetPlayer = getPlayerByName(targetName);
+	Player* targetPlayer = getPlayerByName(violation->targetName);
 	if(targetPlayer){
 		if(targetPlayer->hasFlag(PlayerFlag_CannotBeBanned)){
 			player->sendCancel("You do not have authorization for this action.");
-			return false;
+			return;
 		}
 
-		acc = targetPlayer->getAccountName();
-		ip = targetPlayer->getIP();
+		violation->targetOnline = true;
+		violation->account = targetPlayer->getAccountName();
+		violation->ip = targetPlayer->getIP();
 	}
-	else{
+
+	if(actionType == ACTION_STATEMENT){
+		ChannelStatementMap::iterator it = Player::channelStatementMap.find(channelId);
+		if(it == Player::channelStatementMap.end()){
+			player->sendCancel("Statement has already been reported.");
+			return;
+		}
+
+		violation->statement = it->second;
+		violation->statementId = it->first;
+	}
+
+	// The lookups and ban writes run on the database thread
+	g_databaseExecutor.addJob(boost::bind(&Game::writeViolation, this, violation),
+		boost::bind(&Game::onViolationWritten, this, violation));
+}
+
+void Game::writeViolation(ViolationData_ptr violation)
+{
+	//database thread
+	uint32_t guid = 0;
+	if(!IOPlayer::instance()->getGuidByName(guid, violation->targetName)){
+		violation->error = "A player with this name does not exist.";
+		return;
+	}
+
+	std::string& targetName = violation->targetName;
+	std::string& comment = violation->comment;
+	std::string& statement = violation->statement;
+	ViolationAction& actionType = violation->actionType;
+	uint8_t reasonId = violation->reasonId;
+	bool ipBanishment = violation->ipBanishment;
+	uint32_t adminGuid = violation->adminGuid;
+	uint32_t ip = violation->ip;
+	std::string acc = violation->account;
+
+	if(!violation->targetOnline){
 		if(IOPlayer::instance()->hasFlag(PlayerFlag_CannotBeBanned, guid)){
-			player->sendCancel("You do not have authorization for this action.");
-			return false;
+			violation->error = "You do not have authorization for this action.";
+			return;
 		}
 
 		IOPlayer::instance()->getAccountByName(acc, targetName);
@@ -5257,21 +5500,21 @@ bool Game::playerViolationWindow(uint32_t playerId, std::string targetName, uint
 
 	if(actionType == ACTION_NOTATION)
 	{
-		g_bans.addAccountNotation(account.number, player->getGUID(), comment, statement, reasonId, actionType);
+		g_bans.addAccountNotation(account.number, adminGuid, comment, statement, reasonId, actionType);
 		if(g_bans.getNotationsCount(account.number) >= (uint32_t)g_config.getNumber(ConfigManager::NOTATIONS_TO_BAN)){
 			account.warnings++;
 			if(account.warnings >= (uint32_t)g_config.getNumber(ConfigManager::WARNINGS_TO_DELETION)){
 				actionType = ACTION_DELETION;
-				g_bans.addAccountBan(account.number, -1, player->getGUID(), comment, statement, reasonId, actionType);
+				g_bans.addAccountBan(account.number, -1, adminGuid, comment, statement, reasonId, actionType);
 			}
 			else if(account.warnings >= (uint32_t)g_config.getNumber(ConfigManager::WARNINGS_TO_FINALBAN)){
 				if(!g_bans.addAccountBan(account.number, (time(NULL) + g_config.getNumber(
-					ConfigManager::FINALBAN_LENGTH)), player->getGUID(), comment, statement, reasonId, actionType))
+					ConfigManager::FINALBAN_LENGTH)), adminGuid, comment, statement, reasonId, actionType))
 					account.warnings--;
 			}
 			else{
 				if(!g_bans.addAccountBan(account.number, (time(NULL) + g_config.getNumber(
-					ConfigManager::BAN_LENGTH)), player->getGUID(), comment, statement, reasonId, actionType))
+					ConfigManager::BAN_LENGTH)), adminGuid, comment, statement, reasonId, actionType))
 					account.warnings--;
 			}
 		}
@@ -5281,7 +5524,7 @@ bool Game::playerViolationWindow(uint32_t playerId, std::string targetName, uint
 
 	else if(actionType == ACTION_NAMEREPORT)
 	{
-		g_bans.addPlayerBan(guid, -1, player->getGUID(), comment, statement, reasonId, actionType);
+		g_bans.addPlayerBan(guid, -1, adminGuid, comment, statement, reasonId, actionType);
 		removeNotations = 1;
 	}
 
@@ -5289,23 +5532,23 @@ bool Game::playerViolationWindow(uint32_t playerId, std::string targetName, uint
 	{
 		if(account.warnings >= (uint32_t)g_config.getNumber(ConfigManager::WARNINGS_TO_DELETION)){
 			actionType = ACTION_DELETION;
-			g_bans.addAccountBan(account.number, -1, player->getGUID(), comment, statement, reasonId, actionType);
+			g_bans.addAccountBan(account.number, -1, adminGuid, comment, statement, reasonId, actionType);
 		}
 		else
 		{
 			account.warnings++;
 			if(account.warnings >= (uint32_t)g_config.getNumber(ConfigManager::WARNINGS_TO_FINALBAN)){
 				if(!g_bans.addAccountBan(account.number, (time(NULL) + g_config.getNumber(
-					ConfigManager::FINALBAN_LENGTH)), player->getGUID(), comment, statement, reasonId, actionType))
+					ConfigManager::FINALBAN_LENGTH)), adminGuid, comment, statement, reasonId, actionType))
 					account.warnings--;
 			}
 			else{
 				if(!g_bans.addAccountBan(account.number, (time(NULL) + g_config.getNumber(
-					ConfigManager::BAN_LENGTH)), player->getGUID(), comment, statement, reasonId, actionType))
+					ConfigManager::BAN_LENGTH)), adminGuid, comment, statement, reasonId, actionType))
 					account.warnings--;
 			}
 
-			g_bans.addPlayerBan(guid, -1, player->getGUID(), comment, statement, reasonId, actionType);
+			g_bans.addPlayerBan(guid, -1, adminGuid, comment, statement, reasonId, actionType);
 		}
 	}
 
@@ -5313,11 +5556,11 @@ bool Game::playerViolationWindow(uint32_t playerId, std::string targetName, uint
 	{
 		if(account.warnings++ >= (uint32_t)g_config.getNumber(ConfigManager::WARNINGS_TO_DELETION)){
 			actionType = ACTION_DELETION;
-			if(!g_bans.addAccountBan(account.number, -1, player->getGUID(), comment, statement, reasonId, actionType))
+			if(!g_bans.addAccountBan(account.number, -1, adminGuid, comment, statement, reasonId, actionType))
 				account.warnings--;
 		}
 		else if(g_bans.addAccountBan(account.number, (time(NULL) + g_config.getNumber(
-				ConfigManager::FINALBAN_LENGTH)), player->getGUID(), comment, statement, reasonId, actionType))
+				ConfigManager::FINALBAN_LENGTH)), adminGuid, comment, statement, reasonId, actionType))
 		{
 			account.warnings = g_config.getNumber(ConfigManager::WARNINGS_TO_DELETION) - 1;
 		}
@@ -5327,31 +5570,21 @@ bool Game::playerViolationWindow(uint32_t playerId, std::string targetName, uint
 	{
 		if(account.warnings++ >= (uint32_t)g_config.getNumber(ConfigManager::WARNINGS_TO_DELETION)){
 			actionType = ACTION_DELETION;
-			if(!g_bans.addAccountBan(account.number, -1, player->getGUID(), comment, statement, reasonId, actionType))
+			if(!g_bans.addAccountBan(account.number, -1, adminGuid, comment, statement, reasonId, actionType))
 				account.warnings--;
 		}
 		else{
 			if(g_bans.addAccountBan(account.number, (time(NULL) + g_config.getNumber(
-				ConfigManager::FINALBAN_LENGTH)), player->getGUID(), comment, statement, reasonId, actionType))
+				ConfigManager::FINALBAN_LENGTH)), adminGuid, comment, statement, reasonId, actionType))
 				account.warnings = g_config.getNumber(ConfigManager::WARNINGS_TO_DELETION);
 
-			g_bans.addPlayerBan(guid, -1, player->getGUID(), comment, statement, reasonId, actionType);
+			g_bans.addPlayerBan(guid, -1, adminGuid, comment, statement, reasonId, actionType);
 		}
 	}
 
 	else if(actionType == ACTION_STATEMENT)
 	{
-		ChannelStatementMap::iterator it = Player::channelStatementMap.find(channelId);
-		if(it != Player::channelStatementMap.end()){
-			statement = it->second;
-			g_bans.addPlayerStatement(guid, player->getGUID(), comment, statement, reasonId, actionType);
-			Player::channelStatementMap.erase(it);
-		}
-		else{
-			player->sendCancel("Statement has already been reported.");
-			return false;
-		}
-
+		g_bans.addPlayerStatement(guid, adminGuid, comment, statement, reasonId, actionType);
 		removeNotations = 0;
 	}
 
@@ -5360,61 +5593,85 @@ bool Game::playerViolationWindow(uint32_t playerId, std::string targetName, uint
 		account.warnings++;
 		if(account.warnings >= (uint32_t)g_config.getNumber(ConfigManager::WARNINGS_TO_DELETION)){
 			actionType = ACTION_DELETION;
-			g_bans.addAccountBan(account.number, -1, player->getGUID(), comment, statement, reasonId, actionType);
+			g_bans.addAccountBan(account.number, -1, adminGuid, comment, statement, reasonId, actionType);
 		}
 		else if(account.warnings >= (uint32_t)g_config.getNumber(ConfigManager::WARNINGS_TO_FINALBAN)){
 			if(!g_bans.addAccountBan(account.number, (time(NULL) + g_config.getNumber(
-				ConfigManager::FINALBAN_LENGTH)), player->getGUID(), comment, statement, reasonId, actionType))
+				ConfigManager::FINALBAN_LENGTH)), adminGuid, comment, statement, reasonId, actionType))
 				account.warnings--;
 		}
 		else if(!g_bans.addAccountBan(account.number, (time(NULL) + g_config.getNumber(
-			ConfigManager::BAN_LENGTH)), player->getGUID(), comment, statement, reasonId, actionType))
+			ConfigManager::BAN_LENGTH)), adminGuid, comment, statement, reasonId, actionType))
 			account.warnings--;
 	}
 
 	if(ipBanishment && ip > 0)
 		g_bans.addIpBan(ip, 0xFFFFFFFF, (time(NULL) + g_config.getNumber(ConfigManager::IPBANISHMENT_LENGTH)),
-			player->getGUID(), comment);
+			adminGuid, comment);
 
 	if(removeNotations > 1)
 		g_bans.removeNotations(account.number);
 
+	violation->removeNotations = removeNotations;
+	violation->warnings = account.warnings;
+	IOAccount::instance()->saveAccount(account);
+}
+
+void Game::onViolationWritten(ViolationData_ptr violation)
+{
+	Player* player = getPlayerByID(violation->playerId);
+	if(!violation->error.empty()){
+		if(player){
+			player->sendCancel(violation->error);
+		}
+		return;
+	}
+
+	const std::string& targetName = violation->targetName;
+	ViolationAction actionType = violation->actionType;
+	bool ipBanishment = violation->ipBanishment;
+
+	if(actionType == ACTION_STATEMENT){
+		Player::channelStatementMap.erase(violation->statementId);
+	}
+
 	bool announceViolation = g_config.getNumber(ConfigManager::BROADCAST_BANISHMENTS) != 0;
 	std::ostringstream ss;
 	if(actionType == ACTION_STATEMENT){
 		if(announceViolation){
-			ss << player->getName() << " has taken the action";
+			ss << violation->adminName << " has taken the action";
 		}
 		else{
 			ss << "You have taken the action";
 		}
 
 		ss << "  \"" << getViolationActionString(actionType, ipBanishment) << "\" " <<
-			"for the statement: \"" << statement << "\" against: " << targetName << " " <<
-			"(Warnings: " << account.warnings << "), with reason: \"" << getViolationReasonString(reasonId) <<
-			"\", and comment: \"" << comment << "\".";
+			"for the statement: \"" << violation->statement << "\" against: " << targetName << " " <<
+			"(Warnings: " << violation->warnings << "), with reason: \"" << getViolationReasonString(violation->reasonId) <<
+			"\", and comment: \"" << violation->comment << "\".";
 	}
 	else{
 		if(announceViolation){
-			ss << player->getName() << " has taken the action";
+			ss << violation->adminName << " has taken the action";
 		}
 		else{
 			ss << "You have taken the action";
 		}
 
 		ss << " \"" << getViolationActionString(actionType, ipBanishment) << "\" against: " << targetName <<
-			" (Warnings: " << account.warnings << "), with reason: \"" << getViolationReasonString(reasonId) <<
-			"\", and comment: \"" << comment << "\".";
+			" (Warnings: " << violation->warnings << "), with reason: \"" << getViolationReasonString(violation->reasonId) <<
+			"\", and comment: \"" << violation->comment << "\".";
 	}
 
 	if(announceViolation){
 		anonymousBroadcastMessage(MSG_STATUS_WARNING, ss.str());
 	}
-	else{
+	else if(player){
 		player->sendTextMessage(MSG_STATUS_CONSOLE_RED, ss.str());
 	}
 
-	if(targetPlayer && removeNotations > 0){
+	Player* targetPlayer = getPlayerByName(targetName);
+	if(targetPlayer && violation->removeNotations > 0){
 		targetPlayer->sendTextMessage(MSG_INFO_DESCR, "You have been banished.");
 		addMagicEffect(targetPlayer->getPosition(), MAGIC_EFFECT_GREEN_SHIMMER);
 
@@ -5422,9 +5679,6 @@ bool Game::playerViolationWindow(uint32_t playerId, std::string targetName, uint
 		g_scheduler.addEvent(createSchedulerTask(1000, boost::bind(
 			&Game::kickPlayer, this, targetId)));
 	}
-
-	IOAccount::instance()->saveAccount(account);
-	return true;
 }
 
 bool Game::playerReportViolation(uint32_t playerId, std::string violatorName, uint32_t reportType, uint32_t ruleViolation,
@@ -57,6 +57,7 @@ namespace Script {
 #define EVENT_DECAY_BUCKETS  16
 #define EVENT_SCRIPT_CLEANUP_INTERVAL  90000
 #define EVENT_SCRIPT_TIMER_INTERVAL 20
+#define SERVER_SAVE_RETRY_INTERVAL 60000
 
 #define EVENT_CREATURECOUNT 10
 #define EVENT_CREATURE_THINK_INTERVAL 1000
@@ -490,7 +491,10 @@ public:
 	bool playerEnableSharedPartyExperience(uint32_t playerId, uint8_t sharedExpActive, uint8_t unknown);
 	bool playerShowQuestLog(uint32_t playerId);
 	bool playerShowQuestLine(uint32_t playerId, uint16_t questId);
-	bool playerViolationWindow(uint32_t playerId, std::string targetName, uint8_t reasonId, ViolationAction actionType,
+	// Only checks the rights of the player here, the lookups and ban writes
+	// run on the database thread. Every outcome is sent to the player, a
+	// refusal right away and the rest by onViolationWritten.
+	void playerViolationWindow(uint32_t playerId, std::string targetName, uint8_t reasonId, ViolationAction actionType,
 		std::string comment, std::string statement, uint16_t channelId, bool ipBanishment);
 	bool playerReportBug(uint32_t playerId, std::string comment);
 	bool playerReportViolation(uint32_t playerId, std::string violatorName, uint32_t reportType, uint32_t ruleViolation,
@@ -559,8 +563,12 @@ public:
 
 	GameState getGameState();
 	void setGameState(GameState newState);
+	/** Captures the players, houses and global storage and writes them on
+	  * the database thread, after every write queued before
+	  * \return true, a save that fails to write is reported and retried
+	  * once the database thread is done with it
+	  */
 	bool saveServer(ServerSaveType saveType);
-	bool saveGameState();
 	void loadGameState();
 	void refreshMap(Map::TileMap::iterator* begin = NULL, int clean_max = 0);
 	void proceduralRefresh(Map::TileMap::iterator* begin = NULL);
@@ -624,6 +632,61 @@ public:
 
 protected:
 
+	struct VipLookup{
+		VipLookup() : guid(0), specialVip(false), found(false) {}
+
+		std::string name;
+		uint32_t guid;
+		bool specialVip;
+		bool found;
+	};
+	typedef boost::shared_ptr<VipLookup> VipLookup_ptr;
+
+	void fetchVip(VipLookup_ptr lookup);
+	void onVipFetched(uint32_t playerId, VipLookup_ptr lookup);
+
+	// A violation window action, the checks that need the database and the
+	// ban writes run on the database thread
+	struct ViolationData{
+		ViolationData() : playerId(0), adminGuid(0), reasonId(0), actionType(ACTION_NOTATION),
+			statementId(0), ipBanishment(false), targetOnline(false), ip(0), removeNotations(0), warnings(0) {}
+
+		uint32_t playerId;
+		uint32_t adminGuid;
+		std::string adminName;
+		std::string targetName;
+		uint8_t reasonId;
+		ViolationAction actionType;
+		std::string comment;
+		std::string statement;
+		// the entry of Player::channelStatementMap, removed once written
+		uint32_t statementId;
+		bool ipBanishment;
+		bool targetOnline;
+		std::string account;
+		uint32_t ip;
+
+		// filled in by writeViolation
+		std::string error;
+		int16_t removeNotations;
+		uint32_t warnings;
+	};
+	typedef boost::shared_ptr<ViolationData> ViolationData_ptr;
+
+	void writeViolation(ViolationData_ptr violation);
+	void onViolationWritten(ViolationData_ptr violation);
+
+	// A server save, see saveServer
+	struct ServerSaveData;
+	typedef boost::shared_ptr<ServerSaveData> ServerSaveData_ptr;
+
+	void writeServerSave(ServerSaveData_ptr save);
+	bool writeServerSaveRows(const ServerSaveData& save);
+	void onServerSaveWritten(ServerSaveData_ptr save);
+	bool writeGameState(const StorageMap& storage);
+	// Adds what changed of every player to the player journal
+	void journalPlayers();
+
 	bool playerWhisper(Player* player, const std::string& text);
 	bool playerYell(Player* player, const std::string& text);
 	bool playerSpeakTo(Player* player, SpeakClass type, const std::string& receiver, const std::string& text);
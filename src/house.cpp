@@ -51,6 +51,7 @@ House::House(uint32_t _houseid)
 	syncFlags = HOUSE_SYNC_TOWNID | HOUSE_SYNC_NAME | HOUSE_SYNC_RENT | HOUSE_SYNC_GUILDHALL;
 	guildHall = false;
 	pendingDepotTransfer = false;
+	dirty = false;
 }
 
 House::~House()
@@ -250,7 +251,7 @@ bool House::transferToDepot()
 	}
 
 	if(player && player->isOffline()){
-		IOPlayer::instance()->savePlayer(player);
+		IOPlayer::instance()->savePlayerAsync(player);
 		delete player;
 	}
 
@@ -974,7 +975,7 @@ bool Houses::payHouse(House* house, time_t time)
 
 	if(player->isOffline()){
 		if(savePlayerHere){
-			IOPlayer::instance()->savePlayer(player);
+			IOPlayer::instance()->savePlayerAsync(player);
 		}
 		delete player;
 	}
@@ -169,6 +169,10 @@ public:
 	void setPendingDepotTransfer(bool _pendingDepotTransfer) {pendingDepotTransfer = _pendingDepotTransfer;}
 	bool getPendingDepotTransfer() const {return pendingDepotTransfer;}
 
+	// The items on the tiles changed since the last map save
+	void setDirty(bool _dirty) {dirty = _dirty;}
+	bool isDirty() const {return dirty;}
+
 	uint32_t getHouseId() const {return houseid;}
 
 	void addDoor(Door* door);
@@ -218,6 +222,7 @@ private:
 	bool guildHall;
 	uint32_t syncFlags;
 	bool pendingDepotTransfer;
+	bool dirty;
 };
 
 typedef std::map<uint32_t, House*> HouseMap;
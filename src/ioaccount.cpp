@@ -44,6 +44,14 @@ Account IOAccount::loadAccount(const std::string& accountName, bool preLoad /* =
 		return acc;
 	}
 
+	return fetchAccount(accountName, preLoad);
+}
+
+Account IOAccount::fetchAccount(const std::string& accountName, bool preLoad /* = false*/)
+{
+	Account acc;
+	acc.name = accountName;
+
 	DatabaseDriver* db = DatabaseDriver::instance();
 	DBQuery query;
 	DBResult_ptr result;
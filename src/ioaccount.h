@@ -35,6 +35,9 @@ public:
 	}
 
 	Account loadAccount(const std::string& accountName, bool preLoad = false);
+	// The database part of loadAccount, does not run the account login script
+	// so it is safe to call off the dispatcher thread
+	Account fetchAccount(const std::string& accountName, bool preLoad = false);
 	bool saveAccount(const Account& account);
 	bool getPassword(const std::string& accountName, const std::string& playerName, std::string& password);
 	
@@ -29,6 +29,7 @@
 #include "depot.h"
 #include "housetile.h"
 #include "singleton.h"
+#include "database_executor.h"
 
 extern ConfigManager g_config;
 extern Game g_game;
@@ -51,6 +52,16 @@ bool IOMapSerialize::loadMap(Map* map)
 	else
 		std::cout << "[IOMapSerialize::loadMap] Unknown map storage type" << std::endl;
 
+	if(s){
+		m_tileStorageType = g_config.getString(ConfigManager::MAP_STORAGE_TYPE);
+
+		// adding the items marked every house, the rows hold them already
+		// unless they were moved to the depots
+		for(HouseMap::iterator it = Houses::getInstance()->getHouseBegin(); it != Houses::getInstance()->getHouseEnd(); ++it){
+			it->second->setDirty(it->second->getPendingDepotTransfer());
+		}
+	}
+
 	std::cout << "Notice: Map load (" << g_config.getString(ConfigManager::MAP_STORAGE_TYPE) << ") took : " <<
 		(OTSYS_TIME() - start)/(1000.) << " s" << std::endl;
 
@@ -59,16 +70,198 @@ bool IOMapSerialize::loadMap(Map* map)
 
 bool IOMapSerialize::saveMap(Map* map)
 {
-	bool s = false;
+	MapSaveData data;
+	if(!prepareSave(map, data))
+		return false;
 
-	if(g_config.getString(ConfigManager::MAP_STORAGE_TYPE) == "relational")
-		s = saveMapRelational(map);
-	else if(g_config.getString(ConfigManager::MAP_STORAGE_TYPE) == "binary")
-		s = saveMapBinary(map);
-	else
-		std::cout << "[IOMapSerialize::saveMap] Unknown map storage type" << std::endl;
+	DatabaseDriver* db = DatabaseDriver::instance();
+	DBTransaction transaction(db);
 
-	return s;
+	//Start the transaction
+	if(!transaction.begin())
+		return false;
+
+	if(!writeMap(data) || !transaction.commit()){
+		onSaveFailed(data);
+		return false;
+	}
+
+	return true;
+}
+
+bool IOMapSerialize::prepareSave(Map* map, MapSaveData& data)
+{
+	if(g_config.getString(ConfigManager::MAP_STORAGE_TYPE) == "binary")
+		data.binary = true;
+	else if(g_config.getString(ConfigManager::MAP_STORAGE_TYPE) != "relational"){
+		std::cout << "[IOMapSerialize::prepareSave] Unknown map storage type" << std::endl;
+		return false;
+	}
+
+	// the rows of the other storage type are not there
+	data.allHouses = data.binary && m_tileStorageType != "binary";
+
+	for(HouseMap::iterator it = Houses::getInstance()->getHouseBegin(); it != Houses::getInstance()->getHouseEnd(); ++it){
+		House* house = it->second;
+		data.houses.push_back(HouseSaveData());
+		HouseSaveData& houseData = data.houses.back();
+
+		houseData.houseId = house->getHouseId();
+		houseData.saveTiles = data.binary && (data.allHouses || house->isDirty());
+		houseData.owner = house->getHouseOwner();
+		houseData.paidUntil = house->getPaidUntil();
+		houseData.payRentWarnings = house->getPayRentWarnings();
+		houseData.lastWarning = house->getLastWarning();
+
+		std::string listText;
+		if(house->getAccessList(GUEST_LIST, listText) && listText != ""){
+			houseData.lists.push_back(std::make_pair((uint32_t)GUEST_LIST, listText));
+		}
+		if(house->getAccessList(SUBOWNER_LIST, listText) && listText != ""){
+			houseData.lists.push_back(std::make_pair((uint32_t)SUBOWNER_LIST, listText));
+		}
+
+		for(HouseDoorList::iterator door_iter = house->getDoorBegin(); door_iter != house->getDoorEnd(); ++door_iter){
+			const Door* door = *door_iter;
+			if(door->getAccessList(listText) && listText != ""){
+				houseData.lists.push_back(std::make_pair(door->getDoorId(), listText));
+			}
+		}
+	}
+
+	// data.houses does not grow anymore
+	HouseSaveList houses;
+	for(std::vector<HouseSaveData>::iterator it = data.houses.begin(); it != data.houses.end(); ++it){
+		if(it->saveTiles){
+			houses.push_back(std::make_pair(Houses::getInstance()->getHouse(it->houseId), &*it));
+		}
+	}
+
+	if(!saveHouseTiles(houses)){
+		return false;
+	}
+
+	for(HouseSaveList::iterator it = houses.begin(); it != houses.end(); ++it){
+		it->first->setDirty(false);
+	}
+
+	if(data.binary){
+		m_tileStorageType = "binary";
+	}
+
+	return true;
+}
+
+struct IOMapSerialize::HouseSaveTask{
+	HouseSaveTask(HouseSaveList* _houses) : houses(_houses), count((uint32_t)_houses->size()),
+		next(0), running(0), failed(false) {}
+
+	boost::mutex lock;
+	boost::condition_variable signal;
+	// only read while next < count, saveHouseTiles waits until then
+	HouseSaveList* houses;
+	uint32_t count;
+	uint32_t next;
+	// houses being encoded
+	uint32_t running;
+	bool failed;
+};
+
+bool IOMapSerialize::saveHouseTiles(HouseSaveList& houses)
+{
+	if(houses.empty()){
+		return true;
+	}
+
+	// The game waits, nothing changes the items while the database workers
+	// read them. A worker busy with a query joins once it is done, or finds
+	// every house taken already.
+	uint32_t workers = g_databaseExecutor.getWorkerCount();
+	uint32_t threads = g_config.getNumber(ConfigManager::MAP_SAVE_THREADS);
+	if(threads == 0 || threads > workers + 1){
+		threads = workers + 1;
+	}
+	threads = std::min<uint32_t>(threads, houses.size());
+
+	HouseSaveTask_ptr task(new HouseSaveTask(&houses));
+	for(uint32_t i = 1; i < threads; ++i){
+		g_databaseExecutor.addJob(i - 1, boost::bind(&IOMapSerialize::saveHouseTileJob, this, task));
+	}
+	saveHouseTileJob(task);
+
+	boost::mutex::scoped_lock lockClass(task->lock);
+	while(task->running > 0){
+		task->signal.wait(lockClass);
+	}
+
+	return !task->failed;
+}
+
+void IOMapSerialize::saveHouseTileJob(HouseSaveTask_ptr task)
+{
+	boost::mutex::scoped_lock lockClass(task->lock);
+	while(task->next < task->count){
+		HouseSaveList::value_type& house = (*task->houses)[task->next++];
+		++task->running;
+		lockClass.unlock();
+
+		bool encoded = encodeHouseTiles(house.first, house.second->tiles);
+
+		lockClass.lock();
+		--task->running;
+		if(!encoded){
+			task->failed = true;
+			task->next = task->count;
+		}
+	}
+
+	if(task->running == 0){
+		task->signal.notify_all();
+	}
+}
+
+bool IOMapSerialize::encodeHouseTiles(House* house, std::string& tiles)
+{
+	PropWriteStream stream;
+	for(HouseTileList::iterator tile_iter = house->getTileBegin();
+		tile_iter != house->getTileEnd();
+		++tile_iter)
+	{
+		if(!saveTile(stream, *tile_iter)){
+			return false;
+		}
+	}
+
+	uint32_t attributesSize;
+	const char* attributes = stream.getStream(attributesSize);
+	tiles.assign(attributes, attributesSize);
+	return true;
+}
+
+void IOMapSerialize::onSaveFailed(const MapSaveData& data)
+{
+	if(data.allHouses){
+		m_tileStorageType = "";
+	}
+
+	for(std::vector<HouseSaveData>::const_iterator it = data.houses.begin(); it != data.houses.end(); ++it){
+		House* house = Houses::getInstance()->getHouse(it->houseId);
+		if(house && it->saveTiles){
+			house->setDirty(true);
+		}
+	}
+}
+
+bool IOMapSerialize::writeMap(const MapSaveData& data)
+{
+	DatabaseDriver* db = DatabaseDriver::instance();
+	DBQuery query;
+
+	// the relational storage does not save the tiles yet, see saveMapRelational
+	if(data.binary && !writeMapBinary(db, data))
+		return false;
+
+	return writeHouseInfo(db, data);
 }
 
 bool IOMapSerialize::loadMapRelational(Map* map)
@@ -103,7 +296,7 @@ bool IOMapSerialize::loadMapRelational(Map* map)
 							loadItems(db, result_items, depot, true);
 
 							if(player->isOffline()){
-								IOPlayer::instance()->savePlayer(player);
+								IOPlayer::instance()->savePlayerAsync(player);
 								delete player;
 							}
 						}
@@ -158,7 +351,7 @@ bool IOMapSerialize::loadMapRelational(Map* map)
 								loadItems(db, result_items, depot);
 
 								if(player->isOffline()){
-									IOPlayer::instance()->savePlayer(player);
+									IOPlayer::instance()->savePlayerAsync(player);
 									delete player;
 								}
 							}
@@ -419,15 +612,22 @@ bool IOMapSerialize::loadMapBinary(Map* map)
 	DBQuery query;
 	DBResult_ptr result;
 
-	query << "SELECT * FROM `map_store` WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID);
-	for (result = db->storeQuery(query); result; result = result->advance()){
-		int32_t houseid = result->getDataInt("house_id");
+	static const char* const columnNames[] = {"house_id", "data", NULL};
+	int32_t columns[2];
+
+	query << "SELECT `house_id`, `data` FROM `map_store` WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID);
+	result = db->storeQuery(query);
+	if(result && !result->getColumnIndexes(columnNames, columns)){
+		return false;
+	}
+
+	for(; result; result = result->advance()){
+		int32_t houseid = result->getDataInt(columns[0]);
 		House* house = Houses::getInstance()->getHouse(houseid);
 
-		unsigned long attrSize = 0;
-		const char* attr = result->getDataStream("data", attrSize);
+		boost::string_view data = result->getDataView(columns[1]);
 		PropStream propStream;
-		propStream.init(attr, attrSize);
+		propStream.init(data.data(), data.size());
 
 		while(propStream.size()) {
 			uint32_t item_count = 0;
@@ -449,7 +649,7 @@ bool IOMapSerialize::loadMapBinary(Map* map)
 					}
 
 					if(player->isOffline()){
-						IOPlayer::instance()->savePlayer(player);
+						IOPlayer::instance()->savePlayerAsync(player);
 						delete player;
 					}
 				}
@@ -593,55 +793,68 @@ bool IOMapSerialize::loadItem(PropStream& propStream, Cylinder* parent, bool dep
 	return true;
 }
 
-bool IOMapSerialize::saveMapBinary(Map* map)
+Item* IOMapSerialize::unserializeItem(PropStream& propStream)
+{
+	uint16_t id = 0;
+	if(!propStream.GET_USHORT(id))
+		return NULL;
+
+	Item* item = Item::CreateItem(id);
+	if(!item)
+		return NULL;
+
+	if(!item->unserializeAttr(propStream)){
+		std::cout << "WARNING: Unserialization error in IOMapSerialize::unserializeItem()" << id << std::endl;
+		delete item;
+		return NULL;
+	}
+
+	Container* container = item->getContainer();
+	if(container && !loadContainer(propStream, container)){
+		delete item;
+		return NULL;
+	}
+
+	return item;
+}
+
+bool IOMapSerialize::writeMapBinary(DatabaseDriver* db, const MapSaveData& data)
 {
-	DatabaseDriver* db = DatabaseDriver::instance();
 	DBQuery query;
-	DBTransaction transaction(db);
 	DBInsert stmt(db);
 	stmt.setQuery("INSERT INTO `map_store` (`world_id`, `house_id`, `data`) VALUES ");
 
+	std::ostringstream houseIds;
+	for(std::vector<HouseSaveData>::const_iterator it = data.houses.begin(); it != data.houses.end(); ++it){
+		if(it->saveTiles){
+			houseIds << (houseIds.tellp() > 0 ? ", " : "") << it->houseId;
+		}
+	}
 
-	//Start the transaction
-	if(!transaction.begin())
-		return false;
+	if(houseIds.tellp() <= 0)
+		return true;
 
+	//clear old tile data, of the houses that changed unless all are saved
 	query << "DELETE FROM `map_store` WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID);
+	if(!data.allHouses){
+		query << " AND `house_id` IN (" << houseIds.str() << ")";
+	}
+
 	if(!db->executeQuery(query))
 		return false;
 
-	//clear old tile data
-	for(HouseMap::iterator it = Houses::getInstance()->getHouseBegin();
-		it != Houses::getInstance()->getHouseEnd();
-		++it)
-	{
-		//save house items
-		House* house = it->second;
-		PropWriteStream stream;
-		for(HouseTileList::iterator tile_iter = house->getTileBegin();
-			tile_iter != house->getTileEnd();
-			++tile_iter)
-		{
-			if(!saveTile(stream, *tile_iter)){
-				return false;
-			}
-		}
-
-		uint32_t attributesSize;
-		const char* attributes = stream.getStream(attributesSize);
+	for(std::vector<HouseSaveData>::const_iterator it = data.houses.begin(); it != data.houses.end(); ++it){
+		if(!it->saveTiles)
+			continue;
 
 		query.reset();
-		query << g_config.getNumber(ConfigManager::WORLD_ID) << ", " << it->second->getHouseId() << ", " << db->escapeBlob(attributes, attributesSize);
+		query << g_config.getNumber(ConfigManager::WORLD_ID) << ", " << it->houseId << ", " << db->escapeBlob(it->tiles.data(), (uint32_t)it->tiles.length());
 
 		if(!stmt.addRow(query.str()))
 			return false;
 	}
 
-	if(!stmt.execute())
-		return false;
-
-	//End the transaction
-	return transaction.commit();
+	return stmt.execute();
 }
 
 bool IOMapSerialize::saveItem(PropWriteStream& stream, const Item* item)
@@ -804,16 +1017,25 @@ bool IOMapSerialize::loadHouseInfo(Map* map)
 	DBQuery query;
 	DBResult_ptr result;
 
+	enum {COLUMN_MAP_ID, COLUMN_OWNER_ID, COLUMN_PAID, COLUMN_WARNINGS, COLUMN_LASTWARNING, COLUMN_CLEAR, COLUMN_COUNT};
+	static const char* const columnNames[] = {"map_id", "owner_id", "paid", "warnings", "lastwarning", "clear", NULL};
+	int32_t columns[COLUMN_COUNT];
+
 	query << "SELECT * FROM `houses` WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID);
-	for(result = db->storeQuery(query); result; result = result->advance()){
-		int32_t houseid = result->getDataInt("map_id");
+	result = db->storeQuery(query);
+	if(result && !result->getColumnIndexes(columnNames, columns)){
+		return false;
+	}
+
+	for(; result; result = result->advance()){
+		int32_t houseid = result->getDataInt(columns[COLUMN_MAP_ID]);
 		House* house = Houses::getInstance()->getHouse(houseid);
 		if(house){
-			int32_t ownerid = result->getDataInt("owner_id");
-			int32_t paid = result->getDataInt("paid");
-			int32_t payRentWarnings = result->getDataInt("warnings");
-			uint32_t lastWarning = result->getDataInt("lastwarning");
-			bool clear = (result->getDataInt("clear") != 0);
+			int32_t ownerid = result->getDataInt(columns[COLUMN_OWNER_ID]);
+			int32_t paid = result->getDataInt(columns[COLUMN_PAID]);
+			int32_t payRentWarnings = result->getDataInt(columns[COLUMN_WARNINGS]);
+			uint32_t lastWarning = result->getDataInt(columns[COLUMN_LASTWARNING]);
+			bool clear = (result->getDataInt(columns[COLUMN_CLEAR]) != 0);
 
 			house->setHouseOwner(ownerid);
 			house->setPaidUntil(paid);
@@ -847,14 +1069,9 @@ bool IOMapSerialize::loadHouseInfo(Map* map)
 	return true;
 }
 
-bool IOMapSerialize::saveHouseInfo(Map* map)
+bool IOMapSerialize::writeHouseInfo(DatabaseDriver* db, const MapSaveData& data)
 {
-	DatabaseDriver* db = DatabaseDriver::instance();
 	DBQuery query;
-	DBTransaction transaction(db);
-
-	if(!transaction.begin())
-		return false;
 
 	query.reset();
 	query <<
@@ -867,15 +1084,13 @@ bool IOMapSerialize::saveHouseInfo(Map* map)
 	DBInsert houselist_insert(db);
 	houselist_insert.setQuery("INSERT INTO `house_lists` (`house_id`, `listid`, `list`) VALUES ");
 
-	for(HouseMap::iterator it = Houses::getInstance()->getHouseBegin(); it != Houses::getInstance()->getHouseEnd(); ++it){
-		House* house = it->second;
-
+	for(std::vector<HouseSaveData>::const_iterator it = data.houses.begin(); it != data.houses.end(); ++it){
 		// Fetch house GUID
 		DBResult_ptr fetch_guid;
 		query.reset();
 		query << "SELECT `id` "
 			"FROM `houses` "
-			"WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID) << " AND `map_id` = " << house->getHouseId();
+			"WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID) << " AND `map_id` = " << it->houseId;
 
 		if(!(fetch_guid = db->storeQuery(query)))
 			return false;
@@ -885,50 +1100,26 @@ bool IOMapSerialize::saveHouseInfo(Map* map)
 		// Update house stats
 		query.reset();
 		query << "UPDATE `houses` SET "
-			<< "`owner` = " << house->getHouseOwner() << ", "
-			<< "`paid` = " << house->getPaidUntil() << ", "
-			<< "`warnings` = " << house->getPayRentWarnings() << ", "
-			<< "`lastwarning` = " << house->getLastWarning() << ", "
+			<< "`owner` = " << it->owner << ", "
+			<< "`paid` = " << it->paidUntil << ", "
+			<< "`warnings` = " << it->payRentWarnings << ", "
+			<< "`lastwarning` = " << it->lastWarning << ", "
 			<< "`clear` = " << 0
-			<< "WHERE `id` = " << house_guid;
+			<< " WHERE `id` = " << house_guid;
 
 		if(!db->executeQuery(query)){
 			return false;
 		}
 
 		// Update house list
-		std::string listText;
-		if(house->getAccessList(GUEST_LIST, listText) && listText != ""){
-			query << house_guid << ", " << GUEST_LIST << ", " << db->escapeString(listText);
+		for(std::vector<std::pair<uint32_t, std::string> >::const_iterator list_iter = it->lists.begin(); list_iter != it->lists.end(); ++list_iter){
+			query << house_guid << ", " << list_iter->first << ", " << db->escapeString(list_iter->second);
 
 			if(!houselist_insert.addRowAndReset(query)){
 				return false;
 			}
 		}
-		if(house->getAccessList(SUBOWNER_LIST, listText) && listText != ""){
-			query << house_guid << ", " << SUBOWNER_LIST << ", " << db->escapeString(listText);
-
-			if(!houselist_insert.addRowAndReset(query)){
-				return false;
-			}
-		}
-
-		for(HouseDoorList::iterator it = house->getDoorBegin(); it != house->getDoorEnd(); ++it){
-			const Door* door = *it;
-			if(door->getAccessList(listText) && listText != ""){
-				query << house_guid << ", " << door->getDoorId() << ", " << db->escapeString(listText);
-
-				if(!houselist_insert.addRowAndReset(query)){
-					return false;
-				}
-			}
-		}
 	}
 
-	if(!houselist_insert.execute()){
-		return false;
-	}
-
-	return transaction.commit();
+	return houselist_insert.execute();
 }
-
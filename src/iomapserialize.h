@@ -23,6 +23,37 @@
 
 #include "classes.h"
 #include "database_driver.h"
+#include <boost/shared_ptr.hpp>
+
+/** A house as IOMapSerialize::writeMap saves it, built on the dispatcher
+  * thread so it can be written from any thread */
+struct HouseSaveData {
+	HouseSaveData() : houseId(0), saveTiles(false), owner(0), paidUntil(0), payRentWarnings(0), lastWarning(0) {}
+
+	uint32_t houseId;
+	// the items changed since the last save, tiles holds them
+	bool saveTiles;
+	// saveTile of every tile of the house
+	std::string tiles;
+	uint32_t owner;
+	time_t paidUntil;
+	uint32_t payRentWarnings;
+	time_t lastWarning;
+	// list id and text of the guest, subowner and door lists
+	std::vector<std::pair<uint32_t, std::string> > lists;
+};
+
+struct MapSaveData {
+	MapSaveData() : binary(false), allHouses(false) {}
+
+	// the tiles are only stored by the binary storage
+	bool binary;
+	// the tiles of every house are saved, the other rows are deleted
+	bool allHouses;
+	std::vector<HouseSaveData> houses;
+};
+
+typedef boost::shared_ptr<MapSaveData> MapSaveData_ptr;
 
 class IOMapSerialize{
 public:
@@ -40,6 +71,39 @@ public:
 	*/
 	bool saveMap(Map* map);
 
+	/** Build what saveMap writes, does not touch the database. Only the
+	  * tiles of the houses whose items changed are encoded, on
+	  * map_save_threads threads.
+	  * \param map pointer to the Map class
+	  * \param data receives the houses
+	  * \return Returns false if a house could not be serialized
+	*/
+	bool prepareSave(Map* map, MapSaveData& data);
+
+	/** The tiles of data were not written, the next save encodes them again
+	  * \param data the houses built by prepareSave
+	*/
+	void onSaveFailed(const MapSaveData& data);
+
+	/** Write the houses built by prepareSave, safe to call from any thread.
+	  * The caller holds the transaction.
+	  * \param data the houses to save
+	  * \return Returns true if the houses were saved successfully
+	*/
+	bool writeMap(const MapSaveData& data);
+
+	/** Write an item and the items it contains
+	  * \param stream receives the item
+	  * \param item the item to write
+	*/
+	bool saveItem(PropWriteStream& stream, const Item* item);
+
+	/** Read an item written by saveItem, with the items it contains
+	  * \param propStream the stream to read
+	  * \return Returns the item, NULL if the stream could not be read
+	*/
+	Item* unserializeItem(PropStream& propStream);
+
 	/** Synchronize the house information from the map
 	  * \return Returns true if all houses where updated correctly
 	*/
@@ -56,12 +120,6 @@ public:
 	*/
 	bool loadHouseInfo(Map* map);
 
-	/** Save the house access list to a data storage
-	  * \param map pointer to the Map class
-	  * \return Returns true if the house access list was saved successfully
-	*/
-	bool saveHouseInfo(Map* map);
-
 protected:
 	// Relational storage uses a row for each item/tile
 	bool loadMapRelational(Map* map);
@@ -72,12 +130,26 @@ protected:
 
 	// Binary storage uses a giant BLOB field for storing everything
 	bool loadMapBinary(Map* map);
-	bool saveMapBinary(Map* map);
+	bool writeMapBinary(DatabaseDriver* db, const MapSaveData& data);
+
+	typedef std::vector<std::pair<House*, HouseSaveData*> > HouseSaveList;
+	// The houses saveHouseTiles shares out to the database workers
+	struct HouseSaveTask;
+	typedef boost::shared_ptr<HouseSaveTask> HouseSaveTask_ptr;
+	bool saveHouseTiles(HouseSaveList& houses);
+	// Encodes the houses of task nobody took yet, houses do not change meanwhile
+	void saveHouseTileJob(HouseSaveTask_ptr task);
+	bool encodeHouseTiles(House* house, std::string& tiles);
+
+	bool writeHouseInfo(DatabaseDriver* db, const MapSaveData& data);
 
-	bool saveItem(PropWriteStream& stream, const Item* item);
 	bool saveTile(PropWriteStream& stream, const Tile* tile);
 	bool loadItem(PropStream& propStream, Cylinder* parent, bool depotTransfer = false);
 	bool loadContainer(PropStream& propStream, Container* container);
+
+	// the storage type the tiles of the houses were last saved with, all
+	// houses are saved when it changes
+	std::string m_tileStorageType;
 };
 
 #endif
@@ -28,6 +28,9 @@
 #include "town.h"
 #include "configmanager.h"
 #include "singleton.h"
+#include "database_executor.h"
+#include "iomapserialize.h"
+#include "player_journal.h"
 
 extern ConfigManager g_config;
 extern Game g_game;
@@ -40,11 +43,22 @@ IOPlayer* IOPlayer::instance()
 
 bool IOPlayer::loadPlayer(Player* player, const std::string& name, bool preload /*= false*/)
 {
+	// An offline player may still have its logout save queued
+	g_databaseExecutor.waitForJobs(DatabaseExecutor::getPlayerKey(name));
+
+	PlayerData data;
+	return fetchPlayer(data, name, preload) && loadPlayer(player, data, preload);
+}
+
+bool IOPlayer::fetchPlayer(PlayerData& data, const std::string& name, bool preload /*= false*/)
+{
+	//any thread, only touches the database
 	DatabaseDriver* db = DatabaseDriver::instance();
 	DBQuery query;
-	DBResult_ptr result;
+	DBStatement* stmt;
 
-	query << "SELECT `players`.`id` AS `id`, `players`.`name` AS `name`, `accounts`.`name` AS `accname`, \
+	stmt = db->prepareStatement("SELECT `players`.`id` AS `id`, `players`.`name` AS `name`, `accounts`.`name` AS `accname`, \
+		`accounts`.`password` AS `password`, `accounts`.`premend` AS `premend`, \
 		`account_id`, `sex`, `vocation`, `town_id`, `experience`, `level`, `maglevel`, `health`, \
 		`groups`.`name` AS `groupname`, `groups`.`flags` AS `groupflags`, `groups`.`access` AS `access`, \
 		`groups`.`maxviplist` AS `maxviplist`, `groups`.`maxdepotitems` AS `maxdepotitems`, `groups`.`violation` AS `violationaccess`, \
@@ -53,11 +67,78 @@ bool IOPlayer::loadPlayer(Player* player, const std::string& name, bool preload
 		`lastlogin`, `lastlogout`, `lastip`, `conditions`, `skull_time`, `skull_type`, `stamina`, \
 		`loss_experience`, `loss_mana`, `loss_skills`, `loss_items`, `loss_containers` \
 		FROM `players` \
-		LEFT JOIN `accounts` ON `account_id` = `accounts`.`id`\
+		INNER JOIN `accounts` ON `account_id` = `accounts`.`id`\
 		LEFT JOIN `groups` ON `groups`.`id` = `players`.`group_id` \
-		WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID) << " AND `players`.`name` = " + db->escapeString(name);
+		WHERE `world_id` = ? AND `players`.`name` = ?");
+	if(!stmt){
+		return false;
+	}
 
-	if(!(result = db->storeQuery(query))){
+	stmt->bindInt(0, g_config.getNumber(ConfigManager::WORLD_ID));
+	stmt->bindString(1, name);
+	static const char* const playerBlobs[] = {"conditions", NULL};
+	if(!(data.player = DBStoredResult::copy(stmt->query(), playerBlobs))){
+		return false;
+	}
+
+	if(preload){
+		//only loading basic info
+		return true;
+	}
+
+	uint32_t guid = data.player->getDataInt("id");
+
+	if((stmt = db->prepareStatement(
+		"SELECT "
+		"	`guild_ranks`.`name` as `rank`, `guild_ranks`.`guild_id` as `guildid`, "
+		"	`guild_ranks`.`level` as `level`, `guilds`.`name` as `guildname`, "
+		"	`guild_members`.`nick` AS `nick` "
+		"FROM `guild_members` "
+		"LEFT JOIN `guild_ranks` ON `guild_ranks`.`id` = `guild_members`.`rank_id` "
+		"LEFT JOIN `guilds` ON `guilds`.`id` = `guild_ranks`.`guild_id` "
+		"WHERE `guild_members`.`player_id` = ?"))){
+		stmt->bindInt(0, guid);
+		data.guild = DBStoredResult::copy(stmt->query());
+	}
+
+	if((stmt = db->prepareStatement("SELECT `skill_id`, `value`, `count` FROM `player_skills` WHERE `player_id` = ?"))){
+		stmt->bindInt(0, guid);
+		data.skills = DBStoredResult::copy(stmt->query());
+	}
+
+	if((stmt = db->prepareStatement("SELECT `id`, `value` FROM `player_storage` WHERE `player_id` = ?"))){
+		stmt->bindInt(0, guid);
+		data.storage = DBStoredResult::copy(stmt->query());
+	}
+
+	// the names are read along, so loading does not need a query per vip
+	if((stmt = db->prepareStatement("SELECT `player_viplist`.`vip_id` AS `vip_id`, `players`.`name` AS `name` FROM `player_viplist` "
+		"INNER JOIN `players` ON `players`.`id` = `player_viplist`.`vip_id` "
+		"WHERE `player_viplist`.`player_id` = ?"))){
+		stmt->bindInt(0, guid);
+		data.vips = DBStoredResult::copy(stmt->query());
+	}
+
+	if(g_config.getString(ConfigManager::PLAYER_STORAGE_TYPE) == "binary"){
+		static const char* const itemBlobs[] = {"data", NULL};
+		if((stmt = db->prepareStatement("SELECT `data` FROM `player_inventory_store` WHERE `player_id` = ?"))){
+			stmt->bindInt(0, guid);
+			data.inventory = DBStoredResult::copy(stmt->query(), itemBlobs);
+		}
+
+		if((stmt = db->prepareStatement("SELECT `depot_id`, `data` FROM `player_depot_store` WHERE `player_id` = ? ORDER BY `depot_id`"))){
+			stmt->bindInt(0, guid);
+			data.depots = DBStoredResult::copy(stmt->query(), itemBlobs);
+		}
+	}
+
+	return true;
+}
+
+bool IOPlayer::loadPlayer(Player* player, PlayerData& data, bool preload /*= false*/)
+{
+	DBResult_ptr result = data.player;
+	if(!result){
 		return false;
 	}
 
@@ -172,18 +253,7 @@ bool IOPlayer::loadPlayer(Player* player, const std::string& name, bool preload
 		player->loginPosition = player->masterPos;
 	}
 
-	query.reset();
-	query <<
-		"SELECT "
-		"	`guild_ranks`.`name` as `rank`, `guild_ranks`.`guild_id` as `guildid`, "
-		"	`guild_ranks`.`level` as `level`, `guilds`.`name` as `guildname`, "
-		"	`guild_members`.`nick` AS `nick` "
-		"FROM `guild_members` "
-		"LEFT JOIN `guild_ranks` ON `guild_ranks`.`id` = `guild_members`.`rank_id` "
-		"LEFT JOIN `guilds` ON `guilds`.`id` = `guild_ranks`.`guild_id` "
-		"WHERE `guild_members`.`player_id` = " << player->getGUID();
-
-	if((result = db->storeQuery(query))){
+	if((result = data.guild)){
 		player->guildName = result->getDataString("guildname");
 		player->guildLevel = result->getDataInt("level");
 		player->guildId = result->getDataInt("guildid");
@@ -191,27 +261,27 @@ bool IOPlayer::loadPlayer(Player* player, const std::string& name, bool preload
 		player->guildNick = result->getDataString("nick");
 	}
 
-	//get password
-	query.reset();
-	query << "SELECT `password`, `premend` FROM `accounts` WHERE `id` = " << player->accountId;
-	if(!(result = db->storeQuery(query))){
-		return false;
-	}
+	player->password = data.player->getDataString("password");
+	player->premiumDays = IOAccount::getPremiumDaysLeft(data.player->getDataInt("premend"));
 
-	player->password = result->getDataString("password");
-	player->premiumDays = IOAccount::getPremiumDaysLeft(result->getDataInt("premend"));
+	// the columns are looked up once, not for every row
+	int32_t columns[3];
 
 	// we need to find out our skills
-	// so we query the skill table
-	query.reset();
-	query << "SELECT `skill_id`, `value`, `count` FROM `player_skills` WHERE `player_id` = " << player->getGUID();
-	for(result = db->storeQuery(query); result; result = result->advance()){
+	enum {COLUMN_SKILL_ID, COLUMN_SKILL_VALUE, COLUMN_SKILL_COUNT};
+	static const char* const skillColumns[] = {"skill_id", "value", "count", NULL};
+	result = data.skills;
+	if(result && !result->getColumnIndexes(skillColumns, columns)){
+		result.reset();
+	}
+
+	for(; result; result = result->advance()){
 		//now iterate over the skills
 		try {
-			SkillType skillid = SkillType::fromInteger(result->getDataInt("skill_id"));
+			SkillType skillid = SkillType::fromInteger(result->getDataInt(columns[COLUMN_SKILL_ID]));
 
-			uint32_t skillLevel = result->getDataInt("value");
-			uint32_t skillCount = result->getDataInt("count");
+			uint32_t skillLevel = result->getDataInt(columns[COLUMN_SKILL_VALUE]);
+			uint32_t skillCount = result->getDataInt(columns[COLUMN_SKILL_COUNT]);
 
 			uint32_t nextSkillCount = player->vocation->getReqSkillTries(skillid, skillLevel + 1);
 			if(skillCount > nextSkillCount){
@@ -223,7 +293,7 @@ bool IOPlayer::loadPlayer(Player* player, const std::string& name, bool preload
 			player->skills[skillid.value()][SKILL_TRIES] = skillCount;
 			player->skills[skillid.value()][SKILL_PERCENT] = Player::getPercentLevel(skillCount, nextSkillCount);
 		} catch(enum_conversion_error&) {
-			std::cout << "Unknown skill ID when loading player " << result->getDataInt("skillid") << std::endl;
+			std::cout << "Unknown skill ID when loading player " << result->getDataInt(columns[COLUMN_SKILL_ID]) << std::endl;
 		}
 	}
 
@@ -297,29 +367,82 @@ bool IOPlayer::loadPlayer(Player* player, const std::string& name, bool preload
 	}
 	*/
 
+	//load the inventory and depots of the binary storage, kept as they are
+	//stored for the first save to compare with
+	std::string inventory;
+	if(data.inventory){
+		boost::string_view blob = data.inventory->getDataView(0);
+		if(!unserializeInventory(player, blob)){
+			return false;
+		}
+		inventory.assign(blob.data(), blob.size());
+	}
+
+	std::vector<std::pair<uint32_t, std::string> > depots;
+	for(result = data.depots; result; result = result->advance()){
+		uint32_t depotId = result->getDataInt(0);
+		boost::string_view blob = result->getDataView(1);
+		if(!unserializeDepot(player, depotId, blob)){
+			return false;
+		}
+		depots.push_back(std::make_pair(depotId, std::string(blob.data(), blob.size())));
+	}
+
 	//load storage map
-	query.str("");
-	query << "SELECT `id`, `value` FROM `player_storage` WHERE `player_id` = " << player->getGUID();
-	for(result = db->storeQuery(query); result; result = result->advance()){
-		std::string key = result->getDataString("id");
-		std::string value = result->getDataString("value");
+	enum {COLUMN_STORAGE_KEY, COLUMN_STORAGE_VALUE};
+	static const char* const storageColumns[] = {"id", "value", NULL};
+	result = data.storage;
+	if(result && !result->getColumnIndexes(storageColumns, columns)){
+		result.reset();
+	}
+
+	for(; result; result = result->advance()){
+		std::string key = result->getDataString(columns[COLUMN_STORAGE_KEY]);
+		std::string value = result->getDataString(columns[COLUMN_STORAGE_VALUE]);
 		player->setCustomValue(key, value);
 	}
 
 	//load vips
-	query.str("");
-	query << "SELECT `vip_id` FROM `player_viplist` WHERE `player_id` = " << player->getGUID();
-	for(result = db->storeQuery(query); result; result = result->advance()){
-		uint32_t vip_id = result->getDataInt("vip_id");
+	enum {COLUMN_VIP_ID, COLUMN_VIP_NAME};
+	static const char* const vipColumns[] = {"vip_id", "name", NULL};
+	result = data.vips;
+	if(result && !result->getColumnIndexes(vipColumns, columns)){
+		result.reset();
+	}
+
+	std::vector<uint32_t> vips;
+	for(; result; result = result->advance()){
+		uint32_t vip_id = result->getDataInt(columns[COLUMN_VIP_ID]);
+		vips.push_back(vip_id);
+		boost::mutex::scoped_lock lockClass(cacheLock);
+		if(nameCacheMap.find(vip_id) == nameCacheMap.end()){
+			nameCacheMap[vip_id] = result->getDataString(columns[COLUMN_VIP_NAME]);
+		}
+		lockClass.unlock();
+
 		std::string dummy_str;
-		if(storeNameByGuid(*db, vip_id))
-			player->addVIP(vip_id, dummy_str, false, true);
+		player->addVIP(vip_id, dummy_str, false, true);
 	}
 
 	player->updateBaseSpeed();
 	player->updateInventoryWeight();
 	player->updateItemsLight(true);
 
+	//the first save compares with what was just loaded, the vips as they
+	//are stored, addVIP may have skipped some
+	PlayerSaveData_ptr saved(new PlayerSaveData());
+	if(serializePlayer(player, *saved, false)){
+		std::sort(vips.begin(), vips.end());
+		saved->vips = vips;
+		if(g_config.getString(ConfigManager::PLAYER_STORAGE_TYPE) == "binary"){
+			saved->items = true;
+			saved->inventory.swap(inventory);
+			saved->depots.swap(depots);
+		}
+		player->savedState = saved;
+		player->journalBase = saved;
+	}
+
 	return true;
 }
 
@@ -390,24 +513,239 @@ bool IOPlayer::saveItems(Player* player, const ItemBlockList& itemList, DBInsert
 	return true;
 }
 
-bool IOPlayer::savePlayer(Player* player, bool shallow)
+PlayerSaveData_ptr IOPlayer::getSavedState(const PlayerSaveData_ptr& data, const PlayerSaveData_ptr& saved)
 {
-	player->preSave();
+	if(!data->shallow){
+		return data;
+	}
 
+	if(!saved || saved->failed){
+		//the storage and vips in the database are unknown
+		return PlayerSaveData_ptr();
+	}
+
+	PlayerSaveData_ptr state(new PlayerSaveData(*data));
+	state->shallow = false;
+	state->storage = saved->storage;
+	state->vips = saved->vips;
+	state->items = saved->items;
+	state->inventory = saved->inventory;
+	state->depots = saved->depots;
+	return state;
+}
+
+uint64_t IOPlayer::journalPlayer(Player* player, const PlayerSaveData_ptr& data)
+{
+	PlayerJournal* journal = PlayerJournal::getInstance();
+	if(!journal->isEnabled()){
+		return 0;
+	}
+
+	// the next record holds what changed since this one
+	uint64_t sequence = journal->addPlayer(data, player->journalState, player->journalBase);
+	player->journalState = getSavedState(data, player->journalState);
+	return sequence;
+}
+
+bool IOPlayer::writeJournal(const PlayerJournalContents& contents)
+{
 	DatabaseDriver* db = DatabaseDriver::instance();
 	DBQuery query;
-	DBResult_ptr result;
+	{
+		// every section the journal holds is written in full, it is newer
+		// than the rows
+		DBTransaction transaction(db);
+		if(!transaction.begin())
+			return false;
 
-	//check if the player has to be saved or not
-	query << "SELECT `save` FROM `players` WHERE `id` = " << player->getGUID();
-	if(!(result = db->storeQuery(query))){
+		for(std::map<uint32_t, PlayerJournalContents::Player>::const_iterator it = contents.players.begin(); it != contents.players.end(); ++it){
+			if(!writeSections(it->second.data, it->second.sections, NULL, false)){
+				std::cout << "Error while saving player: " << it->second.data.name << std::endl;
+				return false;
+			}
+		}
+
+		if(!transaction.commit())
+			return false;
+	}
+
+	// the deaths may have been written before the crash
+	for(std::vector<PlayerDeathData_ptr>::const_iterator it = contents.deaths.begin(); it != contents.deaths.end(); ++it){
+		if(!hasPlayerDeath(**it) && !writePlayerDeath(*it)){
+			return false;
+		}
+	}
+	return true;
+}
+
+void IOPlayer::savePlayerAsync(Player* player)
+{
+	PlayerSaveData_ptr data(new PlayerSaveData());
+	if(!prepareSave(player, *data)){
+		std::cout << "Error while saving player: " << player->getName() << std::endl;
+		return;
+	}
+
+	uint64_t journalSequence = journalPlayer(player, data);
+
+	// Same key as the login fetch, a player logging in again is loaded
+	// after this save has been written
+	g_databaseExecutor.addWriteJob(DatabaseExecutor::getPlayerKey(data->name),
+		boost::bind(&IOPlayer::writeLogoutSave, this, data, player->savedState, journalSequence));
+}
+
+void IOPlayer::writeLogoutSave(PlayerSaveData_ptr data, PlayerSaveData_ptr saved, uint64_t journalSequence)
+{
+	//database thread
+	PlayerJournal::getInstance()->waitFlushed(journalSequence);
+	if(saved && saved->unwritten){
+		//the save before did not write saved, the rows are unknown
+		saved.reset();
+	}
+
+	for(uint32_t tries = 0; tries < 3; ++tries){
+		if(writePlayer(*data, saved.get())){
+			return;
+		}
+	}
+
+	std::cout << "Error while saving player: " << data->name << std::endl;
+	PlayerJournal::getInstance()->setUnwritten();
+}
+
+// The columns written by writePlayer, prepareSave adds their values in this order
+static const char* const playerSaveColumns[] = {
+	"level", "vocation", "health", "healthmax", "direction", "experience",
+	"lookbody", "lookfeet", "lookhead", "looklegs", "looktype", "lookaddons",
+	"maglevel", "mana", "manamax", "manaspent", "soul", "town_id",
+	"posx", "posy", "posz", "cap", "sex",
+	"loss_experience", "loss_mana", "loss_skills", "loss_items", "loss_containers", "stamina",
+#ifdef __SKULLSYSTEM__
+	"skull_type", "skull_time",
+#endif
+	NULL
+};
+
+static std::string getUpdatePlayerQuery()
+{
+	std::ostringstream query;
+	query << "UPDATE `players` SET ";
+	for(const char* const* column = playerSaveColumns; *column; ++column){
+		query << (column != playerSaveColumns ? ", " : "") << "`" << *column << "` = ?";
+	}
+	query << " WHERE `id` = ?";
+	return query.str();
+}
+
+bool IOPlayer::prepareSave(Player* player, PlayerSaveData& data, bool shallow)
+{
+	player->preSave();
+	if(!serializePlayer(player, data, shallow)){
 		return false;
 	}
 
-	const uint32_t save = result->getDataInt("save");
+	//shallow saves skip the items like the storage
+	if(!shallow && g_config.getString(ConfigManager::PLAYER_STORAGE_TYPE) == "binary"){
+		serializeItems(player, data);
+	}
+	return true;
+}
 
-	if(save == 0)
-		return true;
+void IOPlayer::serializeItems(Player* player, PlayerSaveData& data)
+{
+	IOMapSerialize* serializer = IOMapSerialize::getInstance();
+	uint32_t size;
+	const char* buffer;
+
+	//the slot of every item, then the item
+	PropWriteStream inventoryStream;
+	inventoryStream.ADD_USHORT(PLAYER_ITEMS_VERSION);
+	for(SlotType::iterator slot = SLOT_FIRST; slot < SLOT_LAST; ++slot){
+		if(Item* item = player->getInventoryItem(*slot)){
+			inventoryStream.ADD_UCHAR((uint8_t)slot->value());
+			serializer->saveItem(inventoryStream, item);
+		}
+	}
+
+	buffer = inventoryStream.getStream(size);
+	data.inventory.assign(buffer, size);
+
+	//the locker with everything in it
+	for(DepotMap::const_iterator it = player->depots.begin(); it != player->depots.end(); ++it){
+		PropWriteStream depotStream;
+		depotStream.ADD_USHORT(PLAYER_ITEMS_VERSION);
+		serializer->saveItem(depotStream, it->second);
+
+		buffer = depotStream.getStream(size);
+		data.depots.push_back(std::make_pair(it->first, std::string(buffer, size)));
+	}
+
+	data.items = true;
+}
+
+bool IOPlayer::unserializeInventory(Player* player, boost::string_view blob)
+{
+	PropStream propStream;
+	propStream.init(blob.data(), blob.size());
+
+	uint16_t version = 0;
+	if(!propStream.GET_USHORT(version) || version != PLAYER_ITEMS_VERSION){
+		std::cout << "Error loading the inventory of player " << player->getName() << ", unknown version " << version << std::endl;
+		return false;
+	}
+
+	IOMapSerialize* serializer = IOMapSerialize::getInstance();
+	while(propStream.size()){
+		uint8_t slot = 0;
+		propStream.GET_UCHAR(slot);
+		if(slot < SLOT_FIRST.value() || slot >= SLOT_LAST.value()){
+			std::cout << "Error loading the inventory of player " << player->getName() << ", invalid slot " << (int32_t)slot << std::endl;
+			return false;
+		}
+
+		Item* item = serializer->unserializeItem(propStream);
+		if(!item){
+			std::cout << "Error loading the inventory of player " << player->getName() << std::endl;
+			return false;
+		}
+		player->__internalAddThing(slot, item);
+	}
+
+	return true;
+}
+
+bool IOPlayer::unserializeDepot(Player* player, uint32_t depotId, boost::string_view blob)
+{
+	PropStream propStream;
+	propStream.init(blob.data(), blob.size());
+
+	uint16_t version = 0;
+	if(!propStream.GET_USHORT(version) || version != PLAYER_ITEMS_VERSION){
+		std::cout << "Error loading depot " << depotId << " of player " << player->getName() << ", unknown version " << version << std::endl;
+		return false;
+	}
+
+	Item* item = IOMapSerialize::getInstance()->unserializeItem(propStream);
+	Depot* depot = NULL;
+	if(item && item->getContainer()){
+		depot = item->getContainer()->getDepot();
+	}
+
+	if(!depot){
+		std::cout << "Error loading depot " << depotId << " of player " << player->getName() << std::endl;
+		delete item;
+		return false;
+	}
+
+	player->addDepot(depot, depotId);
+	return true;
+}
+
+bool IOPlayer::serializePlayer(Player* player, PlayerSaveData& data, bool shallow)
+{
+	data.guid = player->getGUID();
+	data.name = player->getName();
+	data.shallow = shallow;
 
 	//serialize conditions
 	PropWriteStream propWriteStream;
@@ -423,67 +761,175 @@ bool IOPlayer::savePlayer(Player* player, bool shallow)
 
 	uint32_t conditionsSize;
 	const char* conditions = propWriteStream.getStream(conditionsSize);
-
-	//First, an UPDATE query to write the player itself
-	query.reset();
-	query << "UPDATE `players` SET `level` = " << player->level
-	<< ", `vocation` = " << (int32_t)player->getVocationId()
-	<< ", `health` = " << player->health
-	<< ", `healthmax` = " << player->healthMax
-	<< ", `direction` = " << player->getDirection().value()
-	<< ", `experience` = " << player->experience
-	<< ", `lookbody` = " << (int32_t)player->defaultOutfit.lookBody
-	<< ", `lookfeet` = " << (int32_t)player->defaultOutfit.lookFeet
-	<< ", `lookhead` = " << (int32_t)player->defaultOutfit.lookHead
-	<< ", `looklegs` = " << (int32_t)player->defaultOutfit.lookLegs
-	<< ", `looktype` = " << (int32_t)player->defaultOutfit.lookType
-	<< ", `lookaddons` = " << (int32_t)player->defaultOutfit.lookAddons
-	<< ", `maglevel` = " << player->magLevel
-	<< ", `mana` = " << player->mana
-	<< ", `manamax` = " << player->manaMax
-	<< ", `manaspent` = " << player->manaSpent
-	<< ", `soul` = " << player->soul
-	<< ", `town_id` = " << player->town
-	<< ", `posx` = " << player->getLoginPosition().x
-	<< ", `posy` = " << player->getLoginPosition().y
-	<< ", `posz` = " << player->getLoginPosition().z
-	<< ", `cap` = " << player->getCapacity()
-	<< ", `sex` = " << player->sex.value()
-	<< ", `conditions` = " << db->escapeBlob(conditions, conditionsSize)
-	<< ", `loss_experience` = " << (int32_t)player->getLossPercent(LOSS_EXPERIENCE)
-	<< ", `loss_mana` = " << (int32_t)player->getLossPercent(LOSS_MANASPENT)
-	<< ", `loss_skills` = " << (int32_t)player->getLossPercent(LOSS_SKILLTRIES)
-	<< ", `loss_items` = " << (int32_t)player->getLossPercent(LOSS_ITEMS)
-	<< ", `loss_containers` = " << (int32_t)player->getLossPercent(LOSS_CONTAINERS)
-	<< ", `stamina` = " << player->stamina;
+	data.conditions.assign(conditions, conditionsSize);
+
+	//the player itself, see playerSaveColumns
+	data.player.push_back(player->level);
+	data.player.push_back((int32_t)player->getVocationId());
+	data.player.push_back(player->health);
+	data.player.push_back(player->healthMax);
+	data.player.push_back(player->getDirection().value());
+	data.player.push_back(player->experience);
+	data.player.push_back((int32_t)player->defaultOutfit.lookBody);
+	data.player.push_back((int32_t)player->defaultOutfit.lookFeet);
+	data.player.push_back((int32_t)player->defaultOutfit.lookHead);
+	data.player.push_back((int32_t)player->defaultOutfit.lookLegs);
+	data.player.push_back((int32_t)player->defaultOutfit.lookType);
+	data.player.push_back((int32_t)player->defaultOutfit.lookAddons);
+	data.player.push_back(player->magLevel);
+	data.player.push_back(player->mana);
+	data.player.push_back(player->manaMax);
+	data.player.push_back(player->manaSpent);
+	data.player.push_back(player->soul);
+	data.player.push_back(player->town);
+	data.player.push_back(player->getLoginPosition().x);
+	data.player.push_back(player->getLoginPosition().y);
+	data.player.push_back(player->getLoginPosition().z);
+	data.player.push_back(player->getCapacity());
+	data.player.push_back(player->sex.value());
+	data.player.push_back((int32_t)player->getLossPercent(LOSS_EXPERIENCE));
+	data.player.push_back((int32_t)player->getLossPercent(LOSS_MANASPENT));
+	data.player.push_back((int32_t)player->getLossPercent(LOSS_SKILLTRIES));
+	data.player.push_back((int32_t)player->getLossPercent(LOSS_ITEMS));
+	data.player.push_back((int32_t)player->getLossPercent(LOSS_CONTAINERS));
+	data.player.push_back(player->stamina);
 
 #ifdef __SKULLSYSTEM__
-	query << ", `skull_type` = " << (player->getSkull() == SKULL_RED || player->getSkull() == SKULL_BLACK ? player->getSkull().value() : 0);
-	query << ", `skull_time` = " << player->lastSkullTime;
+	data.player.push_back(player->getSkull() == SKULL_RED || player->getSkull() == SKULL_BLACK ? player->getSkull().value() : 0);
+	data.player.push_back(player->lastSkullTime);
 #endif
 
-	query << " WHERE `id` = " << player->getGUID();
+	//skills
+	for(int32_t i = 0; i <= 6; i++){
+		data.skills.push_back(std::make_pair(player->skills[i][SKILL_LEVEL], player->skills[i][SKILL_TRIES]));
+	}
 
-	DBTransaction transaction(db);
-	if(!transaction.begin())
+	if(shallow)
+		return true;
+
+	/*
+	ItemBlockList itemList;
+	Item* item;
+	for(int32_t slotId = 1; slotId <= 10; ++slotId){
+		if((item = player->inventory[slotId])){
+			itemList.push_back(itemBlock(slotId, item));
+		}
+	}
+
+	//item saving
+	stmt.setQuery("INSERT INTO `player_items` (`player_id` , `pid` , `sid` , `itemtype` , `count` , `attributes` ) VALUES ");
+	if(!(saveItems(player, itemList, stmt) && stmt.execute())){
 		return false;
+	}
+
+	itemList.clear();
+	for(DepotMap::iterator it = player->depots.begin(); it != player->depots.end(); ++it){
+		itemList.push_back(itemBlock(it->first, it->second));
+	}
 
-	if(!db->executeQuery(query)){
+	//save depot items
+	stmt.setQuery("INSERT INTO `player_depotitems` (`player_id` , `pid` , `sid` , `itemtype` , `count` , `attributes` ) VALUES ");
+	if(!(saveItems(player, itemList, stmt) && stmt.execute())){
 		return false;
 	}
+	*/
 
-	//skills
-	for(int32_t i = 0; i <= 6; i++){
-		query.reset();
-		query << "UPDATE `player_skills` SET `value` = " << player->skills[i][SKILL_LEVEL] << ", `count` = " << player->skills[i][SKILL_TRIES] << " WHERE `player_id` = " << player->getGUID() << " AND `skill_id` = " << i;
+	data.storage.assign(player->getCustomValueIteratorBegin(), player->getCustomValueIteratorEnd());
+	data.vips.assign(player->VIPList.begin(), player->VIPList.end());
+	return true;
+}
+
+bool IOPlayer::writePlayer(const PlayerSaveData& data, const PlayerSaveData* saved /*= NULL*/, bool transaction /*= true*/)
+{
+	//only what differs from the saved state is written
+	return writeSections(data, data.getChangedSections(saved), saved, transaction);
+}
+
+bool IOPlayer::writeSections(const PlayerSaveData& data, uint32_t sections, const PlayerSaveData* saved /*= NULL*/, bool transaction /*= true*/)
+{
+	bool writeStats = (sections & PLAYER_SAVE_STATS) != 0;
+	bool writeConditions = (sections & PLAYER_SAVE_CONDITIONS) != 0;
+	bool writeSkills = (sections & PLAYER_SAVE_SKILLS) != 0;
+	bool writeStorage = (sections & PLAYER_SAVE_STORAGE) != 0;
+	bool writeVips = (sections & PLAYER_SAVE_VIPS) != 0;
+	bool writeItems = (sections & PLAYER_SAVE_ITEMS) != 0;
+	if(!writeStats && !writeConditions && !writeSkills && !writeStorage && !writeVips && !writeItems){
+		return true;
+	}
 
-		if(!db->executeQuery(query)){
+	DatabaseDriver* db = DatabaseDriver::instance();
+	DBQuery query;
+	DBResult_ptr result;
+	DBStatement* stmt;
+
+	//check if the player has to be saved or not
+	if(!(stmt = db->prepareStatement("SELECT `save` FROM `players` WHERE `id` = ?"))){
+		return false;
+	}
+
+	stmt->bindInt(0, data.guid);
+	if(!(result = stmt->query())){
+		return false;
+	}
+
+	const uint32_t save = result->getDataInt("save");
+	result.reset();
+
+	if(save == 0)
+		return true;
+
+	DBTransaction playerTransaction(db);
+	if(transaction && !playerTransaction.begin())
+		return false;
+
+	if(writeStats){
+		// built once, saves run on several threads
+		static const std::string updatePlayer = getUpdatePlayerQuery();
+		if(!(stmt = db->prepareStatement(updatePlayer))){
+			return false;
+		}
+
+		uint32_t index = 0;
+		for(std::vector<int64_t>::const_iterator it = data.player.begin(); it != data.player.end(); ++it){
+			stmt->bindInt(index++, *it);
+		}
+		stmt->bindInt(index++, data.guid);
+		if(!stmt->execute()){
 			return false;
 		}
 	}
 
-	if(shallow)
-		return transaction.commit();
+	if(writeConditions){
+		if(!(stmt = db->prepareStatement("UPDATE `players` SET `conditions` = ? WHERE `id` = ?"))){
+			return false;
+		}
+
+		stmt->bindBlob(0, data.conditions.data(), data.conditions.length());
+		stmt->bindInt(1, data.guid);
+		if(!stmt->execute()){
+			return false;
+		}
+	}
+
+	if(writeSkills){
+		if(!(stmt = db->prepareStatement("UPDATE `player_skills` SET `value` = ?, `count` = ? WHERE `player_id` = ? AND `skill_id` = ?"))){
+			return false;
+		}
+
+		for(uint32_t i = 0; i < data.skills.size(); ++i){
+			if(saved && i < saved->skills.size() && data.skills[i] == saved->skills[i]){
+				continue;
+			}
+
+			stmt->bindInt(0, data.skills[i].first);
+			stmt->bindInt(1, data.skills[i].second);
+			stmt->bindInt(2, data.guid);
+			stmt->bindInt(3, i);
+			if(!stmt->execute()){
+				return false;
+			}
+		}
+	}
 
 	// deletes all player-related stuff
 
@@ -503,108 +949,292 @@ bool IOPlayer::savePlayer(Player* player, bool shallow)
 	query.str("");
 	*/
 
-	query.reset();
-	query << "DELETE FROM `player_storage` WHERE `player_id` = " << player->getGUID();
-
-	if(!db->executeQuery(query)){
+	if(writeStorage && !writeStorageRows(db, data, saved)){
 		return false;
 	}
 
-	query.reset();
-	query << "DELETE FROM `player_viplist` WHERE `player_id` = " << player->getGUID();
+	if(writeVips && !writeVipRows(db, data, saved)){
+		return false;
+	}
 
-	if(!db->executeQuery(query.str())){
+	if(writeItems && !writeItemRows(db, data, saved && saved->items ? saved : NULL)){
 		return false;
 	}
 
-	// Starti inserting
-	DBInsert insert(db);
+	//End the transaction
+	return !transaction || playerTransaction.commit();
+}
 
-	/*
-	ItemBlockList itemList;
-	Item* item;
-	for(int32_t slotId = 1; slotId <= 10; ++slotId){
-		if((item = player->inventory[slotId])){
-			itemList.push_back(itemBlock(slotId, item));
+bool IOPlayer::writeStorageRows(DatabaseDriver* db, const PlayerSaveData& data, const PlayerSaveData* saved)
+{
+	DBStatement* stmt;
+	if(!saved){
+		if(!(stmt = db->prepareStatement("DELETE FROM `player_storage` WHERE `player_id` = ?"))){
+			return false;
+		}
+
+		stmt->bindInt(0, data.guid);
+		if(!stmt->execute()){
+			return false;
 		}
 	}
 
-	//item saving
-	stmt.setQuery("INSERT INTO `player_items` (`player_id` , `pid` , `sid` , `itemtype` , `count` , `attributes` ) VALUES ");
-	if(!(saveItems(player, itemList, stmt) && stmt.execute())){
+	DBStatement* insert = db->prepareStatement("INSERT INTO `player_storage` (`player_id` , `id` , `value` ) VALUES (?, ?, ?)");
+	DBStatement* update = db->prepareStatement("UPDATE `player_storage` SET `value` = ? WHERE `player_id` = ? AND `id` = ?");
+	DBStatement* remove = db->prepareStatement("DELETE FROM `player_storage` WHERE `player_id` = ? AND `id` = ?");
+	if(!insert || !update || !remove){
 		return false;
 	}
 
-	itemList.clear();
-	for(DepotMap::iterator it = player->depots.begin(); it != player->depots.end(); ++it){
-		itemList.push_back(itemBlock(it->first, it->second));
+	//both lists are sorted by key, walk them side by side
+	typedef std::vector<std::pair<std::string, std::string> > StorageList;
+	StorageList::const_iterator it = data.storage.begin();
+	StorageList::const_iterator old = saved ? saved->storage.begin() : data.storage.end();
+	StorageList::const_iterator oldEnd = saved ? saved->storage.end() : data.storage.end();
+	while(it != data.storage.end() || old != oldEnd){
+		if(old == oldEnd || (it != data.storage.end() && it->first < old->first)){
+			stmt = insert;
+			stmt->bindInt(0, data.guid);
+			stmt->bindString(1, it->first);
+			stmt->bindString(2, it->second);
+			++it;
+		}
+		else if(it == data.storage.end() || old->first < it->first){
+			stmt = remove;
+			stmt->bindInt(0, data.guid);
+			stmt->bindString(1, old->first);
+			++old;
+		}
+		else{
+			if(it->second == old->second){
+				++it;
+				++old;
+				continue;
+			}
+
+			stmt = update;
+			stmt->bindString(0, it->second);
+			stmt->bindInt(1, data.guid);
+			stmt->bindString(2, it->first);
+			++it;
+			++old;
+		}
+
+		if(!stmt->execute()){
+			return false;
+		}
 	}
+	return true;
+}
 
-	//save depot items
-	stmt.setQuery("INSERT INTO `player_depotitems` (`player_id` , `pid` , `sid` , `itemtype` , `count` , `attributes` ) VALUES ");
-	if(!(saveItems(player, itemList, stmt) && stmt.execute())){
-		return false;
+bool IOPlayer::writeItemRows(DatabaseDriver* db, const PlayerSaveData& data, const PlayerSaveData* saved)
+{
+	DBStatement* stmt;
+	if(!saved){
+		if(!(stmt = db->prepareStatement("DELETE FROM `player_inventory_store` WHERE `player_id` = ?"))){
+			return false;
+		}
+
+		stmt->bindInt(0, data.guid);
+		if(!stmt->execute()){
+			return false;
+		}
+
+		if(!(stmt = db->prepareStatement("DELETE FROM `player_depot_store` WHERE `player_id` = ?"))){
+			return false;
+		}
+
+		stmt->bindInt(0, data.guid);
+		if(!stmt->execute()){
+			return false;
+		}
 	}
-	*/
 
-	insert.setQuery("INSERT INTO `player_storage` (`player_id` , `id` , `value` ) VALUES ");
-	for(StorageMap::const_iterator cit = player->getCustomValueIteratorBegin(); cit != player->getCustomValueIteratorEnd();cit++){
-		query.reset();
-		query << player->getGUID() << ", " << db->escapeString(cit->first) << ", " << db->escapeString(cit->second);
-		if(!insert.addRow(query.str())){
+	if(!saved || data.inventory != saved->inventory){
+		//an empty saved inventory has no row yet
+		if(!saved || saved->inventory.empty()){
+			stmt = db->prepareStatement("INSERT INTO `player_inventory_store` (`data`, `player_id`) VALUES (?, ?)");
+		}
+		else{
+			stmt = db->prepareStatement("UPDATE `player_inventory_store` SET `data` = ? WHERE `player_id` = ?");
+		}
+
+		if(!stmt){
+			return false;
+		}
+
+		stmt->bindBlob(0, data.inventory.data(), data.inventory.length());
+		stmt->bindInt(1, data.guid);
+		if(!stmt->execute()){
 			return false;
 		}
 	}
 
-	if(!insert.execute()){
+	DBStatement* insert = db->prepareStatement("INSERT INTO `player_depot_store` (`data`, `player_id`, `depot_id`) VALUES (?, ?, ?)");
+	DBStatement* update = db->prepareStatement("UPDATE `player_depot_store` SET `data` = ? WHERE `player_id` = ? AND `depot_id` = ?");
+	DBStatement* remove = db->prepareStatement("DELETE FROM `player_depot_store` WHERE `player_id` = ? AND `depot_id` = ?");
+	if(!insert || !update || !remove){
 		return false;
 	}
 
-	//save vip list
-	if(!player->VIPList.empty()){
-		query.reset();
-		query << "INSERT INTO `player_viplist` (`player_id`, `vip_id`) SELECT " << player->getGUID()
-			<< ", `id` FROM `players` WHERE `id` IN (";
-		for(VIPListSet::iterator it = player->VIPList.begin(); it != player->VIPList.end(); ){
-			query << (*it);
+	//both lists are sorted by depot id, walk them side by side
+	typedef std::vector<std::pair<uint32_t, std::string> > DepotList;
+	DepotList::const_iterator it = data.depots.begin();
+	DepotList::const_iterator old = saved ? saved->depots.begin() : data.depots.end();
+	DepotList::const_iterator oldEnd = saved ? saved->depots.end() : data.depots.end();
+	while(it != data.depots.end() || old != oldEnd){
+		if(old == oldEnd || (it != data.depots.end() && it->first < old->first)){
+			stmt = insert;
+			stmt->bindBlob(0, it->second.data(), it->second.length());
+			stmt->bindInt(1, data.guid);
+			stmt->bindInt(2, it->first);
 			++it;
-			if(it != player->VIPList.end()){
-				query << ",";
-			}
-			else{
-				query << ")";
+		}
+		else if(it == data.depots.end() || old->first < it->first){
+			stmt = remove;
+			stmt->bindInt(0, data.guid);
+			stmt->bindInt(1, old->first);
+			++old;
+		}
+		else{
+			if(it->second == old->second){
+				++it;
+				++old;
+				continue;
 			}
+
+			stmt = update;
+			stmt->bindBlob(0, it->second.data(), it->second.length());
+			stmt->bindInt(1, data.guid);
+			stmt->bindInt(2, it->first);
+			++it;
+			++old;
 		}
 
-		if(!db->executeQuery(query)){
+		if(!stmt->execute()){
 			return false;
 		}
 	}
+	return true;
+}
 
-	//End the transaction
-	return transaction.commit();
+bool IOPlayer::writeVipRows(DatabaseDriver* db, const PlayerSaveData& data, const PlayerSaveData* saved)
+{
+	DBStatement* stmt;
+	if(!saved){
+		if(!(stmt = db->prepareStatement("DELETE FROM `player_viplist` WHERE `player_id` = ?"))){
+			return false;
+		}
+
+		stmt->bindInt(0, data.guid);
+		if(!stmt->execute()){
+			return false;
+		}
+	}
+
+	//skipping deleted players
+	DBStatement* insert = db->prepareStatement("INSERT INTO `player_viplist` (`player_id`, `vip_id`) SELECT ?, `id` FROM `players` WHERE `id` = ?");
+	DBStatement* remove = db->prepareStatement("DELETE FROM `player_viplist` WHERE `player_id` = ? AND `vip_id` = ?");
+	if(!insert || !remove){
+		return false;
+	}
+
+	std::vector<uint32_t>::const_iterator it = data.vips.begin();
+	std::vector<uint32_t>::const_iterator old = saved ? saved->vips.begin() : data.vips.end();
+	std::vector<uint32_t>::const_iterator oldEnd = saved ? saved->vips.end() : data.vips.end();
+	while(it != data.vips.end() || old != oldEnd){
+		if(old == oldEnd || (it != data.vips.end() && *it < *old)){
+			stmt = insert;
+			stmt->bindInt(1, *it++);
+		}
+		else if(it == data.vips.end() || *old < *it){
+			stmt = remove;
+			stmt->bindInt(1, *old++);
+		}
+		else{
+			++it;
+			++old;
+			continue;
+		}
+
+		stmt->bindInt(0, data.guid);
+		if(!stmt->execute()){
+			return false;
+		}
+	}
+	return true;
 }
 
-bool IOPlayer::storeNameByGuid(DatabaseDriver &db, uint32_t guid)
+void IOPlayer::addPlayerDeath(Player* dying_player, const DeathList& dlist)
 {
-	DBQuery query;
-	DBResult_ptr result;
+	PlayerDeathData_ptr data(new PlayerDeathData());
+	data->guid = dying_player->getGUID();
+	data->date = std::time(NULL);
+	data->level = dying_player->getLevel();
 
-	NameCacheMap::iterator it = nameCacheMap.find(guid);
-	if(it != nameCacheMap.end())
-		return true;
+	for(DeathList::const_iterator dli = dlist.begin(); dli != dlist.end(); ++dli){
+		const DeathEntry& de = *dli;
+		PlayerDeathData::Killer killer;
+
+		if(de.isCreatureKill()){
+			Creature* c = de.getKillerCreature();
+			Player* player = c->getPlayer();
 
-	query << "SELECT `name` FROM `players` WHERE `id` = " << guid;
+			if(c->isPlayerSummon()){
+				// Set player, next it will insert GUID
+				player = c->getPlayerMaster();
+				// Set name, so the environment insert happens
+				killer.name = c->getNameDescription();
+			}
 
-	if(!(result = db.storeQuery(query)))
+			if(player){
+				killer.playerGuid = player->getGUID();
+				killer.unjustified = de.isUnjustKill();
+			}
+			else{ // Kill wasn't player, store name so next insert catches it
+				killer.name = c->getNameDescription();
+			}
+		}
+		else{ // Not a creature kill
+			killer.name = de.getKillerName();
+		}
+
+		data->killers.push_back(killer);
+	}
+
+	// replaying the journal skips the deaths the database has, the row
+	// does not wait for the record
+	PlayerJournal::getInstance()->addDeath(data);
+	g_databaseExecutor.addWriteJob(boost::bind(&IOPlayer::writeDeath, this, data));
+}
+
+void IOPlayer::writeDeath(PlayerDeathData_ptr data)
+{
+	//database thread
+	if(!writePlayerDeath(data)){
+		PlayerJournal::getInstance()->setUnwritten();
+	}
+}
+
+bool IOPlayer::hasPlayerDeath(const PlayerDeathData& data)
+{
+	DatabaseDriver* db = DatabaseDriver::instance();
+	DBQuery query;
+	DBStatement* stmt = db->prepareStatement("SELECT `id` FROM `player_deaths` WHERE `player_id` = ? AND `date` = ? AND `level` = ?");
+	if(!stmt){
 		return false;
+	}
 
-	nameCacheMap[guid] = result->getDataString("name");
-	return true;
+	stmt->bindInt(0, data.guid);
+	stmt->bindInt(1, data.date);
+	stmt->bindInt(2, data.level);
+	DBResult_ptr result = stmt->query();
+	return result.get() != NULL;
 }
 
-bool IOPlayer::addPlayerDeath(Player* dying_player, const DeathList& dlist)
+bool IOPlayer::writePlayerDeath(PlayerDeathData_ptr data)
 {
+	//database thread
 	DatabaseDriver* db = DatabaseDriver::instance();
 
 	DBQuery query;
@@ -617,7 +1247,7 @@ bool IOPlayer::addPlayerDeath(Player* dying_player, const DeathList& dlist)
 		death_stmt.setQuery("INSERT INTO `player_deaths` (`player_id`, `date`, `level`) VALUES ");
 
 		query.reset();
-		query << dying_player->getGUID() << ", " << std::time(NULL) << " , " << dying_player->getLevel();
+		query << data->guid << ", " << data->date << " , " << data->level;
 		if(!death_stmt.addRow(query.str()))
 			return false;
 		if(!death_stmt.execute())
@@ -627,12 +1257,12 @@ bool IOPlayer::addPlayerDeath(Player* dying_player, const DeathList& dlist)
 	uint64_t death_id = db->getLastInsertedRowID();
 
 	// Then insert the killers...
-	for(DeathList::const_iterator dli = dlist.begin(); dli != dlist.end(); ++dli){
+	for(std::vector<PlayerDeathData::Killer>::const_iterator it = data->killers.begin(); it != data->killers.end(); ++it){
 		DBInsert killer_stmt(db);
 		killer_stmt.setQuery("INSERT INTO `killers` (`death_id`, `final_hit`) VALUES ");
 
 		query.reset();
-		query << death_id << ", " << (dli == dlist.begin()? 1 : 0);
+		query << death_id << ", " << (it == data->killers.begin()? 1 : 0);
 		if(!killer_stmt.addRow(query.str()))
 			return false;
 		if(!killer_stmt.execute())
@@ -640,51 +1270,27 @@ bool IOPlayer::addPlayerDeath(Player* dying_player, const DeathList& dlist)
 
 		uint64_t kill_id = db->getLastInsertedRowID();
 
-		const DeathEntry& de = *dli;
+		if(it->playerGuid != 0){
+			//reset unjust kill cache
+			unjustKillCacheMap.erase(it->playerGuid);
 
-		std::string name;
-		if(de.isCreatureKill()){
-			Creature* c = de.getKillerCreature();
-			Player* player = c->getPlayer();
+			DBInsert player_killers_stmt(db);
+			player_killers_stmt.setQuery("INSERT INTO `player_killers` (`kill_id`, `player_id`, `unjustified`) VALUES ");
 
-			if(c->isPlayerSummon()){
-				// Set player, next it will insert GUID
-				player = c->getPlayerMaster();
-				// Set name, so the environment insert happens
-				name = c->getNameDescription();
-			}
-
-			if(player){
-				//reset unjust kill cache
-				UnjustCacheMap::iterator it = unjustKillCacheMap.find(player->getGUID());
-				if(it != unjustKillCacheMap.end()){
-					unjustKillCacheMap.erase(it);
-				}
-
-				DBInsert player_killers_stmt(db);
-				player_killers_stmt.setQuery("INSERT INTO `player_killers` (`kill_id`, `player_id`, `unjustified`) VALUES ");
-
-				query.reset();
-				query << kill_id << ", " << player->getGUID() << ", " << (de.isUnjustKill() ? 1 : 0);
-				if(!player_killers_stmt.addRow(query.str()))
-					return false;
-				if(!player_killers_stmt.execute())
-					return false;
-			}
-			else{ // Kill wasn't player, store name so next insert catches it
-				name = c->getNameDescription();
-			}
-		}
-		else{ // Not a creature kill
-			name = de.getKillerName();
+			query.reset();
+			query << kill_id << ", " << it->playerGuid << ", " << (it->unjustified ? 1 : 0);
+			if(!player_killers_stmt.addRow(query.str()))
+				return false;
+			if(!player_killers_stmt.execute())
+				return false;
 		}
 
-		if(name.size() > 0){
+		if(it->name.size() > 0){
 			DBInsert env_killers_stmt(db);
 			env_killers_stmt.setQuery("INSERT INTO `environment_killers` (`kill_id`, `name`) VALUES ");
 
 			query.reset();
-			query << kill_id << ", " << db->escapeString(name);
+			query << kill_id << ", " << db->escapeString(it->name);
 			if(!env_killers_stmt.addRow(query.str()))
 				return false;
 			if(!env_killers_stmt.execute())
@@ -695,7 +1301,23 @@ bool IOPlayer::addPlayerDeath(Player* dying_player, const DeathList& dlist)
 	return transaction.commit();
 }
 
-int32_t IOPlayer::getPlayerUnjustKillCount(const Player* player, UnjustKillPeriod_t period)
+void IOPlayer::fetchUnjustKillCount(uint32_t guid, const boost::function<void (UnjustKillCount_ptr)>& callback)
+{
+	// Same worker as addPlayerDeath, the deaths queued before are counted
+	UnjustKillCount_ptr count(new UnjustKillCount());
+	g_databaseExecutor.addJob(boost::bind(&IOPlayer::readUnjustKillCount, this, guid, count),
+		boost::bind(callback, count));
+}
+
+void IOPlayer::readUnjustKillCount(uint32_t guid, UnjustKillCount_ptr count)
+{
+	//database thread
+	count->day = getPlayerUnjustKillCount(guid, UNJUST_KILL_PERIOD_DAY);
+	count->week = getPlayerUnjustKillCount(guid, UNJUST_KILL_PERIOD_WEEK);
+	count->month = getPlayerUnjustKillCount(guid, UNJUST_KILL_PERIOD_MONTH);
+}
+
+int32_t IOPlayer::getPlayerUnjustKillCount(uint32_t guid, UnjustKillPeriod_t period)
 {
 	time_t currentTime = std::time(NULL);
 
@@ -720,7 +1342,7 @@ int32_t IOPlayer::getPlayerUnjustKillCount(const Player* player, UnjustKillPerio
 
 	UnjustKillBlock uk;
 
-	UnjustCacheMap::iterator it = unjustKillCacheMap.find(player->getGUID());
+	UnjustCacheMap::iterator it = unjustKillCacheMap.find(guid);
 	if(it != unjustKillCacheMap.end()){
 		uk = it->second;
 
@@ -759,7 +1381,7 @@ int32_t IOPlayer::getPlayerUnjustKillCount(const Player* player, UnjustKillPerio
 	query << "LEFT JOIN ";
 	query << "`players` on `players`.`id` = `player_deaths`.`player_id` ";
 	query << "WHERE ";
-	query << "`player_killers`.`player_id` = " << player->getGUID() << " "
+	query << "`player_killers`.`player_id` = " << guid << " "
 		<< "AND " << "`player_killers`.`unjustified` = " << " 1 "
 		<< "AND " << date  << " < `player_deaths`.`date` "
 		<< "ORDER BY `player_deaths`.`date` ASC";
@@ -797,7 +1419,7 @@ int32_t IOPlayer::getPlayerUnjustKillCount(const Player* player, UnjustKillPerio
 			break;
 	}
 
-	unjustKillCacheMap[player->getGUID()] = uk;
+	unjustKillCacheMap[guid] = uk;
 	return count;
 }
 
@@ -825,7 +1447,7 @@ bool IOPlayer::sendMail(Creature* actor, const std::string name, uint32_t depotI
 	}
 
 	if(player->isOffline()){
-		IOPlayer::instance()->savePlayer(player);
+		IOPlayer::instance()->savePlayerAsync(player);
 		delete player;
 	}
 
@@ -834,49 +1456,62 @@ bool IOPlayer::sendMail(Creature* actor, const std::string name, uint32_t depotI
 
 bool IOPlayer::getNameByGuid(uint32_t guid, std::string& name)
 {
+	boost::mutex::scoped_lock lockClass(cacheLock);
 	NameCacheMap::iterator it = nameCacheMap.find(guid);
 	if(it != nameCacheMap.end()){
 		name = it->second;
 		return true;
 	}
+	lockClass.unlock();
 
 	DatabaseDriver* db = DatabaseDriver::instance();
 	DBQuery query;
 	DBResult_ptr result;
+	DBStatement* stmt = db->prepareStatement("SELECT `name` FROM `players` WHERE `world_id` = ? AND `id` = ?");
+	if(!stmt)
+		return false;
 
-	query << "SELECT `name` FROM `players` WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID) << " AND `id` = " << guid;
-
-	if(!(result = db->storeQuery(query)))
+	stmt->bindInt(0, g_config.getNumber(ConfigManager::WORLD_ID));
+	stmt->bindInt(1, guid);
+	if(!(result = stmt->query()))
 		return false;
 
 	name = result->getDataString("name");
+	lockClass.lock();
 	nameCacheMap[guid] = name;
 	return true;
 }
 
 bool IOPlayer::getGuidByName(uint32_t &guid, std::string& name)
 {
+	boost::mutex::scoped_lock lockClass(cacheLock);
 	GuidCacheMap::iterator it = guidCacheMap.find(name);
 	if(it != guidCacheMap.end()){
 		name = it->first;
 		guid = it->second;
 		return true;
 	}
+	lockClass.unlock();
 
 	DatabaseDriver* db = DatabaseDriver::instance();
-	DBResult_ptr result;
 	DBQuery query;
-
-	query <<
+	DBResult_ptr result;
+	DBStatement* stmt = db->prepareStatement(
 		"SELECT `name`, `id` "
 		"FROM `players` "
-		"WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID) << " AND `name` = " << db->escapeString(name);
-	if(!(result = db->storeQuery(query)))
+		"WHERE `world_id` = ? AND `name` = ?");
+	if(!stmt)
+		return false;
+
+	stmt->bindInt(0, g_config.getNumber(ConfigManager::WORLD_ID));
+	stmt->bindString(1, name);
+	if(!(result = stmt->query()))
 		return false;
 
 	name = result->getDataString("name");
 	guid = result->getDataInt("id");
 
+	lockClass.lock();
 	guidCacheMap[name] = guid;
 	return true;
 }
@@ -1070,25 +1705,43 @@ bool IOPlayer::getLastIP(uint32_t& ip, uint32_t guid)
 
 void IOPlayer::updateLoginInfo(Player* player)
 {
+	// Written on the database thread, the executor keeps it in order
+	// with the logout info of the same player
+	g_databaseExecutor.addWriteJob(DatabaseExecutor::getPlayerKey(player->getName()),
+		boost::bind(&IOPlayer::writeLoginInfo, this,
+		player->getGUID(), player->lastLoginSaved, player->lastip));
+}
+
+void IOPlayer::updateLogoutInfo(Player* player)
+{
+	g_databaseExecutor.addWriteJob(DatabaseExecutor::getPlayerKey(player->getName()),
+		boost::bind(&IOPlayer::writeLogoutInfo, this,
+		player->getGUID(), player->lastLogout));
+}
+
+void IOPlayer::writeLoginInfo(uint32_t guid, time_t lastLogin, uint32_t lastip)
+{
+	//database thread
 	DatabaseDriver* db = DatabaseDriver::instance();
 	DBQuery query;
 
-	query << "UPDATE `players` SET `lastlogin` = " << player->lastLoginSaved
-			<< ", `lastip` = " << player->lastip
+	query << "UPDATE `players` SET `lastlogin` = " << lastLogin
+			<< ", `lastip` = " << lastip
 			<< ", `online` = 1"
-			<< " WHERE `id` = " << player->getGUID();
+			<< " WHERE `id` = " << guid;
 
 	db->executeQuery(query);
 }
 
-void IOPlayer::updateLogoutInfo(Player* player)
+void IOPlayer::writeLogoutInfo(uint32_t guid, time_t lastLogout)
 {
+	//database thread
 	DatabaseDriver* db = DatabaseDriver::instance();
 	DBQuery query;
 
-	query << "UPDATE `players` SET `lastlogout` = " << player->lastLogout
+	query << "UPDATE `players` SET `lastlogout` = " << lastLogout
 			<< ", `online` = 0"
-			<< " WHERE `id` = " << player->getGUID();
+			<< " WHERE `id` = " << guid;
 
 	db->executeQuery(query);
 }
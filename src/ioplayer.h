@@ -27,6 +27,8 @@
 #include <string>
 #include <stdint.h>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
 #include "database_driver.h"
 #include "const.h"
 
@@ -34,15 +36,127 @@ class Item;
 class Player;
 class Creature;
 struct DeathEntry;
+struct PlayerJournalContents;
 
 typedef std::vector<DeathEntry> DeathList;
 
+// Written first in the inventory and depot blobs of the binary storage
+#define PLAYER_ITEMS_VERSION 1
+
+// The parts of a player written by IOPlayer::writeSections
+enum PlayerSaveSection_t {
+	PLAYER_SAVE_STATS = 1 << 0,
+	PLAYER_SAVE_CONDITIONS = 1 << 1,
+	PLAYER_SAVE_SKILLS = 1 << 2,
+	PLAYER_SAVE_STORAGE = 1 << 3,
+	PLAYER_SAVE_VIPS = 1 << 4,
+	PLAYER_SAVE_ITEMS = 1 << 5
+};
+
 enum UnjustKillPeriod_t{
 	UNJUST_KILL_PERIOD_DAY,
 	UNJUST_KILL_PERIOD_WEEK,
 	UNJUST_KILL_PERIOD_MONTH
 };
 
+/** Database rows of a player, fetched by IOPlayer::fetchPlayer. The rows
+  * are kept in memory, so they can be loaded on another thread without
+  * touching the database. Loading consumes the multi-row results. */
+struct PlayerData {
+	DBResult_ptr player;
+	DBResult_ptr guild;
+	DBResult_ptr skills;
+	DBResult_ptr storage;
+	DBResult_ptr vips;
+	// player_storage_type "binary" only
+	DBResult_ptr inventory;
+	DBResult_ptr depots;
+};
+
+typedef boost::shared_ptr<PlayerData> PlayerData_ptr;
+
+/** Everything IOPlayer::writePlayer writes, built from the player on the
+  * dispatcher thread, so it can be written later from any thread. It is
+  * never changed once built, the last one written stays with the player
+  * to compare the next save with. */
+struct PlayerSaveData {
+	PlayerSaveData() : guid(0), shallow(false), failed(false), unwritten(false), items(false) {}
+
+	uint32_t guid;
+	std::string name;
+	bool shallow;
+	// set on the dispatcher when a save queued with it as the next saved
+	// state reported it could not be written, the saves after it write
+	// everything
+	bool failed;
+	// the same for the database thread, set there before the writes queued
+	// after the failed save run
+	bool unwritten;
+	// the columns of the players row, in the order of the UPDATE
+	std::vector<int64_t> player;
+	std::string conditions;
+	// level and tries, by skill id
+	std::vector<std::pair<uint32_t, uint32_t> > skills;
+	// both sorted
+	std::vector<std::pair<std::string, std::string> > storage;
+	std::vector<uint32_t> vips;
+	// the blobs of the binary storage, items is false when they were not
+	// built, depots are sorted by id
+	bool items;
+	std::string inventory;
+	std::vector<std::pair<uint32_t, std::string> > depots;
+
+	// The PlayerSaveSection_t that differ from saved, all of them without
+	// it. Shallow saves leave out the storage and vips.
+	uint32_t getChangedSections(const PlayerSaveData* saved) const
+	{
+		uint32_t sections = 0;
+		if(!saved || player != saved->player)
+			sections |= PLAYER_SAVE_STATS;
+		if(!saved || conditions != saved->conditions)
+			sections |= PLAYER_SAVE_CONDITIONS;
+		if(!saved || skills != saved->skills)
+			sections |= PLAYER_SAVE_SKILLS;
+		if(!shallow && (!saved || storage != saved->storage))
+			sections |= PLAYER_SAVE_STORAGE;
+		if(!shallow && (!saved || vips != saved->vips))
+			sections |= PLAYER_SAVE_VIPS;
+		if(items && (!saved || !saved->items || inventory != saved->inventory || depots != saved->depots))
+			sections |= PLAYER_SAVE_ITEMS;
+		return sections;
+	}
+};
+
+typedef boost::shared_ptr<PlayerSaveData> PlayerSaveData_ptr;
+
+/** A death and its killers, see IOPlayer::addPlayerDeath */
+struct PlayerDeathData {
+	struct Killer {
+		Killer() : playerGuid(0), unjustified(false) {}
+
+		uint32_t playerGuid;
+		bool unjustified;
+		std::string name;
+	};
+
+	uint32_t guid;
+	time_t date;
+	uint32_t level;
+	std::vector<Killer> killers;
+};
+
+typedef boost::shared_ptr<PlayerDeathData> PlayerDeathData_ptr;
+
+struct UnjustKillCount {
+	UnjustKillCount() : day(0), week(0), month(0) {}
+
+	int32_t day;
+	int32_t week;
+	int32_t month;
+};
+
+typedef boost::shared_ptr<UnjustKillCount> UnjustKillCount_ptr;
+
 typedef std::pair<int32_t, Item*> itemBlock;
 typedef std::list<itemBlock> ItemBlockList;
 
@@ -59,14 +173,77 @@ public:
 	  */
 	bool loadPlayer(Player* player, const std::string& name, bool preload = false);
 
-	/** Save a player
+	/** Run all the queries needed to load a player, safe to call from any thread
+	  * \param data receives the rows
+	  * \param name Name of the player
+	  * \param preload if set to true only the player row is fetched, default: false
+	  * \return returns true if the player exists
+	  */
+	bool fetchPlayer(PlayerData& data, const std::string& name, bool preload = false);
+
+	/** Load a player from rows fetched before, does not touch the database
+	  * \param player Player structure to load to
+	  * \param data rows returned by fetchPlayer
+	  * \param preload if set to true only group, guid and account id will be loaded, default: false
+	  * \return returns true if the player was successfully loaded
+	  */
+	bool loadPlayer(Player* player, PlayerData& data, bool preload = false);
+
+	/** Save a player on the database thread, only what changed since the
+	  * player was loaded or saved. For players that are logging out and
+	  * offline players loaded to change them, saves and loads of the same
+	  * player are kept in order, the player may be deleted right after.
 	  * \param player the player to save
+	  */
+	void savePlayerAsync(Player* player);
+
+	/** Build the queries that save a player, does not touch the database
+	  * \param player the player to save
+	  * \param data receives the queries
+	  * \return false if the player could not be serialized
+	  */
+	bool prepareSave(Player* player, PlayerSaveData& data, bool shallow = false);
+
+	/** Run the queries built by prepareSave, safe to call from any thread
+	  * \param data the player to save
+	  * \param saved what the database holds, only the rows that differ from it are
+	  * written, everything when it is NULL. It may not have failed, the caller
+	  * checks the flag of its thread
+	  * \param transaction false when the caller holds a transaction already
 	  * \return true if the player was successfully saved
 	  */
-	bool savePlayer(Player* player, bool shallow = false);
+	bool writePlayer(const PlayerSaveData& data, const PlayerSaveData* saved = NULL, bool transaction = true);
+
+	/** Run the queries of some parts of a player, see writePlayer
+	  * \param sections the PlayerSaveSection_t to write
+	  * \param saved what the database holds, it may not have failed
+	  */
+	bool writeSections(const PlayerSaveData& data, uint32_t sections, const PlayerSaveData* saved = NULL, bool transaction = true);
 
-	bool addPlayerDeath(Player* dying_player, const DeathList& dl);
-	int32_t getPlayerUnjustKillCount(const Player* player, UnjustKillPeriod_t period);
+	/** What the database holds once data was written over saved, the state
+	  * the next save of the player compares with
+	  * \return NULL when it is unknown
+	  */
+	static PlayerSaveData_ptr getSavedState(const PlayerSaveData_ptr& data, const PlayerSaveData_ptr& saved);
+
+	/** Add a save of a player to the player journal
+	  * \return the sequence to wait for before data is written, 0 when the
+	  * journal is disabled
+	  */
+	uint64_t journalPlayer(Player* player, const PlayerSaveData_ptr& data);
+
+	/** Write what the player journal held after a crash, before the game opens
+	  * \return false if the database could not be written
+	  */
+	bool writeJournal(const PlayerJournalContents& contents);
+
+	/** Record a death, the rows are written on the database thread */
+	void addPlayerDeath(Player* dying_player, const DeathList& dl);
+
+	/** Count the unjustified kills of a player on the database thread, the
+	  * count includes all deaths added before. callback runs on the dispatcher.
+	  */
+	void fetchUnjustKillCount(uint32_t guid, const boost::function<void (UnjustKillCount_ptr)>& callback);
 	bool sendMail(Creature* actor, const std::string name, uint32_t depotId, Item* item);
 
 	bool getGuidByName(uint32_t& guid, std::string& player_name);
@@ -86,7 +263,24 @@ public:
 	bool cleanOnlineInfo();
 
 protected:
-	bool storeNameByGuid(DatabaseDriver &mysql, uint32_t guid);
+	void writeLoginInfo(uint32_t guid, time_t lastLogin, uint32_t lastip);
+	void writeLogoutInfo(uint32_t guid, time_t lastLogout);
+	void writeLogoutSave(PlayerSaveData_ptr data, PlayerSaveData_ptr saved, uint64_t journalSequence);
+	bool serializePlayer(Player* player, PlayerSaveData& data, bool shallow);
+	void serializeItems(Player* player, PlayerSaveData& data);
+	bool unserializeInventory(Player* player, boost::string_view blob);
+	bool unserializeDepot(Player* player, uint32_t depotId, boost::string_view blob);
+	// The rows that differ from saved, all of them without it
+	bool writeStorageRows(DatabaseDriver* db, const PlayerSaveData& data, const PlayerSaveData* saved);
+	bool writeVipRows(DatabaseDriver* db, const PlayerSaveData& data, const PlayerSaveData* saved);
+	bool writeItemRows(DatabaseDriver* db, const PlayerSaveData& data, const PlayerSaveData* saved);
+	void writeDeath(PlayerDeathData_ptr data);
+	bool writePlayerDeath(PlayerDeathData_ptr data);
+	bool hasPlayerDeath(const PlayerDeathData& data);
+	void readUnjustKillCount(uint32_t guid, UnjustKillCount_ptr count);
+	// Deaths and unjust kill counts share one database worker, it is the
+	// only thread that touches unjustKillCacheMap
+	int32_t getPlayerUnjustKillCount(uint32_t guid, UnjustKillPeriod_t period);
 
 	struct StringCompareCase
 	{
@@ -135,6 +329,8 @@ protected:
 
 	typedef std::map<uint32_t, UnjustKillBlock > UnjustCacheMap;
 
+	// Guards the name caches, they are used by the dispatcher and database threads
+	boost::mutex cacheLock;
 	NameCacheMap nameCacheMap;
 	GuidCacheMap guidCacheMap;
 	UnjustCacheMap unjustKillCacheMap;
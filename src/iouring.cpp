@@ -0,0 +1,583 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#ifdef __USE_IO_URING__
+
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/bind.hpp>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <deque>
+#include <map>
+#include <vector>
+#include "iouring.h"
+
+namespace {
+	// Enough for the reads and writes started during one dispatcher tick,
+	// a full queue is submitted early
+	const uint32_t ring_entries = 1024;
+	const uint32_t completion_entries = 4096;
+
+	typedef std::map<const boost::asio::io_service*, IoUring*> RingMap;
+	RingMap rings;
+	boost::mutex ringsLock;
+
+	int io_uring_setup(uint32_t entries, io_uring_params* params)
+	{
+		return (int)syscall(__NR_io_uring_setup, entries, params);
+	}
+
+	int io_uring_enter(int fd, uint32_t toSubmit, uint32_t minComplete, uint32_t flags)
+	{
+		return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+	}
+
+	int io_uring_register(int fd, uint32_t opcode, const void* arg, uint32_t count)
+	{
+		return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+	}
+}
+
+struct IoUring::Operation {
+	enum Type {
+		OPERATION_READ,
+		OPERATION_WRITE,
+		OPERATION_WRITE_FIXED,
+		OPERATION_ACCEPT
+	};
+
+	Type type;
+	int fd;
+	// Reads and fixed writes
+	char* buffer;
+	size_t size;
+	size_t done;
+	// Gathered writes, the first iovec is advanced on a short write
+	std::vector<iovec> iov;
+	size_t iovIndex;
+	msghdr msg;
+
+	Handler handler;
+	AcceptHandler acceptHandler;
+};
+
+IoUring::IoUring(boost::asio::io_service& io_service) :
+	m_io_service(io_service),
+	m_eventDescriptor(io_service),
+	m_ringFd(-1),
+	m_eventFd(-1),
+	m_sqMap(MAP_FAILED),
+	m_sqMapSize(0),
+	m_cqMap(MAP_FAILED),
+	m_cqMapSize(0),
+	m_sqes((io_uring_sqe*)MAP_FAILED),
+	m_sqesSize(0),
+	m_fixedBase(NULL),
+	m_fixedSize(0),
+	m_unsubmitted(0),
+	m_submitPosted(false),
+	m_inEvent(false),
+	m_enters(0),
+	m_submitted(0),
+	m_completed(0),
+	m_fixedWrites(0)
+{
+}
+
+IoUring::~IoUring()
+{
+	boost::mutex::scoped_lock lockClass(ringsLock);
+	RingMap::iterator it = rings.find(&m_io_service);
+	if(it != rings.end() && it->second == this){
+		rings.erase(it);
+	}
+	lockClass.unlock();
+
+	// Operations still in flight are dropped with the ring, this only
+	// happens once the io_service has been stopped
+	for(std::deque<Operation*>::iterator it = m_overflow.begin(); it != m_overflow.end(); ++it){
+		delete *it;
+	}
+
+	boost::system::error_code error;
+	m_eventDescriptor.close(error);
+	if(m_sqes != MAP_FAILED){
+		munmap(m_sqes, m_sqesSize);
+	}
+	if(m_cqMap != MAP_FAILED && m_cqMap != m_sqMap){
+		munmap(m_cqMap, m_cqMapSize);
+	}
+	if(m_sqMap != MAP_FAILED){
+		munmap(m_sqMap, m_sqMapSize);
+	}
+	if(m_ringFd >= 0){
+		close(m_ringFd);
+	}
+}
+
+IoUring* IoUring::create(boost::asio::io_service& io_service,
+	const void* fixedBase, size_t fixedSize, std::string& error)
+{
+	IoUring* ring = new IoUring(io_service);
+	if(!ring->setup(fixedBase, fixedSize, error)){
+		delete ring;
+		return NULL;
+	}
+
+	boost::mutex::scoped_lock lockClass(ringsLock);
+	rings[&io_service] = ring;
+	lockClass.unlock();
+
+	ring->waitEvent();
+	return ring;
+}
+
+IoUring* IoUring::get(const boost::asio::io_service& io_service)
+{
+	boost::mutex::scoped_lock lockClass(ringsLock);
+	RingMap::iterator it = rings.find(&io_service);
+	if(it != rings.end()){
+		return it->second;
+	}
+	return NULL;
+}
+
+bool IoUring::setup(const void* fixedBase, size_t fixedSize, std::string& error)
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = completion_entries;
+
+	m_ringFd = io_uring_setup(ring_entries, &params);
+	if(m_ringFd < 0){
+		error = std::string("io_uring_setup: ") + strerror(errno);
+		return false;
+	}
+
+	// Without fast poll every read of an idle socket would block a kernel
+	// worker thread, without nodrop completions could get lost
+	const uint32_t features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL;
+	if((params.features & features) != features){
+		error = "kernel too old, io_uring lacks fast poll";
+		return false;
+	}
+
+	// One probe for every operation used, instead of failing the first read
+	std::vector<char> probeData(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+	io_uring_probe* probe = (io_uring_probe*)&probeData[0];
+	if(io_uring_register(m_ringFd, IORING_REGISTER_PROBE, probe, 256) < 0){
+		error = std::string("io_uring probe: ") + strerror(errno);
+		return false;
+	}
+
+	const uint8_t opcodes[] = {IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_WRITE_FIXED, IORING_OP_ACCEPT};
+	for(size_t i = 0; i < sizeof(opcodes); ++i){
+		if(opcodes[i] > probe->last_op || !(probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED)){
+			error = "io_uring lacks socket operations";
+			return false;
+		}
+	}
+
+	m_sqMapSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	m_cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	// Both rings share one mapping
+	m_sqMapSize = std::max(m_sqMapSize, m_cqMapSize);
+	m_sqMap = mmap(NULL, m_sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+	if(m_sqMap == MAP_FAILED){
+		error = std::string("io_uring mmap: ") + strerror(errno);
+		return false;
+	}
+	m_cqMap = m_sqMap;
+	m_cqMapSize = m_sqMapSize;
+
+	m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	m_sqes = (io_uring_sqe*)mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+	if(m_sqes == MAP_FAILED){
+		error = std::string("io_uring mmap: ") + strerror(errno);
+		return false;
+	}
+
+	char* sq = (char*)m_sqMap;
+	m_sqHead = (uint32_t*)(sq + params.sq_off.head);
+	m_sqTail = (uint32_t*)(sq + params.sq_off.tail);
+	m_sqFlags = (uint32_t*)(sq + params.sq_off.flags);
+	m_sqArray = (uint32_t*)(sq + params.sq_off.array);
+	m_sqMask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+	m_sqEntries = params.sq_entries;
+
+	char* cq = (char*)m_cqMap;
+	m_cqHead = (uint32_t*)(cq + params.cq_off.head);
+	m_cqTail = (uint32_t*)(cq + params.cq_off.tail);
+	m_cqMask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+	m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	// The ring signals completions through an eventfd, which the io_service
+	// waits for like for any other descriptor
+	m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(m_eventFd < 0){
+		error = std::string("eventfd: ") + strerror(errno);
+		return false;
+	}
+	m_eventDescriptor.assign(m_eventFd);
+	if(io_uring_register(m_ringFd, IORING_REGISTER_EVENTFD, &m_eventFd, 1) < 0){
+		error = std::string("io_uring eventfd: ") + strerror(errno);
+		return false;
+	}
+
+	if(fixedSize > 0){
+		iovec fixed;
+		fixed.iov_base = (void*)fixedBase;
+		fixed.iov_len = fixedSize;
+		// Pinned memory counts against RLIMIT_MEMLOCK, if it is too low
+		// the writes just don't use the registered buffer
+		if(io_uring_register(m_ringFd, IORING_REGISTER_BUFFERS, &fixed, 1) == 0){
+			m_fixedBase = (const char*)fixedBase;
+			m_fixedSize = fixedSize;
+		}
+	}
+	return true;
+}
+
+io_uring_sqe* IoUring::getSqe()
+{
+	// m_submitLock is held
+	if(*m_sqTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries){
+		return NULL;
+	}
+
+	uint32_t tail = *m_sqTail;
+	uint32_t index = tail & m_sqMask;
+	io_uring_sqe* sqe = &m_sqes[index];
+	memset(sqe, 0, sizeof(io_uring_sqe));
+	m_sqArray[index] = index;
+	return sqe;
+}
+
+void IoUring::start(Operation* op)
+{
+	// m_submitLock is held
+	io_uring_sqe* sqe = NULL;
+	if(m_overflow.empty()){
+		sqe = getSqe();
+		if(!sqe){
+			enterLocked();
+			sqe = getSqe();
+		}
+	}
+
+	if(!sqe){
+		// The kernel refuses submissions while the completion queue is
+		// full, the ring thread may be the one starting this and has to
+		// reap first. submitLocked starts it once there is room.
+		m_overflow.push_back(op);
+		return;
+	}
+
+	prepare(sqe, op);
+}
+
+void IoUring::prepare(io_uring_sqe* sqe, Operation* op)
+{
+	// m_submitLock is held
+	sqe->fd = op->fd;
+	sqe->user_data = (uint64_t)(uintptr_t)op;
+
+	switch(op->type){
+		case Operation::OPERATION_READ:
+			sqe->opcode = IORING_OP_RECV;
+			sqe->addr = (uint64_t)(uintptr_t)(op->buffer + op->done);
+			sqe->len = op->size - op->done;
+			break;
+
+		case Operation::OPERATION_WRITE_FIXED:
+			// Sockets are not seekable, offset 0 is the only one accepted
+			sqe->opcode = IORING_OP_WRITE_FIXED;
+			sqe->addr = (uint64_t)(uintptr_t)(op->buffer + op->done);
+			sqe->len = op->size - op->done;
+			sqe->buf_index = 0;
+			break;
+
+		case Operation::OPERATION_WRITE:
+			memset(&op->msg, 0, sizeof(op->msg));
+			op->msg.msg_iov = &op->iov[op->iovIndex];
+			op->msg.msg_iovlen = op->iov.size() - op->iovIndex;
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->addr = (uint64_t)(uintptr_t)&op->msg;
+			sqe->len = 1;
+			sqe->msg_flags = MSG_NOSIGNAL;
+			break;
+
+		case Operation::OPERATION_ACCEPT:
+			sqe->opcode = IORING_OP_ACCEPT;
+			sqe->accept_flags = SOCK_CLOEXEC;
+			break;
+	}
+
+	__atomic_store_n(m_sqTail, *m_sqTail + 1, __ATOMIC_RELEASE);
+	++m_unsubmitted;
+}
+
+void IoUring::queue(Operation* op)
+{
+	boost::mutex::scoped_lock lockClass(m_submitLock);
+	start(op);
+
+	// Handlers started by a completion are submitted together once all
+	// completions are handled, everything else with one posted submit
+	if(!m_inEvent && !m_submitPosted){
+		m_submitPosted = true;
+		m_io_service.post(boost::bind(&IoUring::submit, this));
+	}
+}
+
+void IoUring::asyncRead(int fd, char* buffer, size_t size, const Handler& handler)
+{
+	Operation* op = new Operation();
+	op->type = Operation::OPERATION_READ;
+	op->fd = fd;
+	op->buffer = buffer;
+	op->size = size;
+	op->done = 0;
+	op->handler = handler;
+	queue(op);
+}
+
+void IoUring::asyncWrite(int fd, const boost::asio::const_buffer* buffers, size_t count, const Handler& handler)
+{
+	Operation* op = new Operation();
+	op->fd = fd;
+	op->done = 0;
+	op->handler = handler;
+
+	const char* data = boost::asio::buffer_cast<const char*>(buffers[0]);
+	size_t size = boost::asio::buffer_size(buffers[0]);
+	if(count == 1 && data >= m_fixedBase && data + size <= m_fixedBase + m_fixedSize){
+		// A single pooled message, the kernel skips pinning its pages
+		op->type = Operation::OPERATION_WRITE_FIXED;
+		op->buffer = (char*)data;
+		op->size = size;
+		++m_fixedWrites;
+	}
+	else{
+		op->type = Operation::OPERATION_WRITE;
+		op->iov.resize(count);
+		op->size = 0;
+		for(size_t i = 0; i < count; ++i){
+			op->iov[i].iov_base = (void*)boost::asio::buffer_cast<const char*>(buffers[i]);
+			op->iov[i].iov_len = boost::asio::buffer_size(buffers[i]);
+			op->size += op->iov[i].iov_len;
+		}
+		op->iovIndex = 0;
+	}
+	queue(op);
+}
+
+void IoUring::asyncAccept(int fd, const AcceptHandler& handler)
+{
+	Operation* op = new Operation();
+	op->type = Operation::OPERATION_ACCEPT;
+	op->fd = fd;
+	op->acceptHandler = handler;
+	queue(op);
+}
+
+void IoUring::waitEvent()
+{
+	m_eventDescriptor.async_read_some(boost::asio::null_buffers(),
+		boost::bind(&IoUring::onEvent, this, boost::asio::placeholders::error));
+}
+
+void IoUring::onEvent(const boost::system::error_code& error)
+{
+	if(error == boost::asio::error::operation_aborted){
+		return;
+	}
+
+	// Cleared before reaping, a completion posted later signals again
+	uint64_t value;
+	if(read(m_eventFd, &value, sizeof(value)) < 0){
+		// EAGAIN, someone else already cleared it
+	}
+
+	m_submitLock.lock();
+	m_inEvent = true;
+	m_submitLock.unlock();
+
+	reap();
+
+	m_submitLock.lock();
+	m_inEvent = false;
+	submitLocked();
+	m_submitLock.unlock();
+
+	waitEvent();
+}
+
+void IoUring::reap()
+{
+	while(true){
+		uint32_t head = *m_cqHead;
+		if(head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)){
+			if(!(__atomic_load_n(m_sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)){
+				break;
+			}
+
+			// Completions that did not fit are moved to the queue by the kernel
+			++m_enters;
+			io_uring_enter(m_ringFd, 0, 0, IORING_ENTER_GETEVENTS);
+			continue;
+		}
+
+		io_uring_cqe* cqe = &m_cqes[head & m_cqMask];
+		Operation* op = (Operation*)(uintptr_t)cqe->user_data;
+		int32_t result = cqe->res;
+		__atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+
+		++m_completed;
+		complete(op, result);
+	}
+}
+
+void IoUring::complete(Operation* op, int32_t result)
+{
+	boost::system::error_code error;
+	if(result == -EINTR){
+		// Nothing was transferred, try again
+		boost::mutex::scoped_lock lockClass(m_submitLock);
+		start(op);
+		return;
+	}
+	else if(result < 0){
+		error = boost::system::error_code(-result, boost::asio::error::get_system_category());
+	}
+
+	switch(op->type){
+		case Operation::OPERATION_ACCEPT:
+			op->acceptHandler(error, error ? -1 : result);
+			delete op;
+			return;
+
+		case Operation::OPERATION_READ:
+			if(!error && result == 0){
+				error = boost::asio::error::eof;
+			}
+			break;
+
+		case Operation::OPERATION_WRITE:
+			if(!error){
+				size_t written = result;
+				while(written > 0 && written >= op->iov[op->iovIndex].iov_len){
+					written -= op->iov[op->iovIndex].iov_len;
+					++op->iovIndex;
+				}
+				if(written > 0){
+					op->iov[op->iovIndex].iov_base = (char*)op->iov[op->iovIndex].iov_base + written;
+					op->iov[op->iovIndex].iov_len -= written;
+				}
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	if(!error){
+		op->done += result;
+		if(op->done < op->size){
+			// Short read or write, continue where it stopped
+			boost::mutex::scoped_lock lockClass(m_submitLock);
+			start(op);
+			return;
+		}
+	}
+
+	op->handler(error, op->done);
+	delete op;
+}
+
+void IoUring::submit()
+{
+	boost::mutex::scoped_lock lockClass(m_submitLock);
+	m_submitPosted = false;
+	submitLocked();
+}
+
+void IoUring::submitLocked()
+{
+	while(true){
+		enterLocked();
+		if(m_overflow.empty()){
+			break;
+		}
+
+		// The operations that found the queue full take the entries the
+		// kernel consumed, in the order they were started
+		bool moved = false;
+		io_uring_sqe* sqe;
+		while(!m_overflow.empty() && (sqe = getSqe())){
+			prepare(sqe, m_overflow.front());
+			m_overflow.pop_front();
+			moved = true;
+		}
+
+		if(!moved){
+			break;
+		}
+	}
+}
+
+void IoUring::enterLocked()
+{
+	while(m_unsubmitted > 0){
+		++m_enters;
+		int ret = io_uring_enter(m_ringFd, m_unsubmitted, 0, 0);
+		if(ret < 0){
+			if(errno == EINTR){
+				continue;
+			}
+
+			// EBUSY/EAGAIN: the completions have to be reaped first, the
+			// ring thread submits the rest after that
+			if(!m_inEvent && !m_submitPosted){
+				m_submitPosted = true;
+				m_io_service.post(boost::bind(&IoUring::submit, this));
+			}
+			break;
+		}
+
+		m_unsubmitted -= ret;
+		m_submitted += ret;
+		if(ret == 0){
+			break;
+		}
+	}
+}
+
+#endif
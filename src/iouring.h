@@ -0,0 +1,138 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// io_uring transport for the network threads on Linux
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifdef __USE_IO_URING__
+
+#ifndef __OTSERV_IOURING_H__
+#define __OTSERV_IOURING_H__
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/function.hpp>
+#include <boost/utility.hpp>
+#include <deque>
+#include <string>
+#include <stdint.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// One submission/completion ring per io_service. Operations can be started
+// from any thread, the handlers always run on the thread of the io_service,
+// like the asio handlers they replace. Submissions made while the thread is
+// busy are sent to the kernel together with a single io_uring_enter.
+// The sockets have to be in blocking mode, the kernel polls them itself
+// and would otherwise fail the operations with EAGAIN.
+class IoUring : boost::noncopyable
+{
+public:
+	typedef boost::function<void (const boost::system::error_code&, size_t)> Handler;
+	typedef boost::function<void (const boost::system::error_code&, int)> AcceptHandler;
+
+	// NULL if the kernel lacks one of the operations or features used, error
+	// tells which. Writes from the memory range [fixedBase, fixedBase + fixedSize)
+	// use a registered buffer, the range may be empty.
+	static IoUring* create(boost::asio::io_service& io_service,
+		const void* fixedBase, size_t fixedSize, std::string& error);
+	~IoUring();
+
+	// The ring of the io_service, NULL if it has none
+	static IoUring* get(const boost::asio::io_service& io_service);
+
+	// Completes once size bytes were read, or with eof if the peer closed first
+	void asyncRead(int fd, char* buffer, size_t size, const Handler& handler);
+	// Completes once all the buffers were written
+	void asyncWrite(int fd, const boost::asio::const_buffer* buffers, size_t count, const Handler& handler);
+	// Completes with the new socket, the listening socket must be shut down
+	// before it is closed to abort the accept
+	void asyncAccept(int fd, const AcceptHandler& handler);
+
+	bool hasFixedBuffer() const {return m_fixedSize != 0;}
+
+	uint64_t getEnters() const {return m_enters;}
+	uint64_t getSubmitted() const {return m_submitted;}
+	uint64_t getCompleted() const {return m_completed;}
+	uint64_t getFixedWrites() const {return m_fixedWrites;}
+
+private:
+	struct Operation;
+
+	IoUring(boost::asio::io_service& io_service);
+	bool setup(const void* fixedBase, size_t fixedSize, std::string& error);
+
+	// NULL while the submission queue is full
+	io_uring_sqe* getSqe();
+	void start(Operation* op);
+	void prepare(io_uring_sqe* sqe, Operation* op);
+	void queue(Operation* op);
+	void complete(Operation* op, int32_t result);
+
+	void waitEvent();
+	void onEvent(const boost::system::error_code& error);
+	void reap();
+	void submit();
+	void submitLocked();
+	void enterLocked();
+
+	boost::asio::io_service& m_io_service;
+	boost::asio::posix::stream_descriptor m_eventDescriptor;
+	int m_ringFd;
+	int m_eventFd;
+
+	void* m_sqMap;
+	size_t m_sqMapSize;
+	void* m_cqMap;
+	size_t m_cqMapSize;
+	io_uring_sqe* m_sqes;
+	size_t m_sqesSize;
+
+	uint32_t* m_sqHead;
+	uint32_t* m_sqTail;
+	uint32_t* m_sqFlags;
+	uint32_t* m_sqArray;
+	uint32_t m_sqMask;
+	uint32_t m_sqEntries;
+	uint32_t* m_cqHead;
+	uint32_t* m_cqTail;
+	uint32_t m_cqMask;
+	io_uring_cqe* m_cqes;
+
+	const char* m_fixedBase;
+	size_t m_fixedSize;
+
+	// Guards the submission queue
+	boost::mutex m_submitLock;
+	uint32_t m_unsubmitted;
+	// Started while the submission queue was full and could not be submitted
+	std::deque<Operation*> m_overflow;
+	bool m_submitPosted;
+	bool m_inEvent;
+
+	uint64_t m_enters;
+	uint64_t m_submitted;
+	uint64_t m_completed;
+	uint64_t m_fixedWrites;
+};
+
+#endif
+
+#endif
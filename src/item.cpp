@@ -270,6 +270,23 @@ void Item::setActionId(int32_t n)
 	}
 }
 
+void Item::onAttributesChanged()
+{
+	if(!getParent()){
+		return;
+	}
+
+	//items carried by creatures are not saved with the map
+	Cylinder* topParent = getTopParent();
+	if(topParent && topParent->getCreature()){
+		return;
+	}
+
+	if(Tile* tile = getParentTile()){
+		tile->onItemsChanged();
+	}
+}
+
 bool Item::hasSubType() const
 {
 	const ItemType& it = items[id];
@@ -206,6 +206,10 @@ public:
 	void setDecaying(ItemDecayState_t decayState);
 	ItemDecayState_t getDecaying() const;
 
+	// Notifies the tile this item lies on, in a container or not, that the
+	// attributes it saves changed
+	void onAttributesChanged();
+
 	virtual double getWeight() const;
 	int getAttack() const;
 	int getArmor() const;
@@ -0,0 +1,146 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include <cassert>
+#include <cstring>
+#include "knowncreaturelist.h"
+
+KnownCreatureList::KnownCreatureList()
+{
+	memset(m_index, npos, sizeof(m_index));
+	for(uint8_t i = 0; i < capacity; ++i){
+		m_nodes[i].id = 0;
+		m_nodes[i].prev = npos;
+		m_nodes[i].next = (i + 1 < capacity ? (uint8_t)(i + 1) : (uint8_t)npos);
+	}
+
+	m_head = npos;
+	m_tail = npos;
+	m_free = 0;
+	m_size = 0;
+}
+
+uint32_t KnownCreatureList::findSlot(uint32_t id) const
+{
+	uint32_t slot = hash(id);
+	while(m_index[slot] != npos){
+		if(m_nodes[m_index[slot]].id == id){
+			return slot;
+		}
+		slot = (slot + 1) & (index_size - 1);
+	}
+	return slot;
+}
+
+void KnownCreatureList::eraseSlot(uint32_t slot)
+{
+	//backward shift deletion, keeps the probe sequences intact without tombstones
+	uint32_t next = slot;
+	while(true){
+		next = (next + 1) & (index_size - 1);
+		if(m_index[next] == npos){
+			break;
+		}
+
+		uint32_t home = hash(m_nodes[m_index[next]].id);
+		bool movable = (next > slot ? (home <= slot || home > next) : (home <= slot && home > next));
+		if(movable){
+			m_index[slot] = m_index[next];
+			slot = next;
+		}
+	}
+	m_index[slot] = npos;
+}
+
+void KnownCreatureList::unlink(uint8_t node)
+{
+	Node& n = m_nodes[node];
+	if(n.prev != npos)
+		m_nodes[n.prev].next = n.next;
+	else
+		m_head = n.next;
+
+	if(n.next != npos)
+		m_nodes[n.next].prev = n.prev;
+	else
+		m_tail = n.prev;
+}
+
+void KnownCreatureList::linkBack(uint8_t node)
+{
+	Node& n = m_nodes[node];
+	n.prev = m_tail;
+	n.next = npos;
+	if(m_tail != npos)
+		m_nodes[m_tail].next = node;
+	else
+		m_head = node;
+	m_tail = node;
+}
+
+bool KnownCreatureList::touch(uint32_t id)
+{
+	uint8_t node = m_index[findSlot(id)];
+	if(node == npos){
+		return false;
+	}
+
+	if(node != m_tail){
+		unlink(node);
+		linkBack(node);
+	}
+	return true;
+}
+
+void KnownCreatureList::push_back(uint32_t id)
+{
+	assert(m_free != npos);
+	uint8_t node = m_free;
+	m_free = m_nodes[node].next;
+
+	m_nodes[node].id = id;
+	linkBack(node);
+	m_index[findSlot(id)] = node;
+	++m_size;
+}
+
+void KnownCreatureList::pop_front()
+{
+	uint8_t node = m_head;
+	if(node == npos){
+		return;
+	}
+
+	eraseSlot(findSlot(m_nodes[node].id));
+	unlink(node);
+	m_nodes[node].next = m_free;
+	m_free = node;
+	--m_size;
+}
+
+void KnownCreatureList::rotate()
+{
+	uint8_t node = m_head;
+	if(node != npos && node != m_tail){
+		unlink(node);
+		linkBack(node);
+	}
+}
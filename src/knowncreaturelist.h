@@ -0,0 +1,71 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_KNOWNCREATURELIST_H__
+#define __OTSERV_KNOWNCREATURELIST_H__
+
+#include "definitions.h"
+
+// Creatures the client already knows about, in least recently used order.
+// Flat storage with an intrusive list and an open addressing id index, so
+// every operation is O(1).
+class KnownCreatureList
+{
+public:
+	enum {max_size = 150};
+
+	KnownCreatureList();
+
+	// moves a known id to the back, returns false if it is unknown
+	bool touch(uint32_t id);
+	void push_back(uint32_t id);
+	void pop_front();
+	// moves the front id to the back
+	void rotate();
+
+	uint32_t front() const {return m_nodes[m_head].id;}
+	uint32_t size() const {return m_size;}
+
+protected:
+	enum {capacity = max_size + 1}; // one over the limit until eviction
+	enum {index_size = 512}; // power of two
+	enum {npos = 0xFF};
+
+	struct Node{
+		uint32_t id;
+		uint8_t prev;
+		uint8_t next;
+	};
+
+	static uint32_t hash(uint32_t id) {return (id * 2654435761U) & (index_size - 1);}
+	uint32_t findSlot(uint32_t id) const;
+	void unlink(uint8_t node);
+	void linkBack(uint8_t node);
+	void eraseSlot(uint32_t slot);
+
+	Node m_nodes[capacity];
+	uint8_t m_index[index_size];
+	uint8_t m_head;
+	uint8_t m_tail;
+	uint8_t m_free;
+	uint32_t m_size;
+};
+
+#endif
@@ -80,25 +80,12 @@ bool Map::loadMap(const std::string& identifier)
 bool Map::saveMap()
 {
 	IOMapSerialize* IOMapSerialize = IOMapSerialize::getInstance();
-	bool saved = false;
 	for(uint32_t tries = 0; tries < 3; tries++){
 		if(IOMapSerialize->saveMap(this)){
-			saved = true;
-			break;
-		}
-	}
-
-	if(!saved)
-		return false;
-
-	saved = false;
-	for(uint32_t tries = 0; tries < 3; tries++){
-		if(IOMapSerialize->saveHouseInfo(this)){
-			saved = true;
-			break;
+			return true;
 		}
 	}
-	return saved;
+	return false;
 }
 
 Tile* Map::getParentTile(int32_t x, int32_t y, int32_t z)
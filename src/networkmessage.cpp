@@ -71,25 +71,37 @@ uint64_t NetworkMessage::GetU64() const
 }
 
 std::string NetworkMessage::GetString()
+{
+	boost::string_view v = GetStringView();
+	return std::string(v.data(), v.size());
+}
+
+std::string NetworkMessage::GetRaw()
+{
+	boost::string_view v = GetRawView();
+	return std::string(v.data(), v.size());
+}
+
+boost::string_view NetworkMessage::GetStringView()
 {
 	uint16_t stringlen = GetU16();
 	if(stringlen >= (NETWORKMESSAGE_MAXSIZE - m_ReadPos))
-		return std::string();
+		return boost::string_view();
 
-	char* v = (char*)(m_MsgBuf + m_ReadPos);
+	const char* v = (const char*)(m_MsgBuf + m_ReadPos);
 	m_ReadPos += stringlen;
-	return std::string(v, stringlen);
+	return boost::string_view(v, stringlen);
 }
 
-std::string NetworkMessage::GetRaw()
+boost::string_view NetworkMessage::GetRawView()
 {
 	uint16_t stringlen = m_MsgSize- m_ReadPos;
 	if(stringlen >= (NETWORKMESSAGE_MAXSIZE - m_ReadPos))
-		return std::string();
+		return boost::string_view();
 
-	char* v = (char*)(m_MsgBuf + m_ReadPos);
+	const char* v = (const char*)(m_MsgBuf + m_ReadPos);
 	m_ReadPos += stringlen;
-	return std::string(v, stringlen);
+	return boost::string_view(v, stringlen);
 }
 
 Position NetworkMessage::GetPosition()
@@ -24,6 +24,7 @@
 #include <string>
 #include <stdint.h>
 #include <boost/shared_ptr.hpp>
+#include <boost/utility/string_view.hpp>
 #include "protocolconst.h"
 
 class Position;
@@ -51,6 +52,10 @@ public:
 	uint64_t GetU64() const;
 	std::string GetString();
 	std::string GetRaw();
+	// Point into the message buffer, which the connection reuses for the
+	// next packet. Copy what has to outlive the packet handler.
+	boost::string_view GetStringView();
+	boost::string_view GetRawView();
 	Position GetPosition();
 
 	// skips count unknown/unused bytes in an incoming message
@@ -40,6 +40,10 @@
 #include "ban.h"
 #include "rsa.h"
 #include "configmanager.h"
+#include "packetrecorder.h"
+#include "cryptopool.h"
+#include "database_executor.h"
+#include "player_journal.h"
 
 
 #if !defined(__WINDOWS__)
@@ -68,6 +72,8 @@
 Game g_game;
 Dispatcher g_dispatcher;
 Scheduler g_scheduler;
+CryptoPool g_cryptoPool;
+DatabaseExecutor g_databaseExecutor;
 RSA g_RSA;
 ConfigManager g_config;
 CreatureManager g_creature_types;
@@ -266,6 +272,14 @@ int main(int argc, char *argv[])
 #endif
 	g_scheduler.shutdownAndWait();
 	g_dispatcher.shutdownAndWait();
+	g_cryptoPool.shutdownAndWait();
+	// writes everything still queued
+	g_databaseExecutor.shutdownAndWait();
+	// the players were kicked and saved, the journal is only replayed
+	// after a crash or a failed save
+	DatabaseDriver* db = DatabaseDriver::instance();
+	PlayerJournal::getInstance()->stop(g_game.getGameState() == GAME_STATE_SHUTDOWN && db && db->sync());
+	PacketRecorder::getInstance()->stop();
 	// Don't run destructors, may hang!
 	exit(EXIT_SUCCESS);
 
@@ -485,6 +499,9 @@ void mainLoader(const CommandLineOptions& command_opts, ServiceManager* service_
 	}
 	std::cout << "[done]" << std::endl;
 
+	g_databaseExecutor.start(g_config.getNumber(ConfigManager::DATABASE_WORKER_THREADS),
+		db->getParam(DBPARAM_BATCHWRITES) ? DATABASE_WRITE_BATCH : 1);
+
 	std::cout << ":: NO DATABASE VERSION CHECK, TURN ON AGAIN WHEN SCHEMA IS STABLE!" << std::endl;
 	/*
 	 * TODO: Enable this again when DB schema is stable
@@ -513,6 +530,32 @@ void mainLoader(const CommandLineOptions& command_opts, ServiceManager* service_
 	}
 	std::cout << "[done]" << std::endl;
 
+	std::string journalFile = g_config.getString(ConfigManager::PLAYER_JOURNAL_FILE);
+	if(journalFile != ""){
+		// what the players did after the last server save, if the server
+		// did not stop cleanly
+		std::cout << ":: Replaying player journal... " << std::flush;
+		PlayerJournalContents journal;
+		if(!PlayerJournal::read(journalFile, journal) || !IOPlayer::instance()->writeJournal(journal)){
+			ErrorMessage("Unable to replay the player journal!");
+			exit(EXIT_FAILURE);
+		}
+		std::cout << journal.players.size() << " players, " << journal.deaths.size() << " deaths ";
+		if(journal.errors > 0){
+			std::cout << "(" << journal.errors << " broken records skipped) ";
+		}
+		std::cout << "[done]" << std::endl;
+
+		if(!PlayerJournal::getInstance()->start(journalFile, g_config.getNumber(ConfigManager::PLAYER_JOURNAL_FLUSH_INTERVAL))){
+			ErrorMessage("Unable to open the player journal!");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	std::cout << ":: Loading IP bans... " << std::flush;
+	g_bans.loadIpBans();
+	std::cout << "[done]" << std::endl;
+
 
 	//load RSA key
 	std::cout << ":: Loading RSA key... " << std::flush;
@@ -781,6 +824,7 @@ void mainLoader(const CommandLineOptions& command_opts, ServiceManager* service_
 	}
 
 	// Tie ports and register services
+	service_manager->set_thread_count(std::max<int64_t>(1, g_config.getNumber(ConfigManager::NETWORK_THREADS)));
 
 	// Tibia protocols
 	service_manager->add<ProtocolGame>(game_port, ipList);
@@ -805,6 +849,7 @@ void mainLoader(const CommandLineOptions& command_opts, ServiceManager* service_
 	}
 	std::cout << std::endl;
 	std::cout << ":: Client Protocol        " << CLIENT_VERSION_STRING << std::endl;
+	std::cout << ":: Network backend        " << service_manager->get_network_backend() << std::endl;
 
 	//
 	std::cout << "::" << std::endl;
@@ -812,6 +857,15 @@ void mainLoader(const CommandLineOptions& command_opts, ServiceManager* service_
 
 	Status* status = Status::instance();
 	status->setMaxPlayersOnline(g_config.getNumber(ConfigManager::MAX_PLAYERS));
+	status->refresh();
+
+	g_cryptoPool.start(g_config.getNumber(ConfigManager::LOGIN_WORKER_THREADS),
+		g_config.getNumber(ConfigManager::LOGIN_QUEUE_SIZE));
+
+	std::string traceFile = g_config.getString(ConfigManager::PACKET_TRACE_FILE);
+	if(traceFile != "" && !PacketRecorder::getInstance()->start(traceFile)){
+		std::cout << std::endl << "Warning: Could not open packet trace " << traceFile << std::endl;
+	}
 
 	g_game.start(service_manager);
 	g_game.setGameState(GAME_STATE_NORMAL);
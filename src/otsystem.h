@@ -40,6 +40,15 @@ inline int64_t OTSYS_TIME()
   return ((int64_t)t.millitm) + ((int64_t)t.time) * 1000;
 }
 
+// Monotonic time in microseconds, for measuring short intervals
+inline int64_t OTSYS_TIME_US()
+{
+  LARGE_INTEGER freq, counter;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&counter);
+  return (counter.QuadPart / freq.QuadPart) * 1000000 + (counter.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+}
+
 typedef int socklen_t;
 
 #else  // #if defined __WINDOWS__
@@ -61,6 +70,14 @@ inline int64_t OTSYS_TIME()
 	return ((int64_t)t.millitm) + ((int64_t)t.time) * 1000;
 }
 
+// Monotonic time in microseconds, for measuring short intervals
+inline int64_t OTSYS_TIME_US()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((int64_t)t.tv_sec) * 1000000 + t.tv_nsec / 1000;
+}
+
 #ifndef SOCKET
 #define SOCKET int
 #endif
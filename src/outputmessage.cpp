@@ -19,6 +19,7 @@
 //////////////////////////////////////////////////////////////////////
 #include "otpch.h"
 
+#include <new>
 #include "outputmessage.h"
 #include "connection.h"
 #include "protocol.h"
@@ -119,29 +120,48 @@ void OutputMessage::setFrame(uint64_t frame)
 
 OutputMessagePool::OutputMessagePool()
 {
+	// One block, so the io_uring backend can register all of it with the kernel
+	m_arena = (char*)::operator new(OUTPUT_POOL_SIZE * sizeof(OutputMessage));
 	for(uint32_t i = 0; i < OUTPUT_POOL_SIZE; ++i){
-		OutputMessage* msg = new OutputMessage();
+		OutputMessage* msg = new(m_arena + i * sizeof(OutputMessage)) OutputMessage();
 		m_outputMessages.push_back(msg);
 #ifdef __TRACK_NETWORK__
 		m_allOutputMessages.push_back(msg);
 #endif
 	}
-	m_frameTime = OTSYS_TIME();
+	m_frameTime = OTSYS_TIME_US();
+	m_flushes = 0;
+	m_sentMessages = 0;
+	m_writes = 0;
+	m_sentBytes = 0;
+	m_sendDelay = 0;
 }
 
 OutputMessagePool::~OutputMessagePool()
 {
 	InternalOutputMessageList::iterator it;
 	for(it = m_outputMessages.begin(); it != m_outputMessages.end(); ++it){
-		delete *it;
+		if(isArenaMessage(*it)){
+			(*it)->~OutputMessage();
+		}
+		else{
+			delete *it;
+		}
 	}
 	m_outputMessages.clear();
+	::operator delete(m_arena);
+}
+
+bool OutputMessagePool::isArenaMessage(const OutputMessage* msg) const
+{
+	const char* p = (const char*)msg;
+	return p >= m_arena && p < m_arena + getArenaSize();
 }
 
 void OutputMessagePool::startExecutionFrame()
 {
 	//boost::recursive_mutex::scoped_lock lockClass(m_outputPoolLock);
-	m_frameTime = OTSYS_TIME();
+	m_frameTime = OTSYS_TIME_US();
 	m_isOpen = true;
 }
 
@@ -205,55 +225,60 @@ void OutputMessagePool::sendAll()
 {
 	boost::recursive_mutex::scoped_lock lockClass(m_outputPoolLock);
 	OutputMessageMessageList::iterator it;
+	int64_t now = OTSYS_TIME_US();
 
-	for(it = m_toAddQueue.begin(); it != m_toAddQueue.end();){
-		//drop messages that are older than Connection::read_timeout seconds
-		if(OTSYS_TIME() - (*it)->getFrame() > Connection::read_timeout * 1000 ){
-			(*it)->getProtocol()->onSendMessage(*it);
-			it = m_toAddQueue.erase(it);
+	if(m_autoSendOutputMessages.empty()){
+		return;
+	}
+
+	// Group the messages by connection, in the order they were created
+	std::vector<OutputMessageList> connectionMessages;
+	std::map<Connection*, size_t> connectionIndex;
+	for(it = m_autoSendOutputMessages.begin(); it != m_autoSendOutputMessages.end(); ++it){
+		OutputMessage_ptr omsg = *it;
+		Connection* connection = omsg->getConnection().get();
+		if(!connection){
+			#ifdef __DEBUG_NET__
+			std::cout << "Error: [OutputMessagePool::send] NULL connection." << std::endl;
+			#endif
 			continue;
 		}
 
-		(*it)->setState(OutputMessage::STATE_ALLOCATED);
-		m_autoSendOutputMessages.push_back(*it);
-		++it;
-	}
+		std::map<Connection*, size_t>::iterator index = connectionIndex.find(connection);
+		if(index == connectionIndex.end()){
+			connectionIndex[connection] = connectionMessages.size();
+			connectionMessages.push_back(OutputMessageList(1, omsg));
+		}
+		else{
+			connectionMessages[index->second].push_back(omsg);
+		}
 
-	m_toAddQueue.clear();
+		m_sendDelay += now - (int64_t)omsg->getFrame();
+	}
+	m_autoSendOutputMessages.clear();
 
-	for(it = m_autoSendOutputMessages.begin(); it != m_autoSendOutputMessages.end(); ){
-		OutputMessage_ptr omsg = *it;
-		#ifdef __NO_PLAYER_SENDBUFFER__
-		//use this define only for debugging
-		bool v = 1;
-		#else
-		//It will send only messages bigger then 1 kb or with a lifetime greater than 10 ms
-		bool v = omsg->getMessageLength() > 1024 || (m_frameTime - omsg->getFrame() > 10);
+	for(std::vector<OutputMessageList>::iterator cit = connectionMessages.begin(); cit != connectionMessages.end(); ++cit){
+		#ifdef __DEBUG_NET_DETAIL__
+		std::cout << "Sending message - ALL" << std::endl;
 		#endif
-		if(v){
-			#ifdef __DEBUG_NET_DETAIL__
-			std::cout << "Sending message - ALL" << std::endl;
-			#endif
 
-			if(omsg->getConnection()){
-				if(!omsg->getConnection()->send(omsg)){
-					// Send only fails when connection is closing (or in error state)
-					// This call will free the message
-					omsg->getProtocol()->onSendMessage(omsg);
-				}
+		OutputMessageList& messages = *cit;
+		if(messages.front()->getConnection()->send(messages)){
+			++m_writes;
+			for(OutputMessageList::iterator mit = messages.begin(); mit != messages.end(); ++mit){
+				m_sentBytes += (*mit)->getMessageLength();
 			}
-			else{
-				#ifdef __DEBUG_NET__
-				std::cout << "Error: [OutputMessagePool::send] NULL connection." << std::endl;
-				#endif
-			}
-
-			it = m_autoSendOutputMessages.erase(it);
 		}
 		else{
-			++it;
+			// Send only fails when connection is closing (or in error state)
+			// This call will free the messages
+			for(OutputMessageList::iterator mit = messages.begin(); mit != messages.end(); ++mit){
+				(*mit)->getProtocol()->onSendMessage(*mit);
+			}
 		}
+		m_sentMessages += messages.size();
 	}
+	++m_flushes;
 }
 
 void OutputMessagePool::stop()
@@ -366,11 +391,3 @@ void OutputMessagePool::configureOutputMessage(OutputMessage_ptr msg, Protocol*
 #endif
 	msg->setFrame(m_frameTime);
 }
-
-void OutputMessagePool::addToAutoSend(OutputMessage_ptr msg)
-{
-	m_outputPoolLock.lock();
-	m_toAddQueue.push_back(msg);
-	m_outputPoolLock.unlock();
-}
-
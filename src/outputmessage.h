@@ -23,6 +23,7 @@
 
 #include <cstddef>
 #include <list>
+#include <vector>
 #include <stdint.h>
 #include <boost/thread/recursive_mutex.hpp>
 #include "networkmessage.h"
@@ -122,6 +123,7 @@ protected:
 };
 
 typedef boost::shared_ptr<OutputMessage> OutputMessage_ptr;
+typedef std::vector<OutputMessage_ptr> OutputMessageList;
 
 class OutputMessagePool
 {
@@ -136,6 +138,8 @@ public:
 #endif
 
 	void send(OutputMessage_ptr msg);
+	// End of a dispatcher tick, finalises every auto send message and
+	// writes the messages of each connection with a single write
 	void sendAll();
 	void stop();
 	OutputMessage_ptr getOutputMessage(Protocol* protocol, bool autosend = true);
@@ -144,7 +148,16 @@ public:
 	size_t getTotalMessageCount() const;
 	size_t getAvailableMessageCount() const;
 	size_t getAutoMessageCount() const;
-	void addToAutoSend(OutputMessage_ptr msg);
+
+	// The first OUTPUT_POOL_SIZE messages live in this block
+	const char* getArena() const {return m_arena;}
+	size_t getArenaSize() const {return OUTPUT_POOL_SIZE * sizeof(OutputMessage);}
+
+	uint64_t getFlushes() const {return m_flushes;}
+	uint64_t getSentMessages() const {return m_sentMessages;}
+	uint64_t getWrites() const {return m_writes;}
+	uint64_t getSentBytes() const {return m_sentBytes;}
+	uint64_t getSendDelay() const {return m_sendDelay;}
 
 protected:
 
@@ -155,13 +168,22 @@ protected:
 	typedef std::list<OutputMessage*> InternalOutputMessageList;
 	typedef std::list<OutputMessage_ptr> OutputMessageMessageList;
 
+	bool isArenaMessage(const OutputMessage* msg) const;
+
+	char* m_arena;
 	InternalOutputMessageList m_outputMessages;
 	InternalOutputMessageList m_allOutputMessages;
 	OutputMessageMessageList m_autoSendOutputMessages;
-	OutputMessageMessageList m_toAddQueue;
 	boost::recursive_mutex m_outputPoolLock;
-	uint64_t m_frameTime;
+	uint64_t m_frameTime; // microseconds
 	bool m_isOpen;
+
+	uint64_t m_flushes;
+	uint64_t m_sentMessages;
+	uint64_t m_writes;
+	uint64_t m_sentBytes;
+	uint64_t m_sendDelay; // microseconds from the start of the tick to the write
+
 };
 
 #ifdef __TRACK_NETWORK__
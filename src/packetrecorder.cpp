@@ -0,0 +1,189 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include "packetrecorder.h"
+#include "otsystem.h"
+#include "singleton.h"
+
+PacketRecorder::PacketRecorder()
+{
+	m_enabled = false;
+	m_file = NULL;
+	m_startTime = 0;
+	m_lastSession = 0;
+	m_droppedRecords = 0;
+}
+
+PacketRecorder::~PacketRecorder()
+{
+	stop();
+}
+
+PacketRecorder* PacketRecorder::getInstance()
+{
+	static Singleton<PacketRecorder> instance;
+	return instance.get();
+}
+
+bool PacketRecorder::start(const std::string& filename)
+{
+	if(m_enabled){
+		return true;
+	}
+
+	m_file = fopen(filename.c_str(), "wb");
+	if(!m_file){
+		return false;
+	}
+
+	m_startTime = OTSYS_TIME();
+	uint32_t version = PACKET_TRACE_VERSION;
+	uint64_t startTime = (uint64_t)time(NULL) * 1000;
+	fwrite(PACKET_TRACE_MAGIC, 1, 4, m_file);
+	fwrite(&version, sizeof(version), 1, m_file);
+	fwrite(&startTime, sizeof(startTime), 1, m_file);
+
+	m_buffer.reserve(flush_size * 2);
+	m_droppedRecords = 0;
+	m_enabled = true;
+	m_thread = boost::thread(boost::bind(&PacketRecorder::writerThread, (void*)this));
+	return true;
+}
+
+void PacketRecorder::stop()
+{
+	if(!m_enabled){
+		return;
+	}
+
+	m_bufferLock.lock();
+	m_enabled = false;
+	m_bufferLock.unlock();
+	m_bufferSignal.notify_one();
+	m_thread.join();
+
+	fclose(m_file);
+	m_file = NULL;
+
+	if(m_droppedRecords > 0){
+		std::cout << "Packet trace dropped " << m_droppedRecords << " records, the disk was too slow" << std::endl;
+	}
+}
+
+uint64_t PacketRecorder::getDroppedRecords()
+{
+	boost::mutex::scoped_lock lockClass(m_bufferLock);
+	return m_droppedRecords;
+}
+
+uint32_t PacketRecorder::beginSession(const std::string& account, const std::string& name)
+{
+	std::string payload;
+	uint16_t length = (uint16_t)account.size();
+	payload.append((const char*)&length, 2);
+	payload.append(account);
+	length = (uint16_t)name.size();
+	payload.append((const char*)&length, 2);
+	payload.append(name);
+
+	boost::mutex::scoped_lock lockClass(m_bufferLock);
+	uint32_t session = ++m_lastSession;
+	lockClass.unlock();
+
+	addRecord(TRACE_SESSION_START, session, payload.data(), (uint16_t)payload.size());
+	return session;
+}
+
+void PacketRecorder::endSession(uint32_t session)
+{
+	addRecord(TRACE_SESSION_END, session, NULL, 0);
+}
+
+void PacketRecorder::recordInbound(uint32_t session, const char* data, uint16_t size)
+{
+	addRecord(TRACE_INBOUND, session, data, size);
+}
+
+void PacketRecorder::recordOutbound(uint32_t session, const char* data, uint16_t size)
+{
+	addRecord(TRACE_OUTBOUND, session, data, size);
+}
+
+void PacketRecorder::addRecord(uint8_t type, uint32_t session, const char* data, uint16_t size)
+{
+	char header[11];
+	uint32_t time = (uint32_t)(OTSYS_TIME() - m_startTime);
+	header[0] = type;
+	memcpy(header + 1, &session, 4);
+	memcpy(header + 5, &time, 4);
+	memcpy(header + 9, &size, 2);
+
+	// Called from the network and dispatcher threads, the file is written
+	// by the writer thread so a slow disk never stalls the game
+	boost::mutex::scoped_lock lockClass(m_bufferLock);
+	if(!m_enabled){
+		return;
+	}
+
+	// the writer is stuck on the disk, drop rather than grow without limit
+	if(m_buffer.size() + sizeof(header) + size > max_buffer_size){
+		++m_droppedRecords;
+		return;
+	}
+
+	m_buffer.insert(m_buffer.end(), header, header + sizeof(header));
+	if(size > 0){
+		m_buffer.insert(m_buffer.end(), data, data + size);
+	}
+
+	if(m_buffer.size() >= flush_size){
+		m_bufferSignal.notify_one();
+	}
+}
+
+void PacketRecorder::writerThread(void* p)
+{
+	PacketRecorder* recorder = (PacketRecorder*)p;
+	std::vector<char> pending;
+	pending.reserve(flush_size * 2);
+
+	boost::unique_lock<boost::mutex> bufferLockUnique(recorder->m_bufferLock);
+	while(true){
+		if(recorder->m_enabled && recorder->m_buffer.size() < flush_size){
+			recorder->m_bufferSignal.timed_wait(bufferLockUnique, boost::posix_time::seconds(1));
+		}
+
+		pending.swap(recorder->m_buffer);
+		bool enabled = recorder->m_enabled;
+		bufferLockUnique.unlock();
+
+		if(!pending.empty()){
+			fwrite(&pending[0], 1, pending.size(), recorder->m_file);
+			fflush(recorder->m_file);
+			pending.clear();
+		}
+
+		if(!enabled){
+			break;
+		}
+		bufferLockUnique.lock();
+	}
+}
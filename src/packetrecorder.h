@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Records decrypted game traffic to a binary trace for replays
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_PACKETRECORDER_H__
+#define __OTSERV_PACKETRECORDER_H__
+
+#include <boost/thread.hpp>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+// Trace layout, all values little endian:
+//   header: "OTPT", U32 version, U64 wall clock start (ms)
+//   record: U8 type, U32 session, U32 time since start (ms), U16 size, payload
+// A session start payload is the account and character name as two
+// strings, packets carry the decrypted message without length headers.
+// Passwords are never recorded. Records are dropped while the writer
+// is max_buffer_size behind, so a trace with drops may not replay.
+#define PACKET_TRACE_MAGIC "OTPT"
+#define PACKET_TRACE_VERSION 1
+
+enum PacketTraceRecord_t {
+	TRACE_SESSION_START = 1,
+	TRACE_SESSION_END = 2,
+	TRACE_INBOUND = 3,
+	TRACE_OUTBOUND = 4
+};
+
+class PacketRecorder
+{
+public:
+	PacketRecorder();
+	~PacketRecorder();
+
+	static PacketRecorder* getInstance();
+
+	bool start(const std::string& filename);
+	void stop();
+	bool isEnabled() const {return m_enabled;}
+	uint64_t getDroppedRecords();
+
+	uint32_t beginSession(const std::string& account, const std::string& name);
+	void endSession(uint32_t session);
+	void recordInbound(uint32_t session, const char* data, uint16_t size);
+	void recordOutbound(uint32_t session, const char* data, uint16_t size);
+
+protected:
+	void addRecord(uint8_t type, uint32_t session, const char* data, uint16_t size);
+	static void writerThread(void* p);
+
+	enum { flush_size = 64 * 1024 };
+	enum { max_buffer_size = 8 * flush_size };
+
+	volatile bool m_enabled;
+	FILE* m_file;
+	int64_t m_startTime;
+	uint32_t m_lastSession;
+	uint64_t m_droppedRecords;
+
+	boost::thread m_thread;
+	boost::mutex m_bufferLock;
+	boost::condition_variable m_bufferSignal;
+	std::vector<char> m_buffer;
+};
+
+#endif
@@ -1566,17 +1566,7 @@ void Player::onCreatureDisappear(const Creature* creature, bool isLogout)
 
 		lastLogout = time(NULL);
 		IOPlayer::instance()->updateLogoutInfo(this);
-
-		bool saved = false;
-		for(uint32_t tries = 0; tries < 3; ++tries){
-			if(IOPlayer::instance()->savePlayer(this)){
-				saved = true;
-				break;
-			}
-		}
-		if(!saved){
-			std::cout << "Error while saving player: " << getName() << std::endl;
-		}
+		IOPlayer::instance()->savePlayerAsync(this);
 
 #ifdef __DEBUG_PLAYERS__
 		std::cout << (uint32_t)g_game.getPlayersOnline() << " players online." << std::endl;
@@ -4108,39 +4098,33 @@ void Player::addUnjustifiedDead(const Player* attacked)
 		lastSkullTime = std::time(NULL);
 	}
 
-	//day
-	int32_t unjustKills = IOPlayer::instance()->getPlayerUnjustKillCount(this, UNJUST_KILL_PERIOD_DAY);
-	if(g_config.getNumber(ConfigManager::KILLS_PER_DAY_BLACK_SKULL) > 0 &&
-		g_config.getNumber(ConfigManager::KILLS_PER_DAY_BLACK_SKULL) <= unjustKills){
-		setSkull(SKULL_BLACK);
-	}
-	else if(getSkull() != SKULL_BLACK &&
-			g_config.getNumber(ConfigManager::KILLS_PER_DAY_RED_SKULL) > 0 &&
-			g_config.getNumber(ConfigManager::KILLS_PER_DAY_RED_SKULL) <= unjustKills){
-		setSkull(SKULL_RED);
-	}
+	// Counted on the database thread, after the death of attacked was written
+	IOPlayer::instance()->fetchUnjustKillCount(getGUID(),
+		boost::bind(&Player::onUnjustKillCount, getID(), _1));
+}
 
-	//week
-	unjustKills = IOPlayer::instance()->getPlayerUnjustKillCount(this, UNJUST_KILL_PERIOD_WEEK);
-	if(g_config.getNumber(ConfigManager::KILLS_PER_WEEK_BLACK_SKULL) > 0 &&
-		g_config.getNumber(ConfigManager::KILLS_PER_WEEK_BLACK_SKULL) <= unjustKills){
-		setSkull(SKULL_BLACK);
-	}
-	else if(getSkull() != SKULL_BLACK &&
-			g_config.getNumber(ConfigManager::KILLS_PER_WEEK_RED_SKULL) > 0 &&
-			g_config.getNumber(ConfigManager::KILLS_PER_WEEK_RED_SKULL) <= unjustKills){
-		setSkull(SKULL_RED);
+void Player::onUnjustKillCount(uint32_t playerId, UnjustKillCount_ptr count)
+{
+	Player* player = g_game.getPlayerByID(playerId);
+	if(!player || player->isRemoved()){
+		return;
 	}
 
-	//month
-	unjustKills = IOPlayer::instance()->getPlayerUnjustKillCount(this, UNJUST_KILL_PERIOD_MONTH);
-	if(g_config.getNumber(ConfigManager::KILLS_PER_MONTH_BLACK_SKULL) > 0 &&
-		g_config.getNumber(ConfigManager::KILLS_PER_MONTH_BLACK_SKULL) <= unjustKills){
+	player->updateUnjustSkull(count->day, g_config.getNumber(ConfigManager::KILLS_PER_DAY_RED_SKULL),
+		g_config.getNumber(ConfigManager::KILLS_PER_DAY_BLACK_SKULL));
+	player->updateUnjustSkull(count->week, g_config.getNumber(ConfigManager::KILLS_PER_WEEK_RED_SKULL),
+		g_config.getNumber(ConfigManager::KILLS_PER_WEEK_BLACK_SKULL));
+	player->updateUnjustSkull(count->month, g_config.getNumber(ConfigManager::KILLS_PER_MONTH_RED_SKULL),
+		g_config.getNumber(ConfigManager::KILLS_PER_MONTH_BLACK_SKULL));
+}
+
+void Player::updateUnjustSkull(int32_t unjustKills, int64_t redSkullKills, int64_t blackSkullKills)
+{
+	SkullType oldSkull = getSkull();
+	if(blackSkullKills > 0 && blackSkullKills <= unjustKills){
 		setSkull(SKULL_BLACK);
 	}
-	else if(getSkull() != SKULL_BLACK &&
-			g_config.getNumber(ConfigManager::KILLS_PER_MONTH_RED_SKULL) > 0 &&
-			g_config.getNumber(ConfigManager::KILLS_PER_MONTH_RED_SKULL) <= unjustKills){
+	else if(getSkull() != SKULL_BLACK && redSkullKills > 0 && redSkullKills <= unjustKills){
 		setSkull(SKULL_RED);
 	}
 
@@ -4243,7 +4227,7 @@ bool Player::transferMoneyTo(const std::string& name, uint32_t amount)
 	}
 
 	if(target->isOffline()){
-		IOPlayer::instance()->savePlayer(target);
+		IOPlayer::instance()->savePlayerAsync(target);
 		delete target;
 	}
 
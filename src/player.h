@@ -27,6 +27,7 @@
 #include "cylinder.h"
 #include "vocation.h"
 #include "protocolgame.h"
+#include "ioplayer.h"
 
 enum skillsid_t {
 	SKILL_LEVEL=0,
@@ -361,6 +362,8 @@ public:
 	void addAttacked(const Player* attacked);
 	void clearAttacked();
 	void addUnjustifiedDead(const Player* attacked);
+	static void onUnjustKillCount(uint32_t playerId, UnjustKillCount_ptr count);
+	void updateUnjustSkull(int32_t unjustKills, int64_t redSkullKills, int64_t blackSkullKills);
 	void setSkull(SkullType newSkull) {skullType = newSkull;}
 	void sendCreatureSkull(const Creature* creature) const
 		{if(client) client->sendCreatureSkull(creature);}
@@ -547,6 +550,16 @@ public:
 	//items
 	ContainerVector containerVec;
 	void preSave();
+
+	//what the database holds since the load or the last save, a save only
+	//writes what differs from it
+	PlayerSaveData_ptr savedState;
+	//the last state added to the player journal, the next record holds
+	//what differs from it
+	PlayerSaveData_ptr journalState;
+	//what the database holds since the load or the last synced server
+	//save, the next record also holds what differs from it
+	PlayerSaveData_ptr journalBase;
 	bool hasCapacity(const Item* item, uint32_t count) const;
 
 	//stamina
@@ -0,0 +1,690 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include "player_journal.h"
+#include "otsystem.h"
+#include "singleton.h"
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+#include <sstream>
+
+#ifdef __WINDOWS__
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+PlayerJournal::PlayerJournal()
+{
+	m_enabled = false;
+	m_flushInterval = 0;
+	m_file = NULL;
+	m_openFile = 0;
+	m_currentFile = 0;
+	m_sequence = 0;
+	m_flushedSequence = 0;
+	m_flushRequested = false;
+	m_unwritten = false;
+}
+
+PlayerJournal::~PlayerJournal()
+{
+	stop();
+}
+
+PlayerJournal* PlayerJournal::getInstance()
+{
+	static Singleton<PlayerJournal> instance;
+	return instance.get();
+}
+
+bool PlayerJournal::start(const std::string& filename, uint32_t flushInterval)
+{
+	if(m_enabled){
+		return true;
+	}
+
+	// A file left behind would be read again after the next crash, older
+	// than the records written from now on
+	std::vector<uint32_t> files = listFiles(filename);
+	for(std::vector<uint32_t>::const_iterator it = files.begin(); it != files.end(); ++it){
+		if(remove(getFileName(filename, *it).c_str()) != 0){
+			std::cout << "[Error] Could not delete the player journal " << getFileName(filename, *it) << std::endl;
+			return false;
+		}
+	}
+
+	m_filename = filename;
+	m_flushInterval = std::max<uint32_t>(1, flushInterval);
+	m_currentFile = 1;
+	m_unwritten = false;
+	if(!openFile(m_currentFile)){
+		return false;
+	}
+
+	m_enabled = true;
+	m_thread = boost::thread(boost::bind(&PlayerJournal::writerThread, (void*)this));
+	return true;
+}
+
+void PlayerJournal::stop(bool written /*= false*/)
+{
+	if(!m_enabled){
+		return;
+	}
+
+	m_lock.lock();
+	m_enabled = false;
+	m_lock.unlock();
+	m_signal.notify_one();
+	m_thread.join();
+
+	closeFile();
+
+	if(written && !m_unwritten){
+		std::vector<uint32_t> files = listFiles(m_filename);
+		for(std::vector<uint32_t>::const_iterator it = files.begin(); it != files.end(); ++it){
+			remove(getFileName(m_filename, *it).c_str());
+		}
+	}
+}
+
+void PlayerJournal::setUnwritten()
+{
+	boost::mutex::scoped_lock lockClass(m_lock);
+	m_unwritten = true;
+}
+
+uint64_t PlayerJournal::addPlayer(const PlayerSaveData_ptr& data, const PlayerSaveData_ptr& previous, const PlayerSaveData_ptr& base)
+{
+	Entry entry;
+	entry.type = JOURNAL_PLAYER;
+	entry.data = data;
+	entry.previous = previous;
+	entry.base = base;
+	return addEntry(entry);
+}
+
+uint64_t PlayerJournal::addDeath(const PlayerDeathData_ptr& data)
+{
+	Entry entry;
+	entry.type = JOURNAL_DEATH;
+	entry.death = data;
+	return addEntry(entry);
+}
+
+uint64_t PlayerJournal::addEntry(Entry& entry)
+{
+	// The records are encoded by the writer thread, the game only queues
+	// them
+	boost::mutex::scoped_lock lockClass(m_lock);
+	if(!m_enabled){
+		return 0;
+	}
+
+	entry.file = m_currentFile;
+	entry.sequence = ++m_sequence;
+	m_entries.push_back(entry);
+	return entry.sequence;
+}
+
+void PlayerJournal::waitFlushed(uint64_t sequence)
+{
+	if(sequence == 0){
+		return;
+	}
+
+	boost::mutex::scoped_lock lockClass(m_lock);
+	if(m_flushedSequence >= sequence){
+		return;
+	}
+
+	m_flushRequested = true;
+	m_signal.notify_one();
+	while(m_flushedSequence < sequence){
+		m_flushSignal.wait(lockClass);
+	}
+}
+
+uint32_t PlayerJournal::rotate()
+{
+	boost::mutex::scoped_lock lockClass(m_lock);
+	if(!m_enabled){
+		return 0;
+	}
+	return m_currentFile++;
+}
+
+void PlayerJournal::checkpoint(uint32_t file)
+{
+	boost::mutex::scoped_lock lockClass(m_lock);
+	if(!m_enabled || file == 0){
+		return;
+	}
+
+	Entry entry;
+	entry.file = file;
+	m_entries.push_back(entry);
+}
+
+void PlayerJournal::getStats(PlayerJournalStats& stats)
+{
+	boost::mutex::scoped_lock lockClass(m_lock);
+	stats = m_stats;
+}
+
+void PlayerJournal::writerThread(void* p)
+{
+	PlayerJournal* journal = (PlayerJournal*)p;
+	std::vector<Entry> pending;
+
+	boost::unique_lock<boost::mutex> lockUnique(journal->m_lock);
+	while(true){
+		if(journal->m_enabled && !journal->m_flushRequested){
+			// the records of the whole interval are synced at once
+			journal->m_signal.timed_wait(lockUnique, boost::posix_time::milliseconds(journal->m_flushInterval));
+		}
+
+		pending.swap(journal->m_entries);
+		journal->m_flushRequested = false;
+		bool enabled = journal->m_enabled;
+		lockUnique.unlock();
+
+		PlayerJournalStats stats;
+		uint64_t sequence = 0;
+		bool flushed = !pending.empty();
+		if(flushed){
+			int64_t start = OTSYS_TIME_US();
+			if(!journal->writeEntries(pending, stats)){
+				std::cout << "[Error] Could not write the player journal." << std::endl;
+			}
+			stats.flushTime = OTSYS_TIME_US() - start;
+
+			for(std::vector<Entry>::const_iterator it = pending.begin(); it != pending.end(); ++it){
+				sequence = std::max(sequence, it->sequence);
+			}
+			pending.clear();
+		}
+
+		lockUnique.lock();
+		if(flushed){
+			journal->m_stats.records += stats.records;
+			journal->m_stats.deaths += stats.deaths;
+			journal->m_stats.bytes += stats.bytes;
+			++journal->m_stats.flushes;
+			journal->m_stats.flushTime += stats.flushTime;
+			journal->m_stats.maxFlushTime = std::max(journal->m_stats.maxFlushTime, stats.flushTime);
+		}
+
+		// a failed write does not hold back the saves waiting for it, the
+		// error is reported above
+		journal->m_flushedSequence = std::max(journal->m_flushedSequence, sequence);
+		journal->m_flushSignal.notify_all();
+
+		if(!enabled){
+			break;
+		}
+	}
+}
+
+bool PlayerJournal::writeEntries(const std::vector<Entry>& entries, PlayerJournalStats& stats)
+{
+	bool written = true;
+	for(std::vector<Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it){
+		if(it->type == 0){
+			// a server save has written the records of these files, the
+			// next record opens the file after them
+			if(m_openFile <= it->file){
+				written = syncFile() && written;
+				closeFile();
+			}
+
+			std::vector<uint32_t> files = listFiles(m_filename);
+			for(std::vector<uint32_t>::const_iterator file = files.begin(); file != files.end(); ++file){
+				if(*file <= it->file){
+					remove(getFileName(m_filename, *file).c_str());
+				}
+			}
+			continue;
+		}
+
+		if(it->file != m_openFile){
+			// the records before the rotation are complete
+			written = syncFile() && written;
+			closeFile();
+			openFile(it->file);
+		}
+
+		if(!m_file){
+			written = false;
+			continue;
+		}
+
+		PropWriteStream stream;
+		if(it->type == JOURNAL_PLAYER){
+			// previous keeps a section that changed back since an earlier
+			// record, base one the database never received
+			uint32_t sections = it->data->getChangedSections(it->previous.get()) |
+				it->data->getChangedSections(it->base.get());
+			if(sections == 0){
+				continue;
+			}
+
+			encodePlayer(stream, *it->data, sections);
+			++stats.records;
+		}
+		else{
+			encodeDeath(stream, *it->death);
+			++stats.deaths;
+		}
+
+		uint32_t size;
+		const char* payload = stream.getStream(size);
+		boost::crc_32_type crc;
+		crc.process_bytes(payload, size);
+		uint32_t checksum = crc.checksum();
+
+		if(fwrite(&size, sizeof(size), 1, m_file) != 1 ||
+			fwrite(&checksum, sizeof(checksum), 1, m_file) != 1 ||
+			fwrite(payload, 1, size, m_file) != size)
+		{
+			written = false;
+		}
+		stats.bytes += size + 8;
+	}
+
+	return syncFile() && written;
+}
+
+bool PlayerJournal::openFile(uint32_t file)
+{
+	std::string name = getFileName(m_filename, file);
+	m_file = fopen(name.c_str(), "wb");
+	m_openFile = file;
+	if(!m_file){
+		std::cout << "[Error] Could not open the player journal " << name << std::endl;
+		return false;
+	}
+
+	uint32_t version = PLAYER_JOURNAL_VERSION;
+	fwrite(PLAYER_JOURNAL_MAGIC, 1, 4, m_file);
+	fwrite(&version, sizeof(version), 1, m_file);
+	return true;
+}
+
+bool PlayerJournal::syncFile()
+{
+	if(!m_file){
+		return true;
+	}
+
+	if(fflush(m_file) != 0){
+		return false;
+	}
+
+#ifdef __WINDOWS__
+	return _commit(_fileno(m_file)) == 0;
+#else
+	return fsync(fileno(m_file)) == 0;
+#endif
+}
+
+void PlayerJournal::closeFile()
+{
+	if(m_file){
+		fclose(m_file);
+		m_file = NULL;
+	}
+}
+
+void PlayerJournal::encodePlayer(PropWriteStream& stream, const PlayerSaveData& data, uint32_t sections)
+{
+	stream.ADD_UCHAR(JOURNAL_PLAYER);
+	stream.ADD_ULONG(data.guid);
+	stream.ADD_STRING(data.name);
+	stream.ADD_UCHAR((uint8_t)sections);
+
+	if(sections & PLAYER_SAVE_STATS){
+		stream.ADD_UCHAR((uint8_t)data.player.size());
+		for(std::vector<int64_t>::const_iterator it = data.player.begin(); it != data.player.end(); ++it){
+			stream.ADD_VALUE(*it);
+		}
+	}
+
+	if(sections & PLAYER_SAVE_CONDITIONS){
+		stream.ADD_LSTRING(data.conditions);
+	}
+
+	if(sections & PLAYER_SAVE_SKILLS){
+		stream.ADD_UCHAR((uint8_t)data.skills.size());
+		for(std::vector<std::pair<uint32_t, uint32_t> >::const_iterator it = data.skills.begin(); it != data.skills.end(); ++it){
+			stream.ADD_ULONG(it->first);
+			stream.ADD_ULONG(it->second);
+		}
+	}
+
+	if(sections & PLAYER_SAVE_STORAGE){
+		stream.ADD_ULONG((uint32_t)data.storage.size());
+		for(std::vector<std::pair<std::string, std::string> >::const_iterator it = data.storage.begin(); it != data.storage.end(); ++it){
+			stream.ADD_LSTRING(it->first);
+			stream.ADD_LSTRING(it->second);
+		}
+	}
+
+	if(sections & PLAYER_SAVE_VIPS){
+		stream.ADD_ULONG((uint32_t)data.vips.size());
+		for(std::vector<uint32_t>::const_iterator it = data.vips.begin(); it != data.vips.end(); ++it){
+			stream.ADD_ULONG(*it);
+		}
+	}
+
+	if(sections & PLAYER_SAVE_ITEMS){
+		stream.ADD_LSTRING(data.inventory);
+		stream.ADD_ULONG((uint32_t)data.depots.size());
+		for(std::vector<std::pair<uint32_t, std::string> >::const_iterator it = data.depots.begin(); it != data.depots.end(); ++it){
+			stream.ADD_ULONG(it->first);
+			stream.ADD_LSTRING(it->second);
+		}
+	}
+}
+
+void PlayerJournal::encodeDeath(PropWriteStream& stream, const PlayerDeathData& data)
+{
+	stream.ADD_UCHAR(JOURNAL_DEATH);
+	stream.ADD_ULONG(data.guid);
+	stream.ADD_VALUE((uint64_t)data.date);
+	stream.ADD_ULONG(data.level);
+	stream.ADD_USHORT((uint16_t)data.killers.size());
+	for(std::vector<PlayerDeathData::Killer>::const_iterator it = data.killers.begin(); it != data.killers.end(); ++it){
+		stream.ADD_ULONG(it->playerGuid);
+		stream.ADD_UCHAR(it->unjustified ? 1 : 0);
+		stream.ADD_STRING(it->name);
+	}
+}
+
+bool PlayerJournal::read(const std::string& filename, PlayerJournalContents& contents)
+{
+	std::vector<uint32_t> files = listFiles(filename);
+	for(std::vector<uint32_t>::const_iterator it = files.begin(); it != files.end(); ++it){
+		std::string name = getFileName(filename, *it);
+		FILE* file = fopen(name.c_str(), "rb");
+		if(!file){
+			std::cout << "[Error] Could not open the player journal " << name << std::endl;
+			return false;
+		}
+
+		std::vector<char> buffer;
+		fseek(file, 0, SEEK_END);
+		long fileSize = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		if(fileSize > 0){
+			buffer.resize(fileSize);
+			buffer.resize(fread(&buffer[0], 1, fileSize, file));
+		}
+		fclose(file);
+
+		++contents.files;
+		contents.bytes += buffer.size();
+
+		// a crash right after the file was created may leave it empty
+		const uint32_t headerSize = 8;
+		if(buffer.size() < headerSize){
+			continue;
+		}
+
+		uint32_t version;
+		memcpy(&version, &buffer[4], sizeof(version));
+		if(memcmp(&buffer[0], PLAYER_JOURNAL_MAGIC, 4) != 0 || version != PLAYER_JOURNAL_VERSION){
+			std::cout << "[Error] Unknown player journal format in " << name << std::endl;
+			return false;
+		}
+
+		size_t pos = headerSize;
+		while(pos < buffer.size()){
+			uint32_t size, checksum;
+			if(buffer.size() - pos < 8){
+				++contents.errors;
+				break;
+			}
+
+			memcpy(&size, &buffer[pos], sizeof(size));
+			memcpy(&checksum, &buffer[pos + 4], sizeof(checksum));
+			pos += 8;
+
+			// cut short by the crash, nothing after it was synced
+			if(buffer.size() - pos < size){
+				++contents.errors;
+				break;
+			}
+
+			boost::crc_32_type crc;
+			crc.process_bytes(&buffer[pos], size);
+			if(crc.checksum() != checksum){
+				++contents.errors;
+				break;
+			}
+
+			PropStream stream;
+			stream.init(&buffer[pos], size);
+			pos += size;
+
+			uint8_t type = 0;
+			stream.GET_UCHAR(type);
+			bool decoded = false;
+			if(type == JOURNAL_PLAYER){
+				decoded = decodePlayer(stream, contents);
+			}
+			else if(type == JOURNAL_DEATH){
+				decoded = decodeDeath(stream, contents);
+			}
+
+			if(decoded){
+				++contents.records;
+			}
+			else{
+				++contents.errors;
+			}
+		}
+	}
+	return true;
+}
+
+bool PlayerJournal::decodePlayer(PropStream& stream, PlayerJournalContents& contents)
+{
+	uint32_t guid;
+	std::string name;
+	uint8_t sections;
+	if(!stream.GET_ULONG(guid) || !stream.GET_STRING(name) || !stream.GET_UCHAR(sections)){
+		return false;
+	}
+
+	// read aside first, a broken record leaves the player as it was
+	PlayerSaveData record;
+	if(sections & PLAYER_SAVE_STATS){
+		uint8_t count;
+		if(!stream.GET_UCHAR(count)){
+			return false;
+		}
+
+		for(uint8_t i = 0; i < count; ++i){
+			int64_t value;
+			if(!stream.GET_VALUE(value)){
+				return false;
+			}
+			record.player.push_back(value);
+		}
+	}
+
+	if((sections & PLAYER_SAVE_CONDITIONS) && !stream.GET_LSTRING(record.conditions)){
+		return false;
+	}
+
+	if(sections & PLAYER_SAVE_SKILLS){
+		uint8_t count;
+		if(!stream.GET_UCHAR(count)){
+			return false;
+		}
+
+		for(uint8_t i = 0; i < count; ++i){
+			uint32_t level, tries;
+			if(!stream.GET_ULONG(level) || !stream.GET_ULONG(tries)){
+				return false;
+			}
+			record.skills.push_back(std::make_pair(level, tries));
+		}
+	}
+
+	if(sections & PLAYER_SAVE_STORAGE){
+		uint32_t count;
+		if(!stream.GET_ULONG(count)){
+			return false;
+		}
+
+		for(uint32_t i = 0; i < count; ++i){
+			std::string key, value;
+			if(!stream.GET_LSTRING(key) || !stream.GET_LSTRING(value)){
+				return false;
+			}
+			record.storage.push_back(std::make_pair(key, value));
+		}
+	}
+
+	if(sections & PLAYER_SAVE_VIPS){
+		uint32_t count;
+		if(!stream.GET_ULONG(count)){
+			return false;
+		}
+
+		for(uint32_t i = 0; i < count; ++i){
+			uint32_t vip;
+			if(!stream.GET_ULONG(vip)){
+				return false;
+			}
+			record.vips.push_back(vip);
+		}
+	}
+
+	if(sections & PLAYER_SAVE_ITEMS){
+		uint32_t count;
+		if(!stream.GET_LSTRING(record.inventory) || !stream.GET_ULONG(count)){
+			return false;
+		}
+
+		for(uint32_t i = 0; i < count; ++i){
+			uint32_t depotId;
+			std::string depot;
+			if(!stream.GET_ULONG(depotId) || !stream.GET_LSTRING(depot)){
+				return false;
+			}
+			record.depots.push_back(std::make_pair(depotId, depot));
+		}
+	}
+
+	// the sections of a later record replace the ones before
+	PlayerJournalContents::Player& player = contents.players[guid];
+	player.data.guid = guid;
+	player.data.name = name;
+	if(sections & PLAYER_SAVE_STATS)
+		player.data.player.swap(record.player);
+	if(sections & PLAYER_SAVE_CONDITIONS)
+		player.data.conditions.swap(record.conditions);
+	if(sections & PLAYER_SAVE_SKILLS)
+		player.data.skills.swap(record.skills);
+	if(sections & PLAYER_SAVE_STORAGE)
+		player.data.storage.swap(record.storage);
+	if(sections & PLAYER_SAVE_VIPS)
+		player.data.vips.swap(record.vips);
+	if(sections & PLAYER_SAVE_ITEMS){
+		player.data.items = true;
+		player.data.inventory.swap(record.inventory);
+		player.data.depots.swap(record.depots);
+	}
+	player.sections |= sections;
+	return true;
+}
+
+bool PlayerJournal::decodeDeath(PropStream& stream, PlayerJournalContents& contents)
+{
+	PlayerDeathData_ptr death(new PlayerDeathData());
+	uint64_t date;
+	uint16_t count;
+	if(!stream.GET_ULONG(death->guid) || !stream.GET_VALUE(date) ||
+		!stream.GET_ULONG(death->level) || !stream.GET_USHORT(count))
+	{
+		return false;
+	}
+	death->date = (time_t)date;
+
+	for(uint16_t i = 0; i < count; ++i){
+		PlayerDeathData::Killer killer;
+		uint8_t unjustified;
+		if(!stream.GET_ULONG(killer.playerGuid) || !stream.GET_UCHAR(unjustified) || !stream.GET_STRING(killer.name)){
+			return false;
+		}
+
+		killer.unjustified = (unjustified != 0);
+		death->killers.push_back(killer);
+	}
+
+	contents.deaths.push_back(death);
+	return true;
+}
+
+std::vector<uint32_t> PlayerJournal::listFiles(const std::string& filename)
+{
+	using namespace boost::filesystem;
+	std::vector<uint32_t> files;
+
+	path journal(filename);
+	path directory = journal.parent_path();
+	if(directory.empty()){
+		directory = ".";
+	}
+
+	// filename.1, filename.2 and so on
+	std::string prefix = journal.filename().string() + ".";
+	try
+	{
+		directory_iterator end_itr;
+		for(directory_iterator itr(directory); itr != end_itr; ++itr){
+			std::string name = itr->path().filename().string();
+			if(name.size() > prefix.size() && name.compare(0, prefix.size(), prefix) == 0 &&
+				name.find_first_not_of("0123456789", prefix.size()) == std::string::npos)
+			{
+				files.push_back((uint32_t)atol(name.c_str() + prefix.size()));
+			}
+		}
+	}
+	catch(boost::filesystem::filesystem_error&)
+	{
+		// no directory, no files
+	}
+
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+std::string PlayerJournal::getFileName(const std::string& filename, uint32_t file)
+{
+	std::ostringstream name;
+	name << filename << "." << file;
+	return name.str();
+}
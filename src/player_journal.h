@@ -0,0 +1,198 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Append-only journal of the player changes between server saves
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_PLAYER_JOURNAL_H__
+#define __OTSERV_PLAYER_JOURNAL_H__
+
+#include <boost/thread.hpp>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include "ioplayer.h"
+#include "fileloader.h"
+
+// Journal layout, all values little endian:
+//   file: "OTPJ", U32 version, records
+//   record: U32 size, U32 crc32 of the payload, payload
+//   player payload: U8 type, U32 guid, STRING name, U8 sections, and the
+//     sections of PlayerSaveData that changed since the record before or
+//     differ from what the database held at the last synced save
+//   death payload: U8 type, U32 guid, U64 date, U32 level, U16 killers,
+//     every killer as U32 guid, U8 unjustified, STRING name
+// A record cut short by a crash ends the file.
+#define PLAYER_JOURNAL_MAGIC "OTPJ"
+#define PLAYER_JOURNAL_VERSION 1
+
+enum PlayerJournalRecord_t {
+	JOURNAL_PLAYER = 1,
+	JOURNAL_DEATH = 2
+};
+
+struct PlayerJournalStats {
+	PlayerJournalStats() : records(0), deaths(0), bytes(0), flushes(0), flushTime(0), maxFlushTime(0) {}
+
+	uint64_t records;
+	uint64_t deaths;
+	uint64_t bytes;
+	uint64_t flushes;
+	uint64_t flushTime; // us
+	uint64_t maxFlushTime; // us
+};
+
+/** What the journal files hold, the records of every player are merged */
+struct PlayerJournalContents {
+	PlayerJournalContents() : files(0), records(0), bytes(0), errors(0) {}
+
+	struct Player {
+		Player() : sections(0) {}
+
+		PlayerSaveData data;
+		// the PlayerSaveSection_t of data that were journaled
+		uint32_t sections;
+	};
+
+	std::map<uint32_t, Player> players;
+	std::vector<PlayerDeathData_ptr> deaths;
+
+	uint32_t files;
+	uint32_t records;
+	uint64_t bytes;
+	// records that could not be read
+	uint32_t errors;
+};
+
+/**
+ * Player changes between two server saves.
+ *
+ * A background thread appends the records to the current file and syncs
+ * them to the disk in batches. A server save starts a new file and, once
+ * it has been written, deletes the files before it, so the files hold the
+ * changes the database does not have yet. A clean shutdown deletes them
+ * once every player is saved. They are read back with read() after a crash
+ * and written with IOPlayer::writeJournal before the game opens.
+ *
+ * A player row has to be written after its record is on the disk, writes
+ * wait for it with waitFlushed(). Otherwise an older record could replace
+ * it after a crash.
+*/
+class PlayerJournal
+{
+public:
+	PlayerJournal();
+	~PlayerJournal();
+
+	static PlayerJournal* getInstance();
+
+	/** Deletes the files of filename, they have to be written to the
+	  * database before, and opens a new one
+	  * \param flushInterval ms a record waits for the next sync at most
+	  */
+	bool start(const std::string& filename, uint32_t flushInterval);
+	/** Syncs the records added so far and closes the file
+	  * \param written the database holds every record and is synced, the
+	  * files are deleted so the next start has nothing to replay. They are
+	  * kept anyway once setUnwritten was called.
+	  */
+	void stop(bool written = false);
+	bool isEnabled() const {return m_enabled;}
+
+	// A write of what the records hold failed, stop keeps the files
+	void setUnwritten();
+
+	/** Adds the sections of data that differ from previous or from base,
+	  * all of them without either. None of them may change afterwards.
+	  * \param previous the state of the last record of the player
+	  * \param base what the database held at the last synced save, a
+	  * record never leaves out a section the database does not have, even
+	  * when a shallow save made it look unchanged since previous
+	  * \return the sequence of the record for waitFlushed, 0 when disabled
+	  */
+	uint64_t addPlayer(const PlayerSaveData_ptr& data, const PlayerSaveData_ptr& previous, const PlayerSaveData_ptr& base);
+	uint64_t addDeath(const PlayerDeathData_ptr& data);
+
+	// Blocks until the record of sequence is on the disk, it is synced
+	// without waiting for the flush interval
+	void waitFlushed(uint64_t sequence);
+
+	/** The records added from now on go to a new file
+	  * \return the file the records before went to, for checkpoint
+	  */
+	uint32_t rotate();
+	// Deletes file and the files before it, once the database holds them
+	void checkpoint(uint32_t file);
+
+	void getStats(PlayerJournalStats& stats);
+
+	// Reads the files of filename, does not change them
+	static bool read(const std::string& filename, PlayerJournalContents& contents);
+
+protected:
+	struct Entry {
+		Entry() : type(0), file(0), sequence(0) {}
+
+		uint8_t type; // PlayerJournalRecord_t, 0 deletes the files up to file
+		uint32_t file;
+		uint64_t sequence;
+		PlayerSaveData_ptr data;
+		PlayerSaveData_ptr previous;
+		PlayerSaveData_ptr base;
+		PlayerDeathData_ptr death;
+	};
+
+	uint64_t addEntry(Entry& entry);
+	static void writerThread(void* p);
+	bool writeEntries(const std::vector<Entry>& entries, PlayerJournalStats& stats);
+	bool openFile(uint32_t file);
+	bool syncFile();
+	void closeFile();
+
+	static void encodePlayer(PropWriteStream& stream, const PlayerSaveData& data, uint32_t sections);
+	static void encodeDeath(PropWriteStream& stream, const PlayerDeathData& data);
+	static bool decodePlayer(PropStream& stream, PlayerJournalContents& contents);
+	static bool decodeDeath(PropStream& stream, PlayerJournalContents& contents);
+	// The numbers of the files of filename, sorted
+	static std::vector<uint32_t> listFiles(const std::string& filename);
+	static std::string getFileName(const std::string& filename, uint32_t file);
+
+	volatile bool m_enabled;
+	std::string m_filename;
+	uint32_t m_flushInterval;
+
+	// written by the writer thread only
+	FILE* m_file;
+	uint32_t m_openFile;
+
+	boost::thread m_thread;
+	boost::mutex m_lock;
+	boost::condition_variable m_signal;
+	boost::condition_variable m_flushSignal;
+	std::vector<Entry> m_entries;
+	uint32_t m_currentFile;
+	uint64_t m_sequence;
+	uint64_t m_flushedSequence;
+	bool m_flushRequested;
+	bool m_unwritten;
+
+	PlayerJournalStats m_stats;
+};
+
+#endif
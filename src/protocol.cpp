@@ -28,6 +28,8 @@
 #include "outputmessage.h"
 #include "rsa.h"
 #include "connection.h"
+#include "packetrecorder.h"
+#include "cryptopool.h"
 
 extern RSA g_RSA;
 
@@ -37,6 +39,11 @@ void Protocol::onSendMessage(OutputMessage_ptr msg)
 	std::cout << "Protocol::onSendMessage" << std::endl;
 	#endif
 
+	if(m_traceSession != 0){
+		PacketRecorder::getInstance()->recordOutbound(m_traceSession,
+			msg->getOutputBuffer(), (uint16_t)msg->getMessageLength());
+	}
+
 	if(!m_rawMessages){
 		msg->writeMessageLength();
 
@@ -64,12 +71,18 @@ void Protocol::onRecvMessage(NetworkMessage& msg)
 	std::cout << "Protocol::onRecvMessage" << std::endl;
 	#endif
 
+	bool decrypted = true;
 	if(m_encryptionEnabled){
 		#ifdef __DEBUG_NET_DETAIL__
 		std::cout << "Protocol::onRecvMessage - decrypt" << std::endl;
 		#endif
 
-		XTEA_decrypt(msg);
+		decrypted = XTEA_decrypt(msg);
+	}
+
+	if(decrypted && m_traceSession != 0){
+		PacketRecorder::getInstance()->recordInbound(m_traceSession,
+			msg.getBuffer() + msg.getReadPos(), (uint16_t)msg.getMessageLength());
 	}
 	parsePacket(msg);
 }
@@ -88,6 +101,15 @@ OutputMessage_ptr Protocol::getOutputBuffer()
 	}
 }
 
+bool Protocol::skipOptionalUpdate()
+{
+	if(m_connection && m_connection->isBacklogged()){
+		ConnectionManager::getInstance()->onUpdateDropped();
+		return true;
+	}
+	return false;
+}
+
 void Protocol::releaseProtocol()
 {
 	if(m_refCount > 0){
@@ -104,6 +126,9 @@ void Protocol::deleteProtocolTask()
 {
 	//dispather thread
 	assert(m_refCount == 0);
+	if(m_traceSession != 0){
+		PacketRecorder::getInstance()->endSession(m_traceSession);
+	}
 	setConnection(Connection_ptr());
 
 	delete this;
@@ -189,6 +214,50 @@ bool Protocol::RSA_decrypt(NetworkMessage& msg)
 	return RSA_decrypt(&g_RSA, msg);
 }
 
+NetworkMessage_ptr Protocol::copyRSABlock(NetworkMessage& msg)
+{
+	if(msg.getMessageLength() - msg.getReadPos() != 128){
+		return NetworkMessage_ptr();
+	}
+
+	NetworkMessage_ptr block(new NetworkMessage());
+	memcpy(block->getBuffer(), msg.getBuffer() + msg.getReadPos(), 128);
+	block->setReadPos(0);
+	block->setMessageLength(128);
+	return block;
+}
+
+bool Protocol::addCryptoJob(const boost::function<void (void)>& work, const boost::function<void (void)>& done)
+{
+	//network thread
+	// the reference is dropped by onCryptoJobDone, or by the pool when it
+	// shuts down before the job ran
+	addRef();
+	if(!g_cryptoPool.addJob(boost::bind(&Protocol::onCryptoJob, this, getConnection(), work, done),
+		boost::bind(&Protocol::unRef, this)))
+	{
+		unRef();
+		return false;
+	}
+	return true;
+}
+
+void Protocol::onCryptoJob(Connection_ptr connection, boost::function<void (void)> work, boost::function<void (void)> done)
+{
+	//crypto pool thread
+	work();
+	connection->post(boost::bind(&Protocol::onCryptoJobDone, this, done));
+}
+
+void Protocol::onCryptoJobDone(boost::function<void (void)> done)
+{
+	//network thread
+	if(getConnection()){
+		done();
+	}
+	unRef();
+}
+
 bool Protocol::RSA_decrypt(RSA* rsa, NetworkMessage& msg)
 {
 	if(msg.getMessageLength() - msg.getReadPos() != 128){
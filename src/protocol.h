@@ -23,6 +23,8 @@
 
 #include <boost/shared_ptr.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/function.hpp>
+#include <boost/atomic.hpp>
 #include <stdint.h>
 #include "protocolconst.h"
 
@@ -33,18 +35,19 @@ class NetworkMessage;
 
 typedef boost::shared_ptr<OutputMessage> OutputMessage_ptr;
 typedef boost::shared_ptr<Connection> Connection_ptr;
+typedef boost::shared_ptr<NetworkMessage> NetworkMessage_ptr;
 
 class Protocol : boost::noncopyable
 {
 public:
-	Protocol(Connection_ptr connection)
+	Protocol(Connection_ptr connection) : m_refCount(0)
 	{
 		m_connection = connection;
 		m_encryptionEnabled = false;
 		m_checksumEnabled = false;
 		m_rawMessages = false;
 		m_key[0] = 0; m_key[1] = 0; m_key[2] = 0; m_key[3] = 0;
-		m_refCount = 0;
+		m_traceSession = 0;
 	}
 
 	virtual ~Protocol() {}
@@ -67,6 +70,9 @@ public:
 protected:
 	//Use this function for autosend messages only
 	OutputMessage_ptr getOutputBuffer();
+	// Effects and other updates the client can do without are skipped
+	// while the connection is behind on writing
+	bool skipOptionalUpdate();
 
 	void enableXTEAEncryption() { m_encryptionEnabled = true; }
 	void disableXTEAEncryption() { m_encryptionEnabled = false; }
@@ -80,13 +86,26 @@ protected:
 	bool XTEA_decrypt(NetworkMessage& msg);
 	bool RSA_decrypt(NetworkMessage& msg);
 	bool RSA_decrypt(RSA* rsa, NetworkMessage& msg);
+	// The connection reuses msg for the next packet, work queued for
+	// later needs its own copy of the RSA block
+	NetworkMessage_ptr copyRSABlock(NetworkMessage& msg);
+
+	// Runs work on the crypto pool and then done on the network thread,
+	// the protocol is kept alive in between. done is skipped if the
+	// connection was closed meanwhile. Fails if the pool is saturated.
+	bool addCryptoJob(const boost::function<void (void)>& work, const boost::function<void (void)>& done);
 
 	void setRawMessages(bool value) { m_rawMessages = value; }
+	// Packets of a traced session are written to the packet recorder
+	void setTraceSession(uint32_t session) { m_traceSession = session; }
 
 	virtual void releaseProtocol();
 	virtual void deleteProtocolTask();
 	friend class Connection;
 private:
+	void onCryptoJob(Connection_ptr connection, boost::function<void (void)> work, boost::function<void (void)> done);
+	void onCryptoJobDone(boost::function<void (void)> done);
+
 
 	OutputMessage_ptr m_outputBuffer;
 	Connection_ptr m_connection;
@@ -94,7 +113,9 @@ private:
 	bool m_checksumEnabled;
 	bool m_rawMessages;
 	uint32_t m_key[4];
-	uint32_t m_refCount;
+	// changed from the network and the dispatcher thread
+	boost::atomic<uint32_t> m_refCount;
+	uint32_t m_traceSession;
 };
 
 #endif
@@ -20,6 +20,7 @@
 #include "otpch.h"
 
 #include <fstream>
+#include <cstdlib>
 #include "protocolgame.h"
 #include "scheduler.h"
 #include "tasks.h"
@@ -35,6 +36,8 @@
 #include "ban.h"
 #include "configmanager.h"
 #include "connection.h"
+#include "packetrecorder.h"
+#include "database_executor.h"
 
 extern Game g_game;
 extern ConfigManager g_config;
@@ -44,6 +47,79 @@ Chat g_chat;
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
 uint32_t ProtocolGame::protocolGameCount = 0;
 #endif
+TileDescriptionCache ProtocolGame::tileDescriptionCache;
+ProtocolGame::PacketType ProtocolGame::packetTypes[256];
+uint8_t ProtocolGame::packetBucketCount = 0;
+bool ProtocolGame::packetTypesLoaded = ProtocolGame::loadPacketTypes();
+
+TileDescriptionCache::TileDescriptionCache()
+{
+	memset(m_entries, 0, sizeof(m_entries));
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+	hits = 0;
+	misses = 0;
+#endif
+}
+
+const TileDescriptionCache::Entry& TileDescriptionCache::get(const Tile* tile)
+{
+	//direct mapped, a client view never collides with itself: 18x14 tiles
+	//shifted by up to 7 per floor fit in 64x32, and 8 floors in a row
+	//differ in z & 7
+	const Position& pos = tile->getPosition();
+	Entry& entry = m_entries[(pos.x & 0x3F) | ((pos.y & 0x1F) << 6) | ((pos.z & 0x07) << 11)];
+
+	if(entry.tile != tile || entry.version != tile->getItemVersion()){
+		encode(entry, tile);
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+		misses++;
+#endif
+	}
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+	else{
+		hits++;
+	}
+#endif
+
+	return entry;
+}
+
+void TileDescriptionCache::encode(Entry& entry, const Tile* tile)
+{
+	entry.tile = tile;
+	entry.version = tile->getItemVersion();
+
+	m_encodeMsg.setReadPos(0);
+	m_encodeMsg.setMessageLength(0);
+
+	uint32_t count = 0;
+	if(tile->ground){
+		m_encodeMsg.AddItem(tile->ground);
+		count++;
+	}
+
+	TileItemConstIterator it;
+	for(it = tile->items_topBegin(); ((it != tile->items_topEnd()) && (count < max_tile_things)); ++it){
+		m_encodeMsg.AddItem(*it);
+		count++;
+	}
+
+	entry.topCount = count;
+	entry.topSize = m_encodeMsg.getReadPos();
+
+	//creatures go between top and down items, so keep the size of every
+	//down item prefix to cut the list wherever the thing limit is reached
+	count = 0;
+	entry.downSize[0] = 0;
+	for(it = tile->items_downBegin(); ((it != tile->items_downEnd()) && (count < max_tile_things)); ++it){
+		m_encodeMsg.AddItem(*it);
+		count++;
+		entry.downSize[count] = m_encodeMsg.getReadPos() - entry.topSize;
+	}
+
+	entry.downCount = count;
+	memcpy(entry.buffer, m_encodeMsg.getBuffer(), m_encodeMsg.getReadPos());
+}
 
 // Helping templates to add dispatcher tasks
 
@@ -63,6 +139,7 @@ ProtocolGame::ProtocolGame(Connection_ptr connection) :
 	m_debugAssertSent = false;
 	m_acceptPackets = false;
 	eventConnect = 0;
+	memset(m_packetBuckets, 0, sizeof(m_packetBuckets));
 	enableChecksum();
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
@@ -111,16 +188,18 @@ void ProtocolGame::deleteProtocolTask()
 	Protocol::deleteProtocolTask();
 }
 
-bool ProtocolGame::login(const std::string& name, bool isSetGM)
+bool ProtocolGame::login(LoginRequest_ptr request)
 {
 	//dispatcher thread
+	const std::string& name = request->name;
 	Player* _player = g_game.getPlayerByName(name);
 	if(!_player || g_config.getNumber(ConfigManager::ALLOW_CLONES)){
 		player = new Player(name, this);
 		player->addRef();
 		player->setID();
 
-		if(!IOPlayer::instance()->loadPlayer(player, name, true)){
+		// the rows were fetched on the database thread
+		if(!request->playerData || !IOPlayer::instance()->loadPlayer(player, *request->playerData, true)){
 #ifdef __DEBUG__
 			std::cout << "ProtocolGame::login - preloading loadPlayer failed - " << name << std::endl;
 #endif
@@ -128,17 +207,17 @@ bool ProtocolGame::login(const std::string& name, bool isSetGM)
 			return false;
 		}
 
-		if(g_bans.isPlayerBanished(name) && !player->hasFlag(PlayerFlag_CannotBeBanned)){
+		if(request->playerBanished && !player->hasFlag(PlayerFlag_CannotBeBanned)){
 			disconnectClient(0x14, "Your character is locked!");
 			return false;
 		}
 
-		if(g_bans.isAccountBanished(player->getAccountId()) && !player->hasFlag(PlayerFlag_CannotBeBanned)){
+		if(request->accountBanished && !player->hasFlag(PlayerFlag_CannotBeBanned)){
 			disconnectClient(0x14, "Your account is banished!");
 			return false;
 		}
 
-		if(isSetGM && !player->hasFlag(PlayerFlag_CanAlwaysLogin) &&
+		if(request->isSetGM && !player->hasFlag(PlayerFlag_CanAlwaysLogin) &&
 			!g_config.getNumber(ConfigManager::ALLOW_GAMEMASTER_MULTICLIENT))
 		{
 			disconnectClient(0x14, "You may only login with a Gamemaster account.");
@@ -156,7 +235,7 @@ bool ProtocolGame::login(const std::string& name, bool isSetGM)
 		}
 
 		if(g_config.getNumber(ConfigManager::CHECK_ACCOUNTS) && !player->hasFlag(PlayerFlag_CanAlwaysLogin)
-			&& (g_game.getPlayerByAccount(player->getAccountId()) != NULL || IOPlayer::instance()->isPlayerOnlineByAccount(player->getAccountId()))){
+			&& (g_game.getPlayerByAccount(player->getAccountId()) != NULL || request->onlineByAccount)){
 			disconnectClient(0x14, "You may only login with one character per account.");
 			return false;
 		}
@@ -181,7 +260,7 @@ bool ProtocolGame::login(const std::string& name, bool isSetGM)
 			return false;
 		}
 
-		if(!IOPlayer::instance()->loadPlayer(player, name)){
+		if(!IOPlayer::instance()->loadPlayer(player, *request->playerData)){
 #ifdef __DEBUG__
 			std::cout << "ProtocolGame::login - loadPlayer failed - " << name << std::endl;
 #endif
@@ -201,6 +280,9 @@ bool ProtocolGame::login(const std::string& name, bool isSetGM)
 		player->lastLoginMs = OTSYS_TIME();
 		IOPlayer::instance()->updateLoginInfo(player);
 		m_acceptPackets = true;
+		if(Connection_ptr connection = getConnection()){
+			connection->onPlayerPlaced(player->getName());
+		}
 
 		return true;
 	}
@@ -247,6 +329,9 @@ bool ProtocolGame::connect(uint32_t playerId)
 	player->lastip = player->getIP();
 	IOPlayer::instance()->updateLoginInfo(player);
 	m_acceptPackets = true;
+	if(Connection_ptr connection = getConnection()){
+		connection->onPlayerPlaced(player->getName());
+	}
 
 	return true;
 }
@@ -298,59 +383,124 @@ bool ProtocolGame::parseFirstPacket(NetworkMessage& msg)
 	/*uint16_t clientos =*/ msg.GetU16();
 	uint16_t version  = msg.GetU16();
 
-	if(!RSA_decrypt(msg)){
+	// RSA and hashing the password run on the crypto pool, when it is
+	// saturated the login is dropped before any expensive work is done
+	NetworkMessage_ptr rsaBlock = copyRSABlock(msg);
+	LoginRequest_ptr request(new LoginRequest());
+	request->version = version;
+	if(!rsaBlock || !addCryptoJob(boost::bind(&ProtocolGame::decryptLogin, this, rsaBlock, request),
+			boost::bind(&ProtocolGame::onLoginDecrypted, this, request))){
 		getConnection()->closeConnection();
 		return false;
 	}
 
-	uint32_t key[4];
-	key[0] = msg.GetU32();
-	key[1] = msg.GetU32();
-	key[2] = msg.GetU32();
-	key[3] = msg.GetU32();
-	enableXTEAEncryption();
-	setXTEAKey(key);
+	return true;
+}
 
-	bool isSetGM = (msg.GetByte() == 1);
-	std::string accname = msg.GetString();
-	const std::string name = msg.GetString();
-	const std::string password = msg.GetString();
+void ProtocolGame::decryptLogin(NetworkMessage_ptr msg, LoginRequest_ptr request)
+{
+	//crypto pool thread
+	if(!RSA_decrypt(*msg)){
+		return;
+	}
+
+	request->decrypted = true;
+	request->key[0] = msg->GetU32();
+	request->key[1] = msg->GetU32();
+	request->key[2] = msg->GetU32();
+	request->key[3] = msg->GetU32();
+	request->isSetGM = (msg->GetByte() == 1);
+	request->accname = msg->GetString();
+	request->name = msg->GetString();
+	request->password = hashPassword(msg->GetString());
+}
+
+void ProtocolGame::onLoginDecrypted(LoginRequest_ptr request)
+{
+	//network thread
+	if(!request->decrypted){
+		getConnection()->closeConnection();
+		return;
+	}
 
-	msg.SkipBytes(6); //841 specific
+	enableXTEAEncryption();
+	setXTEAKey(request->key);
 
-	if(version < CLIENT_VERSION_MIN || version > CLIENT_VERSION_MAX){
+	if(request->version < CLIENT_VERSION_MIN || request->version > CLIENT_VERSION_MAX){
 		disconnectClient(0x0A, "This server requires client version " CLIENT_VERSION_STRING ".");
-		return false;
+		return;
 	}
 
 	if(g_game.getGameState() == GAME_STATE_STARTUP){
 		disconnectClient(0x14, "Gameworld is starting up. Please wait.");
-		return false;
+		return;
 	}
 
 	if(g_bans.isIpDisabled(getIP()) && false){
 		disconnectClient(0x14, "Too many connections attempts from this IP. Try again later.");
-		return false;
+		return;
 	}
 
 	if(g_bans.isIpBanished(getIP())){
 		disconnectClient(0x14, "Your IP is banished!");
-		return false;
+		return;
 	}
 
+	// The checks that need the database and loading the player rows run on
+	// the database thread, the dispatcher only places the player
+	request->ip = getIP();
+	addRef();
+	g_databaseExecutor.addJob(DatabaseExecutor::getPlayerKey(request->name),
+		boost::bind(&ProtocolGame::fetchLogin, this, request),
+		boost::bind(&ProtocolGame::onLoginFetched, this, request));
+}
+
+void ProtocolGame::fetchLogin(LoginRequest_ptr request)
+{
+	//database thread
 	std::string acc_pass;
-	if(!(IOAccount::instance()->getPassword(accname, name, acc_pass) && passwordTest(password, acc_pass))){
-		g_bans.addLoginAttempt(getIP(), false);
+	if(!IOAccount::instance()->getPassword(request->accname, request->name, acc_pass) ||
+		!hashedPasswordTest(request->password, acc_pass)){
+		return;
+	}
+	request->authenticated = true;
+
+	PlayerData_ptr data(new PlayerData());
+	if(!IOPlayer::instance()->fetchPlayer(*data, request->name)){
+		return;
+	}
+
+	request->playerData = data;
+	uint32_t accountId = data->player->getDataInt("account_id");
+	request->playerBanished = g_bans.isPlayerBanished((uint32_t)data->player->getDataInt("id"));
+	request->accountBanished = g_bans.isAccountBanished(accountId);
+	request->onlineByAccount = IOPlayer::instance()->isPlayerOnlineByAccount(accountId);
+}
+
+void ProtocolGame::onLoginFetched(LoginRequest_ptr request)
+{
+	//dispatcher thread
+	unRef();
+
+	// the client may have disconnected while the database thread worked
+	if(!getConnection()){
+		request->playerData.reset();
+		return;
+	}
+
+	if(!request->authenticated){
+		g_bans.addLoginAttempt(request->ip, false);
 		getConnection()->closeConnection();
-		return false;
+		return;
 	}
 
-	g_bans.addLoginAttempt(getIP(), true);
+	g_bans.addLoginAttempt(request->ip, true);
 
-	g_dispatcher.addTask(
-		createTask(boost::bind(&ProtocolGame::login, this, name, isSetGM)));
+	if(PacketRecorder::getInstance()->isEnabled()){
+		setTraceSession(PacketRecorder::getInstance()->beginSession(request->accname, request->name));
+	}
 
-	return true;
+	login(request);
 }
 
 void ProtocolGame::onRecvFirstMessage(NetworkMessage& msg)
@@ -402,6 +552,128 @@ void ProtocolGame::disconnect()
 	}
 }
 
+void ProtocolGame::setPacketType(uint8_t type, const PacketHandler& handler, uint32_t rate /*= 0*/, uint32_t burst /*= 0*/)
+{
+	PacketType& packetType = packetTypes[type];
+	packetType.handler = handler;
+	packetType.rate = rate;
+	packetType.burst = std::max(burst, rate);
+	packetType.bucket = no_packet_bucket;
+
+	if(rate > 0){
+		if(packetBucketCount >= max_packet_buckets){
+			// runs during static initialization, a bucket past m_packetBuckets
+			// would corrupt every connection so refuse to start at all
+			std::cerr << "ProtocolGame: more than " << (int)max_packet_buckets
+				<< " rate limited packet types, raise max_packet_buckets" << std::endl;
+			std::abort();
+		}
+		packetType.bucket = packetBucketCount++;
+	}
+}
+
+bool ProtocolGame::loadPacketTypes()
+{
+	for(uint32_t i = 0; i < 256; ++i){
+		packetTypes[i].rate = 0;
+		packetTypes[i].burst = 0;
+		packetTypes[i].bucket = no_packet_bucket;
+		packetTypes[i].stats.received = 0;
+		packetTypes[i].stats.dropped = 0;
+		packetTypes[i].stats.parseTime = 0;
+	}
+
+	setPacketType(0x14, boost::bind(&ProtocolGame::parseLogout, _1, _2)); // logout
+	setPacketType(0x1E, boost::bind(&ProtocolGame::parseReceivePing, _1, _2)); // keep alive / ping response
+	setPacketType(0x64, boost::bind(&ProtocolGame::parseAutoWalk, _1, _2)); // move with steps
+	setPacketType(0x65, boost::bind(&ProtocolGame::parseMove, _1, _2, NORTH)); // move north
+	setPacketType(0x66, boost::bind(&ProtocolGame::parseMove, _1, _2, EAST)); // move east
+	setPacketType(0x67, boost::bind(&ProtocolGame::parseMove, _1, _2, SOUTH)); // move south
+	setPacketType(0x68, boost::bind(&ProtocolGame::parseMove, _1, _2, WEST)); // move west
+	setPacketType(0x69, boost::bind(&ProtocolGame::parseStopAutoWalk, _1, _2)); // stop-autowalk
+	setPacketType(0x6A, boost::bind(&ProtocolGame::parseMove, _1, _2, NORTHEAST));
+	setPacketType(0x6B, boost::bind(&ProtocolGame::parseMove, _1, _2, SOUTHEAST));
+	setPacketType(0x6C, boost::bind(&ProtocolGame::parseMove, _1, _2, SOUTHWEST));
+	setPacketType(0x6D, boost::bind(&ProtocolGame::parseMove, _1, _2, NORTHWEST));
+	setPacketType(0x6F, boost::bind(&ProtocolGame::parseTurn, _1, _2, NORTH)); // turn north
+	setPacketType(0x70, boost::bind(&ProtocolGame::parseTurn, _1, _2, EAST)); // turn east
+	setPacketType(0x71, boost::bind(&ProtocolGame::parseTurn, _1, _2, SOUTH)); // turn south
+	setPacketType(0x72, boost::bind(&ProtocolGame::parseTurn, _1, _2, WEST)); // turn west
+	setPacketType(0x78, boost::bind(&ProtocolGame::parseThrow, _1, _2), 20, 40); // throw item
+	setPacketType(0x79, boost::bind(&ProtocolGame::parseLookInShop, _1, _2), 10, 20); // description in shop window
+	setPacketType(0x7A, boost::bind(&ProtocolGame::parseShopPurchase, _1, _2)); // player bought from shop
+	setPacketType(0x7B, boost::bind(&ProtocolGame::parseShopSale, _1, _2)); // player sold to shop
+	setPacketType(0x7C, boost::bind(&ProtocolGame::parseShopClose, _1, _2)); // player closed shop window
+	setPacketType(0x7D, boost::bind(&ProtocolGame::parseRequestTrade, _1, _2)); // Request trade
+	setPacketType(0x7E, boost::bind(&ProtocolGame::parseLookInTrade, _1, _2), 10, 20); // Look at an item in trade
+	setPacketType(0x7F, boost::bind(&ProtocolGame::parseAcceptTrade, _1, _2)); // Accept trade
+	setPacketType(0x80, boost::bind(&ProtocolGame::parseCloseTrade, _1)); // Close/cancel trade
+	setPacketType(0x82, boost::bind(&ProtocolGame::parseUseItem, _1, _2), 10, 20); // use item
+	setPacketType(0x83, boost::bind(&ProtocolGame::parseUseItemEx, _1, _2), 10, 20); // use item
+	setPacketType(0x84, boost::bind(&ProtocolGame::parseBattleWindow, _1, _2), 10, 20); // battle window
+	setPacketType(0x85, boost::bind(&ProtocolGame::parseRotateItem, _1, _2)); //rotate item
+	setPacketType(0x87, boost::bind(&ProtocolGame::parseCloseContainer, _1, _2)); // close container
+	setPacketType(0x88, boost::bind(&ProtocolGame::parseUpArrowContainer, _1, _2)); //"up-arrow" - container
+	setPacketType(0x89, boost::bind(&ProtocolGame::parseTextWindow, _1, _2));
+	setPacketType(0x8A, boost::bind(&ProtocolGame::parseHouseWindow, _1, _2));
+	setPacketType(0x8C, boost::bind(&ProtocolGame::parseLookAt, _1, _2), 10, 20); // look at
+	setPacketType(0x96, boost::bind(&ProtocolGame::parseSay, _1, _2), 10, 20); // say something
+	setPacketType(0x97, boost::bind(&ProtocolGame::parseGetChannels, _1, _2), 2, 5); // request Channels
+	setPacketType(0x98, boost::bind(&ProtocolGame::parseOpenChannel, _1, _2)); // open Channel
+	setPacketType(0x99, boost::bind(&ProtocolGame::parseCloseChannel, _1, _2)); // close Channel
+	setPacketType(0x9A, boost::bind(&ProtocolGame::parseOpenPriv, _1, _2)); // open priv
+	setPacketType(0x9E, boost::bind(&ProtocolGame::parseCloseNpc, _1, _2)); // close NPC
+	setPacketType(0xA0, boost::bind(&ProtocolGame::parseFightModes, _1, _2)); // set attack and follow mode
+	setPacketType(0xA1, boost::bind(&ProtocolGame::parseAttack, _1, _2)); // attack
+	setPacketType(0xA2, boost::bind(&ProtocolGame::parseFollow, _1, _2)); //follow
+	setPacketType(0xA3, boost::bind(&ProtocolGame::parseInviteToParty, _1, _2));
+	setPacketType(0xA4, boost::bind(&ProtocolGame::parseJoinParty, _1, _2));
+	setPacketType(0xA5, boost::bind(&ProtocolGame::parseRevokePartyInvitation, _1, _2));
+	setPacketType(0xA6, boost::bind(&ProtocolGame::parsePassPartyLeadership, _1, _2));
+	setPacketType(0xA7, boost::bind(&ProtocolGame::parseLeaveParty, _1, _2));
+	setPacketType(0xA8, boost::bind(&ProtocolGame::parseEnableSharedPartyExperience, _1, _2));
+	setPacketType(0xAA, boost::bind(&ProtocolGame::parseCreatePrivateChannel, _1, _2));
+	setPacketType(0xAB, boost::bind(&ProtocolGame::parseChannelInvite, _1, _2));
+	setPacketType(0xAC, boost::bind(&ProtocolGame::parseChannelExclude, _1, _2));
+	setPacketType(0xBE, boost::bind(&ProtocolGame::parseCancelMove, _1, _2)); // cancel move
+	setPacketType(0xC9, boost::bind(&ProtocolGame::parseUpdateTile, _1, _2), 5, 10); //client request to resend the tile
+	setPacketType(0xCA, boost::bind(&ProtocolGame::parseUpdateContainer, _1, _2), 10, 20); //client request to resend the container (happens when you store more than container maxsize)
+	setPacketType(0xD2, boost::bind(&ProtocolGame::parseRequestOutfit, _1, _2), 2, 5); // request outfit
+	setPacketType(0xD3, boost::bind(&ProtocolGame::parseSetOutfit, _1, _2)); // set outfit
+	setPacketType(0xD4, boost::bind(&ProtocolGame::parseMount, _1, _2)); // mount/unmount
+	setPacketType(0xDC, boost::bind(&ProtocolGame::parseAddVip, _1, _2));
+	setPacketType(0xDD, boost::bind(&ProtocolGame::parseRemoveVip, _1, _2));
+	setPacketType(0xE6, boost::bind(&ProtocolGame::parseBugReport, _1, _2), 1, 2);
+	setPacketType(0xE7, boost::bind(&ProtocolGame::parseViolationWindow, _1, _2), 1, 2);
+	setPacketType(0xE8, boost::bind(&ProtocolGame::parseDebugAssert, _1, _2), 1, 2);
+	setPacketType(0xF0, boost::bind(&ProtocolGame::parseQuestLog, _1, _2), 2, 5);
+	setPacketType(0xF1, boost::bind(&ProtocolGame::parseQuestLine, _1, _2), 5, 10);
+	setPacketType(0xF2, boost::bind(&ProtocolGame::parseViolationReport, _1, _2), 1, 2);
+	return true;
+}
+
+const PacketStatistics& ProtocolGame::getPacketStatistics(uint8_t type)
+{
+	return packetTypes[type].stats;
+}
+
+bool ProtocolGame::consumePacketToken(const PacketType& type)
+{
+	PacketBucket& bucket = m_packetBuckets[type.bucket];
+
+	int64_t now = OTSYS_TIME();
+	uint64_t tokens = bucket.tokens + (uint64_t)(now - bucket.lastRefill) * type.rate;
+	bucket.tokens = (uint32_t)std::min(tokens, (uint64_t)type.burst * 1000);
+	bucket.lastRefill = now;
+
+	if(bucket.tokens < 1000){
+		return false;
+	}
+
+	bucket.tokens -= 1000;
+	return true;
+}
+
 void ProtocolGame::parsePacket(NetworkMessage &msg)
 {
 	if(!player || !m_acceptPackets || g_game.getGameState() == GAME_STATE_SHUTDOWN || msg.getMessageLength() <= 0)
@@ -413,294 +685,37 @@ void ProtocolGame::parsePacket(NetworkMessage &msg)
 		return;
 	}
 
-	switch(recvbyte){
-	case 0x14: // logout
-		parseLogout(msg);
-		break;
-
-	case 0x1E: // keep alive / ping response
-		parseReceivePing(msg);
-		break;
-
-	case 0x64: // move with steps
-		parseAutoWalk(msg);
-		break;
-
-	case 0x65: // move north
-		parseMove(msg, NORTH);
-		break;
-
-	case 0x66: // move east
-		parseMove(msg, EAST);
-		break;
-
-	case 0x67: // move south
-		parseMove(msg, SOUTH);
-		break;
-
-	case 0x68: // move west
-		parseMove(msg, WEST);
-		break;
-
-	case 0x69: // stop-autowalk
-		parseStopAutoWalk(msg);
-		break;
-
-	case 0x6A:
-		parseMove(msg, NORTHEAST);
-		break;
-
-	case 0x6B:
-		parseMove(msg, SOUTHEAST);
-		break;
-
-	case 0x6C:
-		parseMove(msg, SOUTHWEST);
-		break;
-
-	case 0x6D:
-		parseMove(msg, NORTHWEST);
-		break;
-
-	case 0x6F: // turn north
-		parseTurn(msg, NORTH);
-		break;
-
-	case 0x70: // turn east
-		parseTurn(msg, EAST);
-		break;
-
-	case 0x71: // turn south
-		parseTurn(msg, SOUTH);
-		break;
-
-	case 0x72: // turn west
-		parseTurn(msg, WEST);
-		break;
-
-	case 0x78: // throw item
-		parseThrow(msg);
-		break;
-
-	case 0x79: // description in shop window
-		parseLookInShop(msg);
-		break;
-
-	case 0x7A: // player bought from shop
-		parseShopPurchase(msg);
-		break;
-
-	case 0x7B: // player sold to shop
-		parseShopSale(msg);
-		break;
-
-	case 0x7C: // player closed shop window
-		parseShopClose(msg);
-		break;
-
-	case 0x7D: // Request trade
-		parseRequestTrade(msg);
-		break;
-
-	case 0x7E: // Look at an item in trade
-		parseLookInTrade(msg);
-		break;
-
-	case 0x7F: // Accept trade
-		parseAcceptTrade(msg);
-		break;
-
-	case 0x80: // Close/cancel trade
-		parseCloseTrade();
-		break;
-
-	case 0x82: // use item
-		parseUseItem(msg);
-		break;
-
-	case 0x83: // use item
-		parseUseItemEx(msg);
-		break;
-
-	case 0x84: // battle window
-		parseBattleWindow(msg);
-		break;
-
-	case 0x85:	//rotate item
-		parseRotateItem(msg);
-		break;
-
-	case 0x87: // close container
-		parseCloseContainer(msg);
-		break;
-
-	case 0x88: //"up-arrow" - container
-		parseUpArrowContainer(msg);
-		break;
-
-	case 0x89:
-		parseTextWindow(msg);
-		break;
-
-	case 0x8A:
-		parseHouseWindow(msg);
-		break;
-
-	case 0x8C: // throw item
-		parseLookAt(msg);
-		break;
-
-	case 0x96:  // say something
-		parseSay(msg);
-		break;
-
-	case 0x97: // request Channels
-		parseGetChannels(msg);
-		break;
-
-	case 0x98: // open Channel
-		parseOpenChannel(msg);
-		break;
-
-	case 0x99: // close Channel
-		parseCloseChannel(msg);
-		break;
-
-	case 0x9A: // open priv
-		parseOpenPriv(msg);
-		break;
-
-	case 0x9E: // close NPC
-		parseCloseNpc(msg);
-		break;
-
-	case 0xA0: // set attack and follow mode
-		parseFightModes(msg);
-		break;
-
-	case 0xA1: // attack
-		parseAttack(msg);
-		break;
-
-	case 0xA2: //follow
-		parseFollow(msg);
-		break;
-
-	case 0xA3:
-		parseInviteToParty(msg);
-		break;
-
-	case 0xA4:
-		parseJoinParty(msg);
-		break;
-
-	case 0xA5:
-		parseRevokePartyInvitation(msg);
-		break;
-
-	case 0xA6:
-		parsePassPartyLeadership(msg);
-		break;
-
-	case 0xA7:
-		parseLeaveParty(msg);
-		break;
-
-	case 0xA8:
-		parseEnableSharedPartyExperience(msg);
-		break;
-
-	case 0xAA:
-		parseCreatePrivateChannel(msg);
-		break;
-
-	case 0xAB:
-		parseChannelInvite(msg);
-		break;
-
-	case 0xAC:
-		parseChannelExclude(msg);
-		break;
-
-	case 0xBE: // cancel move
-		parseCancelMove(msg);
-		break;
-
-	case 0xC9: //client request to resend the tile
-		parseUpdateTile(msg);
-		break;
-
-	case 0xCA: //client request to resend the container (happens when you store more than container maxsize)
-		parseUpdateContainer(msg);
-		break;
-
-	case 0xD2: // request outfit
-		parseRequestOutfit(msg);
-		break;
-
-	case 0xD3: // set outfit
-		parseSetOutfit(msg);
-		break;
-
-	case 0xD4: // mount/unmount
-		parseMount(msg);
-		break;
-
-	case 0xDC:
-		parseAddVip(msg);
-		break;
-
-	case 0xDD:
-		parseRemoveVip(msg);
-		break;
-
-	case 0xE6:
-		parseBugReport(msg);
-		break;
+	PacketType& type = packetTypes[recvbyte];
+	type.stats.received.fetch_add(1, boost::memory_order_relaxed);
 
-	case 0xE7:
-		parseViolationWindow(msg);
-		break;
-
-	case 0xE8:
-		parseDebugAssert(msg);
-		break;
-
-	case 0xF0:
-		parseQuestLog(msg);
-		break;
-
-	case 0xF1:
-		parseQuestLine(msg);
-		break;
+	//flooding clients are dropped here, before any game task is created
+	if(type.bucket != no_packet_bucket && !consumePacketToken(type)){
+		type.stats.dropped.fetch_add(1, boost::memory_order_relaxed);
+		return;
+	}
 
-	case 0xF2:
-		parseViolationReport(msg);
-		break;
+	int64_t startTime = OTSYS_TIME_US();
 
-	default:
+	if(type.handler){
+		type.handler(this, msg);
+	}
+	else{
 //#ifdef __DEBUG__
 		printf("unknown packet header: %x \n", recvbyte);
 		parseDebug(msg);
 //#endif
-		break;
 	}
+
+	type.stats.parseTime.fetch_add(OTSYS_TIME_US() - startTime, boost::memory_order_relaxed);
 }
 
 void ProtocolGame::GetTileDescription(const Tile* tile, NetworkMessage_ptr msg)
 {
 	if(tile){
-		int count = 0;
-		if(tile->ground){
-			msg->AddItem(tile->ground);
-			count++;
-		}
-
-		TileItemConstIterator it;
-		for(it = tile->items_topBegin(); ((it != tile->items_topEnd()) && (count < 10)); ++it){
-			msg->AddItem(*it);
-			count++;
-		}
+		//the items look the same for everyone, only creatures depend on the viewer
+		const TileDescriptionCache::Entry& entry = tileDescriptionCache.get(tile);
+		msg->AddBytes(entry.buffer, entry.topSize);
+		int count = entry.topCount;
 
 		if(!tile->creatures_empty()){
 			// TODO REVERSE ITERATOR?
@@ -716,9 +731,9 @@ void ProtocolGame::GetTileDescription(const Tile* tile, NetworkMessage_ptr msg)
 			}
 		}
 
-		for(it = tile->items_downBegin(); ((it != tile->items_downEnd()) && (count < 10)); ++it){
-			msg->AddItem(*it);
-			count++;
+		int downCount = std::min((int)entry.downCount, 10 - count);
+		if(downCount > 0){
+			msg->AddBytes(entry.buffer + entry.topSize, entry.downSize[downCount]);
 		}
 	}
 }
@@ -788,17 +803,10 @@ void ProtocolGame::GetFloorDescription(NetworkMessage_ptr msg, int32_t x, int32_
 
 void ProtocolGame::checkCreatureAsKnown(uint32_t id, bool &known, uint32_t &removedKnown)
 {
-	// loop through the known player and check if the given player is in
-	std::list<uint32_t>::iterator i;
-	for(i = knownCreatureList.begin(); i != knownCreatureList.end(); ++i){
-		if((*i) == id){
-			// know... make the creature even more known...
-			knownCreatureList.erase(i);
-			knownCreatureList.push_back(id);
-
-			known = true;
-			return;
-		}
+	if(knownCreatureList.touch(id)){
+		// know... the creature is now the most recently known
+		known = true;
+		return;
 	}
 
 	// ok, he is unknown...
@@ -808,9 +816,9 @@ void ProtocolGame::checkCreatureAsKnown(uint32_t id, bool &known, uint32_t &remo
 	knownCreatureList.push_back(id);
 
 	// to many known creatures?
-	if(knownCreatureList.size() > 150){
+	if(knownCreatureList.size() > KnownCreatureList::max_size){
 		// lets try to remove one from the end of the list
-		for (int n = 0; n < 150; n++){
+		for (int n = 0; n < KnownCreatureList::max_size; n++){
 			removedKnown = knownCreatureList.front();
 
 			Creature* c = g_game.getCreatureByID(removedKnown);
@@ -818,8 +826,7 @@ void ProtocolGame::checkCreatureAsKnown(uint32_t id, bool &known, uint32_t &remo
 				break;
 
 			// this creature we can't remove, still in sight, so back to the end
-			knownCreatureList.pop_front();
-			knownCreatureList.push_back(removedKnown);
+			knownCreatureList.rotate();
 		}
 
 		// hopefully we found someone to remove :S, we got only 150 tries
@@ -1152,12 +1159,12 @@ void ProtocolGame::parseSay(NetworkMessage& msg)
 {
 	SpeakClass type = (SpeakClass)msg.GetByte();
 
-	std::string receiver;
+	boost::string_view receiver;
 	uint16_t channelId = 0;
 	switch(type.value()){
 	case enums::SPEAK_PRIVATE:
 	case enums::SPEAK_PRIVATE_RED:
-		receiver = msg.GetString();
+		receiver = msg.GetStringView();
 		break;
 	case enums::SPEAK_CHANNEL_Y:
 	case enums::SPEAK_CHANNEL_R1:
@@ -1167,11 +1174,21 @@ void ProtocolGame::parseSay(NetworkMessage& msg)
 		break;
 	}
 
-	const std::string text = msg.GetString();
+	// Only copied once the text is known to be used
+	boost::string_view text = msg.GetStringView();
 	if(text.length() > 255)
 		return;
 
-	addGameTaskTimed(DISPATCHER_TASK_EXPIRATION, &Game::playerSay, player->getID(), channelId, type, receiver, text);
+	boost::shared_ptr<SayPacket> packet(new SayPacket());
+	packet->receiver.assign(receiver.data(), receiver.size());
+	packet->text.assign(text.data(), text.size());
+	addGameTaskInternal(true, DISPATCHER_TASK_EXPIRATION,
+		boost::bind(&ProtocolGame::playerSay, player->getID(), channelId, type, packet));
+}
+
+void ProtocolGame::playerSay(uint32_t playerId, uint16_t channelId, SpeakClass type, boost::shared_ptr<SayPacket> packet)
+{
+	g_game.playerSay(playerId, channelId, type, packet->receiver, packet->text);
 }
 
 void ProtocolGame::parseFightModes(NetworkMessage& msg)
@@ -1352,11 +1369,11 @@ void ProtocolGame::parseCloseTrade()
 
 void ProtocolGame::parseAddVip(NetworkMessage& msg)
 {
-	const std::string name = msg.GetString();
+	boost::string_view name = msg.GetStringView();
 	if(name.size() > 32)
 		return;
 
-	addGameTask(&Game::playerRequestAddVip, player->getID(), name);
+	addGameTask(&Game::playerRequestAddVip, player->getID(), name.to_string());
 }
 
 void ProtocolGame::parseRemoveVip(NetworkMessage& msg)
@@ -1423,10 +1440,10 @@ void ProtocolGame::parseDebugAssert(NetworkMessage& msg)
 	}
 	m_debugAssertSent = true;
 
-	std::string assertLine = msg.GetString();
-	std::string report_date = msg.GetString();
-	std::string description = msg.GetString();
-	std::string comment = msg.GetString();
+	boost::string_view assertLine = msg.GetStringView();
+	boost::string_view report_date = msg.GetStringView();
+	boost::string_view description = msg.GetStringView();
+	boost::string_view comment = msg.GetStringView();
 
 	//write it in the assertions file
 	std::ofstream of("client_assertions.txt", std::ios_base::app);
@@ -1519,7 +1536,7 @@ void ProtocolGame::sendCreatureShield(const Creature* creature)
 
 void ProtocolGame::sendCreatureSquare(const Creature* creature, SquareColor color)
 {
-	if(canSee(creature)){
+	if(canSee(creature) && !skipOptionalUpdate()){
 		NetworkMessage_ptr msg = getOutputBuffer();
 		if(msg){
 			TRACK_MESSAGE(msg);
@@ -1895,7 +1912,7 @@ void ProtocolGame::sendPing()
 
 void ProtocolGame::sendDistanceShoot(const Position& from, const Position& to, uint8_t type)
 {
-	if(canSee(from) || canSee(to)){
+	if((canSee(from) || canSee(to)) && !skipOptionalUpdate()){
 		NetworkMessage_ptr msg = getOutputBuffer();
 		if(msg){
 			TRACK_MESSAGE(msg);
@@ -1906,7 +1923,7 @@ void ProtocolGame::sendDistanceShoot(const Position& from, const Position& to, u
 
 void ProtocolGame::sendMagicEffect(const Position& pos, uint8_t type)
 {
-	if(canSee(pos)){
+	if(canSee(pos) && !skipOptionalUpdate()){
 		NetworkMessage_ptr msg = getOutputBuffer();
 		if(msg){
 			TRACK_MESSAGE(msg);
@@ -1917,7 +1934,7 @@ void ProtocolGame::sendMagicEffect(const Position& pos, uint8_t type)
 
 void ProtocolGame::sendAnimatedText(const Position& pos, uint8_t color, std::string text)
 {
-	if(canSee(pos)){
+	if(canSee(pos) && !skipOptionalUpdate()){
 		NetworkMessage_ptr msg = getOutputBuffer();
 		if(msg){
 			TRACK_MESSAGE(msg);
@@ -22,14 +22,63 @@
 #define __OTSERV_PROTOCOLGAME_H__
 
 #include <list>
+#include <boost/function.hpp>
+#include <boost/atomic.hpp>
 #include "classes.h"
 #include "protocol.h"
+#include "networkmessage.h"
 #include "enums.h"
 #include "const.h"
+#include "knowncreaturelist.h"
+
+struct PlayerData;
 
 typedef std::list<ShopItem> ShopItemList;
 typedef boost::shared_ptr<NetworkMessage> NetworkMessage_ptr;
 
+// Keeps the encoded items of recently described tiles, so map descriptions
+// only have to add the creatures that are visible to each viewer.
+// Entries are validated against Tile::getItemVersion().
+class TileDescriptionCache
+{
+public:
+	enum {cache_size = 16384};
+	enum {max_tile_things = 10};
+
+	struct Entry{
+		const Tile* tile;
+		uint32_t version;
+		uint8_t topCount; //ground and top items
+		uint8_t topSize;
+		uint8_t downCount;
+		uint8_t downSize[max_tile_things + 1]; //bytes taken by the first n down items
+		char buffer[64];
+	};
+
+	TileDescriptionCache();
+
+	const Entry& get(const Tile* tile);
+
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+	uint64_t hits;
+	uint64_t misses;
+#endif
+
+protected:
+	void encode(Entry& entry, const Tile* tile);
+
+	Entry m_entries[cache_size];
+	NetworkMessage m_encodeMsg;
+};
+
+// Counters kept for every packet type received by the game protocol,
+// updated by every network thread
+struct PacketStatistics{
+	boost::atomic<uint64_t> received;
+	boost::atomic<uint64_t> dropped; // over the rate limit
+	boost::atomic<uint64_t> parseTime; // microseconds spent parsing and queueing the game task
+};
+
 class ProtocolGame : public Protocol
 {
 public:
@@ -43,16 +92,50 @@ public:
 	static uint32_t protocolGameCount;
 #endif
 
+	//dispatcher thread only
+	static TileDescriptionCache tileDescriptionCache;
+
 	ProtocolGame(Connection_ptr connection);
 	virtual ~ProtocolGame();
 
-	bool login(const std::string& name, bool isSetGM);
 	bool logout(bool forced);
 
 	void setPlayer(Player* p);
 
+	static const PacketStatistics& getPacketStatistics(uint8_t type);
+
 private:
-	std::list<uint32_t> knownCreatureList;
+	typedef boost::function<void (ProtocolGame*, NetworkMessage&)> PacketHandler;
+
+	// room for every rate limited opcode in loadPacketTypes, currently 18
+	enum {max_packet_buckets = 32};
+	enum {no_packet_bucket = 0xFF};
+
+	struct PacketType{
+		PacketHandler handler;
+		uint32_t rate; // packets per second allowed for each client
+		uint32_t burst;
+		uint8_t bucket; // index in m_packetBuckets, no_packet_bucket if unlimited
+		PacketStatistics stats;
+	};
+
+	// token bucket of a rate limited packet type, in thousandths of a packet
+	struct PacketBucket{
+		int64_t lastRefill;
+		uint32_t tokens;
+	};
+
+	static bool loadPacketTypes();
+	static void setPacketType(uint8_t type, const PacketHandler& handler, uint32_t rate = 0, uint32_t burst = 0);
+	bool consumePacketToken(const PacketType& type);
+
+	static PacketType packetTypes[256];
+	static uint8_t packetBucketCount;
+	static bool packetTypesLoaded;
+
+	PacketBucket m_packetBuckets[max_packet_buckets];
+
+	KnownCreatureList knownCreatureList;
 
 	bool connect(uint32_t playerId);
 	void disconnectClient(uint8_t error, const char* message);
@@ -73,6 +156,35 @@ private:
 	virtual void onConnect();
 	bool parseFirstPacket(NetworkMessage& msg);
 
+	struct LoginRequest {
+		LoginRequest() : version(0), decrypted(false), isSetGM(false), ip(0),
+			authenticated(false), playerBanished(false), accountBanished(false),
+			onlineByAccount(false) {}
+
+		uint16_t version;
+		bool decrypted;
+		uint32_t key[4];
+		bool isSetGM;
+		std::string accname;
+		std::string name;
+		std::string password; // hashed
+		uint32_t ip;
+
+		// filled on the database thread
+		bool authenticated;
+		bool playerBanished;
+		bool accountBanished;
+		bool onlineByAccount;
+		boost::shared_ptr<PlayerData> playerData;
+	};
+	typedef boost::shared_ptr<LoginRequest> LoginRequest_ptr;
+
+	void decryptLogin(NetworkMessage_ptr msg, LoginRequest_ptr request);
+	void onLoginDecrypted(LoginRequest_ptr request);
+	void fetchLogin(LoginRequest_ptr request);
+	void onLoginFetched(LoginRequest_ptr request);
+	bool login(LoginRequest_ptr request);
+
 	//Parse methods
 	void parseLogout(NetworkMessage& msg);
 	void parseCancelMove(NetworkMessage& msg);
@@ -88,6 +200,13 @@ private:
 	void parseSetOutfit(NetworkMessage& msg);
 	void parseMount(NetworkMessage &msg);
 	void parseSay(NetworkMessage& msg);
+	// The strings of a say packet, boost::bind and the task copy the
+	// pointer instead of the text
+	struct SayPacket {
+		std::string receiver;
+		std::string text;
+	};
+	static void playerSay(uint32_t playerId, uint16_t channelId, SpeakClass type, boost::shared_ptr<SayPacket> packet);
 	void parseLookAt(NetworkMessage& msg);
 	void parseFightModes(NetworkMessage& msg);
 	void parseAttack(NetworkMessage& msg);
@@ -27,6 +27,7 @@
 #include "game.h"
 #include "configmanager.h"
 #include "connection.h"
+#include "database_executor.h"
 
 extern ConfigManager g_config;
 extern BanManager g_bans;
@@ -53,7 +54,10 @@ void ProtocolLogin::disconnectClient(uint8_t error, const char* message)
 		output->AddString(message);
 		OutputMessagePool::getInstance()->send(output);
 	}
-	getConnection()->closeConnection();
+
+	if(getConnection()){
+		getConnection()->closeConnection();
+	}
 }
 
 bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
@@ -63,8 +67,6 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 		return false;
 	}
 
-	uint32_t clientip = getConnection()->getIP();
-
 	/*uint16_t clientos =*/ msg.GetU16();
 	uint16_t version  = msg.GetU16();
 	msg.SkipBytes(12);
@@ -73,48 +75,105 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 		disconnectClient(0x0A, "This server requires client version " CLIENT_VERSION_STRING ".");
 	}
 
-	if(!RSA_decrypt(msg)){
+	// RSA and hashing the password run on the crypto pool, when it is
+	// saturated the login is dropped before any expensive work is done
+	NetworkMessage_ptr rsaBlock = copyRSABlock(msg);
+	LoginRequest_ptr request(new LoginRequest());
+	request->version = version;
+	if(!rsaBlock || !addCryptoJob(boost::bind(&ProtocolLogin::decryptLogin, this, rsaBlock, request),
+			boost::bind(&ProtocolLogin::onLoginDecrypted, this, request))){
 		getConnection()->closeConnection();
 		return false;
 	}
 
-	uint32_t key[4];
-	key[0] = msg.GetU32();
-	key[1] = msg.GetU32();
-	key[2] = msg.GetU32();
-	key[3] = msg.GetU32();
+	return true;
+}
+
+void ProtocolLogin::decryptLogin(NetworkMessage_ptr msg, LoginRequest_ptr request)
+{
+	//crypto pool thread
+	if(!RSA_decrypt(*msg)){
+		return;
+	}
+
+	request->decrypted = true;
+	request->key[0] = msg->GetU32();
+	request->key[1] = msg->GetU32();
+	request->key[2] = msg->GetU32();
+	request->key[3] = msg->GetU32();
+	request->accname = msg->GetString();
+	request->password = hashPassword(msg->GetString());
+}
+
+void ProtocolLogin::onLoginDecrypted(LoginRequest_ptr request)
+{
+	//network thread
+	if(!request->decrypted){
+		getConnection()->closeConnection();
+		return;
+	}
+
 	enableXTEAEncryption();
-	setXTEAKey(key);
+	setXTEAKey(request->key);
 
-	std::string accname = msg.GetString();
-	std::string password = msg.GetString();
+	uint32_t clientip = getConnection()->getIP();
+	uint16_t version = request->version;
+	const std::string& accname = request->accname;
 
 	if(!accname.length()){
 		//Tibia sends this message if the account name length is < 5
 		//We will send it only if account name is BLANK
 		disconnectClient(0x0A, "Invalid Account Name.");
-		return false;
+		return;
 	}
 
 	if(version < CLIENT_VERSION_MIN || version > CLIENT_VERSION_MAX){
 		disconnectClient(0x0A, "This server requires client version " CLIENT_VERSION_STRING ".");
-		return false;
+		return;
 	}
 
 	if(g_game.getGameState() == GAME_STATE_STARTUP){
 		disconnectClient(0x0A, "Gameworld is starting up. Please wait.");
-		return false;
+		return;
 	}
 
 	if(g_bans.isIpDisabled(clientip)){
 		disconnectClient(0x0A, "Too many connections attempts from this IP. Try again later.");
-		return false;
+		return;
 	}
 
 	if(g_bans.isIpBanished(clientip)){
 		disconnectClient(0x0A, "Your IP is banished!");
-		return false;
+		return;
+	}
+
+	// The account is read on the database thread, the account login script
+	// and the answer run on the dispatcher
+	request->ip = clientip;
+	addRef();
+	g_databaseExecutor.addJob(boost::bind(&ProtocolLogin::fetchLogin, this, request),
+		boost::bind(&ProtocolLogin::onLoginFetched, this, request));
+}
+
+void ProtocolLogin::fetchLogin(LoginRequest_ptr request)
+{
+	//database thread
+	request->account = IOAccount::instance()->fetchAccount(request->accname);
+}
+
+void ProtocolLogin::onLoginFetched(LoginRequest_ptr request)
+{
+	//dispatcher thread
+	unRef();
+
+	// the client may have disconnected while the database thread worked
+	if(!getConnection()){
+		return;
 	}
+
+	uint32_t clientip = request->ip;
+	const std::string& accname = request->accname;
+
 	/*
 	uint32_t serverip = serverIPs[0].first;
 	for(uint32_t i = 0; i < serverIPs.size(); i++){
@@ -125,13 +184,20 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 	}
 	*/
 
-	Account account = IOAccount::instance()->loadAccount(accname);
+	Account account;
+	account.name = accname;
+	if(!g_game.onAccountLogin(account.name, account.number, account.password,
+			account.premiumEnd, account.warnings, account.charList)){
+		//not handled by script
+		account = request->account;
+	}
+
 	if(!(asLowerCaseString(account.name) == asLowerCaseString(accname) &&
-			passwordTest(password, account.password))){
+			hashedPasswordTest(request->password, account.password))){
 
 		g_bans.addLoginAttempt(clientip, false);
 		disconnectClient(0x0A, "Account name or password is not correct.");
-		return false;
+		return;
 	}
 
 	g_bans.addLoginAttempt(clientip, true);
@@ -162,8 +228,6 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 		OutputMessagePool::getInstance()->send(output);
 	}
 	getConnection()->closeConnection();
-
-	return true;
 }
 
 void ProtocolLogin::onRecvFirstMessage(NetworkMessage& msg)
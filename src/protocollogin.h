@@ -23,6 +23,7 @@
 
 #include "classes.h"
 #include "protocol.h"
+#include "account.h"
 
 class ProtocolLogin : public Protocol
 {
@@ -60,6 +61,26 @@ protected:
 	
 	bool parseFirstPacket(NetworkMessage& msg);
 
+	struct LoginRequest {
+		LoginRequest() : version(0), decrypted(false), ip(0) {}
+
+		uint16_t version;
+		bool decrypted;
+		uint32_t key[4];
+		std::string accname;
+		std::string password; // hashed
+		uint32_t ip;
+
+		// filled on the database thread
+		Account account;
+	};
+	typedef boost::shared_ptr<LoginRequest> LoginRequest_ptr;
+
+	void decryptLogin(NetworkMessage_ptr msg, LoginRequest_ptr request);
+	void onLoginDecrypted(LoginRequest_ptr request);
+	void fetchLogin(LoginRequest_ptr request);
+	void onLoginFetched(LoginRequest_ptr request);
+
 	#ifdef __DEBUG_NET_DETAIL__
 	virtual void deleteProtocolTask();
 	#endif
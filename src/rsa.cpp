@@ -30,6 +30,9 @@ RSA::RSA()
 	mpz_init(m_n);
 	mpz_init2(m_d, 1024);
 	mpz_init(m_e);
+	mpz_init2(m_dp, 512);
+	mpz_init2(m_dq, 512);
+	mpz_init2(m_qinv, 512);
 }
 
 RSA::~RSA()
@@ -39,6 +42,9 @@ RSA::~RSA()
 	mpz_clear(m_n);
 	mpz_clear(m_d);
 	mpz_clear(m_e);
+	mpz_clear(m_dp);
+	mpz_clear(m_dq);
+	mpz_clear(m_qinv);
 }
 
 bool RSA::setKey(const std::string& file)
@@ -63,7 +69,7 @@ bool RSA::setKey(const std::string& file)
 
 void RSA::setKey(const char* p, const char* q)
 {
-	boost::recursive_mutex::scoped_lock lockClass(rsaLock);
+	boost::unique_lock<boost::shared_mutex> lockClass(rsaLock);
 
 	mpz_set_str(m_p, p, 10);
 	mpz_set_str(m_q, q, 10);
@@ -93,6 +99,11 @@ void RSA::setKey(const char* p, const char* q)
 	
 	// m_d = m_e^-1 mod (p - 1)(q - 1)
 	mpz_invert(m_d, m_e, pq_1);
+
+	// dp = d mod (p - 1), dq = d mod (q - 1), qinv = q^-1 mod p
+	mpz_mod(m_dp, m_d, p_1);
+	mpz_mod(m_dq, m_d, q_1);
+	mpz_invert(m_qinv, m_q, m_p);
 	
 	mpz_clear(p_1);
 	mpz_clear(q_1);
@@ -101,7 +112,7 @@ void RSA::setKey(const char* p, const char* q)
 
 bool RSA::encrypt(char* msg)
 {
-	boost::recursive_mutex::scoped_lock lockClass(rsaLock);
+	boost::shared_lock<boost::shared_mutex> lockClass(rsaLock);
 	
 	mpz_t plain, c;
 	mpz_init2(plain, 1024);
@@ -125,16 +136,26 @@ bool RSA::encrypt(char* msg)
 
 bool RSA::decrypt(char* msg)
 {
-	boost::recursive_mutex::scoped_lock lockClass(rsaLock);
+	boost::shared_lock<boost::shared_mutex> lockClass(rsaLock);
 
-	mpz_t c, m;
+	mpz_t c, m, m2;
 	mpz_init2(c, 1024);
 	mpz_init2(m, 1024);
+	mpz_init2(m2, 512);
 
 	mpz_import(c, 128, 1, 1, 0, 0, msg);
-	
-	// m = c^d mod n
-	mpz_powm(m, c, m_d, m_n);
+
+	// m = c^d mod n, computed with the CRT as two half size exponentiations
+	// m1 = c^dp mod p, m2 = c^dq mod q
+	mpz_powm(m, c, m_dp, m_p);
+	mpz_powm(m2, c, m_dq, m_q);
+
+	// m = m2 + q * (qinv * (m1 - m2) mod p)
+	mpz_sub(m, m, m2);
+	mpz_mul(m, m, m_qinv);
+	mpz_mod(m, m, m_p);
+	mpz_mul(m, m, m_q);
+	mpz_add(m, m, m2);
 	
 	size_t count = (mpz_sizeinbase(m, 2) + 7)/8;
 	
@@ -143,6 +164,7 @@ bool RSA::decrypt(char* msg)
 
 	mpz_clear(c);
 	mpz_clear(m);
+	mpz_clear(m2);
 
 	return true;
 }
@@ -42,10 +42,13 @@ protected:
 
 	bool m_keySet;
 
-	boost::recursive_mutex rsaLock;
+	// Decryption runs on several crypto pool threads at once
+	boost::shared_mutex rsaLock;
 
 	//use only GMP
 	mpz_t m_p, m_q, m_n, m_d, m_e;
+	// CRT parameters: d mod (p - 1), d mod (q - 1), q^-1 mod p
+	mpz_t m_dp, m_dq, m_qinv;
 };
 
 #endif
@@ -5091,6 +5091,7 @@ int setItemAttribute(LuaState* state)
 	item->setAttribute(key, value);
 	// Update any intrinistic attributes
 	updateActionID<T>(key, item, value);
+	item->onAttributesChanged();
 
 	state->pushBoolean(true);
 	return 1;
@@ -5136,6 +5137,7 @@ int LuaState::lua_Item_eraseAttribute()
 	Item* item = popItem();
 
 	item->eraseAttribute(key);
+	item->onAttributesChanged();
 
 	pushBoolean(true);
 	return 1;
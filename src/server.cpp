@@ -24,14 +24,21 @@
 #endif
 
 #include <boost/asio/placeholders.hpp>
+#include <boost/thread.hpp>
 #include "server.h"
 #include "scheduler.h"
 #include "outputmessage.h"
 #include "ban.h"
 #include "connection.h"
+#ifdef __USE_IO_URING__
+#include "iouring.h"
+#endif
 
 extern BanManager g_bans;
 
+#ifdef SO_REUSEPORT
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
 
 bool ServicePort::m_logError = true;
 
@@ -60,23 +67,88 @@ std::list<uint16_t> ServiceManager::get_ports() const
 	return ports;
 }
 
+void ServiceManager::set_thread_count(uint32_t count)
+{
+	assert(m_acceptors.empty());
+#ifdef __USE_IO_URING__
+	if(m_rings.empty()){
+		create_ring(m_io_service);
+	}
+#endif
+	while(m_thread_services.size() + 1 < count){
+		IOService_ptr io_service(new boost::asio::io_service());
+		// Keeps run() from returning before the first connection arrives
+		m_thread_work.push_back(boost::shared_ptr<boost::asio::io_service::work>(
+			new boost::asio::io_service::work(*io_service)));
+		m_thread_services.push_back(io_service);
+#ifdef __USE_IO_URING__
+		create_ring(*io_service);
+#endif
+	}
+}
+
+#ifdef __USE_IO_URING__
+void ServiceManager::create_ring(boost::asio::io_service& io_service)
+{
+	// Pooled output messages are written from registered memory
+	OutputMessagePool* pool = OutputMessagePool::getInstance();
+	std::string error;
+	IoUring* ring = IoUring::create(io_service, pool->getArena(), pool->getArenaSize(), error);
+	if(!ring){
+		static bool logged = false;
+		if(!logged){
+			std::cout << "Warning: io_uring not available (" << error << "), using asio." << std::endl;
+			logged = true;
+		}
+		return;
+	}
+	m_rings.push_back(boost::shared_ptr<IoUring>(ring));
+}
+#endif
+
+std::string ServiceManager::get_network_backend() const
+{
+#ifdef __USE_IO_URING__
+	if(IoUring::get(m_io_service)){
+		return "io_uring";
+	}
+#endif
+	return "asio";
+}
+
 void ServiceManager::die()
 {
+	m_thread_work.clear();
+	for(std::vector<IOService_ptr>::iterator it = m_thread_services.begin(); it != m_thread_services.end(); ++it){
+		(*it)->stop();
+	}
 	m_io_service.stop();
 }
 
-void ServiceManager::run()
+static void runService(boost::asio::io_service* io_service)
 {
-	assert(!running);
-	running = true;
 	try{
-		m_io_service.run();
+		io_service->run();
 	}
 	catch(boost::system::system_error& e){
 		LOG_MESSAGE("NETWORK", LOGTYPE_ERROR, 1, e.what());
 	}
 }
 
+void ServiceManager::run()
+{
+	assert(!running);
+	running = true;
+
+	boost::thread_group threads;
+	for(std::vector<IOService_ptr>::iterator it = m_thread_services.begin(); it != m_thread_services.end(); ++it){
+		threads.create_thread(boost::bind(&runService, it->get()));
+	}
+
+	runService(&m_io_service);
+	threads.join_all();
+}
+
 void ServiceManager::stop()
 {
 	if(!running)
@@ -106,8 +178,9 @@ void ServiceManager::stop()
 ///////////////////////////////////////////////////////////////////////////////
 // ServicePort
 
-ServicePort::ServicePort(boost::asio::io_service& io_service) :
-	m_io_service(io_service),
+ServicePort::ServicePort(const IOServiceList& io_services) :
+	m_io_services(io_services),
+	m_nextService(0),
 	m_serverPort(0),
 	m_pendingStart(false)
 {
@@ -135,13 +208,27 @@ std::string ServicePort::get_protocol_names() const
 	return str;
 }
 
-void ServicePort::accept(Acceptor_ptr acceptor)
+void ServicePort::accept(Acceptor_ptr acceptor, boost::asio::io_service* io_service)
 {
 	try{
-		boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(m_io_service);
+		// A shared acceptor (io_service is NULL) hands the connections out in turn
+		boost::asio::io_service* socket_service = io_service;
+		if(!socket_service){
+			socket_service = m_io_services[m_nextService++ % m_io_services.size()];
+		}
+		boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(*socket_service);
+
+#ifdef __USE_IO_URING__
+		// A shared acceptor was opened on the first io_service
+		if(IoUring* ring = IoUring::get(io_service ? *io_service : *m_io_services.front())){
+			ring->asyncAccept(acceptor->native_handle(),
+				boost::bind(&ServicePort::onRingAccept, this, acceptor, io_service, socket_service, socket, _1, _2));
+			return;
+		}
+#endif
 
 		acceptor->async_accept(*socket,
-			boost::bind(&ServicePort::onAccept, this, acceptor, socket,
+			boost::bind(&ServicePort::onAccept, this, acceptor, io_service, socket_service, socket,
 			boost::asio::placeholders::error));
 	}
 	catch(boost::system::system_error& e){
@@ -152,7 +239,8 @@ void ServicePort::accept(Acceptor_ptr acceptor)
 	}
 }
 
-void ServicePort::onAccept(Acceptor_ptr acceptor, boost::asio::ip::tcp::socket* socket, const boost::system::error_code& error)
+void ServicePort::onAccept(Acceptor_ptr acceptor, boost::asio::io_service* io_service, boost::asio::io_service* socket_service,
+	boost::asio::ip::tcp::socket* socket, const boost::system::error_code& error)
 {
 	if(!error){
 		if(m_services.empty()){
@@ -170,15 +258,12 @@ void ServicePort::onAccept(Acceptor_ptr acceptor, boost::asio::ip::tcp::socket*
 		}
 
 		if(remote_ip != 0 && g_bans.acceptConnection(remote_ip)){
-
-			Connection_ptr connection = ConnectionManager::getInstance()->createConnection(socket, m_io_service, shared_from_this());
-
-			if(m_services.front()->is_single_socket()){
-				// Only one handler, and it will send first
-				connection->acceptConnection(m_services.front()->make_protocol(connection));
+			if(socket_service == io_service){
+				startConnection(socket_service, socket);
 			}
 			else{
-				connection->acceptConnection();
+				// The connection belongs to another network thread
+				socket_service->post(boost::bind(&ServicePort::startConnection, shared_from_this(), socket_service, socket));
 			}
 		}
 		else{
@@ -194,7 +279,7 @@ void ServicePort::onAccept(Acceptor_ptr acceptor, boost::asio::ip::tcp::socket*
 #ifdef __DEBUG_NET_DETAIL__
 		std::cout << "accept - OK" << std::endl;
 #endif
-		accept(acceptor);
+		accept(acceptor, io_service);
 	}
 	else{
 		if(error != boost::asio::error::operation_aborted){
@@ -214,6 +299,38 @@ void ServicePort::onAccept(Acceptor_ptr acceptor, boost::asio::ip::tcp::socket*
 	}
 }
 
+#ifdef __USE_IO_URING__
+void ServicePort::onRingAccept(Acceptor_ptr acceptor, boost::asio::io_service* io_service, boost::asio::io_service* socket_service,
+	boost::asio::ip::tcp::socket* socket, const boost::system::error_code& error, int fd)
+{
+	boost::system::error_code acceptError = error;
+	if(!error){
+		socket->assign(boost::asio::ip::tcp::v4(), fd, acceptError);
+		if(acceptError){
+			::close(fd);
+		}
+	}
+	else if(error == boost::asio::error::invalid_argument){
+		// closeAcceptor shut the listening socket down
+		acceptError = boost::asio::error::operation_aborted;
+	}
+	onAccept(acceptor, io_service, socket_service, socket, acceptError);
+}
+#endif
+
+void ServicePort::startConnection(boost::asio::io_service* socket_service, boost::asio::ip::tcp::socket* socket)
+{
+	Connection_ptr connection = ConnectionManager::getInstance()->createConnection(socket, *socket_service, shared_from_this());
+
+	if(m_services.front()->is_single_socket()){
+		// Only one handler, and it will send first
+		connection->acceptConnection(m_services.front()->make_protocol(connection));
+	}
+	else{
+		connection->acceptConnection();
+	}
+}
+
 Protocol* ServicePort::make_protocol(bool checksummed, NetworkMessage& msg) const
 {
 	uint8_t protocolId = msg.GetByte();
@@ -253,20 +370,56 @@ void ServicePort::openAcceptor(boost::weak_ptr<ServicePort> weak_service, IPAddr
 	}
 }
 
+Acceptor_ptr ServicePort::openListener(boost::asio::io_service& io_service, const IPAddress& ip, bool reusePort)
+{
+	boost::asio::ip::tcp::endpoint endpoint(ip, m_serverPort);
+	Acceptor_ptr aptr(new boost::asio::ip::tcp::acceptor(io_service));
+
+	aptr->open(endpoint.protocol());
+	aptr->set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+	if(reusePort){
+		aptr->set_option(reuse_port(true));
+	}
+#endif
+	aptr->bind(endpoint);
+	aptr->listen();
+
+	aptr->set_option(boost::asio::ip::tcp::no_delay(true));
+	return aptr;
+}
+
 void ServicePort::open(IPAddressList ips, uint16_t port)
 {
 	m_serverPort = port;
 	m_pendingStart = false;
 
+#ifdef SO_REUSEPORT
+	bool reusePort = m_io_services.size() > 1;
+#else
+	bool reusePort = false;
+#endif
+
 	for(IPAddressList::iterator ip = ips.begin(); ip != ips.end(); ++ip){
 		try{
 			// std::cout << "\n" << ip->to_string() << "\n";
-			Acceptor_ptr aptr(new boost::asio::ip::tcp::acceptor(m_io_service, boost::asio::ip::tcp::endpoint(*ip, m_serverPort)));
-
-			aptr->set_option(boost::asio::ip::tcp::no_delay(true));
+			if(reusePort){
+				// One listener per network thread, all bound to the same port
+				for(IOServiceList::iterator it = m_io_services.begin(); it != m_io_services.end(); ++it){
+					Acceptor_ptr aptr = openListener(**it, *ip, true);
+
+					boost::mutex::scoped_lock lockClass(m_acceptorLock);
+					accept(aptr, *it);
+					m_tcp_acceptors.push_back(std::make_pair(aptr, *it));
+				}
+			}
+			else{
+				Acceptor_ptr aptr = openListener(*m_io_services.front(), *ip, false);
 
-			accept(aptr);
-			m_tcp_acceptors.push_back(aptr);
+				boost::mutex::scoped_lock lockClass(m_acceptorLock);
+				accept(aptr, m_io_services.size() > 1 ? NULL : m_io_services.front());
+				m_tcp_acceptors.push_back(std::make_pair(aptr, m_io_services.front()));
+			}
 		}
 		catch(boost::system::system_error& e){
 			if(m_logError){
@@ -283,18 +436,31 @@ void ServicePort::open(IPAddressList ips, uint16_t port)
 
 void ServicePort::close()
 {
-	for (std::vector<Acceptor_ptr>::iterator aptr = m_tcp_acceptors.begin(); aptr != m_tcp_acceptors.end(); ++aptr){
-		if((*aptr)->is_open()){
-			boost::system::error_code error;
-			(*aptr)->close(error);
-			if(error){
-				PRINT_ASIO_ERROR("Closing listen socket");
-			}
-		}
+	boost::mutex::scoped_lock lockClass(m_acceptorLock);
+	for(std::vector<std::pair<Acceptor_ptr, boost::asio::io_service*> >::iterator aptr = m_tcp_acceptors.begin();
+		aptr != m_tcp_acceptors.end(); ++aptr)
+	{
+		// Acceptors are not thread safe, each one is closed by its own thread
+		aptr->second->post(boost::bind(&ServicePort::closeAcceptor, aptr->first));
 	}
 	m_tcp_acceptors.clear();
 }
 
+void ServicePort::closeAcceptor(Acceptor_ptr acceptor)
+{
+	if(acceptor->is_open()){
+#ifdef __USE_IO_URING__
+		// Closing alone leaves an accept in the io_uring waiting
+		::shutdown(acceptor->native_handle(), SHUT_RDWR);
+#endif
+		boost::system::error_code error;
+		acceptor->close(error);
+		if(error){
+			PRINT_ASIO_ERROR("Closing listen socket");
+		}
+	}
+}
+
 bool ServicePort::add_service(Service_ptr new_svc)
 {
 	for(std::vector<Service_ptr>::const_iterator svc_iter = m_services.begin(); svc_iter != m_services.end(); ++svc_iter){
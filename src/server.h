@@ -26,14 +26,19 @@
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ip/address.hpp>
 #include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/thread/mutex.hpp>
 #include "classes.h"
 
 class ServiceBase;
 class ServicePort;
+class IoUring;
 typedef boost::shared_ptr<ServiceBase> Service_ptr;
 typedef boost::shared_ptr<boost::asio::ip::tcp::acceptor> Acceptor_ptr;
 typedef boost::shared_ptr<ServicePort> ServicePort_ptr;
 typedef boost::shared_ptr<Connection> Connection_ptr;
+typedef boost::shared_ptr<boost::asio::io_service> IOService_ptr;
+typedef std::vector<boost::asio::io_service*> IOServiceList;
 
 typedef boost::asio::ip::address IPAddress;
 typedef std::vector<IPAddress> IPAddressList;
@@ -71,10 +76,13 @@ public:
 // It accepts connections, and asks each Service running
 // on it if it can accept the connection, and if so passes
 // it on to the service
+// With more than one network thread every thread gets its own
+// SO_REUSEPORT listening socket, so the kernel spreads the incoming
+// connections and each connection stays on the thread that accepted it
 class ServicePort : boost::noncopyable, public boost::enable_shared_from_this<ServicePort>
 {
 public:
-	ServicePort(boost::asio::io_service& io_service);
+	ServicePort(const IOServiceList& io_services);
 	~ServicePort();
 
 	static void openAcceptor(boost::weak_ptr<ServicePort> weak_service, IPAddress ip, uint16_t port);
@@ -87,13 +95,25 @@ public:
 	Protocol* make_protocol(bool checksummed, NetworkMessage& msg) const;
 
 	void onStopServer();
-	void onAccept(Acceptor_ptr acceptor, boost::asio::ip::tcp::socket* socket, const boost::system::error_code& error);
+	void onAccept(Acceptor_ptr acceptor, boost::asio::io_service* io_service, boost::asio::io_service* socket_service,
+		boost::asio::ip::tcp::socket* socket, const boost::system::error_code& error);
+#ifdef __USE_IO_URING__
+	void onRingAccept(Acceptor_ptr acceptor, boost::asio::io_service* io_service, boost::asio::io_service* socket_service,
+		boost::asio::ip::tcp::socket* socket, const boost::system::error_code& error, int fd);
+#endif
 
 protected:
-	void accept(Acceptor_ptr acceptor);
-
-	boost::asio::io_service& m_io_service;
-	std::vector<Acceptor_ptr> m_tcp_acceptors;
+	void accept(Acceptor_ptr acceptor, boost::asio::io_service* io_service);
+	void startConnection(boost::asio::io_service* socket_service, boost::asio::ip::tcp::socket* socket);
+	Acceptor_ptr openListener(boost::asio::io_service& io_service, const IPAddress& ip, bool reusePort);
+	static void closeAcceptor(Acceptor_ptr acceptor);
+
+	IOServiceList m_io_services;
+	// Connections of a shared acceptor are spread over the threads in turn
+	uint32_t m_nextService;
+	// Each acceptor together with the io_service it was opened on
+	std::vector<std::pair<Acceptor_ptr, boost::asio::io_service*> > m_tcp_acceptors;
+	boost::mutex m_acceptorLock;
 	std::vector<Service_ptr> m_services;
 
 	uint16_t m_serverPort;
@@ -115,20 +135,35 @@ public:
 	void run();
 	void stop();
 
+	// Has to be called before the first service is added
+	void set_thread_count(uint32_t count);
+
 	// Adds a new service to be managed
 	template <typename ProtocolType>
 	bool add(uint16_t port, IPAddressList ips);
 
 	bool is_running() const {return m_acceptors.empty() == false;}
 	std::list<uint16_t> get_ports() const;
+	// "io_uring" or "asio"
+	std::string get_network_backend() const;
 protected:
 	void die();
+#ifdef __USE_IO_URING__
+	void create_ring(boost::asio::io_service& io_service);
+#endif
 
 	std::map<uint16_t, ServicePort_ptr> m_acceptors;
 
+	// Runs on the thread calling run(), the other ones get their own thread
 	boost::asio::io_service m_io_service;
+	std::vector<IOService_ptr> m_thread_services;
+	std::vector<boost::shared_ptr<boost::asio::io_service::work> > m_thread_work;
 	boost::asio::deadline_timer death_timer;
 	bool running;
+#ifdef __USE_IO_URING__
+	// Destroyed before the io_services they wait on
+	std::vector<boost::shared_ptr<IoUring> > m_rings;
+#endif
 };
 
 template <typename ProtocolType>
@@ -144,7 +179,13 @@ bool ServiceManager::add(uint16_t port, IPAddressList ips)
 		m_acceptors.find(port);
 
 	if(finder == m_acceptors.end()){
-		service_port.reset(new ServicePort(m_io_service));
+		IOServiceList io_services;
+		io_services.push_back(&m_io_service);
+		for(std::vector<IOService_ptr>::iterator it = m_thread_services.begin(); it != m_thread_services.end(); ++it){
+			io_services.push_back(it->get());
+		}
+
+		service_port.reset(new ServicePort(io_services));
 		service_port->open(ips, port);
 		m_acceptors[port] = service_port;
 	}
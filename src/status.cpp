@@ -26,6 +26,11 @@
 #include "configmanager.h"
 #include "singleton.h"
 #include "connection.h"
+#include "protocolgame.h"
+#include "tasks.h"
+#include "scheduler.h"
+#include "database_pool.h"
+#include "packetrecorder.h"
 
 #ifndef WIN32
 	#define SOCKET_ERROR -1
@@ -43,13 +48,54 @@ enum RequestedInfo_t{
 	REQUEST_MAP_INFO           = 0x10,
 	REQUEST_EXT_PLAYERS_INFO   = 0x20,
 	REQUEST_PLAYER_STATUS_INFO = 0x40,
-	REQUEST_SERVER_SOFTWARE_INFORMATION = 0x80
+	REQUEST_SERVER_SOFTWARE_INFORMATION = 0x80,
+	REQUEST_PACKET_STATISTICS  = 0x100,
+	REQUEST_DISPATCHER_STATISTICS = 0x200,
+	REQUEST_OUTPUT_STATISTICS  = 0x400,
+	REQUEST_SEND_QUEUE_STATISTICS = 0x800,
+	REQUEST_CONNECTION_STATISTICS = 0x1000,
+	REQUEST_DATABASE_STATISTICS = 0x2000,
+	REQUEST_TRACE_STATISTICS = 0x4000
 };
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
 uint32_t ProtocolStatus::protocolStatusCount = 0;
 #endif
-std::map<uint32_t, int64_t> ProtocolStatus::ipConnectMap;
+StatusQueryLimiter ProtocolStatus::queryLimiter;
+
+bool StatusQueryLimiter::allowQuery(uint32_t ip, int64_t now, int64_t timeout)
+{
+	boost::mutex::scoped_lock lockClass(m_lock);
+
+	// Every entry that can still refuse a query is at most one timeout
+	// old, so it is in the current or the previous generation
+	if(now >= m_generationStart + timeout || m_current.size() >= max_generation_size){
+		if(now >= m_generationStart + 2 * timeout){
+			m_previous.clear();
+		}
+		else{
+			m_previous.swap(m_current);
+		}
+		m_current.clear();
+		m_generationStart = now;
+	}
+
+	QueryTimeMap::const_iterator it = m_current.find(ip);
+	if(it == m_current.end()){
+		it = m_previous.find(ip);
+		if(it == m_previous.end()){
+			m_current[ip] = now;
+			return true;
+		}
+	}
+
+	if(now < it->second + timeout){
+		return false;
+	}
+
+	m_current[ip] = now;
+	return true;
+}
 
 ProtocolStatus::ProtocolStatus(Connection_ptr connection)
 	: Protocol(connection)
@@ -68,29 +114,20 @@ ProtocolStatus::~ProtocolStatus()
 
 void ProtocolStatus::onRecvFirstMessage(NetworkMessage& msg)
 {
-	std::map<uint32_t, int64_t>::const_iterator it = ipConnectMap.find(getIP());
-	if(it != ipConnectMap.end()){
-		if(OTSYS_TIME() < it->second + g_config.getNumber(ConfigManager::STATUSQUERY_TIMEOUT)){
-			getConnection()->closeConnection();
-			return;
-		}
+	if(!queryLimiter.allowQuery(getIP(), OTSYS_TIME(), g_config.getNumber(ConfigManager::STATUSQUERY_TIMEOUT))){
+		getConnection()->closeConnection();
+		return;
 	}
 
-	ipConnectMap[getIP()] = OTSYS_TIME();
-
 	switch(msg.GetByte()){
 	//XML info protocol
 	case 0xFF:
 	{
-		if(msg.GetRaw() == "info"){
-			OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, false);
-			if(output){
-				TRACK_MESSAGE(output);
-				Status* status = Status::instance();
-				std::string str = status->getStatusString();
-				output->AddBytes(str.c_str(), str.size());
-				setRawMessages(true); // we dont want the size header, nor encryption
-				OutputMessagePool::getInstance()->send(output);
+		if(msg.GetRawView() == "info"){
+			// no size header nor encryption
+			SharedBuffer_ptr str = Status::instance()->getStatusString();
+			if(str){
+				getConnection()->send(str);
 			}
 		}
 		break;
@@ -99,11 +136,19 @@ void ProtocolStatus::onRecvFirstMessage(NetworkMessage& msg)
 	case 0x01:
 	{
 		uint32_t requestedInfo = msg.GetU16(); //Only a Byte is necessary, though we could add new infos here
+		Status* status = Status::instance();
+
+		if(Status::isCachedInfo(requestedInfo)){
+			SharedBuffer_ptr response = status->getInfo(requestedInfo);
+			if(response){
+				getConnection()->send(response);
+			}
+			break;
+		}
 
 		OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, false);
 		if(output){
 			TRACK_MESSAGE(output);
-			Status* status = Status::instance();
 			status->getInfo(requestedInfo, output, msg);
 			OutputMessagePool::getInstance()->send(output);
 		}
@@ -154,7 +199,71 @@ void Status::removePlayer()
 	m_playersonline--;
 }
 
-std::string Status::getStatusString() const
+void Status::refresh()
+{
+	// Queries are answered by the network thread, render everything
+	// here where reading the game state is safe
+	boost::shared_ptr<RenderedStatus> rendered(new RenderedStatus());
+	rendered->statusString.reset(new std::string(renderStatusString()));
+	for(uint32_t i = 0; i < 8; ++i){
+		if((1u << i) != REQUEST_PLAYER_STATUS_INFO){
+			rendered->info[i] = renderInfo(1u << i);
+		}
+	}
+
+	m_renderedLock.lock();
+	m_rendered = rendered;
+	m_renderedLock.unlock();
+
+	g_scheduler.addEvent(createSchedulerTask(refresh_interval,
+		boost::bind(&Status::refresh, this)));
+}
+
+SharedBuffer_ptr Status::getStatusString() const
+{
+	boost::mutex::scoped_lock lockClass(m_renderedLock);
+	if(!m_rendered){
+		return SharedBuffer_ptr();
+	}
+	return m_rendered->statusString;
+}
+
+bool Status::isCachedInfo(uint32_t requestedInfo)
+{
+	return (requestedInfo & ~0xFF) == 0 && (requestedInfo & REQUEST_PLAYER_STATUS_INFO) == 0;
+}
+
+SharedBuffer_ptr Status::getInfo(uint32_t requestedInfo)
+{
+	boost::mutex::scoped_lock lockClass(m_renderedLock);
+	if(!m_rendered){
+		return SharedBuffer_ptr();
+	}
+
+	std::map<uint32_t, SharedBuffer_ptr>::const_iterator it = m_rendered->responses.find(requestedInfo);
+	if(it != m_rendered->responses.end()){
+		return it->second;
+	}
+
+	// Built once per combination of requested infos and refresh,
+	// with the size header the protocol would add
+	std::string response(NetworkMessage::header_length, 0);
+	for(uint32_t i = 0; i < 8; ++i){
+		if(requestedInfo & (1u << i)){
+			response += m_rendered->info[i];
+		}
+	}
+
+	uint16_t length = (uint16_t)(response.size() - NetworkMessage::header_length);
+	response[0] = (char)(length & 0xFF);
+	response[1] = (char)(length >> 8);
+
+	SharedBuffer_ptr buffer(new std::string(response));
+	m_rendered->responses[requestedInfo] = buffer;
+	return buffer;
+}
+
+std::string Status::renderStatusString() const
 {
 	std::string xml;
 
@@ -246,11 +355,12 @@ std::string Status::getStatusString() const
 	return xml;
 }
 
-void Status::getInfo(uint32_t requestedInfo, OutputMessage_ptr output, NetworkMessage& msg) const
+std::string Status::renderInfo(uint32_t requestedInfo) const
 {
 	// the client selects which information may be
 	// sent back, so we'll save some bandwidth and
 	// make many
+	NetworkMessage output;
 	std::stringstream ss;
 	uint64_t running = getUpTime();
 	// since we haven't all the things on the right place like map's
@@ -259,57 +369,82 @@ void Status::getInfo(uint32_t requestedInfo, OutputMessage_ptr output, NetworkMe
 	// properties of the server, such serverinfo, playersinfo and so
 
 	if(requestedInfo & REQUEST_BASIC_SERVER_INFO){
-		output->AddByte(0x10); // server info
-		output->AddString(g_config.getString(ConfigManager::SERVER_NAME).c_str());
-		output->AddString(g_config.getString(ConfigManager::IP).c_str());
+		output.AddByte(0x10); // server info
+		output.AddString(g_config.getString(ConfigManager::SERVER_NAME).c_str());
+		output.AddString(g_config.getString(ConfigManager::IP).c_str());
 		ss << g_config.getNumber(ConfigManager::LOGIN_PORT);
-		output->AddString(ss.str().c_str());
+		output.AddString(ss.str().c_str());
 		ss.str("");
 	}
 
 	if(requestedInfo & REQUEST_OWNER_SERVER_INFO){
-		output->AddByte(0x11); // server info - owner info
-		output->AddString(g_config.getString(ConfigManager::OWNER_NAME).c_str());
-		output->AddString(g_config.getString(ConfigManager::OWNER_EMAIL).c_str());
+		output.AddByte(0x11); // server info - owner info
+		output.AddString(g_config.getString(ConfigManager::OWNER_NAME).c_str());
+		output.AddString(g_config.getString(ConfigManager::OWNER_EMAIL).c_str());
 	}
 
 	if(requestedInfo & REQUEST_MISC_SERVER_INFO){
-		output->AddByte(0x12); // server info - misc
-		output->AddString(g_config.getString(ConfigManager::MOTD).c_str());
-		output->AddString(g_config.getString(ConfigManager::LOCATION).c_str());
-		output->AddString(g_config.getString(ConfigManager::URL).c_str());
-		output->AddU32((uint32_t)(running >> 32)); // this method prevents a big number parsing
-		output->AddU32((uint32_t)(running));       // since servers can be online for months ;)
+		output.AddByte(0x12); // server info - misc
+		output.AddString(g_config.getString(ConfigManager::MOTD).c_str());
+		output.AddString(g_config.getString(ConfigManager::LOCATION).c_str());
+		output.AddString(g_config.getString(ConfigManager::URL).c_str());
+		output.AddU32((uint32_t)(running >> 32)); // this method prevents a big number parsing
+		output.AddU32((uint32_t)(running));       // since servers can be online for months ;)
 	}
 
 	if(requestedInfo & REQUEST_PLAYERS_INFO){
-		output->AddByte(0x20); // players info
-		output->AddU32(m_playersonline);
-		output->AddU32(m_playersmax);
-		output->AddU32(m_playerspeak);
+		output.AddByte(0x20); // players info
+		output.AddU32(m_playersonline);
+		output.AddU32(m_playersmax);
+		output.AddU32(m_playerspeak);
 	}
 
 	if(requestedInfo & REQUEST_MAP_INFO){
-		output->AddByte(0x30); // map info
-		output->AddString(m_mapname.c_str());
-		output->AddString(m_mapauthor.c_str());
+		output.AddByte(0x30); // map info
+		output.AddString(m_mapname.c_str());
+		output.AddString(m_mapauthor.c_str());
 		uint32_t mapWidth, mapHeight;
 		g_game.getMapDimensions(mapWidth, mapHeight);
-		output->AddU16(mapWidth);
-		output->AddU16(mapHeight);
+		output.AddU16(mapWidth);
+		output.AddU16(mapHeight);
 	}
 
 	if(requestedInfo & REQUEST_EXT_PLAYERS_INFO){
-		output->AddByte(0x21); // players info - online players list
-		output->AddU32(m_playersonline);
+		output.AddByte(0x21); // players info - online players list
+		output.AddU32(m_playersonline);
 		for(AutoList<Player>::listiterator it = Player::listPlayer.list.begin(); it != Player::listPlayer.list.end(); ++it){
 			//Send the most common info
-			output->AddString(it->second->getName());
-			output->AddU32(it->second->getLevel());
+			output.AddString(it->second->getName());
+			output.AddU32(it->second->getLevel());
 		}
 	}
 
-	if(requestedInfo & REQUEST_PLAYER_STATUS_INFO){
+	if(requestedInfo & REQUEST_SERVER_SOFTWARE_INFORMATION){
+		output.AddByte(0x23); // server software info
+		output.AddString(OTSERV_NAME);
+		output.AddString(OTSERV_VERSION);
+		output.AddString(CLIENT_VERSION_STRING);
+	}
+
+	return std::string(output.getBuffer() + output.getReadPos() - output.getMessageLength(), output.getMessageLength());
+}
+
+void Status::getInfo(uint32_t requestedInfo, OutputMessage_ptr output, NetworkMessage& msg) const
+{
+	boost::mutex::scoped_lock lockClass(m_renderedLock);
+	for(uint32_t i = 0; i < 8; ++i){
+		uint32_t info = 1u << i;
+		if(!(requestedInfo & info)){
+			continue;
+		}
+
+		if(info != REQUEST_PLAYER_STATUS_INFO){
+			if(m_rendered){
+				output->AddBytes(m_rendered->info[i].data(), m_rendered->info[i].size());
+			}
+			continue;
+		}
+
 		output->AddByte(0x22); // players info - online status info of a player
 		const std::string name = msg.GetString();
 		if(g_game.getPlayerByName(name) != NULL){
@@ -319,15 +454,98 @@ void Status::getInfo(uint32_t requestedInfo, OutputMessage_ptr output, NetworkMe
 			output->AddByte(0x00);
 		}
 	}
+	lockClass.unlock();
+
+	if(requestedInfo & REQUEST_PACKET_STATISTICS){
+		output->AddByte(0x24); // game packet statistics
+		//the network threads keep counting, read every type once
+		uint64_t received[256];
+		uint16_t count = 0;
+		for(uint32_t type = 0; type < 256; ++type){
+			received[type] = ProtocolGame::getPacketStatistics(type).received.load(boost::memory_order_relaxed);
+			if(received[type] > 0){
+				++count;
+			}
+		}
 
-	if(requestedInfo & REQUEST_SERVER_SOFTWARE_INFORMATION){
-		output->AddByte(0x23); // server software info
-		output->AddString(OTSERV_NAME);
-		output->AddString(OTSERV_VERSION);
-		output->AddString(CLIENT_VERSION_STRING);
+		output->AddU16(count);
+		for(uint32_t type = 0; type < 256; ++type){
+			const PacketStatistics& stats = ProtocolGame::getPacketStatistics(type);
+			if(received[type] > 0){
+				output->AddByte(type);
+				output->AddU64(received[type]);
+				output->AddU64(stats.dropped.load(boost::memory_order_relaxed));
+				output->AddU64(stats.parseTime.load(boost::memory_order_relaxed));
+			}
+		}
+	}
+
+	if(requestedInfo & REQUEST_DISPATCHER_STATISTICS){
+		output->AddByte(0x25); // dispatcher statistics
+		output->AddU64(g_dispatcher.getExecutedTasks());
+		output->AddU64(g_dispatcher.getBusyTime());
+		output->AddU64(g_dispatcher.getStalledTasks());
+		output->AddU64(g_dispatcher.getStallTime());
+	}
+
+	if(requestedInfo & REQUEST_OUTPUT_STATISTICS){
+		OutputMessagePool* outputPool = OutputMessagePool::getInstance();
+		output->AddByte(0x26); // end of tick flushes
+		output->AddU64(outputPool->getFlushes());
+		output->AddU64(outputPool->getSentMessages());
+		output->AddU64(outputPool->getWrites());
+		output->AddU64(outputPool->getSentBytes());
+		output->AddU64(outputPool->getSendDelay());
 	}
 
-	return;
+	if(requestedInfo & REQUEST_SEND_QUEUE_STATISTICS){
+		SendQueueStats stats;
+		ConnectionManager::getInstance()->getSendQueueStats(stats);
+		output->AddByte(0x27); // output waiting for slow clients
+		output->AddU32(stats.connections);
+		output->AddU32(stats.backlogged);
+		output->AddU64(stats.queuedMessages);
+		output->AddU64(stats.queuedBytes);
+		output->AddU32(stats.maxQueuedBytes);
+		output->AddU64(stats.backloggedMemory);
+		output->AddU64(stats.droppedUpdates);
+		output->AddU64(stats.overflows);
+	}
+
+	if(requestedInfo & REQUEST_CONNECTION_STATISTICS){
+		output->AddByte(0x28); // connection lifecycle histograms
+		output->AddByte(ConnectionManager::HISTOGRAM_COUNT);
+		for(uint32_t type = 0; type < ConnectionManager::HISTOGRAM_COUNT; ++type){
+			uint64_t buckets[Histogram::bucket_count];
+			ConnectionManager::getInstance()->getHistogram((ConnectionManager::ConnectionHistogram_t)type).getBuckets(buckets);
+			output->AddByte(Histogram::bucket_count);
+			for(uint32_t i = 0; i < Histogram::bucket_count; ++i){
+				output->AddU64(buckets[i]);
+			}
+		}
+	}
+
+	if(requestedInfo & REQUEST_DATABASE_STATISTICS){
+		DatabasePoolStats stats;
+		DatabasePool::instance()->getStats(stats);
+		output->AddByte(0x29); // database connection pool
+		output->AddU32(stats.size);
+		output->AddU32(stats.connections);
+		output->AddU32(stats.leased);
+		output->AddU64(stats.leases);
+		output->AddU64(stats.waits);
+		output->AddU64(stats.waitTime);
+		output->AddU64(stats.maxWaitTime);
+		output->AddU64(stats.checks);
+		output->AddU64(stats.reconnects);
+	}
+
+	if(requestedInfo & REQUEST_TRACE_STATISTICS){
+		PacketRecorder* recorder = PacketRecorder::getInstance();
+		output->AddByte(0x2A); // packet trace
+		output->AddByte(recorder->isEnabled() ? 0x01 : 0x00);
+		output->AddU64(recorder->getDroppedRecords());
+	}
 }
 
 uint32_t Status::getPlayersOnline() const
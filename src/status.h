@@ -25,7 +25,30 @@
 #include <map>
 #include <stdint.h>
 #include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
 #include "protocol.h"
+#include "connection.h"
+
+// Remembers the last query of each IP in two generations of one timeout
+// each, older entries are dropped together with their generation
+class StatusQueryLimiter
+{
+public:
+	StatusQueryLimiter() : m_generationStart(0) {}
+
+	bool allowQuery(uint32_t ip, int64_t now, int64_t timeout);
+
+protected:
+	// A flood of distinct IPs starts a new generation early
+	enum {max_generation_size = 16384};
+
+	typedef std::map<uint32_t, int64_t> QueryTimeMap;
+	QueryTimeMap m_current;
+	QueryTimeMap m_previous;
+	int64_t m_generationStart;
+	// Queries arrive on every network thread
+	boost::mutex m_lock;
+};
 
 class ProtocolStatus : public Protocol
 {
@@ -47,7 +70,7 @@ public:
 	static const char* protocol_name();
 
 protected:
-	static std::map<uint32_t, int64_t> ipConnectMap;
+	static StatusQueryLimiter queryLimiter;
 
 	#ifdef __DEBUG_NET_DETAIL__
 	virtual void deleteProtocolTask();
@@ -64,8 +87,14 @@ public:
 	void removePlayer();
 	bool hasSlot() const;
 
-	std::string getStatusString() const;
+	// Renders the answers to all status queries, they are served from
+	// this cache until the next refresh (dispatcher thread)
+	void refresh();
+	SharedBuffer_ptr getStatusString() const;
+	// Answers for requests that do not depend on the request or on live statistics
+	SharedBuffer_ptr getInfo(uint32_t requestedInfo);
 	void getInfo(uint32_t requestedInfo, OutputMessage_ptr output, NetworkMessage& msg) const;
+	static bool isCachedInfo(uint32_t requestedInfo);
 
 	uint32_t getPlayersOnline() const;
 	uint32_t getMaxPlayersOnline() const;
@@ -74,7 +103,21 @@ public:
 
 	uint64_t getUpTime() const;
 
+	enum {refresh_interval = 5000};
+
 private:
+	std::string renderStatusString() const;
+	std::string renderInfo(uint32_t requestedInfo) const;
+
+	struct RenderedStatus {
+		SharedBuffer_ptr statusString;
+		std::string info[8];
+		std::map<uint32_t, SharedBuffer_ptr> responses;
+	};
+
+	boost::shared_ptr<RenderedStatus> m_rendered;
+	mutable boost::mutex m_renderedLock;
+
 	uint64_t m_start;
 	int m_playersmax, m_playersonline, m_playerspeak;
 	std::string m_mapname, m_mapauthor;
@@ -34,6 +34,10 @@ Dispatcher::Dispatcher()
 {
 	m_taskList.clear();
 	m_threadState = STATE_TERMINATED;
+	m_executedTasks = 0;
+	m_busyTime = 0;
+	m_stalledTasks = 0;
+	m_stallTime = 0;
 }
 
 void Dispatcher::shutdownAndWait()
@@ -61,6 +65,7 @@ void Dispatcher::dispatcherThread(void* p)
 	#endif
 
 	OutputMessagePool* outputPool;
+	std::list<Task*> batch;
 
 	// NOTE: second argument defer_lock is to prevent from immediate locking
 	boost::unique_lock<boost::mutex> taskLockUnique(dispatcher->m_taskLock, boost::defer_lock);
@@ -84,24 +89,36 @@ void Dispatcher::dispatcherThread(void* p)
 		#endif
 
 		if(!dispatcher->m_taskList.empty() && (dispatcher->m_threadState != STATE_TERMINATED)){
-			// take the first task
-			task = dispatcher->m_taskList.front();
-			dispatcher->m_taskList.pop_front();
+			// take every waiting task, they are run as one batch
+			batch.swap(dispatcher->m_taskList);
 		}
 
 		taskLockUnique.unlock();
 
-		// finally execute the task...
-		if(task){
+		if(batch.empty()){
+			continue;
+		}
+
+		OutputMessagePool::getInstance()->startExecutionFrame();
+
+		// finally execute the tasks...
+		while(!batch.empty()){
+			task = batch.front();
+			batch.pop_front();
+
 			if(!task->hasExpired()){
-				OutputMessagePool::getInstance()->startExecutionFrame();
+				int64_t startTime = OTSYS_TIME_US();
 				(*task)();
 
-				outputPool = OutputMessagePool::getInstance();
-				if(outputPool)
-					outputPool->sendAll();
-
 				g_game.clearSpectatorCache();
+
+				int64_t taskTime = OTSYS_TIME_US() - startTime;
+				dispatcher->m_busyTime.fetch_add(taskTime, boost::memory_order_relaxed);
+				dispatcher->m_executedTasks.fetch_add(1, boost::memory_order_relaxed);
+				if(taskTime >= DISPATCHER_STALL_TIME){
+					dispatcher->m_stalledTasks.fetch_add(1, boost::memory_order_relaxed);
+					dispatcher->m_stallTime.fetch_add(taskTime, boost::memory_order_relaxed);
+				}
 			}
 
 			delete task;
@@ -110,6 +127,11 @@ void Dispatcher::dispatcherThread(void* p)
 			std::cout << "Dispatcher: Executing task" << std::endl;
 			#endif
 		}
+
+		// End of the tick, everything the batch produced goes out now
+		outputPool = OutputMessagePool::getInstance();
+		if(outputPool)
+			outputPool->sendAll();
 	}
 #if defined __EXCEPTION_TRACER__
 	dispatcherExceptionHandler.RemoveHandler();
@@ -24,8 +24,11 @@
 
 #include <boost/function.hpp>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
 
 const int DISPATCHER_TASK_EXPIRATION = 2000;
+// Tasks running at least this long (microseconds) are counted as stalls
+const int DISPATCHER_STALL_TIME = 10000;
 
 class Task{
 public:
@@ -59,11 +62,11 @@ protected:
 	boost::function<void (void)> m_f;
 };
 
-inline Task* createTask(boost::function<void (void)> f){
+inline Task* createTask(const boost::function<void (void)>& f){
 	return new Task(f);
 }
 
-inline Task* createTask(uint32_t expiration, boost::function<void (void)> f){
+inline Task* createTask(uint32_t expiration, const boost::function<void (void)>& f){
 	return new Task(expiration, f);
 }
 
@@ -85,6 +88,12 @@ public:
 	void shutdown();
 	void shutdownAndWait();
 
+	// Read from the status thread while the dispatcher counts
+	uint64_t getExecutedTasks() const {return m_executedTasks.load(boost::memory_order_relaxed);}
+	uint64_t getBusyTime() const {return m_busyTime.load(boost::memory_order_relaxed);}
+	uint64_t getStalledTasks() const {return m_stalledTasks.load(boost::memory_order_relaxed);}
+	uint64_t getStallTime() const {return m_stallTime.load(boost::memory_order_relaxed);}
+
 	enum DispatcherState{
 		STATE_RUNNING,
 		STATE_CLOSING,
@@ -103,6 +112,12 @@ protected:
 
 	std::list<Task*> m_taskList;
 	DispatcherState m_threadState;
+
+	boost::atomic<uint64_t> m_executedTasks;
+	boost::atomic<uint64_t> m_busyTime; // microseconds spent running tasks
+	boost::atomic<uint64_t> m_stalledTasks;
+	boost::atomic<uint64_t> m_stallTime; // microseconds spent in stalled tasks
+
 };
 
 extern Dispatcher g_dispatcher;
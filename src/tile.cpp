@@ -21,6 +21,7 @@
 
 #include "tile.h"
 #include "housetile.h"
+#include "house.h"
 #include "game.h"
 #include "combat.h"
 #include "actor.h"
@@ -34,6 +35,7 @@ StaticTile real_null_tile(0xFFFF, 0xFFFF, 0xFFFF);
 Tile& Tile::null_tile = real_null_tile;
 ItemVector StaticTile::null_items;
 CreatureVector StaticTile::null_creatures;
+uint32_t Tile::itemVersionCounter = 0;
 
 HouseTile* Tile::getHouseTile()
 {
@@ -54,6 +56,15 @@ bool Tile::isHouseTile() const
 	return hasFlag(TILEPROP_HOUSE_TILE);
 }
 
+void Tile::onItemsChanged()
+{
+	m_itemVersion = ++itemVersionCounter;
+
+	if(HouseTile* houseTile = getHouseTile()){
+		houseTile->getHouse()->setDirty(true);
+	}
+}
+
 bool Tile::hasHeight(uint32_t n) const
 {
 	uint32_t height = 0;
@@ -1184,6 +1195,11 @@ Thing* Tile::__getThing(uint32_t index) const
 
 void Tile::postAddNotification(Creature* actor, Thing* thing, const Cylinder* oldParent, int32_t index, cylinderlink_t link /*= LINK_OWNER*/)
 {
+	//also called for the items in the containers on this tile
+	if(thing->getItem()){
+		onItemsChanged();
+	}
+
 	const Position& cylinderMapPos = getPosition();
 
 	const SpectatorVec& list = g_game.getSpectators(cylinderMapPos);
@@ -1224,6 +1240,10 @@ void Tile::postAddNotification(Creature* actor, Thing* thing, const Cylinder* ol
 
 void Tile::postRemoveNotification(Creature* actor, Thing* thing,  const Cylinder* newParent, int32_t index, bool isCompleteRemoval, cylinderlink_t link /*= LINK_OWNER*/)
 {
+	if(thing->getItem()){
+		onItemsChanged();
+	}
+
 	const Position& cylinderMapPos = getPosition();
 
 	const SpectatorVec& list = g_game.getSpectators(cylinderMapPos);
@@ -1331,6 +1351,9 @@ bool Tile::hasItemWithProperty(Item* exclude, uint32_t props) const
 
 void Tile::updateTileFlags(Item* item, bool removed)
 {
+	//every change to the items of this tile ends up here
+	onItemsChanged();
+
 	if(!removed){
 		if(!hasFlag(TILEPROP_FLOORCHANGE)){
 			if(item->hasProperty(ITEMPROP_FLOORCHANGEDOWN)){
@@ -350,6 +350,8 @@ public:
 	Item* getItemByTopOrder(uint32_t topOrder);
 
 	uint32_t getThingCount() const {return (ground ? 1 : 0) + items_count() + creatures_count();}
+	//Changes every time an item on this tile is added, removed or updated
+	uint32_t getItemVersion() const {return m_itemVersion;}
 	uint32_t getCreatureCount() const;
 
 	bool hasItemWithProperty(uint32_t props) const;
@@ -417,6 +419,9 @@ public:
 
 	//Should be called when itemId/actionId or any other data associated with ItemMultiIndex is modified.
 	void items_onItemModified(Item* item);
+	//Should be called when an item on this tile or in a container on it changes, bumps
+	//the item version and marks the house for the next map save.
+	void onItemsChanged();
 
 private:
 	void onAddTileItem(Item* item);
@@ -446,6 +451,9 @@ protected:
 	uint16_t downItemCount;
 	Position tilePos;
 	uint32_t m_flags;
+	uint32_t m_itemVersion;
+
+	static uint32_t itemVersionCounter;
 
 	friend class Map;
 };
@@ -1030,7 +1038,8 @@ inline Tile::Tile(uint16_t x, uint16_t y, uint16_t z) :
 	ground(NULL),
 	downItemCount(0),
 	tilePos(x, y, z),
-	m_flags(0)
+	m_flags(0),
+	m_itemVersion(++itemVersionCounter)
 {
 }
 
@@ -1202,6 +1211,8 @@ inline TileItemIterator Tile::items_erase(TileItemIterator _pos)
 
 inline void Tile::items_onItemModified(Item* item)
 {
+	onItemsChanged();
+
 	if(is_dynamic())
 		return static_cast<DynamicTile*>(this)->DynamicTile::items_onItemModified(item);
 	else if(is_indexed())
@@ -298,19 +298,12 @@ char upchar(char c)
 	return c;
 }
 
-bool passwordTest(std::string plain, std::string &hash)
+std::string hashPassword(std::string plain)
 {
 	// Salt it beforehand
 	plain += g_config.getString(ConfigManager::PASSWORD_SALT);
 
 	switch(g_config.getNumber(ConfigManager::PASSWORD_TYPE)){
-	case PASSWORD_TYPE_PLAIN:
-	{
-		if(plain == hash){
-			return true;
-		}
-		break;
-	}
 	case PASSWORD_TYPE_MD5:
 	{
 		MD5_CTX m_md5;
@@ -325,11 +318,7 @@ bool passwordTest(std::string plain, std::string &hash)
 			hexStream << std::setw(2) << std::setfill('0') << (uint32_t)m_md5.digest[i];
 		}
 
-		std::transform(hash.begin(), hash.end(), hash.begin(), upchar);
-		if(hexStream.str() == hash){
-			return true;
-		}
-		break;
+		return hexStream.str();
 	}
 	case PASSWORD_TYPE_SHA1:
 	{
@@ -345,17 +334,36 @@ bool passwordTest(std::string plain, std::string &hash)
 			hexStream << std::setw(8) << std::setfill('0') << (uint32_t)sha1Hash[i];
 		}
 
-		std::transform(hash.begin(), hash.end(), hash.begin(), upchar);
-		if(hexStream.str() == hash){
-			return true;
-		}
-
+		return hexStream.str();
+	}
+	default:
 		break;
 	}
+	return plain;
+}
+
+bool hashedPasswordTest(const std::string& hashed, std::string &hash)
+{
+	switch(g_config.getNumber(ConfigManager::PASSWORD_TYPE)){
+	case PASSWORD_TYPE_PLAIN:
+	{
+		return hashed == hash;
+	}
+	case PASSWORD_TYPE_MD5:
+	case PASSWORD_TYPE_SHA1:
+	{
+		std::transform(hash.begin(), hash.end(), hash.begin(), upchar);
+		return hashed == hash;
+	}
 	}
 	return false;
 }
 
+bool passwordTest(std::string plain, std::string &hash)
+{
+	return hashedPasswordTest(hashPassword(plain), hash);
+}
+
 std::string convertIPToString(uint32_t ip)
 {
 	char buffer[20];
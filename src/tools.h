@@ -82,6 +82,9 @@ int random_range(int lowest_number, int highest_number, DistributionType_t type
 void hexdump(unsigned char *_data, int _len);
 char upchar(char c);
 bool passwordTest(std::string plain, std::string &hash);
+// The expensive half of passwordTest, thread safe
+std::string hashPassword(std::string plain);
+bool hashedPasswordTest(const std::string& hashed, std::string &hash);
 std::string convertIPToString(uint32_t ip);
 void formatDate(time_t time, char* buffer);
 void formatDateShort(time_t time, char* buffer);
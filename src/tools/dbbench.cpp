@@ -0,0 +1,1440 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Database benchmark, writes player saves the way IOPlayer does, with
+// queries built as text, with prepared statements, with only the rows
+// that changed since the last save and with those saves committed in
+// batches like the queued writes of the database workers, times a server save of all of them
+// written by the game thread and in the background, journals the changes
+// of the players and replays the journal, reads the items of a player by
+// field name and by field index, loads and saves them as rows and as one
+// blob, and saves the tiles of all houses and of the changed ones
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+//
+// The saves overwrite the players they use, run it against a copy of
+// the database or the sample world:
+//
+//   ./tools/gendb.sh
+//   otserv-loadgen --sql 100 | sqlite3 db.s3db
+//   otserv-dbbench --players 100 --rounds 20
+//
+// The connection settings are read from config.lua, --type and --db
+// replace its database_type and database_schema:
+//
+//   otserv-dbbench --type sqlite --db copy.s3db
+//
+// With --threads the saves run on several threads at once, each of them
+// leasing a connection of the pool for every save, as the database
+// workers do. The size of the pool is database_connections.
+//
+// --tuned replaces sqlite_tuned of the configuration, the batched saves
+// need it:
+//
+//   otserv-dbbench --type sqlite --db copy.s3db --tuned yes
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "../otpch.h"
+#include "../database_driver.h"
+#include "../database_pool.h"
+#include "../configmanager.h"
+#include "../player_journal.h"
+#include "../database_executor.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+ConfigManager g_config;
+
+namespace {
+
+struct Options {
+	std::string config;
+	std::string type;
+	std::string db;
+	std::string tuned;
+	uint32_t players;
+	uint32_t rounds;
+	uint32_t storage;
+	uint32_t vips;
+	uint32_t items;
+	uint32_t threads;
+	uint32_t changed;
+	bool text;
+	bool prepared;
+	bool dirty;
+	bool batched;
+	bool server;
+	bool journal;
+	std::string journalFile;
+	bool map;
+	uint32_t houses;
+};
+
+Options g_options;
+
+// Same columns as playerSaveColumns in ioplayer.cpp
+const char* const saveColumns[] = {
+	"level", "vocation", "health", "healthmax", "direction", "experience",
+	"lookbody", "lookfeet", "lookhead", "looklegs", "looktype", "lookaddons",
+	"maglevel", "mana", "manamax", "manaspent", "soul", "town_id",
+	"posx", "posy", "posz", "cap", "sex",
+	"loss_experience", "loss_mana", "loss_skills", "loss_items", "loss_containers", "stamina",
+	NULL
+};
+
+struct SaveData {
+	uint32_t guid;
+	std::vector<int64_t> player;
+	std::string conditions;
+	std::vector<std::pair<uint32_t, uint32_t> > skills;
+	std::vector<std::pair<std::string, std::string> > storage;
+	std::vector<uint32_t> vips;
+};
+
+// A player with some of everything, every version changes the stats, the
+// skill and storage value it names and every fourth the conditions
+void buildSave(SaveData& data, uint32_t guid, uint32_t version, const std::vector<uint32_t>& guids)
+{
+	data.guid = guid;
+	data.player.clear();
+	for(uint32_t i = 0; saveColumns[i]; ++i){
+		data.player.push_back(i == 0 ? 8 + version % 50 : version % 100);
+	}
+	// a few persistent conditions
+	data.conditions.assign(48, (char)(version / 4));
+
+	data.skills.clear();
+	for(uint32_t i = 0; i <= 6; ++i){
+		uint32_t advances = (version + 6 - i) / 7;
+		data.skills.push_back(std::make_pair(10 + advances % 20, advances * 7 + i));
+	}
+
+	data.storage.clear();
+	for(uint32_t i = 0; i < g_options.storage; ++i){
+		std::ostringstream key, value;
+		key << "storage_" << i;
+		value << (i == version % g_options.storage ? version * 100 + i : i) << "'s";
+		data.storage.push_back(std::make_pair(key.str(), value.str()));
+	}
+	// sorted like the storage map of a player
+	std::sort(data.storage.begin(), data.storage.end());
+
+	data.vips.clear();
+	for(uint32_t i = 0; i < g_options.vips && i < guids.size(); ++i){
+		data.vips.push_back(guids[(guid + i) % guids.size()]);
+	}
+	std::sort(data.vips.begin(), data.vips.end());
+}
+
+// The queries IOPlayer sent before it used prepared statements
+bool writeText(DatabaseDriver* db, const SaveData& data, uint32_t& writes)
+{
+	DBQuery query;
+	DBResult_ptr result;
+
+	query << "SELECT `save` FROM `players` WHERE `id` = " << data.guid;
+	if(!(result = db->storeQuery(query))){
+		return false;
+	}
+	result.reset();
+
+	DBTransaction transaction(db);
+	if(!transaction.begin())
+		return false;
+
+	query.reset();
+	query << "UPDATE `players` SET ";
+	for(uint32_t i = 0; saveColumns[i]; ++i){
+		query << "`" << saveColumns[i] << "` = " << data.player[i] << ", ";
+	}
+	query << "`conditions` = " << db->escapeBlob(data.conditions.data(), data.conditions.length()) << " WHERE `id` = " << data.guid;
+	if(!db->executeQuery(query)){
+		return false;
+	}
+	++writes;
+
+	for(uint32_t i = 0; i < data.skills.size(); ++i){
+		query.reset();
+		query << "UPDATE `player_skills` SET `value` = " << data.skills[i].first << ", `count` = " << data.skills[i].second
+			<< " WHERE `player_id` = " << data.guid << " AND `skill_id` = " << i;
+		if(!db->executeQuery(query)){
+			return false;
+		}
+		++writes;
+	}
+
+	query.reset();
+	query << "DELETE FROM `player_storage` WHERE `player_id` = " << data.guid;
+	if(!db->executeQuery(query)){
+		return false;
+	}
+	++writes;
+
+	query.reset();
+	query << "DELETE FROM `player_viplist` WHERE `player_id` = " << data.guid;
+	if(!db->executeQuery(query)){
+		return false;
+	}
+	++writes;
+
+	DBInsert insert(db);
+	insert.setQuery("INSERT INTO `player_storage` (`player_id` , `id` , `value` ) VALUES ");
+	for(uint32_t i = 0; i < data.storage.size(); ++i){
+		query.reset();
+		query << data.guid << ", " << db->escapeString(data.storage[i].first) << ", " << db->escapeString(data.storage[i].second);
+		if(!insert.addRow(query.str())){
+			return false;
+		}
+	}
+
+	if(!insert.execute()){
+		return false;
+	}
+	++writes;
+
+	if(!data.vips.empty()){
+		query.reset();
+		query << "INSERT INTO `player_viplist` (`player_id`, `vip_id`) SELECT " << data.guid << ", `id` FROM `players` WHERE `id` IN (";
+		for(uint32_t i = 0; i < data.vips.size(); ++i){
+			query << (i != 0 ? "," : "") << data.vips[i];
+		}
+		query << ")";
+		if(!db->executeQuery(query)){
+			return false;
+		}
+		++writes;
+	}
+
+	return transaction.commit();
+}
+
+// The UPDATE of the players row, the threads share it
+std::string getUpdateQuery(bool conditions)
+{
+	std::ostringstream query;
+	query << "UPDATE `players` SET ";
+	for(uint32_t i = 0; saveColumns[i]; ++i){
+		query << (i != 0 ? ", " : "") << "`" << saveColumns[i] << "` = ?";
+	}
+	if(conditions){
+		query << ", `conditions` = ?";
+	}
+	query << " WHERE `id` = ?";
+	return query.str();
+}
+
+// The statements IOPlayer::writePlayer sent before it only wrote what changed
+bool writePrepared(DatabaseDriver* db, const SaveData& data, uint32_t& writes, bool transaction = true)
+{
+	DBQuery query;
+	DBResult_ptr result;
+	DBStatement* stmt;
+
+	if(!(stmt = db->prepareStatement("SELECT `save` FROM `players` WHERE `id` = ?"))){
+		return false;
+	}
+
+	stmt->bindInt(0, data.guid);
+	if(!(result = stmt->query())){
+		return false;
+	}
+	result.reset();
+
+	DBTransaction playerTransaction(db);
+	if(transaction && !playerTransaction.begin())
+		return false;
+
+	static const std::string updatePlayer = getUpdateQuery(true);
+	if(!(stmt = db->prepareStatement(updatePlayer))){
+		return false;
+	}
+
+	uint32_t index = 0;
+	for(uint32_t i = 0; i < data.player.size(); ++i){
+		stmt->bindInt(index++, data.player[i]);
+	}
+	stmt->bindBlob(index++, data.conditions.data(), data.conditions.length());
+	stmt->bindInt(index++, data.guid);
+	if(!stmt->execute()){
+		return false;
+	}
+	++writes;
+
+	if(!(stmt = db->prepareStatement("UPDATE `player_skills` SET `value` = ?, `count` = ? WHERE `player_id` = ? AND `skill_id` = ?"))){
+		return false;
+	}
+
+	for(uint32_t i = 0; i < data.skills.size(); ++i){
+		stmt->bindInt(0, data.skills[i].first);
+		stmt->bindInt(1, data.skills[i].second);
+		stmt->bindInt(2, data.guid);
+		stmt->bindInt(3, i);
+		if(!stmt->execute()){
+			return false;
+		}
+		++writes;
+	}
+
+	if(!(stmt = db->prepareStatement("DELETE FROM `player_storage` WHERE `player_id` = ?"))){
+		return false;
+	}
+
+	stmt->bindInt(0, data.guid);
+	if(!stmt->execute()){
+		return false;
+	}
+	++writes;
+
+	if(!(stmt = db->prepareStatement("DELETE FROM `player_viplist` WHERE `player_id` = ?"))){
+		return false;
+	}
+
+	stmt->bindInt(0, data.guid);
+	if(!stmt->execute()){
+		return false;
+	}
+	++writes;
+
+	if(!(stmt = db->prepareStatement("INSERT INTO `player_storage` (`player_id` , `id` , `value` ) VALUES (?, ?, ?)"))){
+		return false;
+	}
+
+	for(uint32_t i = 0; i < data.storage.size(); ++i){
+		stmt->bindInt(0, data.guid);
+		stmt->bindString(1, data.storage[i].first);
+		stmt->bindString(2, data.storage[i].second);
+		if(!stmt->execute()){
+			return false;
+		}
+		++writes;
+	}
+
+	if(!(stmt = db->prepareStatement("INSERT INTO `player_viplist` (`player_id`, `vip_id`) SELECT ?, `id` FROM `players` WHERE `id` = ?"))){
+		return false;
+	}
+
+	for(uint32_t i = 0; i < data.vips.size(); ++i){
+		stmt->bindInt(0, data.guid);
+		stmt->bindInt(1, data.vips[i]);
+		if(!stmt->execute()){
+			return false;
+		}
+		++writes;
+	}
+
+	return !transaction || playerTransaction.commit();
+}
+
+// The statements of IOPlayer::writePlayer, only what differs from saved
+bool writeDirty(DatabaseDriver* db, const SaveData& data, const SaveData& saved, uint32_t& writes, bool transaction = true)
+{
+	bool writeStats = data.player != saved.player;
+	bool writeConditions = data.conditions != saved.conditions;
+	bool writeSkills = data.skills != saved.skills;
+	bool writeStorage = data.storage != saved.storage;
+	bool writeVips = data.vips != saved.vips;
+	if(!writeStats && !writeConditions && !writeSkills && !writeStorage && !writeVips){
+		return true;
+	}
+
+	DBQuery query;
+	DBResult_ptr result;
+	DBStatement* stmt;
+
+	if(!(stmt = db->prepareStatement("SELECT `save` FROM `players` WHERE `id` = ?"))){
+		return false;
+	}
+
+	stmt->bindInt(0, data.guid);
+	if(!(result = stmt->query())){
+		return false;
+	}
+	result.reset();
+
+	DBTransaction playerTransaction(db);
+	if(transaction && !playerTransaction.begin())
+		return false;
+
+	if(writeStats){
+		static const std::string updatePlayer = getUpdateQuery(false);
+		if(!(stmt = db->prepareStatement(updatePlayer))){
+			return false;
+		}
+
+		uint32_t index = 0;
+		for(uint32_t i = 0; i < data.player.size(); ++i){
+			stmt->bindInt(index++, data.player[i]);
+		}
+		stmt->bindInt(index++, data.guid);
+		if(!stmt->execute()){
+			return false;
+		}
+		++writes;
+	}
+
+	if(writeConditions){
+		if(!(stmt = db->prepareStatement("UPDATE `players` SET `conditions` = ? WHERE `id` = ?"))){
+			return false;
+		}
+
+		stmt->bindBlob(0, data.conditions.data(), data.conditions.length());
+		stmt->bindInt(1, data.guid);
+		if(!stmt->execute()){
+			return false;
+		}
+		++writes;
+	}
+
+	if(writeSkills){
+		if(!(stmt = db->prepareStatement("UPDATE `player_skills` SET `value` = ?, `count` = ? WHERE `player_id` = ? AND `skill_id` = ?"))){
+			return false;
+		}
+
+		for(uint32_t i = 0; i < data.skills.size(); ++i){
+			if(i < saved.skills.size() && data.skills[i] == saved.skills[i]){
+				continue;
+			}
+
+			stmt->bindInt(0, data.skills[i].first);
+			stmt->bindInt(1, data.skills[i].second);
+			stmt->bindInt(2, data.guid);
+			stmt->bindInt(3, i);
+			if(!stmt->execute()){
+				return false;
+			}
+			++writes;
+		}
+	}
+
+	if(writeStorage){
+		DBStatement* insert = db->prepareStatement("INSERT INTO `player_storage` (`player_id` , `id` , `value` ) VALUES (?, ?, ?)");
+		DBStatement* update = db->prepareStatement("UPDATE `player_storage` SET `value` = ? WHERE `player_id` = ? AND `id` = ?");
+		DBStatement* remove = db->prepareStatement("DELETE FROM `player_storage` WHERE `player_id` = ? AND `id` = ?");
+		if(!insert || !update || !remove){
+			return false;
+		}
+
+		uint32_t i = 0, j = 0;
+		while(i < data.storage.size() || j < saved.storage.size()){
+			if(j == saved.storage.size() || (i < data.storage.size() && data.storage[i].first < saved.storage[j].first)){
+				stmt = insert;
+				stmt->bindInt(0, data.guid);
+				stmt->bindString(1, data.storage[i].first);
+				stmt->bindString(2, data.storage[i].second);
+				++i;
+			}
+			else if(i == data.storage.size() || saved.storage[j].first < data.storage[i].first){
+				stmt = remove;
+				stmt->bindInt(0, data.guid);
+				stmt->bindString(1, saved.storage[j].first);
+				++j;
+			}
+			else if(data.storage[i].second != saved.storage[j].second){
+				stmt = update;
+				stmt->bindString(0, data.storage[i].second);
+				stmt->bindInt(1, data.guid);
+				stmt->bindString(2, data.storage[i].first);
+				++i;
+				++j;
+			}
+			else{
+				++i;
+				++j;
+				continue;
+			}
+
+			if(!stmt->execute()){
+				return false;
+			}
+			++writes;
+		}
+	}
+
+	if(writeVips){
+		DBStatement* insert = db->prepareStatement("INSERT INTO `player_viplist` (`player_id`, `vip_id`) SELECT ?, `id` FROM `players` WHERE `id` = ?");
+		DBStatement* remove = db->prepareStatement("DELETE FROM `player_viplist` WHERE `player_id` = ? AND `vip_id` = ?");
+		if(!insert || !remove){
+			return false;
+		}
+
+		uint32_t i = 0, j = 0;
+		while(i < data.vips.size() || j < saved.vips.size()){
+			if(j == saved.vips.size() || (i < data.vips.size() && data.vips[i] < saved.vips[j])){
+				stmt = insert;
+				stmt->bindInt(1, data.vips[i++]);
+			}
+			else if(i == data.vips.size() || saved.vips[j] < data.vips[i]){
+				stmt = remove;
+				stmt->bindInt(1, saved.vips[j++]);
+			}
+			else{
+				++i;
+				++j;
+				continue;
+			}
+
+			stmt->bindInt(0, data.guid);
+			if(!stmt->execute()){
+				return false;
+			}
+			++writes;
+		}
+	}
+
+	return !transaction || playerTransaction.commit();
+}
+
+enum SaveMode_t {
+	SAVE_TEXT,
+	SAVE_PREPARED,
+	SAVE_DIRTY,
+	SAVE_BATCHED
+};
+
+// Whether the player changed in the round, the same for every mode
+bool isChanged(uint32_t guid, uint32_t round)
+{
+	return (guid * 2654435761u + round * 40503u) % 100 < g_options.changed;
+}
+
+// Saves every threads-th player, starting with the first-th. versions and
+// saved hold the state of every player in the database before the run.
+void saveThread(DatabaseDriver* db, SaveMode_t mode, const std::vector<uint32_t>& guids,
+	std::vector<uint32_t>* versions, std::vector<SaveData>* saved,
+	uint32_t first, uint32_t* saves, uint32_t* errors, uint32_t* writes)
+{
+	SaveData data;
+	// the saves of a batch are savepoints of its transaction, like the
+	// write jobs queued on a database worker
+	boost::scoped_ptr<DBTransaction> batch;
+	uint32_t batched = 0;
+	for(uint32_t round = 0; round < g_options.rounds; ++round){
+		for(uint32_t i = first; i < guids.size(); i += g_options.threads){
+			if(isChanged(guids[i], round)){
+				++(*versions)[i];
+			}
+
+			if(mode == SAVE_BATCHED && !batch){
+				batch.reset(new DBTransaction(db));
+				if(!batch->begin()){
+					++*errors;
+				}
+			}
+
+			buildSave(data, guids[i], (*versions)[i], guids);
+			bool done;
+			switch(mode){
+			case SAVE_TEXT: done = writeText(db, data, *writes); break;
+			case SAVE_PREPARED: done = writePrepared(db, data, *writes); break;
+			default: done = writeDirty(db, data, (*saved)[i], *writes); break;
+			}
+
+			if(done){
+				++*saves;
+				(*saved)[i] = data;
+			}
+			else{
+				++*errors;
+			}
+
+			if(batch && ++batched == DATABASE_WRITE_BATCH){
+				if(!batch->commit()){
+					++*errors;
+				}
+				batch.reset();
+				batched = 0;
+			}
+		}
+	}
+
+	if(batch && !batch->commit()){
+		++*errors;
+	}
+}
+
+void runSaves(DatabaseDriver* db, const std::string& name, SaveMode_t mode, const std::vector<uint32_t>& guids)
+{
+	// every run starts from the first version of every player, like a
+	// server save right after everyone logged in
+	std::vector<uint32_t> versions(guids.size());
+	std::vector<SaveData> saved(guids.size());
+	uint32_t unused = 0;
+	for(uint32_t i = 0; i < guids.size(); ++i){
+		buildSave(saved[i], guids[i], 0, guids);
+		writePrepared(db, saved[i], unused);
+	}
+
+	std::vector<uint32_t> threadSaves(g_options.threads);
+	std::vector<uint32_t> threadErrors(g_options.threads);
+	std::vector<uint32_t> threadWrites(g_options.threads);
+
+	DatabasePoolStats before, after;
+	DatabasePool::instance()->getStats(before);
+
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	boost::thread_group threads;
+	for(uint32_t i = 0; i < g_options.threads; ++i){
+		threads.create_thread(boost::bind(&saveThread, db, mode, boost::cref(guids), &versions, &saved,
+			i, &threadSaves[i], &threadErrors[i], &threadWrites[i]));
+	}
+	threads.join_all();
+	int64_t elapsed = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+	DatabasePool::instance()->getStats(after);
+
+	uint32_t saves = 0;
+	uint32_t errors = 0;
+	uint32_t writes = 0;
+	for(uint32_t i = 0; i < g_options.threads; ++i){
+		saves += threadSaves[i];
+		errors += threadErrors[i];
+		writes += threadWrites[i];
+	}
+
+	std::cout << "  " << std::left << std::setw(10) << name << std::right
+		<< std::setw(8) << saves
+		<< std::setw(8) << errors
+		<< std::setw(12) << std::fixed << std::setprecision(1) << (elapsed > 0 ? saves * 1000000.0 / elapsed : 0.)
+		<< std::setw(12) << std::setprecision(3) << (saves > 0 ? elapsed / 1000.0 / saves : 0.)
+		<< std::setw(12) << std::setprecision(2) << (saves > 0 ? (double)writes / saves : 0.)
+		<< std::setw(10) << after.waits - before.waits
+		<< std::setw(12) << (after.waits > before.waits ? (after.waitTime - before.waitTime) / 1000.0 / (after.waits - before.waits) : 0.) << std::endl;
+}
+
+// The background half of Game::saveServer, every player in one transaction
+void writeServerSave(DatabaseDriver* db, const std::vector<SaveData>* saves, const std::vector<SaveData>* saved,
+	bool* done, uint32_t* writes)
+{
+	DBTransaction transaction(db);
+	*done = transaction.begin();
+	for(uint32_t i = 0; *done && i < saves->size(); ++i){
+		*done = writeDirty(db, (*saves)[i], (*saved)[i], *writes, false);
+	}
+	*done = *done && transaction.commit();
+}
+
+// A server save every round. Inline the game thread builds and writes every
+// player, in the background it only builds them and a database thread
+// writes them. stall is the time the game thread spent.
+void runServerSaves(DatabaseDriver* db, const std::string& name, bool background, const std::vector<uint32_t>& guids)
+{
+	std::vector<uint32_t> versions(guids.size());
+	std::vector<SaveData> saved(guids.size());
+	uint32_t unused = 0;
+	for(uint32_t i = 0; i < guids.size(); ++i){
+		buildSave(saved[i], guids[i], 0, guids);
+		writePrepared(db, saved[i], unused);
+	}
+
+	std::vector<SaveData> saves(guids.size());
+	uint32_t errors = 0;
+	uint32_t writes = 0;
+	int64_t stall = 0;
+	int64_t maxStall = 0;
+	int64_t writeTime = 0;
+	for(uint32_t round = 0; round < g_options.rounds; ++round){
+		for(uint32_t i = 0; i < guids.size(); ++i){
+			if(isChanged(guids[i], round)){
+				++versions[i];
+			}
+		}
+
+		bool done = true;
+		boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+		for(uint32_t i = 0; i < guids.size(); ++i){
+			buildSave(saves[i], guids[i], versions[i], guids);
+			if(!background && !writeDirty(db, saves[i], saved[i], writes)){
+				done = false;
+			}
+		}
+		int64_t elapsed = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+		stall += elapsed;
+		maxStall = std::max(maxStall, elapsed);
+
+		if(background){
+			start = boost::posix_time::microsec_clock::universal_time();
+			boost::thread writer(boost::bind(&writeServerSave, db, &saves, &saved, &done, &writes));
+			writer.join();
+			writeTime += (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+		}
+
+		if(done){
+			saved.swap(saves);
+		}
+		else{
+			++errors;
+		}
+	}
+
+	uint32_t rounds = g_options.rounds;
+	std::cout << "  " << std::left << std::setw(10) << name << std::right
+		<< std::setw(8) << rounds
+		<< std::setw(8) << errors
+		<< std::setw(12) << std::fixed << std::setprecision(3) << stall / 1000.0 / rounds
+		<< std::setw(12) << maxStall / 1000.0
+		<< std::setw(12) << (background ? writeTime : stall) / 1000.0 / rounds
+		<< std::setw(12) << std::setprecision(2) << (double)writes / rounds << std::endl;
+}
+
+// The save as the server builds it for the player journal
+PlayerSaveData_ptr getJournalData(const SaveData& save)
+{
+	PlayerSaveData_ptr data(new PlayerSaveData());
+	data->guid = save.guid;
+	data->name = "Player";
+	data->player = save.player;
+	data->conditions = save.conditions;
+	data->skills = save.skills;
+	data->storage = save.storage;
+	data->vips = save.vips;
+	return data;
+}
+
+// Every round journals all players like Game::journalPlayers, the ones
+// that did not change add nothing. The first round holds everything, like
+// the first records after a start. With wait every record is synced before
+// the next one is added, like saves waiting for their record, otherwise
+// the writer syncs whatever was added in the meantime at once.
+void runJournal(const std::string& name, bool wait, const std::vector<uint32_t>& guids)
+{
+	PlayerJournal* journal = PlayerJournal::getInstance();
+	if(!journal->start(g_options.journalFile, 1000)){
+		std::cout << "Unable to open the journal " << g_options.journalFile << std::endl;
+		return;
+	}
+
+	PlayerJournalStats before, after;
+	journal->getStats(before);
+
+	// built before, only the journal is timed
+	std::vector<uint32_t> versions(guids.size());
+	std::vector<PlayerSaveData_ptr> saves;
+	SaveData save;
+	for(uint32_t round = 0; round < g_options.rounds; ++round){
+		for(uint32_t i = 0; i < guids.size(); ++i){
+			if(round > 0 && isChanged(guids[i], round)){
+				++versions[i];
+			}
+
+			buildSave(save, guids[i], versions[i], guids);
+			saves.push_back(getJournalData(save));
+		}
+	}
+
+	std::vector<PlayerSaveData_ptr> previous(guids.size());
+	uint64_t sequence = 0;
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	for(uint32_t i = 0; i < saves.size(); ++i){
+		sequence = journal->addPlayer(saves[i], previous[i % guids.size()]);
+		previous[i % guids.size()] = saves[i];
+		if(wait){
+			journal->waitFlushed(sequence);
+		}
+	}
+	journal->waitFlushed(sequence);
+	int64_t elapsed = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+	journal->getStats(after);
+	journal->stop();
+
+	uint64_t records = after.records - before.records;
+	uint64_t flushes = after.flushes - before.flushes;
+	std::cout << "  " << std::left << std::setw(10) << name << std::right
+		<< std::setw(8) << records
+		<< std::setw(10) << (records > 0 ? (after.bytes - before.bytes) / records : 0)
+		<< std::setw(12) << std::fixed << std::setprecision(1) << (elapsed > 0 ? records * 1000000.0 / elapsed : 0.)
+		<< std::setw(8) << flushes
+		<< std::setw(12) << std::setprecision(3) << (flushes > 0 ? (after.flushTime - before.flushTime) / 1000.0 / flushes : 0.) << std::endl;
+}
+
+// Reads the journal left by runJournal and writes it in one transaction,
+// as the server does at the start after a crash
+void runReplay(DatabaseDriver* db)
+{
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	PlayerJournalContents contents;
+	if(!PlayerJournal::read(g_options.journalFile, contents)){
+		std::cout << "Unable to read the journal " << g_options.journalFile << std::endl;
+		return;
+	}
+	int64_t readTime = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+	// every player journaled everything in the first round
+	start = boost::posix_time::microsec_clock::universal_time();
+	uint32_t errors = 0;
+	uint32_t writes = 0;
+	{
+		DBTransaction transaction(db);
+		bool done = transaction.begin();
+		for(std::map<uint32_t, PlayerJournalContents::Player>::const_iterator it = contents.players.begin(); done && it != contents.players.end(); ++it){
+			SaveData save;
+			save.guid = it->first;
+			save.player = it->second.data.player;
+			save.conditions = it->second.data.conditions;
+			save.skills = it->second.data.skills;
+			save.storage = it->second.data.storage;
+			save.vips = it->second.data.vips;
+			done = writePrepared(db, save, writes, false);
+		}
+
+		if(!done || !transaction.commit()){
+			++errors;
+		}
+	}
+	int64_t writeTime = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+	std::cout << "  " << std::left << std::setw(10) << "replay" << std::right
+		<< std::setw(8) << contents.records
+		<< std::setw(10) << contents.bytes
+		<< std::setw(10) << contents.players.size()
+		<< std::setw(8) << errors + contents.errors
+		<< std::setw(12) << std::fixed << std::setprecision(3) << readTime / 1000.0
+		<< std::setw(12) << writeTime / 1000.0 << std::endl;
+
+	// the runs never rotate, everything is in the first file
+	std::ostringstream file;
+	file << g_options.journalFile << ".1";
+	remove(file.str().c_str());
+}
+
+// a few serialized attributes, 22 bytes
+const std::string itemAttributes = std::string("\x05\x10\x00", 3) + std::string(16, 'a') + std::string("\x04\xe8\x03", 3);
+
+// Writes the items of a container as rows, all of them every time, the
+// way the relational storage saves a depot
+bool writeItemRows(DatabaseDriver* db, uint32_t containerId)
+{
+	DBQuery query;
+	DBTransaction transaction(db);
+	if(!transaction.begin())
+		return false;
+
+	DBStatement* stmt = db->prepareStatement("DELETE FROM `items` WHERE `container_id` = ?");
+	if(!stmt){
+		return false;
+	}
+
+	stmt->bindInt(0, containerId);
+	if(!stmt->execute()){
+		return false;
+	}
+
+	if(!(stmt = db->prepareStatement("INSERT INTO `items` (`container_id`, `id`, `parent_id`, `count`, `attributes`) VALUES (?, ?, ?, ?, ?)"))){
+		return false;
+	}
+
+	for(uint32_t i = 0; i < g_options.items; ++i){
+		stmt->bindInt(0, containerId);
+		stmt->bindInt(1, 2000 + i % 500);
+		stmt->bindInt(2, i / 20);
+		stmt->bindInt(3, 1 + i % 100);
+		stmt->bindBlob(4, itemAttributes.data(), itemAttributes.length());
+		if(!stmt->execute()){
+			return false;
+		}
+	}
+	return transaction.commit();
+}
+
+// Gives the player a container of items, like the inventory and depots
+bool createItems(DatabaseDriver* db, uint32_t guid, uint32_t& containerId)
+{
+	{
+		DBQuery query;
+		DBTransaction transaction(db);
+		if(!transaction.begin())
+			return false;
+
+		if(!db->executeQuery("INSERT INTO `item_containers` (`id`) VALUES (NULL)")){
+			return false;
+		}
+		containerId = (uint32_t)db->getLastInsertedRowID();
+
+		query << "INSERT INTO `player_items` (`player_id`, `container_id`) VALUES (" << guid << ", " << containerId << ")";
+		if(!db->executeQuery(query)){
+			return false;
+		}
+
+		if(!transaction.commit()){
+			return false;
+		}
+	}
+	return writeItemRows(db, containerId);
+}
+
+void addShort(std::string& blob, uint16_t value)
+{
+	blob += (char)(value & 0xFF);
+	blob += (char)(value >> 8);
+}
+
+void addLong(std::string& blob, uint32_t value)
+{
+	addShort(blob, value & 0xFFFF);
+	addShort(blob, value >> 16);
+}
+
+// The same items as one depot of the binary storage, a locker holding
+// containers of 20 items, written like IOMapSerialize::saveItem
+std::string buildItemBlob()
+{
+	const uint8_t containerItems = 23; // ATTR_CONTAINER_ITEMS
+	uint32_t containers = (g_options.items + 19) / 20;
+
+	std::string blob;
+	addShort(blob, 1); // PLAYER_ITEMS_VERSION
+	addShort(blob, 2594); // the locker
+	blob += (char)containerItems;
+	addLong(blob, containers);
+	for(uint32_t i = 0; i < g_options.items; i += 20){
+		uint32_t count = std::min<uint32_t>(20, g_options.items - i);
+		addShort(blob, 1988); // a backpack
+		blob += (char)containerItems;
+		addLong(blob, count);
+		for(uint32_t j = i; j < i + count; ++j){
+			addShort(blob, 2000 + j % 500);
+			blob += itemAttributes;
+			blob += '\0';
+		}
+		blob += '\0';
+	}
+	blob += '\0';
+	return blob;
+}
+
+bool writeItemBlob(DatabaseDriver* db, uint32_t guid, const std::string& blob)
+{
+	DBQuery query;
+	DBStatement* stmt = db->prepareStatement("UPDATE `player_depot_store` SET `data` = ? WHERE `player_id` = ? AND `depot_id` = 0");
+	if(!stmt){
+		return false;
+	}
+
+	stmt->bindBlob(0, blob.data(), blob.length());
+	stmt->bindInt(1, guid);
+	return stmt->execute();
+}
+
+void removeItems(DatabaseDriver* db, uint32_t containerId)
+{
+	DBQuery query;
+	query << "DELETE FROM `items` WHERE `container_id` = " << containerId;
+	db->executeQuery(query);
+
+	query.reset();
+	query << "DELETE FROM `player_items` WHERE `container_id` = " << containerId;
+	db->executeQuery(query);
+
+	query.reset();
+	query << "DELETE FROM `item_containers` WHERE `id` = " << containerId;
+	db->executeQuery(query);
+}
+
+// Reads every field of every item, as IOPlayer::loadItems did
+uint64_t readItems(DBResult_ptr result, bool byIndex)
+{
+	uint64_t checksum = 0;
+	if(!byIndex){
+		for(; result; result = result->advance()){
+			checksum += result->getDataInt("id");
+			checksum += result->getDataInt("parent_id");
+			checksum += result->getDataInt("count");
+
+			unsigned long attrSize = 0;
+			result->getDataStream("attributes", attrSize);
+			checksum += attrSize;
+		}
+		return checksum;
+	}
+
+	enum {COLUMN_ID, COLUMN_PARENT_ID, COLUMN_COUNT, COLUMN_ATTRIBUTES, COLUMN_LAST};
+	static const char* const columnNames[] = {"id", "parent_id", "count", "attributes", NULL};
+	int32_t columns[COLUMN_LAST];
+	if(!result || !result->getColumnIndexes(columnNames, columns)){
+		return checksum;
+	}
+
+	for(; result; result = result->advance()){
+		checksum += result->getDataInt(columns[COLUMN_ID]);
+		checksum += result->getDataInt(columns[COLUMN_PARENT_ID]);
+		checksum += result->getDataInt(columns[COLUMN_COUNT]);
+		checksum += result->getDataView(columns[COLUMN_ATTRIBUTES]).size();
+	}
+	return checksum;
+}
+
+void runLoads(DatabaseDriver* db, const std::string& name, bool byIndex, uint32_t guid)
+{
+	uint32_t loads = 0;
+	uint64_t checksum = 0;
+
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	for(uint32_t round = 0; round < g_options.rounds; ++round){
+		DBQuery query;
+		DBStatement* stmt = db->prepareStatement("SELECT `items`.`id` AS `id`, `parent_id`, `count`, `attributes` FROM `items` "
+			"INNER JOIN `player_items` ON `player_items`.`container_id` = `items`.`container_id` "
+			"WHERE `player_items`.`player_id` = ?");
+		if(!stmt){
+			return;
+		}
+
+		stmt->bindInt(0, guid);
+		checksum += readItems(stmt->query(), byIndex);
+		++loads;
+	}
+	int64_t elapsed = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+	std::cout << "  " << std::left << std::setw(10) << name << std::right
+		<< std::setw(8) << loads
+		<< std::setw(12) << std::fixed << std::setprecision(3) << (loads > 0 ? elapsed / 1000.0 / loads : 0.)
+		<< std::setw(12) << std::setprecision(0) << (elapsed > 0 ? (double)loads * g_options.items * 1000000.0 / elapsed : 0.)
+		<< std::setw(14) << checksum << std::endl;
+}
+
+// Loads and saves the items of the player as rows and as one blob. The
+// server builds the items from both the same way, only the database part
+// is timed.
+void runItemStorage(DatabaseDriver* db, uint32_t guid, uint32_t containerId)
+{
+	std::string blob = buildItemBlob();
+	{
+		DBQuery query;
+		query << "DELETE FROM `player_depot_store` WHERE `player_id` = " << guid << " AND `depot_id` = 0";
+		db->executeQuery(query);
+
+		query.reset();
+		query << "INSERT INTO `player_depot_store` (`player_id`, `depot_id`, `data`) VALUES (" << guid << ", 0, " << db->escapeBlob(blob.data(), (uint32_t)blob.length()) << ")";
+		if(!db->executeQuery(query)){
+			std::cout << "Unable to store the blob, is the schema up to date?" << std::endl;
+			return;
+		}
+	}
+
+	for(uint32_t binary = 0; binary < 2; ++binary){
+		uint32_t errors = 0;
+		uint64_t bytes = 0;
+
+		boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+		for(uint32_t round = 0; round < g_options.rounds; ++round){
+			DBQuery query;
+			DBStatement* stmt;
+			if(binary){
+				stmt = db->prepareStatement("SELECT `data` FROM `player_depot_store` WHERE `player_id` = ? AND `depot_id` = 0");
+			}
+			else{
+				stmt = db->prepareStatement("SELECT `items`.`id` AS `id`, `parent_id`, `count`, `attributes` FROM `items` "
+					"INNER JOIN `player_items` ON `player_items`.`container_id` = `items`.`container_id` "
+					"WHERE `player_items`.`player_id` = ?");
+			}
+
+			if(!stmt){
+				++errors;
+				continue;
+			}
+
+			stmt->bindInt(0, guid);
+			DBResult_ptr result = stmt->query();
+			if(binary){
+				bytes += result ? result->getDataView(0).size() : 0;
+			}
+			else{
+				bytes += readItems(result, true);
+			}
+		}
+		int64_t loadTime = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+		start = boost::posix_time::microsec_clock::universal_time();
+		for(uint32_t round = 0; round < g_options.rounds; ++round){
+			if(!(binary ? writeItemBlob(db, guid, blob) : writeItemRows(db, containerId))){
+				++errors;
+			}
+		}
+		int64_t saveTime = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+		std::cout << "  " << std::left << std::setw(10) << (binary ? "binary" : "relational") << std::right
+			<< std::setw(8) << (binary ? 1 : g_options.items)
+			<< std::setw(8) << errors
+			<< std::setw(12) << std::fixed << std::setprecision(3) << loadTime / 1000.0 / g_options.rounds
+			<< std::setw(12) << saveTime / 1000.0 / g_options.rounds << std::endl;
+	}
+
+	DBQuery query;
+	query << "DELETE FROM `player_depot_store` WHERE `player_id` = " << guid << " AND `depot_id` = 0";
+	db->executeQuery(query);
+}
+
+// Houses written by the map mode, above the ids of the real ones
+const uint32_t firstHouseId = 1000000;
+
+// The tiles of a house as IOMapSerialize::saveTile writes them, 40 tiles
+// of 3 items, every version changes the items
+std::string buildHouseBlob(uint32_t house, uint32_t version)
+{
+	std::string blob;
+	for(uint32_t tile = 0; tile < 40; ++tile){
+		addShort(blob, 1000 + house % 100 * 10 + tile % 10);
+		addShort(blob, 1000 + house / 100 * 10 + tile / 10);
+		blob += (char)7;
+		addLong(blob, 3);
+		for(uint32_t i = 0; i < 3; ++i){
+			addShort(blob, 2000 + (house + tile + i + version) % 500);
+			blob += itemAttributes;
+			blob += '\0';
+		}
+	}
+	return blob;
+}
+
+// Encodes every step-th house of houses from first, like the jobs of
+// IOMapSerialize::saveHouseTiles
+void buildHouseBlobs(const std::vector<uint32_t>* houses, const std::vector<uint32_t>* versions,
+	std::vector<std::string>* blobs, uint32_t first, uint32_t step)
+{
+	for(uint32_t i = first; i < houses->size(); i += step){
+		uint32_t house = (*houses)[i];
+		(*blobs)[i] = buildHouseBlob(house, (*versions)[house]);
+	}
+}
+
+// A map save every round, in one transaction like Game::writeServerSave.
+// all rewrites every house, otherwise only the houses that changed in the
+// round are encoded, on threads threads, and replaced.
+void runMapSaves(DatabaseDriver* db, const std::string& name, bool all, uint32_t threads)
+{
+	std::vector<uint32_t> versions(g_options.houses);
+	uint32_t errors = 0;
+	uint64_t written = 0;
+	int64_t encodeTime = 0;
+	int64_t writeTime = 0;
+	for(uint32_t round = 0; round < g_options.rounds; ++round){
+		std::vector<uint32_t> houses;
+		for(uint32_t i = 0; i < g_options.houses; ++i){
+			bool changed = isChanged(firstHouseId + i, round);
+			if(changed){
+				++versions[i];
+			}
+
+			if(all || changed){
+				houses.push_back(i);
+			}
+		}
+
+		boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+		std::vector<std::string> blobs(houses.size());
+		boost::thread_group group;
+		for(uint32_t i = 1; i < threads; ++i){
+			group.create_thread(boost::bind(&buildHouseBlobs, &houses, &versions, &blobs, i, threads));
+		}
+		buildHouseBlobs(&houses, &versions, &blobs, 0, threads);
+		group.join_all();
+		encodeTime += (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+		start = boost::posix_time::microsec_clock::universal_time();
+		bool done = true;
+		if(!houses.empty()){
+			DBTransaction transaction(db);
+			done = transaction.begin();
+
+			DBQuery query;
+			query << "DELETE FROM `map_store` WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID)
+				<< " AND `house_id` >= " << firstHouseId;
+			if(!all){
+				query << " AND `house_id` IN (";
+				for(uint32_t i = 0; i < houses.size(); ++i){
+					query << (i ? ", " : "") << firstHouseId + houses[i];
+				}
+				query << ")";
+			}
+			done = done && db->executeQuery(query);
+
+			DBInsert stmt(db);
+			stmt.setQuery("INSERT INTO `map_store` (`world_id`, `house_id`, `data`) VALUES ");
+			for(uint32_t i = 0; done && i < houses.size(); ++i){
+				query.reset();
+				query << g_config.getNumber(ConfigManager::WORLD_ID) << ", " << firstHouseId + houses[i] << ", "
+					<< db->escapeBlob(blobs[i].data(), (uint32_t)blobs[i].length());
+				done = stmt.addRow(query.str());
+			}
+			done = done && stmt.execute() && transaction.commit();
+		}
+		writeTime += (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+		if(done){
+			written += houses.size();
+		}
+		else{
+			++errors;
+		}
+	}
+
+	uint32_t rounds = g_options.rounds;
+	std::cout << "  " << std::left << std::setw(10) << name << std::right
+		<< std::setw(8) << threads
+		<< std::setw(8) << errors
+		<< std::setw(12) << std::fixed << std::setprecision(1) << (double)written / rounds
+		<< std::setw(12) << std::setprecision(3) << encodeTime / 1000.0 / rounds
+		<< std::setw(12) << writeTime / 1000.0 / rounds
+		<< std::setw(12) << (encodeTime + writeTime) / 1000.0 / rounds << std::endl;
+}
+
+void printUsage(const char* name)
+{
+	std::cout << "Usage: " << name << " [options]" << std::endl
+		<< "  --config <file>    configuration file (config.lua)" << std::endl
+		<< "  --type <type>      replaces database_type of the configuration" << std::endl
+		<< "  --db <name>        replaces database_schema of the configuration" << std::endl
+		<< "  --tuned <yes|no>   replaces sqlite_tuned of the configuration" << std::endl
+		<< "  --players <n>      players saved per round (100)" << std::endl
+		<< "  --rounds <n>       rounds (10)" << std::endl
+		<< "  --storage <n>      storage values per player (20)" << std::endl
+		<< "  --vips <n>         vips per player (10)" << std::endl
+		<< "  --items <n>        items of the player loaded, 0 skips the loads (2000)" << std::endl
+		<< "  --threads <n>      threads saving at once (1)" << std::endl
+		<< "  --changed <n>      percentage of the players that changed between two saves (10)" << std::endl
+		<< "  --mode <mode>      text, prepared, dirty, batched, server, journal, map or all (all)" << std::endl
+		<< "  --journal <file>   player journal written by the journal mode (dbbench.journal)" << std::endl
+		<< "  --houses <n>       houses saved by the map mode, --changed of them change (1000)" << std::endl;
+}
+
+bool parseCommandLine(int argc, char* argv[])
+{
+	g_options.config = "config.lua";
+	g_options.players = 100;
+	g_options.rounds = 10;
+	g_options.storage = 20;
+	g_options.vips = 10;
+	g_options.items = 2000;
+	g_options.threads = 1;
+	g_options.changed = 10;
+	g_options.text = true;
+	g_options.prepared = true;
+	g_options.dirty = true;
+	g_options.batched = true;
+	g_options.server = true;
+	g_options.journal = true;
+	g_options.journalFile = "dbbench.journal";
+	g_options.map = true;
+	g_options.houses = 1000;
+
+	for(int32_t i = 1; i < argc; ++i){
+		std::string arg = argv[i];
+		if(arg == "--help"){
+			printUsage(argv[0]);
+			exit(EXIT_SUCCESS);
+		}
+
+		if(i + 1 >= argc){
+			std::cout << "Missing parameter for '" << arg << "'" << std::endl;
+			return false;
+		}
+
+		std::string value = argv[++i];
+		if(arg == "--config")
+			g_options.config = value;
+		else if(arg == "--type")
+			g_options.type = value;
+		else if(arg == "--db")
+			g_options.db = value;
+		else if(arg == "--tuned")
+			g_options.tuned = value;
+		else if(arg == "--players")
+			g_options.players = std::max(1, atoi(value.c_str()));
+		else if(arg == "--rounds")
+			g_options.rounds = std::max(1, atoi(value.c_str()));
+		else if(arg == "--storage")
+			g_options.storage = std::max(0, atoi(value.c_str()));
+		else if(arg == "--vips")
+			g_options.vips = std::max(0, atoi(value.c_str()));
+		else if(arg == "--items")
+			g_options.items = std::max(0, atoi(value.c_str()));
+		else if(arg == "--threads")
+			g_options.threads = std::max(1, atoi(value.c_str()));
+		else if(arg == "--changed")
+			g_options.changed = std::min(100, std::max(0, atoi(value.c_str())));
+		else if(arg == "--journal")
+			g_options.journalFile = value;
+		else if(arg == "--houses")
+			g_options.houses = std::max(1, atoi(value.c_str()));
+		else if(arg == "--mode"){
+			g_options.text = (value == "text" || value == "all");
+			g_options.prepared = (value == "prepared" || value == "all");
+			g_options.dirty = (value == "dirty" || value == "all");
+			g_options.batched = (value == "batched" || value == "all");
+			g_options.server = (value == "server" || value == "all");
+			g_options.journal = (value == "journal" || value == "all");
+			g_options.map = (value == "map" || value == "all");
+			if(!g_options.text && !g_options.prepared && !g_options.dirty && !g_options.batched && !g_options.server
+				&& !g_options.journal && !g_options.map){
+				std::cout << "Unknown mode '" << value << "'" << std::endl;
+				return false;
+			}
+		}
+		else{
+			std::cout << "Unrecognized command line argument '" << arg << "'" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	if(!parseCommandLine(argc, argv)){
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(!g_config.loadFile(g_options.config)){
+		std::cout << "Unable to load " << g_options.config << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if(!g_options.type.empty())
+		g_config.setString(ConfigManager::SQL_TYPE, g_options.type);
+	if(!g_options.db.empty())
+		g_config.setString(ConfigManager::SQL_DB, g_options.db);
+	if(!g_options.tuned.empty())
+		g_config.setNumber(ConfigManager::SQLITE_TUNED, g_options.tuned == "yes");
+
+	DatabaseDriver* db = DatabaseDriver::instance();
+	if(!db || !db->isConnected()){
+		std::cout << "Unable to connect to the database" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<uint32_t> guids;
+	{
+		// released before the saves, the threads need the connection
+		DBQuery query;
+		query << "SELECT `id` FROM `players` ORDER BY `id` LIMIT " << g_options.players;
+		for(DBResult_ptr result = db->storeQuery(query); result; result = result->advance()){
+			guids.push_back(result->getDataInt("id"));
+		}
+	}
+
+	if(guids.empty()){
+		std::cout << "There are no players to save" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::cout << g_config.getString(ConfigManager::SQL_TYPE) << ", " << guids.size() << " players, " << g_options.rounds << " rounds, "
+		<< g_options.storage << " storage values and " << g_options.vips << " vips per player, "
+		<< g_options.changed << "% changed per round, "
+		<< g_options.threads << " threads on " << DatabasePool::instance()->getSize() << " connections" << std::endl;
+
+	if(g_options.text || g_options.prepared || g_options.dirty || g_options.batched){
+		std::cout << std::endl
+			<< "  mode         saves  errors     saves/s     ms/save  writes/save     waits     ms/wait" << std::endl;
+	}
+
+	if(g_options.text){
+		runSaves(db, "text", SAVE_TEXT, guids);
+	}
+	if(g_options.prepared){
+		runSaves(db, "prepared", SAVE_PREPARED, guids);
+	}
+	if(g_options.dirty){
+		runSaves(db, "dirty", SAVE_DIRTY, guids);
+	}
+	if(g_options.batched){
+		if(db->getParam(DBPARAM_BATCHWRITES)){
+			runSaves(db, "batched", SAVE_BATCHED, guids);
+		}
+		else{
+			std::cout << "  batched   the database does not batch writes, see --tuned" << std::endl;
+		}
+	}
+
+	if(g_options.server){
+		std::cout << std::endl
+			<< "A server save of all players per round" << std::endl
+			<< std::endl
+			<< "  save        rounds  errors    stall ms      max ms    write ms writes/save" << std::endl;
+
+		runServerSaves(db, "inline", false, guids);
+		runServerSaves(db, "background", true, guids);
+	}
+
+	if(g_options.journal){
+		std::cout << std::endl
+			<< "The changes of all players per round in the player journal, and the replay of it" << std::endl
+			<< std::endl
+			<< "  sync       records  bytes/rec   records/s   syncs     ms/sync" << std::endl;
+
+		runJournal("each", true, guids);
+		runJournal("batched", false, guids);
+
+		std::cout << std::endl
+			<< "  journal    records     bytes   players  errors     ms/read    ms/write" << std::endl;
+
+		runReplay(db);
+	}
+
+	if(g_options.map){
+		uint32_t threads = std::max<uint32_t>(1, boost::thread::hardware_concurrency());
+		std::cout << std::endl
+			<< "A map save of " << g_options.houses << " houses per round, " << g_options.changed << "% of them changed" << std::endl
+			<< std::endl
+			<< "  houses     threads  errors houses/save   encode ms    write ms     save ms" << std::endl;
+
+		runMapSaves(db, "all", true, 1);
+		runMapSaves(db, "changed", false, 1);
+		if(threads > 1){
+			runMapSaves(db, "changed", false, threads);
+		}
+
+		DBQuery query;
+		query << "DELETE FROM `map_store` WHERE `world_id` = " << g_config.getNumber(ConfigManager::WORLD_ID)
+			<< " AND `house_id` >= " << firstHouseId;
+		db->executeQuery(query);
+	}
+
+	uint32_t containerId = 0;
+	if(g_options.items != 0){
+		if(!createItems(db, guids.front(), containerId)){
+			std::cout << "Unable to create the items" << std::endl;
+			removeItems(db, containerId);
+			return EXIT_FAILURE;
+		}
+
+		std::cout << std::endl
+			<< g_options.items << " items of one player, " << g_options.rounds << " loads" << std::endl
+			<< std::endl
+			<< "  fields       loads     ms/load      rows/s      checksum" << std::endl;
+
+		runLoads(db, "by name", false, guids.front());
+		runLoads(db, "by index", true, guids.front());
+
+		std::cout << std::endl
+			<< "The same items as rows and as one blob, player_storage_type" << std::endl
+			<< std::endl
+			<< "  storage       rows  errors     ms/load     ms/save" << std::endl;
+
+		runItemStorage(db, guids.front(), containerId);
+		removeItems(db, containerId);
+	}
+	return EXIT_SUCCESS;
+}
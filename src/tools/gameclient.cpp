@@ -0,0 +1,647 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "../otpch.h"
+
+#include "gameclient.h"
+#include "../definitions.h"
+#include "../rsa.h"
+
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <iomanip>
+#include <cstdlib>
+
+const char* default_rsa_p("14299623962416399520070177382898895550795403345466153217470516082934737582776038882967213386204600674145392845853859217990626450972452084065728686565928113");
+const char* default_rsa_q("7630979195970404721891201847792002125535401292779123937207447574596692788513647179235335529307251350570728407373705564708871762033017096809910315212884101");
+
+uint32_t adlerChecksum(const uint8_t* data, size_t len)
+{
+	uint32_t a = 1, b = 0;
+	while(len > 0){
+		size_t tlen = len > 5552 ? 5552 : len;
+		len -= tlen;
+		do{
+			a += *data++;
+			b += a;
+		} while(--tlen);
+
+		a %= 65521;
+		b %= 65521;
+	}
+
+	return (b << 16) | a;
+}
+
+void ClientMessage::encryptRSA(RSA* rsa, size_t start)
+{
+	size_t used = m_buffer.size();
+	m_buffer.resize(start + 128);
+	for(size_t i = used; i < m_buffer.size(); ++i){
+		m_buffer[i] = (uint8_t)rand();
+	}
+	rsa->encrypt((char*)&m_buffer[start]);
+}
+
+void ClientMessage::encryptXTEA(const uint32_t* key)
+{
+	uint16_t length = (uint16_t)m_buffer.size();
+	m_buffer.insert(m_buffer.begin(), (uint8_t*)&length, (uint8_t*)&length + 2);
+	if(m_buffer.size() % 8 != 0){
+		m_buffer.resize(m_buffer.size() + 8 - m_buffer.size() % 8, 0x33);
+	}
+
+	uint32_t* buffer = (uint32_t*)&m_buffer[0];
+	for(size_t pos = 0; pos < m_buffer.size() / 4; pos += 2){
+		uint32_t v0 = buffer[pos], v1 = buffer[pos + 1];
+		uint32_t delta = 0x61C88647;
+		uint32_t sum = 0;
+
+		for(int32_t i = 0; i < 32; i++){
+			v0 += ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + key[sum & 3]);
+			sum -= delta;
+			v1 += ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + key[sum>>11 & 3]);
+		}
+		buffer[pos] = v0; buffer[pos + 1] = v1;
+	}
+}
+
+boost::shared_ptr<std::vector<uint8_t> > ClientMessage::finish(bool checksum)
+{
+	boost::shared_ptr<std::vector<uint8_t> > out(new std::vector<uint8_t>());
+	uint16_t length = (uint16_t)(m_buffer.size() + (checksum ? 4 : 0));
+	out->reserve(length + 2);
+	out->insert(out->end(), (uint8_t*)&length, (uint8_t*)&length + 2);
+	if(checksum){
+		uint32_t sum = adlerChecksum(data(), size());
+		out->insert(out->end(), (uint8_t*)&sum, (uint8_t*)&sum + 4);
+	}
+	out->insert(out->end(), m_buffer.begin(), m_buffer.end());
+	return out;
+}
+
+GameClient::GameClient(boost::asio::io_service& io_service, RSA* rsa) :
+	m_io_service(io_service),
+	m_socket(io_service),
+	m_rsa(rsa)
+{
+	m_state = STATE_CLOSED;
+	m_gamePort = 0;
+	for(int32_t i = 0; i < 4; ++i){
+		m_key[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+	}
+	m_header[0] = m_header[1] = 0;
+	m_bytesIn = 0;
+	m_bytesOut = 0;
+}
+
+void GameClient::connect(const std::string& host, uint16_t loginPort, uint16_t gamePort,
+	const std::string& account, const std::string& character, const std::string& password)
+{
+	m_account = account;
+	m_character = character;
+	m_password = password;
+	m_gamePort = gamePort;
+
+	boost::system::error_code error;
+	m_address = boost::asio::ip::address::from_string(host, error);
+	if(error){
+		m_state = STATE_LOGIN;
+		fail("invalid host " + host);
+		return;
+	}
+
+	if(loginPort == 0){
+		m_state = STATE_GAME_CONNECT;
+		connectTo(m_gamePort);
+	}
+	else{
+		m_state = STATE_LOGIN;
+		connectTo(loginPort);
+	}
+}
+
+void GameClient::send(ClientMessage& msg)
+{
+	if(m_state != STATE_ONLINE){
+		return;
+	}
+
+	msg.encryptXTEA(m_key);
+	write(msg.finish(true));
+}
+
+void GameClient::logout()
+{
+	if(m_state == STATE_ONLINE){
+		// The server closes the connection once the player is removed
+		ClientMessage msg;
+		msg.addByte(0x14);
+		send(msg);
+		m_state = STATE_CLOSED;
+	}
+	else{
+		close();
+	}
+}
+
+void GameClient::close()
+{
+	m_state = STATE_CLOSED;
+
+	boost::system::error_code error;
+	m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
+	m_socket.close(error);
+}
+
+void GameClient::connectTo(uint16_t port)
+{
+	m_socket.async_connect(boost::asio::ip::tcp::endpoint(m_address, port),
+		boost::bind(&GameClient::onConnect, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void GameClient::onConnect(const boost::system::error_code& error)
+{
+	if(error){
+		fail("connect: " + error.message());
+		return;
+	}
+
+	boost::system::error_code ignored;
+	m_socket.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+
+	// The game server talks first
+	if(m_state == STATE_LOGIN){
+		sendLogin();
+	}
+	readHeader();
+}
+
+void GameClient::readHeader()
+{
+	boost::asio::async_read(m_socket, boost::asio::buffer(m_header, 2),
+		boost::bind(&GameClient::onReadHeader, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void GameClient::onReadHeader(const boost::system::error_code& error)
+{
+	if(error){
+		if(m_state == STATE_GAME_LOGIN && error == boost::asio::error::eof){
+			// The game server drops the connection on a wrong password
+			fail("game server closed the connection, check account and password");
+		}
+		else{
+			fail("read: " + error.message());
+		}
+		return;
+	}
+
+	uint16_t size = m_header[0] | (m_header[1] << 8);
+	m_body.resize(size);
+	boost::asio::async_read(m_socket, boost::asio::buffer(m_body),
+		boost::bind(&GameClient::onReadBody, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void GameClient::onReadBody(const boost::system::error_code& error)
+{
+	if(error){
+		fail("read: " + error.message());
+		return;
+	}
+
+	m_bytesIn += m_body.size() + 2;
+
+	// Login replies are not checksummed, game packets are
+	size_t offset = 0;
+	if(m_state == STATE_GAME_CONNECT || m_body.size() % 8 == 4){
+		offset = 4;
+	}
+
+	if(m_state != STATE_GAME_CONNECT){
+		size_t length = m_body.size() - offset;
+		if(length == 0 || length % 8 != 0){
+			fail("received a packet that is not XTEA encrypted");
+			return;
+		}
+
+		uint32_t* buffer = (uint32_t*)&m_body[offset];
+		for(size_t pos = 0; pos < length / 4; pos += 2){
+			uint32_t v0 = buffer[pos], v1 = buffer[pos + 1];
+			uint32_t delta = 0x61C88647;
+			uint32_t sum = 0xC6EF3720;
+
+			for(int32_t i = 0; i < 32; i++){
+				v1 -= ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + m_key[sum>>11 & 3]);
+				sum += delta;
+				v0 -= ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + m_key[sum & 3]);
+			}
+			buffer[pos] = v0; buffer[pos + 1] = v1;
+		}
+	}
+
+	if(m_body.size() < offset + 2){
+		fail("received a truncated packet");
+		return;
+	}
+
+	uint16_t length = m_body[offset] | (m_body[offset + 1] << 8);
+	if(length > m_body.size() - offset - 2){
+		fail("received a packet with an invalid inner length");
+		return;
+	}
+
+	// The login connection is replaced by the game connection after the reply
+	bool loginReply = (m_state == STATE_LOGIN);
+	ServerMessage msg(&m_body[offset + 2], length);
+	switch(m_state){
+	case STATE_LOGIN:
+		onLoginReply(msg);
+		break;
+	case STATE_GAME_CONNECT:
+		// 0x1F, the server is ready for the login packet
+		m_state = STATE_GAME_LOGIN;
+		sendGameLogin();
+		break;
+	case STATE_GAME_LOGIN:
+		onGameLoginReply(msg);
+		break;
+	case STATE_ONLINE:
+		if(msg.canRead(1) && msg.getData()[0] == 0x14){
+			msg.getByte();
+			fail("kicked: " + msg.getString());
+			return;
+		}
+		onPacket(msg);
+		break;
+	default:
+		break;
+	}
+
+	if(!loginReply && m_socket.is_open()){
+		readHeader();
+	}
+}
+
+void GameClient::write(boost::shared_ptr<std::vector<uint8_t> > buffer)
+{
+	m_bytesOut += buffer->size();
+	m_writeQueue.push_back(buffer);
+	if(m_writeQueue.size() == 1){
+		boost::asio::async_write(m_socket, boost::asio::buffer(*buffer),
+			boost::bind(&GameClient::onWrite, shared_from_this(), boost::asio::placeholders::error));
+	}
+}
+
+void GameClient::onWrite(const boost::system::error_code& error)
+{
+	if(m_writeQueue.empty()){
+		return;
+	}
+
+	m_writeQueue.pop_front();
+	if(error){
+		m_writeQueue.clear();
+		fail("write: " + error.message());
+		return;
+	}
+
+	if(!m_writeQueue.empty()){
+		boost::asio::async_write(m_socket, boost::asio::buffer(*m_writeQueue.front()),
+			boost::bind(&GameClient::onWrite, shared_from_this(), boost::asio::placeholders::error));
+	}
+}
+
+void GameClient::fail(const std::string& reason)
+{
+	if(m_state == STATE_CLOSED){
+		// Expected after a logout or close
+		close();
+		return;
+	}
+
+	bool wasOnline = (m_state == STATE_ONLINE);
+	close();
+	onError(reason, wasOnline);
+}
+
+void GameClient::sendLogin()
+{
+	ClientMessage msg;
+	msg.addByte(0x01); // protocol id
+	msg.addU16(0x02); // os
+	msg.addU16(CLIENT_VERSION_MIN);
+	msg.addU32(0); // dat signature
+	msg.addU32(0); // spr signature
+	msg.addU32(0); // pic signature
+
+	size_t rsaStart = msg.size();
+	msg.addByte(0);
+	for(int32_t i = 0; i < 4; ++i){
+		msg.addU32(m_key[i]);
+	}
+	msg.addString(m_account);
+	msg.addString(m_password);
+	msg.encryptRSA(m_rsa, rsaStart);
+
+	write(msg.finish(true));
+}
+
+void GameClient::sendGameLogin()
+{
+	ClientMessage msg;
+	msg.addByte(0x0A); // protocol id
+	msg.addU16(0x02); // os
+	msg.addU16(CLIENT_VERSION_MIN);
+
+	size_t rsaStart = msg.size();
+	msg.addByte(0);
+	for(int32_t i = 0; i < 4; ++i){
+		msg.addU32(m_key[i]);
+	}
+	msg.addByte(0); // gamemaster flag
+	msg.addString(m_account);
+	msg.addString(m_character);
+	msg.addString(m_password);
+	msg.encryptRSA(m_rsa, rsaStart);
+
+	write(msg.finish(true));
+}
+
+void GameClient::onLoginReply(ServerMessage& msg)
+{
+	bool found = false;
+	while(msg.canRead(1)){
+		uint8_t type = msg.getByte();
+		switch(type){
+		case 0x0A:
+			fail("login refused: " + msg.getString());
+			return;
+		case 0x14:
+			msg.getString(); // motd
+			break;
+		case 0x64:
+		{
+			uint8_t count = msg.getByte();
+			for(uint8_t i = 0; i < count; ++i){
+				std::string name = msg.getString();
+				msg.getString(); // world name
+				msg.getU32(); // world ip
+				uint16_t port = msg.getU16();
+				if(name == m_character){
+					m_gamePort = port;
+					found = true;
+				}
+			}
+			msg.getU16(); // premium days
+			break;
+		}
+		default:
+			fail("unexpected login reply");
+			return;
+		}
+	}
+
+	if(!found){
+		fail("character '" + m_character + "' is not on account '" + m_account + "'");
+		return;
+	}
+
+	boost::system::error_code error;
+	m_socket.close(error);
+	m_state = STATE_GAME_CONNECT;
+	connectTo(m_gamePort);
+}
+
+void GameClient::onGameLoginReply(ServerMessage& msg)
+{
+	uint8_t type = msg.getByte();
+	size_t stringLength = (msg.getSize() >= 3 ? msg.getData()[1] | (msg.getData()[2] << 8) : 0);
+	if(type == 0x14 || type == 0x16 ||
+		(type == 0x0A && msg.getSize() == 3 + stringLength)){
+		// Disconnect or waiting list, 0x0A with only a string is the version error
+		fail("game login refused: " + msg.getString());
+		return;
+	}
+	else if(type != 0x0A){
+		return;
+	}
+
+	m_state = STATE_ONLINE;
+	uint32_t creatureId = msg.getU32();
+	onLogin(creatureId, msg);
+}
+
+bool queryServerStats(const std::string& host, uint16_t port, ServerStats& stats)
+{
+	try{
+		boost::asio::io_service io_service;
+		boost::asio::ip::tcp::socket socket(io_service);
+		socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(host), port));
+
+		// length, protocol id, info request, packet, dispatcher, output, send queue, connection and database statistics
+		const uint8_t request[6] = {0x04, 0x00, 0xFF, 0x01, 0x00, 0x3F};
+		boost::asio::write(socket, boost::asio::buffer(request, sizeof(request)));
+
+		uint8_t header[2];
+		boost::asio::read(socket, boost::asio::buffer(header, 2));
+		std::vector<uint8_t> body(header[0] | (header[1] << 8));
+		if(body.empty()){
+			return false;
+		}
+		boost::asio::read(socket, boost::asio::buffer(body));
+
+		ServerMessage msg(&body[0], body.size());
+		while(msg.canRead(1)){
+			uint8_t type = msg.getByte();
+			if(type == 0x24){
+				uint16_t count = msg.getU16();
+				for(uint16_t i = 0; i < count && msg.canRead(25); ++i){
+					ServerPacketStats& entry = stats.packets[msg.getByte()];
+					entry.received = msg.getU64();
+					entry.dropped = msg.getU64();
+					entry.parseTime = msg.getU64();
+				}
+			}
+			else if(type == 0x25){
+				stats.dispatcherTasks = msg.getU64();
+				stats.dispatcherTime = msg.getU64();
+				stats.dispatcherStalls = msg.getU64();
+				stats.dispatcherStallTime = msg.getU64();
+			}
+			else if(type == 0x26){
+				stats.flushes = msg.getU64();
+				stats.sentMessages = msg.getU64();
+				stats.writes = msg.getU64();
+				stats.sentBytes = msg.getU64();
+				stats.sendDelay = msg.getU64();
+			}
+			else if(type == 0x27){
+				stats.connections = msg.getU32();
+				stats.backlogged = msg.getU32();
+				stats.queuedMessages = msg.getU64();
+				stats.queuedBytes = msg.getU64();
+				stats.maxQueuedBytes = msg.getU32();
+				stats.backloggedMemory = msg.getU64();
+				stats.droppedUpdates = msg.getU64();
+				stats.sendQueueOverflows = msg.getU64();
+			}
+			else if(type == 0x28){
+				stats.connectionHistograms.resize(msg.getByte());
+				for(size_t i = 0; i < stats.connectionHistograms.size(); ++i){
+					stats.connectionHistograms[i].resize(msg.getByte());
+					for(size_t j = 0; j < stats.connectionHistograms[i].size(); ++j){
+						stats.connectionHistograms[i][j] = msg.getU64();
+					}
+				}
+			}
+			else if(type == 0x29){
+				stats.databaseSize = msg.getU32();
+				stats.databaseConnections = msg.getU32();
+				stats.databaseLeased = msg.getU32();
+				stats.databaseLeases = msg.getU64();
+				stats.databaseWaits = msg.getU64();
+				stats.databaseWaitTime = msg.getU64();
+				stats.databaseMaxWaitTime = msg.getU64();
+				msg.getU64(); // health checks
+				stats.databaseReconnects = msg.getU64();
+			}
+			else{
+				return false;
+			}
+		}
+		return true;
+	}
+	catch(boost::system::system_error&){
+		return false;
+	}
+}
+
+// Upper bound of the bucket holding the given fraction of the values added between the two snapshots
+static uint64_t histogramPercentile(const ServerStats& before, const ServerStats& after, size_t type, double fraction)
+{
+	const std::vector<uint64_t>& buckets = after.connectionHistograms[type];
+	std::vector<uint64_t> delta(buckets.size());
+	uint64_t total = 0;
+	for(size_t i = 0; i < buckets.size(); ++i){
+		delta[i] = buckets[i];
+		if(type < before.connectionHistograms.size() && i < before.connectionHistograms[type].size()){
+			delta[i] -= before.connectionHistograms[type][i];
+		}
+		total += delta[i];
+	}
+
+	uint64_t seen = 0;
+	for(size_t i = 0; i < delta.size(); ++i){
+		seen += delta[i];
+		if(seen > 0 && seen >= total * fraction){
+			return i == 0 ? 0 : ((uint64_t)1 << i);
+		}
+	}
+	return 0;
+}
+
+void printServerStats(std::ostream& os, const ServerStats& before, const ServerStats& after, double seconds)
+{
+	uint64_t tasks = after.dispatcherTasks - before.dispatcherTasks;
+	uint64_t busyTime = after.dispatcherTime - before.dispatcherTime;
+	os << "  dispatcher: " << std::fixed << std::setprecision(1) << tasks / seconds << " tasks/s, "
+		<< busyTime / seconds / 10000. << "% busy, "
+		<< std::setprecision(2) << (tasks > 0 ? (double)busyTime / tasks : 0.) << " us/task" << std::endl;
+	// DISPATCHER_STALL_TIME in tasks.h
+	os << "  dispatcher stalls: " << after.dispatcherStalls - before.dispatcherStalls << " tasks over 10 ms, "
+		<< std::setprecision(1)
+		<< (after.dispatcherStallTime - before.dispatcherStallTime) / 1000. << " ms stalled" << std::endl;
+
+	uint64_t flushes = after.flushes - before.flushes;
+	uint64_t messages = after.sentMessages - before.sentMessages;
+	uint64_t writes = after.writes - before.writes;
+	uint64_t bytes = after.sentBytes - before.sentBytes;
+	os << "  output: " << std::setprecision(1) << flushes / seconds << " flushes/s, "
+		<< writes / seconds << " writes/s, "
+		<< std::setprecision(2) << (writes > 0 ? (double)messages / writes : 0.) << " messages/write, "
+		<< std::setprecision(0) << (writes > 0 ? (double)bytes / writes : 0.) << " bytes/write, "
+		<< std::setprecision(2) << (messages > 0 ? (after.sendDelay - before.sendDelay) / 1000. / messages : 0.)
+		<< " ms tick to write" << std::endl;
+	os << "  send queues: " << after.backlogged << " of " << after.connections << " connections backlogged, "
+		<< std::setprecision(1) << after.queuedBytes / 1024. << " kB in " << after.queuedMessages << " messages queued (max "
+		<< after.maxQueuedBytes / 1024. << " kB), " << after.backloggedMemory / 1024. << " kB pool held by slow clients" << std::endl;
+	os << "  slow clients: " << (after.droppedUpdates - before.droppedUpdates) / seconds << " updates dropped/s, "
+		<< after.sendQueueOverflows - before.sendQueueOverflows << " disconnected" << std::endl;
+	if(after.connectionHistograms.size() >= 4){
+		os << "  connections (p50/p99): first packet " << std::setprecision(1)
+			<< histogramPercentile(before, after, 0, 0.5) / 1000. << "/" << histogramPercentile(before, after, 0, 0.99) / 1000. << " ms, placement "
+			<< histogramPercentile(before, after, 1, 0.5) / 1000. << "/" << histogramPercentile(before, after, 1, 0.99) / 1000. << " ms, write "
+			<< histogramPercentile(before, after, 2, 0.5) / 1000. << "/" << histogramPercentile(before, after, 2, 0.99) / 1000. << " ms, queue high water "
+			<< histogramPercentile(before, after, 3, 0.5) / 1024. << "/" << histogramPercentile(before, after, 3, 0.99) / 1024. << " kB" << std::endl;
+	}
+
+	if(after.databaseSize > 0){
+		uint64_t leases = after.databaseLeases - before.databaseLeases;
+		uint64_t waits = after.databaseWaits - before.databaseWaits;
+		os << "  database: " << after.databaseConnections << " of " << after.databaseSize << " connections open, "
+			<< std::setprecision(1) << leases / seconds << " leases/s, "
+			<< (leases > 0 ? waits * 100. / leases : 0.) << "% waited, "
+			<< std::setprecision(2) << (waits > 0 ? (after.databaseWaitTime - before.databaseWaitTime) / 1000. / waits : 0.)
+			<< " ms avg wait (max " << after.databaseMaxWaitTime / 1000. << " ms), "
+			<< after.databaseReconnects - before.databaseReconnects << " reconnects" << std::endl;
+	}
+
+	os << "  type    received/s   dropped/s  avg parse us" << std::endl;
+	uint64_t totalReceived = 0, totalDropped = 0;
+	for(std::map<uint8_t, ServerPacketStats>::const_iterator it = after.packets.begin(); it != after.packets.end(); ++it){
+		ServerPacketStats delta = it->second;
+		std::map<uint8_t, ServerPacketStats>::const_iterator old = before.packets.find(it->first);
+		if(old != before.packets.end()){
+			delta.received -= old->second.received;
+			delta.dropped -= old->second.dropped;
+			delta.parseTime -= old->second.parseTime;
+		}
+
+		if(delta.received == 0){
+			continue;
+		}
+
+		totalReceived += delta.received;
+		totalDropped += delta.dropped;
+		uint64_t parsed = delta.received - delta.dropped;
+
+		os << "  0x" << std::hex << std::setw(2) << std::setfill('0') << (uint32_t)it->first << std::dec << std::setfill(' ')
+			<< std::setprecision(1) << std::setw(14) << delta.received / seconds << std::setw(12) << delta.dropped / seconds
+			<< std::setprecision(2) << std::setw(14) << (parsed > 0 ? (double)delta.parseTime / parsed : 0.) << std::endl;
+	}
+	os << "  total " << std::setprecision(1) << std::setw(14) << totalReceived / seconds
+		<< std::setw(12) << totalDropped / seconds << std::endl;
+}
+
+void printPercentiles(std::ostream& os, std::vector<uint32_t>& latencies)
+{
+	if(latencies.empty()){
+		os << std::setw(10) << "-" << std::setw(10) << "-" << std::setw(10) << "-" << std::setw(10) << "-";
+		return;
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	const double percentiles[3] = {0.50, 0.90, 0.99};
+	os << std::fixed << std::setprecision(2);
+	for(int32_t i = 0; i < 3; ++i){
+		size_t rank = (size_t)(percentiles[i] * (latencies.size() - 1) + 0.5);
+		os << std::setw(10) << latencies[rank] / 1000.;
+	}
+	os << std::setw(10) << latencies.back() / 1000.;
+}
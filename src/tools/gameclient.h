@@ -0,0 +1,254 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Minimal client side of the login and game protocols, shared by
+// the load generator and the packet trace replay tool
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_TOOLS_GAMECLIENT_H__
+#define __OTSERV_TOOLS_GAMECLIENT_H__
+
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include <string.h>
+
+class RSA;
+
+// The key loaded by otserv.cpp
+extern const char* default_rsa_p;
+extern const char* default_rsa_q;
+
+uint32_t adlerChecksum(const uint8_t* data, size_t len);
+
+// Outgoing packet, the layout mirrors what the server expects in
+// Connection::parseHeader/parsePacket and Protocol::XTEA_decrypt
+class ClientMessage
+{
+public:
+	ClientMessage() {m_buffer.reserve(256);}
+
+	void addByte(uint8_t value) {m_buffer.push_back(value);}
+	void addU16(uint16_t value) {addBytes(&value, 2);}
+	void addU32(uint32_t value) {addBytes(&value, 4);}
+	void addBytes(const void* bytes, size_t size)
+	{
+		const uint8_t* data = (const uint8_t*)bytes;
+		m_buffer.insert(m_buffer.end(), data, data + size);
+	}
+	void addString(const std::string& value)
+	{
+		addU16((uint16_t)value.size());
+		addBytes(value.data(), value.size());
+	}
+	void addPosition(uint16_t x, uint16_t y, uint8_t z)
+	{
+		addU16(x);
+		addU16(y);
+		addByte(z);
+	}
+
+	size_t size() const {return m_buffer.size();}
+	uint8_t* data() {return &m_buffer[0];}
+
+	// Pads and encrypts everything from start on as one RSA block
+	void encryptRSA(RSA* rsa, size_t start);
+	// Prepends the inner length and encrypts the message body
+	void encryptXTEA(const uint32_t* key);
+	// Adds the checksum and the outer length header
+	boost::shared_ptr<std::vector<uint8_t> > finish(bool checksum);
+
+protected:
+	std::vector<uint8_t> m_buffer;
+};
+
+// Incoming packet reader, never reads past the end of the buffer
+class ServerMessage
+{
+public:
+	ServerMessage(const uint8_t* data, size_t size) : m_data(data), m_size(size), m_pos(0) {}
+
+	bool canRead(size_t size) const {return m_pos + size <= m_size;}
+	uint8_t getByte() {return canRead(1) ? m_data[m_pos++] : 0;}
+	uint16_t getU16() {uint16_t value = 0; getBytes(&value, 2); return value;}
+	uint32_t getU32() {uint32_t value = 0; getBytes(&value, 4); return value;}
+	uint64_t getU64() {uint64_t value = 0; getBytes(&value, 8); return value;}
+	std::string getString()
+	{
+		uint16_t length = getU16();
+		if(!canRead(length)){
+			m_pos = m_size;
+			return std::string();
+		}
+		std::string value((const char*)m_data + m_pos, length);
+		m_pos += length;
+		return value;
+	}
+
+	size_t getReadPos() const {return m_pos;}
+	size_t getSize() const {return m_size;}
+	const uint8_t* getData() const {return m_data;}
+
+protected:
+	void getBytes(void* value, size_t size)
+	{
+		if(canRead(size)){
+			memcpy(value, m_data + m_pos, size);
+			m_pos += size;
+		}
+	}
+
+	const uint8_t* m_data;
+	size_t m_size;
+	size_t m_pos;
+};
+
+// One client connection: logs in through the login server (optional)
+// and the game server, then hands decrypted game packets to the subclass
+class GameClient : public boost::enable_shared_from_this<GameClient>
+{
+public:
+	GameClient(boost::asio::io_service& io_service, RSA* rsa);
+	virtual ~GameClient() {}
+
+	// loginPort 0 skips the login server
+	void connect(const std::string& host, uint16_t loginPort, uint16_t gamePort,
+		const std::string& account, const std::string& character, const std::string& password);
+	void send(ClientMessage& msg);
+	void logout();
+	void close();
+
+	bool isOnline() const {return m_state == STATE_ONLINE;}
+	const std::string& getCharacter() const {return m_character;}
+	uint64_t getBytesIn() const {return m_bytesIn;}
+	uint64_t getBytesOut() const {return m_bytesOut;}
+
+protected:
+	// The self appear packet, read position is right after the player id
+	virtual void onLogin(uint32_t creatureId, ServerMessage& msg) = 0;
+	virtual void onPacket(ServerMessage& msg) = 0;
+	// Called once, when the login fails or an online client is disconnected
+	virtual void onError(const std::string& reason, bool wasOnline) = 0;
+
+	boost::asio::io_service& m_io_service;
+
+private:
+	enum ClientState {
+		STATE_LOGIN,
+		STATE_GAME_CONNECT,
+		STATE_GAME_LOGIN,
+		STATE_ONLINE,
+		STATE_CLOSED
+	};
+
+	void connectTo(uint16_t port);
+	void onConnect(const boost::system::error_code& error);
+	void readHeader();
+	void onReadHeader(const boost::system::error_code& error);
+	void onReadBody(const boost::system::error_code& error);
+	void write(boost::shared_ptr<std::vector<uint8_t> > buffer);
+	void onWrite(const boost::system::error_code& error);
+	void fail(const std::string& reason);
+
+	void sendLogin();
+	void sendGameLogin();
+	void onLoginReply(ServerMessage& msg);
+	void onGameLoginReply(ServerMessage& msg);
+
+	boost::asio::ip::tcp::socket m_socket;
+	RSA* m_rsa;
+	ClientState m_state;
+	boost::asio::ip::address m_address;
+	uint16_t m_gamePort;
+	std::string m_account;
+	std::string m_character;
+	std::string m_password;
+	uint32_t m_key[4];
+
+	uint8_t m_header[2];
+	std::vector<uint8_t> m_body;
+	std::deque<boost::shared_ptr<std::vector<uint8_t> > > m_writeQueue;
+
+	uint64_t m_bytesIn;
+	uint64_t m_bytesOut;
+};
+
+// Per opcode statistics reported by the status protocol
+struct ServerPacketStats {
+	ServerPacketStats() : received(0), dropped(0), parseTime(0) {}
+
+	uint64_t received;
+	uint64_t dropped;
+	uint64_t parseTime;
+};
+
+struct ServerStats {
+	ServerStats() : dispatcherTasks(0), dispatcherTime(0), dispatcherStalls(0), dispatcherStallTime(0),
+		flushes(0), sentMessages(0), writes(0), sentBytes(0), sendDelay(0),
+		connections(0), backlogged(0), queuedMessages(0), queuedBytes(0), maxQueuedBytes(0),
+		backloggedMemory(0), droppedUpdates(0), sendQueueOverflows(0),
+		databaseConnections(0), databaseSize(0), databaseLeased(0), databaseLeases(0),
+		databaseWaits(0), databaseWaitTime(0), databaseMaxWaitTime(0), databaseReconnects(0) {}
+
+	std::map<uint8_t, ServerPacketStats> packets;
+	uint64_t dispatcherTasks;
+	uint64_t dispatcherTime;
+	uint64_t dispatcherStalls;
+	uint64_t dispatcherStallTime;
+	uint64_t flushes;
+	uint64_t sentMessages;
+	uint64_t writes;
+	uint64_t sentBytes;
+	uint64_t sendDelay;
+	// the send queue values are a snapshot, except for the last two
+	uint32_t connections;
+	uint32_t backlogged;
+	uint64_t queuedMessages;
+	uint64_t queuedBytes;
+	uint32_t maxQueuedBytes;
+	uint64_t backloggedMemory;
+	uint64_t droppedUpdates;
+	uint64_t sendQueueOverflows;
+	// first packet, placement and write time in us, queue high water in bytes,
+	// bucket i counts the values below 2^i
+	std::vector<std::vector<uint64_t> > connectionHistograms;
+	// database connection pool, the wait times in us
+	uint32_t databaseConnections;
+	uint32_t databaseSize;
+	uint32_t databaseLeased;
+	uint64_t databaseLeases;
+	uint64_t databaseWaits;
+	uint64_t databaseWaitTime;
+	uint64_t databaseMaxWaitTime;
+	uint64_t databaseReconnects;
+};
+
+// Queries packet, dispatcher, output, send queue, connection and database statistics, the status port only
+// answers one query per status_information_timeout and IP
+bool queryServerStats(const std::string& host, uint16_t port, ServerStats& stats);
+// Prints what the server did between the two queries
+void printServerStats(std::ostream& os, const ServerStats& before, const ServerStats& after, double seconds);
+// Prints p50, p90, p99 and max in milliseconds, sorts the samples
+void printPercentiles(std::ostream& os, std::vector<uint32_t>& latencies);
+
+#endif
@@ -0,0 +1,1526 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Headless load generator, spawns bot clients that log in through
+// the login and game protocols and play a configurable action mix
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+//
+// Typical offline run against the bundled sample world:
+//
+//   ./tools/gendb.sh
+//   otserv-loadgen --sql 100 | sqlite3 db.s3db
+//   otserv &
+//   otserv-loadgen --bots 100 --duration 120 --mix walk=60,say=20,attack=10,use=10
+//
+// Set maximum_login_tries = 0 in config.lua, otherwise the login server
+// temporarily disables 127.0.0.1 after a burst of logins.
+//
+// Floor changes and teleports, every one sends a full map description.
+// The floor action says /up and /down, so the bots have to be gamemasters:
+//
+//   otserv-loadgen --sql 100 --group 5 | sqlite3 db.s3db
+//   otserv-loadgen --bots 100 --mix walk=50,floor=50
+//
+// Parse cost of chat heavy traffic, the "avg parse us" of packet 0x96:
+//
+//   otserv-loadgen --bots 200 --think 200 --mix say=100
+//
+// Status port throughput, with status_information_timeout = 0:
+//
+//   otserv-loadgen --status-bench 32 --duration 30
+//
+// Accepted connections per second on the game port, compare the
+// network_threads settings:
+//
+//   otserv-loadgen --accept-bench 64 --duration 30
+//
+// The same with a large ban list, every accepted connection is looked up
+// in the IP ban trie. The bans lie outside 127/8 where the probes come
+// from, restart the server after loading them:
+//
+//   otserv-loadgen --sql-bans 100000 | sqlite3 db.s3db
+//   otserv-loadgen --accept-bench 64 --duration 30
+//
+// Known creature tracking of ProtocolGame, offline. Replays the same
+// creature sequences through KnownCreatureList and the std::list it
+// replaced, checks both send and remove the same ids and times them:
+//
+//   otserv-loadgen --known-bench 2000
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "../otpch.h"
+#include "../otsystem.h"
+#include "../definitions.h"
+#include "../rsa.h"
+#include "../knowncreaturelist.h"
+#include "gameclient.h"
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <list>
+#include <set>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+enum ActionType {
+	ACTION_WALK,
+	ACTION_SAY,
+	ACTION_ATTACK,
+	ACTION_USE,
+	ACTION_FLOOR,
+	ACTION_COUNT
+};
+
+const char* actionNames[ACTION_COUNT] = {"walk", "say", "attack", "use", "floor"};
+
+struct Options {
+	std::string host;
+	uint16_t loginPort;
+	uint16_t gamePort;
+	uint16_t statusPort;
+	uint32_t bots;
+	uint32_t firstBot;
+	uint32_t duration;
+	uint32_t rampUp;
+	uint32_t thinkTime;
+	uint32_t replyTimeout;
+	uint32_t reportInterval;
+	uint32_t mix[ACTION_COUNT];
+	uint16_t useItemId;
+	uint8_t useSlot;
+	bool skipLogin;
+	std::string accountFormat;
+	std::string characterFormat;
+	std::string password;
+	std::string rsaKeyFile;
+	uint32_t printSql;
+	uint32_t printBanSql;
+	uint32_t groupId;
+	uint32_t statusBench;
+	uint32_t acceptBench;
+	uint32_t knownBench;
+};
+
+struct ActionStats {
+	ActionStats() : sent(0), replied(0), timeouts(0) {}
+
+	uint64_t sent;
+	uint64_t replied;
+	uint64_t timeouts;
+	std::vector<uint32_t> latencies; // microseconds
+};
+
+Options g_options;
+RSA g_RSA;
+
+std::string formatName(const std::string& format, uint32_t index)
+{
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), format.c_str(), index);
+	return buffer;
+}
+
+class Bot;
+typedef boost::shared_ptr<Bot> Bot_ptr;
+class StatusBenchmark;
+
+class LoadGenerator
+{
+public:
+	LoadGenerator(boost::asio::io_service& io_service);
+
+	void start();
+	void stop();
+
+	void onBotOnline(uint32_t index, uint32_t creatureId, int64_t loginTime);
+	void onBotFailed(uint32_t index, const std::string& reason);
+	void onBotOffline();
+	void onAction(ActionType type);
+	void onActionReply(ActionType type, int64_t latency);
+	void onActionTimeout(ActionType type);
+
+	uint32_t getAttackTarget(uint32_t index) const;
+	bool isStopping() const {return m_stopping;}
+
+	void printReport(std::ostream& os, const ServerStats& before, const ServerStats& after, bool haveServerStats) const;
+
+protected:
+	void startBot(uint32_t index);
+	void onReportTimer(const boost::system::error_code& error);
+	void onStopTimer(const boost::system::error_code& error);
+
+	boost::asio::io_service& m_io_service;
+	boost::asio::deadline_timer m_rampTimer;
+	boost::asio::deadline_timer m_reportTimer;
+	boost::asio::deadline_timer m_stopTimer;
+
+	std::vector<Bot_ptr> m_bots;
+	std::vector<uint32_t> m_creatureIds;
+	std::vector<uint32_t> m_loginTimes; // microseconds
+	int64_t m_lastLogin;
+	ActionStats m_actions[ACTION_COUNT];
+	uint32_t m_online;
+	uint32_t m_failed;
+	uint64_t m_lastActions;
+	int64_t m_startTime;
+	int64_t m_stopTime;
+	int64_t m_lastReport;
+	bool m_stopping;
+};
+
+class Bot : public GameClient
+{
+public:
+	Bot(boost::asio::io_service& io_service, LoadGenerator& generator, uint32_t index);
+
+	void start();
+	void stop();
+
+protected:
+	Bot_ptr self() {return boost::static_pointer_cast<Bot>(shared_from_this());}
+
+	virtual void onLogin(uint32_t creatureId, ServerMessage& msg);
+	virtual void onPacket(ServerMessage& msg);
+	virtual void onError(const std::string& reason, bool wasOnline);
+
+	void cancelTimers();
+	void scheduleAction(uint32_t delay);
+	void onActionTimer(const boost::system::error_code& error);
+	void onReplyTimer(const boost::system::error_code& error);
+	void onPingTimer(const boost::system::error_code& error);
+	void doAction();
+
+	bool findPattern(const ServerMessage& msg, const uint8_t* pattern, size_t size, size_t* found = NULL) const;
+	bool findTextMessage(const ServerMessage& msg) const;
+
+	boost::asio::deadline_timer m_actionTimer;
+	boost::asio::deadline_timer m_replyTimer;
+	boost::asio::deadline_timer m_pingTimer;
+	LoadGenerator& m_generator;
+	uint32_t m_index;
+
+	uint32_t m_creatureId;
+	uint16_t m_posX, m_posY;
+	uint8_t m_posZ;
+
+	bool m_waitingReply;
+	ActionType m_pendingAction;
+	int64_t m_actionSent;
+	int64_t m_loginStarted;
+	uint8_t m_walkDirection;
+	std::string m_sayToken;
+	uint32_t m_saySequence;
+	bool m_floorUp;
+};
+
+Bot::Bot(boost::asio::io_service& io_service, LoadGenerator& generator, uint32_t index) :
+	GameClient(io_service, &g_RSA),
+	m_actionTimer(io_service),
+	m_replyTimer(io_service),
+	m_pingTimer(io_service),
+	m_generator(generator),
+	m_index(index)
+{
+	m_creatureId = 0;
+	m_posX = m_posY = 0;
+	m_posZ = 0;
+	m_waitingReply = false;
+	m_pendingAction = ACTION_WALK;
+	m_actionSent = 0;
+	m_loginStarted = 0;
+	m_walkDirection = 0;
+	m_saySequence = 0;
+	m_floorUp = true;
+}
+
+void Bot::start()
+{
+	m_loginStarted = OTSYS_TIME_US();
+	connect(g_options.host, g_options.skipLogin ? 0 : g_options.loginPort, g_options.gamePort,
+		formatName(g_options.accountFormat, m_index), formatName(g_options.characterFormat, m_index),
+		g_options.password);
+}
+
+void Bot::stop()
+{
+	cancelTimers();
+	logout();
+}
+
+void Bot::onLogin(uint32_t creatureId, ServerMessage& msg)
+{
+	// 0x0A player id, drawing speed, can report bugs, then the
+	// map description which starts with the player position
+	m_creatureId = creatureId;
+	const uint8_t* data = msg.getData();
+	for(size_t pos = msg.getReadPos(); pos + 6 <= msg.getSize(); ++pos){
+		if(data[pos] == 0x64){
+			ServerMessage position(data + pos + 1, 5);
+			m_posX = position.getU16();
+			m_posY = position.getU16();
+			m_posZ = position.getByte();
+			break;
+		}
+	}
+
+	m_generator.onBotOnline(m_index, m_creatureId, OTSYS_TIME_US() - m_loginStarted);
+
+	m_pingTimer.expires_from_now(boost::posix_time::seconds(5));
+	m_pingTimer.async_wait(boost::bind(&Bot::onPingTimer, self(), boost::asio::placeholders::error));
+	scheduleAction(rand() % (g_options.thinkTime + 1));
+}
+
+void Bot::onError(const std::string& reason, bool wasOnline)
+{
+	cancelTimers();
+	if(wasOnline){
+		m_generator.onBotOffline();
+		if(!m_generator.isStopping()){
+			std::cout << "[" << getCharacter() << "] disconnected: " << reason << std::endl;
+		}
+	}
+	else{
+		m_generator.onBotFailed(m_index, reason);
+	}
+}
+
+void Bot::onPacket(ServerMessage& msg)
+{
+	if(!m_waitingReply){
+		return;
+	}
+
+	// A packet may carry updates caused by other bots, so only count it
+	// as the reply when it contains the message our action triggers
+	bool replied = false;
+	switch(m_pendingAction){
+	case ACTION_WALK:
+	{
+		uint8_t pattern[6] = {0x6D, (uint8_t)m_posX, (uint8_t)(m_posX >> 8), (uint8_t)m_posY, (uint8_t)(m_posY >> 8), m_posZ};
+		size_t found = 0;
+		if(findPattern(msg, pattern, sizeof(pattern), &found)){
+			// old position, stack position, new position
+			if(found + 12 <= msg.getSize()){
+				ServerMessage position(msg.getData() + found + 7, 5);
+				m_posX = position.getU16();
+				m_posY = position.getU16();
+				m_posZ = position.getByte();
+			}
+			replied = true;
+		}
+		else{
+			uint8_t cancel[2] = {0xB5, m_walkDirection};
+			replied = findPattern(msg, cancel, sizeof(cancel)) || findTextMessage(msg);
+		}
+		break;
+	}
+	case ACTION_SAY:
+		replied = findPattern(msg, (const uint8_t*)m_sayToken.data(), m_sayToken.size()) || findTextMessage(msg);
+		break;
+	case ACTION_ATTACK:
+	{
+		uint8_t cancel[5] = {0xA3, 0, 0, 0, 0};
+		replied = findPattern(msg, cancel, sizeof(cancel)) || findTextMessage(msg);
+		break;
+	}
+	case ACTION_USE:
+		replied = findTextMessage(msg);
+		break;
+	case ACTION_FLOOR:
+	{
+		// a teleport removes the player from the old tile, then describes
+		// the map around the new position
+		uint8_t pattern[6] = {0x6C, (uint8_t)m_posX, (uint8_t)(m_posX >> 8), (uint8_t)m_posY, (uint8_t)(m_posY >> 8), m_posZ};
+		size_t found = 0;
+		if(findPattern(msg, pattern, sizeof(pattern), &found) &&
+			found + 13 <= msg.getSize() && msg.getData()[found + 7] == 0x64){
+			ServerMessage position(msg.getData() + found + 8, 5);
+			m_posX = position.getU16();
+			m_posY = position.getU16();
+			m_posZ = position.getByte();
+			m_floorUp = !m_floorUp;
+			replied = true;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	if(replied){
+		m_waitingReply = false;
+		m_replyTimer.cancel();
+		m_generator.onActionReply(m_pendingAction, OTSYS_TIME_US() - m_actionSent);
+		scheduleAction(g_options.thinkTime / 2 + rand() % (g_options.thinkTime + 1));
+	}
+}
+
+void Bot::cancelTimers()
+{
+	m_actionTimer.cancel();
+	m_replyTimer.cancel();
+	m_pingTimer.cancel();
+}
+
+void Bot::scheduleAction(uint32_t delay)
+{
+	if(m_generator.isStopping()){
+		return;
+	}
+
+	m_actionTimer.expires_from_now(boost::posix_time::milliseconds(delay));
+	m_actionTimer.async_wait(boost::bind(&Bot::onActionTimer, self(), boost::asio::placeholders::error));
+}
+
+void Bot::onActionTimer(const boost::system::error_code& error)
+{
+	if(error || !isOnline()){
+		return;
+	}
+
+	doAction();
+}
+
+void Bot::onReplyTimer(const boost::system::error_code& error)
+{
+	if(error || !isOnline() || !m_waitingReply){
+		return;
+	}
+
+	m_waitingReply = false;
+	if(m_pendingAction == ACTION_FLOOR){
+		// no floor in that direction
+		m_floorUp = !m_floorUp;
+	}
+	m_generator.onActionTimeout(m_pendingAction);
+	scheduleAction(g_options.thinkTime / 2 + rand() % (g_options.thinkTime + 1));
+}
+
+void Bot::onPingTimer(const boost::system::error_code& error)
+{
+	if(error || !isOnline()){
+		return;
+	}
+
+	// Answer the server ping unconditionally, the player is kicked
+	// if no pong arrives within a minute
+	ClientMessage msg;
+	msg.addByte(0x1E);
+	send(msg);
+
+	m_pingTimer.expires_from_now(boost::posix_time::seconds(5));
+	m_pingTimer.async_wait(boost::bind(&Bot::onPingTimer, self(), boost::asio::placeholders::error));
+}
+void Bot::doAction()
+{
+	uint32_t total = 0;
+	for(int32_t i = 0; i < ACTION_COUNT; ++i){
+		total += g_options.mix[i];
+	}
+
+	uint32_t roll = rand() % total;
+	ActionType type = ACTION_WALK;
+	for(int32_t i = 0; i < ACTION_COUNT; ++i){
+		if(roll < g_options.mix[i]){
+			type = (ActionType)i;
+			break;
+		}
+		roll -= g_options.mix[i];
+	}
+
+	ClientMessage msg;
+	switch(type){
+	case ACTION_WALK:
+		m_walkDirection = rand() % 4;
+		msg.addByte(0x65 + m_walkDirection);
+		break;
+	case ACTION_SAY:
+	{
+		std::ostringstream ss;
+		ss << "lg" << m_index << "x" << ++m_saySequence;
+		m_sayToken = ss.str();
+		msg.addByte(0x96);
+		msg.addByte(0x01); // SPEAK_SAY
+		msg.addString(m_sayToken);
+		break;
+	}
+	case ACTION_ATTACK:
+		msg.addByte(0xA1);
+		msg.addU32(m_generator.getAttackTarget(m_index));
+		msg.addU32(0);
+		msg.addU32(0);
+		break;
+	case ACTION_USE:
+		msg.addByte(0x82);
+		msg.addPosition(0xFFFF, g_options.useSlot, 0);
+		msg.addU16(g_options.useItemId);
+		msg.addByte(0); // stack position
+		msg.addByte(0); // container index
+		break;
+	case ACTION_FLOOR:
+		msg.addByte(0x96);
+		msg.addByte(0x01); // SPEAK_SAY
+		msg.addString(m_floorUp ? "/up" : "/down");
+		break;
+	default:
+		break;
+	}
+
+	m_pendingAction = type;
+	m_waitingReply = true;
+	m_actionSent = OTSYS_TIME_US();
+	m_generator.onAction(type);
+	send(msg);
+
+	m_replyTimer.expires_from_now(boost::posix_time::milliseconds(g_options.replyTimeout));
+	m_replyTimer.async_wait(boost::bind(&Bot::onReplyTimer, self(), boost::asio::placeholders::error));
+}
+
+bool Bot::findPattern(const ServerMessage& msg, const uint8_t* pattern, size_t size, size_t* found /*= NULL*/) const
+{
+	const uint8_t* begin = msg.getData();
+	const uint8_t* end = begin + msg.getSize();
+	const uint8_t* it = std::search(begin, end, pattern, pattern + size);
+	if(it == end){
+		return false;
+	}
+
+	if(found){
+		*found = it - begin;
+	}
+	return true;
+}
+
+bool Bot::findTextMessage(const ServerMessage& msg) const
+{
+	// 0xB4 MSG_STATUS_SMALL followed by a printable string, used for cancel messages
+	const uint8_t* data = msg.getData();
+	for(size_t pos = 0; pos + 5 <= msg.getSize(); ++pos){
+		if(data[pos] != 0xB4 || data[pos + 1] != 0x14){
+			continue;
+		}
+
+		size_t length = data[pos + 2] | (data[pos + 3] << 8);
+		if(length == 0 || pos + 4 + length > msg.getSize()){
+			continue;
+		}
+
+		bool printable = true;
+		for(size_t i = 0; i < length && printable; ++i){
+			printable = (data[pos + 4 + i] >= 0x20 && data[pos + 4 + i] < 0x7F);
+		}
+
+		if(printable){
+			return true;
+		}
+	}
+
+	return false;
+}
+
+LoadGenerator::LoadGenerator(boost::asio::io_service& io_service) :
+	m_io_service(io_service),
+	m_rampTimer(io_service),
+	m_reportTimer(io_service),
+	m_stopTimer(io_service)
+{
+	m_creatureIds.resize(g_options.bots, 0);
+	m_online = 0;
+	m_failed = 0;
+	m_lastActions = 0;
+	m_startTime = 0;
+	m_stopTime = 0;
+	m_lastReport = 0;
+	m_lastLogin = 0;
+	m_stopping = false;
+}
+
+void LoadGenerator::start()
+{
+	m_startTime = OTSYS_TIME_US();
+	m_lastReport = m_startTime;
+
+	for(uint32_t i = 0; i < g_options.bots; ++i){
+		m_bots.push_back(Bot_ptr(new Bot(m_io_service, *this, g_options.firstBot + i)));
+	}
+	startBot(0);
+
+	m_reportTimer.expires_from_now(boost::posix_time::seconds(g_options.reportInterval));
+	m_reportTimer.async_wait(boost::bind(&LoadGenerator::onReportTimer, this, boost::asio::placeholders::error));
+
+	m_stopTimer.expires_from_now(boost::posix_time::seconds(g_options.duration));
+	m_stopTimer.async_wait(boost::bind(&LoadGenerator::onStopTimer, this, boost::asio::placeholders::error));
+}
+
+void LoadGenerator::startBot(uint32_t index)
+{
+	if(m_stopping || index >= m_bots.size()){
+		return;
+	}
+
+	m_bots[index]->start();
+	if(index + 1 < m_bots.size()){
+		m_rampTimer.expires_from_now(boost::posix_time::milliseconds(g_options.rampUp));
+		m_rampTimer.async_wait(boost::bind(&LoadGenerator::startBot, this, index + 1));
+	}
+}
+
+void LoadGenerator::stop()
+{
+	m_stopping = true;
+	m_stopTime = OTSYS_TIME_US();
+	m_rampTimer.cancel();
+	m_reportTimer.cancel();
+	for(std::vector<Bot_ptr>::iterator it = m_bots.begin(); it != m_bots.end(); ++it){
+		(*it)->stop();
+	}
+}
+
+void LoadGenerator::onStopTimer(const boost::system::error_code& error)
+{
+	if(error){
+		return;
+	}
+
+	if(!m_stopping){
+		stop();
+
+		// Players in fight can not logout, give the rest a moment and close
+		m_stopTimer.expires_from_now(boost::posix_time::seconds(5));
+		m_stopTimer.async_wait(boost::bind(&LoadGenerator::onStopTimer, this, boost::asio::placeholders::error));
+	}
+	else{
+		for(std::vector<Bot_ptr>::iterator it = m_bots.begin(); it != m_bots.end(); ++it){
+			(*it)->close();
+		}
+	}
+}
+
+void LoadGenerator::onReportTimer(const boost::system::error_code& error)
+{
+	if(error){
+		return;
+	}
+
+	uint64_t actions = 0;
+	for(int32_t i = 0; i < ACTION_COUNT; ++i){
+		actions += m_actions[i].sent;
+	}
+
+	int64_t now = OTSYS_TIME_US();
+	double seconds = (now - m_lastReport) / 1000000.;
+	std::cout << "[" << (now - m_startTime) / 1000000 << "s] online: " << m_online << "/" << g_options.bots
+		<< ", failed: " << m_failed
+		<< ", actions/s: " << std::fixed << std::setprecision(1) << (actions - m_lastActions) / seconds
+		<< std::endl;
+
+	m_lastActions = actions;
+	m_lastReport = now;
+
+	m_reportTimer.expires_from_now(boost::posix_time::seconds(g_options.reportInterval));
+	m_reportTimer.async_wait(boost::bind(&LoadGenerator::onReportTimer, this, boost::asio::placeholders::error));
+}
+
+void LoadGenerator::onBotOnline(uint32_t index, uint32_t creatureId, int64_t loginTime)
+{
+	m_creatureIds[index - g_options.firstBot] = creatureId;
+	++m_online;
+	m_loginTimes.push_back((uint32_t)loginTime);
+	m_lastLogin = OTSYS_TIME_US();
+}
+
+void LoadGenerator::onBotFailed(uint32_t index, const std::string& reason)
+{
+	++m_failed;
+	std::cout << "[" << formatName(g_options.characterFormat, index) << "] " << reason << std::endl;
+	if(m_failed == g_options.bots){
+		stop();
+	}
+}
+
+void LoadGenerator::onBotOffline()
+{
+	--m_online;
+}
+
+void LoadGenerator::onAction(ActionType type)
+{
+	++m_actions[type].sent;
+}
+
+void LoadGenerator::onActionReply(ActionType type, int64_t latency)
+{
+	++m_actions[type].replied;
+	m_actions[type].latencies.push_back((uint32_t)latency);
+}
+
+void LoadGenerator::onActionTimeout(ActionType type)
+{
+	++m_actions[type].timeouts;
+}
+
+uint32_t LoadGenerator::getAttackTarget(uint32_t index) const
+{
+	// Another bot when one is online, otherwise an id nobody has
+	std::vector<uint32_t> targets;
+	for(uint32_t i = 0; i < m_creatureIds.size(); ++i){
+		if(m_creatureIds[i] != 0 && i != index - g_options.firstBot){
+			targets.push_back(m_creatureIds[i]);
+		}
+	}
+
+	if(targets.empty()){
+		return 0x7FFFFFFF;
+	}
+	return targets[rand() % targets.size()];
+}
+
+void LoadGenerator::printReport(std::ostream& os, const ServerStats& before, const ServerStats& after, bool haveServerStats) const
+{
+	double seconds = (m_stopTime - m_startTime) / 1000000.;
+	if(seconds <= 0){
+		seconds = 1;
+	}
+
+	uint64_t bytesIn = 0, bytesOut = 0;
+	for(std::vector<Bot_ptr>::const_iterator it = m_bots.begin(); it != m_bots.end(); ++it){
+		bytesIn += (*it)->getBytesIn();
+		bytesOut += (*it)->getBytesOut();
+	}
+
+	os << std::endl << "Client side, " << std::fixed << std::setprecision(1) << seconds << "s, "
+		<< g_options.bots << " bots, " << m_failed << " failed" << std::endl;
+	os << "  traffic in: " << bytesIn / seconds / 1024 << " KB/s, out: " << bytesOut / seconds / 1024 << " KB/s" << std::endl;
+
+	// With --ramp-up 0 this is the login throughput of the server
+	std::vector<uint32_t> loginTimes(m_loginTimes);
+	double loginSeconds = (m_lastLogin - m_startTime) / 1000000.;
+	os << "  logins: " << loginTimes.size() << ", " << (loginSeconds > 0 ? loginTimes.size() / loginSeconds : 0.) << "/s" << std::endl;
+	os << std::endl;
+	os << "                  p50ms     p90ms     p99ms     maxms" << std::endl;
+	os << "  login     ";
+	printPercentiles(os, loginTimes);
+	os << std::endl;
+
+	os << std::endl;
+	os << "  action      sent   replied  timeouts     p50ms     p90ms     p99ms     maxms" << std::endl;
+
+	for(int32_t i = 0; i < ACTION_COUNT; ++i){
+		const ActionStats& stats = m_actions[i];
+		std::vector<uint32_t> latencies(stats.latencies);
+
+		os << "  " << std::left << std::setw(8) << actionNames[i] << std::right
+			<< std::setw(8) << stats.sent << std::setw(10) << stats.replied << std::setw(10) << stats.timeouts;
+		printPercentiles(os, latencies);
+		os << std::endl;
+	}
+
+	if(!haveServerStats){
+		os << std::endl << "Server side statistics unavailable, the status query was refused"
+			" (see status_information_timeout) or the server is too old." << std::endl;
+		return;
+	}
+
+	os << std::endl << "Server side" << std::endl;
+	printServerStats(os, before, after, seconds);
+}
+
+// Hammers the status port like a server list crawler, every connection
+// sends one query and reads the answer until the server closes it
+class StatusQuery : public boost::enable_shared_from_this<StatusQuery>
+{
+public:
+	StatusQuery(boost::asio::io_service& io_service, StatusBenchmark& benchmark) :
+		m_socket(io_service), m_benchmark(benchmark), m_startTime(0), m_received(0) {}
+
+	void start();
+
+protected:
+	void onConnect(const boost::system::error_code& error);
+	void onWrite(const boost::system::error_code& error);
+	void onRead(const boost::system::error_code& error, size_t bytes);
+
+	boost::asio::ip::tcp::socket m_socket;
+	StatusBenchmark& m_benchmark;
+	int64_t m_startTime;
+	size_t m_received;
+	uint8_t m_buffer[4096];
+};
+
+class StatusBenchmark
+{
+public:
+	StatusBenchmark(boost::asio::io_service& io_service) :
+		m_io_service(io_service), m_stopTimer(io_service),
+		m_queries(0), m_refused(0), m_errors(0), m_bytes(0), m_startTime(0), m_stopTime(0), m_stopping(false) {}
+
+	void start();
+	void startQuery();
+	void onQueryDone(int64_t latency, size_t bytes, bool error);
+
+	void printReport(std::ostream& os) const;
+
+protected:
+	void onStopTimer(const boost::system::error_code& error);
+
+	boost::asio::io_service& m_io_service;
+	boost::asio::deadline_timer m_stopTimer;
+	uint64_t m_queries;
+	uint64_t m_refused;
+	uint64_t m_errors;
+	uint64_t m_bytes;
+	std::vector<uint32_t> m_latencies; // microseconds
+	int64_t m_startTime;
+	int64_t m_stopTime;
+	bool m_stopping;
+};
+
+void StatusQuery::start()
+{
+	m_startTime = OTSYS_TIME_US();
+	boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(g_options.host), g_options.statusPort);
+	m_socket.async_connect(endpoint, boost::bind(&StatusQuery::onConnect, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void StatusQuery::onConnect(const boost::system::error_code& error)
+{
+	if(error){
+		m_benchmark.onQueryDone(0, 0, true);
+		return;
+	}
+
+	// length, protocol id, xml info request
+	static const uint8_t request[8] = {0x06, 0x00, 0xFF, 0xFF, 'i', 'n', 'f', 'o'};
+	boost::asio::async_write(m_socket, boost::asio::buffer(request, sizeof(request)),
+		boost::bind(&StatusQuery::onWrite, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void StatusQuery::onWrite(const boost::system::error_code& error)
+{
+	if(error){
+		m_benchmark.onQueryDone(0, 0, true);
+		return;
+	}
+
+	m_socket.async_read_some(boost::asio::buffer(m_buffer, sizeof(m_buffer)),
+		boost::bind(&StatusQuery::onRead, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+void StatusQuery::onRead(const boost::system::error_code& error, size_t bytes)
+{
+	m_received += bytes;
+	if(!error){
+		m_socket.async_read_some(boost::asio::buffer(m_buffer, sizeof(m_buffer)),
+			boost::bind(&StatusQuery::onRead, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+		return;
+	}
+
+	// A refused query is closed without an answer
+	bool failed = (error != boost::asio::error::eof);
+	m_benchmark.onQueryDone(OTSYS_TIME_US() - m_startTime, m_received, failed);
+}
+
+void StatusBenchmark::start()
+{
+	m_startTime = OTSYS_TIME_US();
+	for(uint32_t i = 0; i < g_options.statusBench; ++i){
+		startQuery();
+	}
+
+	m_stopTimer.expires_from_now(boost::posix_time::seconds(g_options.duration));
+	m_stopTimer.async_wait(boost::bind(&StatusBenchmark::onStopTimer, this, boost::asio::placeholders::error));
+}
+
+void StatusBenchmark::startQuery()
+{
+	if(!m_stopping){
+		boost::shared_ptr<StatusQuery>(new StatusQuery(m_io_service, *this))->start();
+	}
+}
+
+void StatusBenchmark::onStopTimer(const boost::system::error_code& error)
+{
+	if(!error){
+		m_stopping = true;
+		m_stopTime = OTSYS_TIME_US();
+	}
+}
+
+void StatusBenchmark::onQueryDone(int64_t latency, size_t bytes, bool error)
+{
+	if(m_stopping){
+		return;
+	}
+
+	if(error){
+		++m_errors;
+	}
+	else if(bytes == 0){
+		++m_refused;
+	}
+	else{
+		++m_queries;
+		m_bytes += bytes;
+		m_latencies.push_back((uint32_t)latency);
+	}
+	startQuery();
+}
+
+void StatusBenchmark::printReport(std::ostream& os) const
+{
+	double seconds = (m_stopTime - m_startTime) / 1000000.;
+	if(seconds <= 0){
+		seconds = 1;
+	}
+
+	std::vector<uint32_t> latencies(m_latencies);
+	os << std::endl << "Status queries, " << std::fixed << std::setprecision(1) << seconds << "s, "
+		<< g_options.statusBench << " connections" << std::endl;
+	os << "  answered: " << m_queries / seconds << "/s, refused: " << m_refused / seconds
+		<< "/s, errors: " << m_errors << ", " << (m_queries > 0 ? m_bytes / m_queries : 0) << " bytes each" << std::endl;
+	os << std::endl;
+	os << "                  p50ms     p90ms     p99ms     maxms" << std::endl;
+	os << "  latency   ";
+	printPercentiles(os, latencies);
+	os << std::endl;
+}
+
+class AcceptBenchmark;
+
+// Connects to the game port and waits for the first packet the server
+// sends, a connection that got it was accepted and served by a thread
+class AcceptProbe : public boost::enable_shared_from_this<AcceptProbe>
+{
+public:
+	AcceptProbe(boost::asio::io_service& io_service, AcceptBenchmark& benchmark) :
+		m_socket(io_service), m_benchmark(benchmark), m_startTime(0) {}
+
+	void start(const boost::asio::ip::address& source);
+
+protected:
+	void onConnect(const boost::system::error_code& error);
+	void onRead(const boost::system::error_code& error);
+
+	boost::asio::ip::tcp::socket m_socket;
+	AcceptBenchmark& m_benchmark;
+	int64_t m_startTime;
+	uint8_t m_header[2];
+};
+
+class AcceptBenchmark
+{
+public:
+	AcceptBenchmark(boost::asio::io_service& io_service) :
+		m_io_service(io_service), m_stopTimer(io_service),
+		m_accepted(0), m_errors(0), m_nextSource(0), m_startTime(0), m_stopTime(0), m_stopping(false) {}
+
+	void start();
+	void startProbe();
+	void onProbeDone(int64_t latency, bool error);
+
+	void printReport(std::ostream& os) const;
+
+protected:
+	void onStopTimer(const boost::system::error_code& error);
+
+	boost::asio::io_service& m_io_service;
+	boost::asio::deadline_timer m_stopTimer;
+	uint64_t m_accepted;
+	uint64_t m_errors;
+	uint32_t m_nextSource;
+	std::vector<uint32_t> m_latencies; // microseconds
+	int64_t m_startTime;
+	int64_t m_stopTime;
+	bool m_stopping;
+};
+
+void AcceptProbe::start(const boost::asio::ip::address& source)
+{
+	m_startTime = OTSYS_TIME_US();
+	boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(g_options.host), g_options.gamePort);
+	if(!source.is_unspecified()){
+		boost::system::error_code error;
+		m_socket.open(endpoint.protocol(), error);
+		m_socket.bind(boost::asio::ip::tcp::endpoint(source, 0), error);
+	}
+	m_socket.async_connect(endpoint, boost::bind(&AcceptProbe::onConnect, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void AcceptProbe::onConnect(const boost::system::error_code& error)
+{
+	if(error){
+		m_benchmark.onProbeDone(0, true);
+		return;
+	}
+
+	boost::asio::async_read(m_socket, boost::asio::buffer(m_header, sizeof(m_header)),
+		boost::bind(&AcceptProbe::onRead, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void AcceptProbe::onRead(const boost::system::error_code& error)
+{
+	boost::system::error_code ignored;
+	m_socket.close(ignored);
+	m_benchmark.onProbeDone(OTSYS_TIME_US() - m_startTime, (bool)error);
+}
+
+void AcceptBenchmark::start()
+{
+	m_startTime = OTSYS_TIME_US();
+	for(uint32_t i = 0; i < g_options.acceptBench; ++i){
+		startProbe();
+	}
+
+	m_stopTimer.expires_from_now(boost::posix_time::seconds(g_options.duration));
+	m_stopTimer.async_wait(boost::bind(&AcceptBenchmark::onStopTimer, this, boost::asio::placeholders::error));
+}
+
+void AcceptBenchmark::startProbe()
+{
+	if(m_stopping){
+		return;
+	}
+
+	// BanManager::acceptConnection blocks an IP opening more than 10
+	// connections per second, on loopback every connection gets its own
+	// source address out of 127.0.0.0/8
+	boost::asio::ip::address source;
+	boost::asio::ip::address host = boost::asio::ip::address::from_string(g_options.host);
+	if(host.is_v4() && host.to_v4().is_loopback()){
+		m_nextSource = m_nextSource % 0xFFFFFD + 1;
+		source = boost::asio::ip::address_v4(0x7F000001 + m_nextSource);
+	}
+
+	boost::shared_ptr<AcceptProbe>(new AcceptProbe(m_io_service, *this))->start(source);
+}
+
+void AcceptBenchmark::onStopTimer(const boost::system::error_code& error)
+{
+	if(!error){
+		m_stopping = true;
+		m_stopTime = OTSYS_TIME_US();
+	}
+}
+
+void AcceptBenchmark::onProbeDone(int64_t latency, bool error)
+{
+	if(m_stopping){
+		return;
+	}
+
+	if(error){
+		++m_errors;
+	}
+	else{
+		++m_accepted;
+		m_latencies.push_back((uint32_t)latency);
+	}
+	startProbe();
+}
+
+void AcceptBenchmark::printReport(std::ostream& os) const
+{
+	double seconds = (m_stopTime - m_startTime) / 1000000.;
+	if(seconds <= 0){
+		seconds = 1;
+	}
+
+	std::vector<uint32_t> latencies(m_latencies);
+	os << std::endl << "Game port connections, " << std::fixed << std::setprecision(1) << seconds << "s, "
+		<< g_options.acceptBench << " at a time" << std::endl;
+	os << "  accepted: " << m_accepted / seconds << "/s, errors: " << m_errors << std::endl;
+	os << std::endl;
+	os << "                  p50ms     p90ms     p99ms     maxms" << std::endl;
+	os << "  accept    ";
+	printPercentiles(os, latencies);
+	os << std::endl;
+}
+
+// The creatures a client can see, a window moving over the ids of a world
+class KnownBenchView
+{
+public:
+	KnownBenchView() : m_first(0), m_count(0) {}
+
+	void move(uint32_t first, uint32_t count) {m_first = first; m_count = count;}
+	bool canSee(uint32_t id) const {return id >= m_first && id < m_first + m_count;}
+
+protected:
+	uint32_t m_first;
+	uint32_t m_count;
+};
+
+// ProtocolGame::checkCreatureAsKnown before KnownCreatureList
+class ListKnownCreatures
+{
+public:
+	void check(const KnownBenchView& view, uint32_t id, bool& known, uint32_t& removedKnown)
+	{
+		std::list<uint32_t>::iterator i;
+		for(i = m_list.begin(); i != m_list.end(); ++i){
+			if((*i) == id){
+				m_list.erase(i);
+				m_list.push_back(id);
+				known = true;
+				return;
+			}
+		}
+
+		known = false;
+		m_list.push_back(id);
+
+		if(m_list.size() > 150){
+			for(int n = 0; n < 150; n++){
+				removedKnown = m_list.front();
+				if(!view.canSee(removedKnown))
+					break;
+
+				m_list.pop_front();
+				m_list.push_back(removedKnown);
+			}
+
+			m_list.pop_front();
+		}
+		else{
+			removedKnown = 0;
+		}
+	}
+
+protected:
+	std::list<uint32_t> m_list;
+};
+
+// ProtocolGame::checkCreatureAsKnown
+class FlatKnownCreatures
+{
+public:
+	void check(const KnownBenchView& view, uint32_t id, bool& known, uint32_t& removedKnown)
+	{
+		if(m_list.touch(id)){
+			known = true;
+			return;
+		}
+
+		known = false;
+		m_list.push_back(id);
+
+		if(m_list.size() > KnownCreatureList::max_size){
+			for(int n = 0; n < KnownCreatureList::max_size; n++){
+				removedKnown = m_list.front();
+				if(!view.canSee(removedKnown))
+					break;
+
+				m_list.rotate();
+			}
+
+			m_list.pop_front();
+		}
+		else{
+			removedKnown = 0;
+		}
+	}
+
+protected:
+	KnownCreatureList m_list;
+};
+
+// One client walking through a world of creatures, every step describes
+// the creatures in sight in a random order, like the tiles of a map
+// description do. The same seed gives the same sequence.
+struct KnownBenchStep {
+	uint32_t first;
+	uint32_t count;
+	std::vector<uint32_t> ids;
+};
+
+void buildKnownBench(std::vector<KnownBenchStep>& steps, uint32_t count)
+{
+	srand(1);
+	uint32_t first = 1;
+	steps.resize(count);
+	for(uint32_t i = 0; i < count; ++i){
+		KnownBenchStep& step = steps[i];
+		// crowds of up to 250 creatures, more than the list holds
+		first += rand() % 20;
+		step.first = first;
+		step.count = 20 + rand() % 230;
+		for(uint32_t id = first; id < first + step.count; ++id){
+			if(rand() % 4 != 0){
+				step.ids.push_back(id);
+			}
+		}
+		std::random_shuffle(step.ids.begin(), step.ids.end());
+	}
+}
+
+template<class KnownCreatures>
+int64_t runKnownBench(const std::vector<KnownBenchStep>& steps, std::vector<uint32_t>& wire)
+{
+	KnownCreatures list;
+	KnownBenchView view;
+	wire.clear();
+
+	int64_t start = OTSYS_TIME_US();
+	for(std::vector<KnownBenchStep>::const_iterator it = steps.begin(); it != steps.end(); ++it){
+		view.move(it->first, it->count);
+		for(std::vector<uint32_t>::const_iterator id = it->ids.begin(); id != it->ids.end(); ++id){
+			bool known;
+			uint32_t removedKnown = 0;
+			list.check(view, *id, known, removedKnown);
+
+			// AddCreature sends 0x62 and the id for a known creature, 0x61,
+			// the removed id and the new id otherwise
+			if(known){
+				wire.push_back(0x62);
+			}
+			else{
+				wire.push_back(0x61);
+				wire.push_back(removedKnown);
+			}
+			wire.push_back(*id);
+		}
+	}
+	return OTSYS_TIME_US() - start;
+}
+
+bool runKnownBenchmark(std::ostream& os)
+{
+	std::vector<KnownBenchStep> steps;
+	buildKnownBench(steps, g_options.knownBench);
+
+	uint64_t checks = 0;
+	for(std::vector<KnownBenchStep>::const_iterator it = steps.begin(); it != steps.end(); ++it){
+		checks += it->ids.size();
+	}
+
+	std::vector<uint32_t> listWire, flatWire;
+	int64_t listTime = runKnownBench<ListKnownCreatures>(steps, listWire);
+	int64_t flatTime = runKnownBench<FlatKnownCreatures>(steps, flatWire);
+
+	size_t common = std::min(listWire.size(), flatWire.size());
+	size_t mismatch = std::mismatch(listWire.begin(), listWire.begin() + common, flatWire.begin()).first - listWire.begin();
+	bool same = (listWire.size() == flatWire.size() && mismatch == common);
+
+	os << std::endl << "Known creatures, " << steps.size() << " map descriptions, " << checks << " creatures" << std::endl;
+	os << "                   total ms    ns/check" << std::endl;
+	os << "  std::list   " << std::fixed << std::setprecision(1)
+		<< std::setw(12) << listTime / 1000. << std::setw(12) << listTime * 1000. / std::max<uint64_t>(checks, 1) << std::endl;
+	os << "  flat LRU    "
+		<< std::setw(12) << flatTime / 1000. << std::setw(12) << flatTime * 1000. / std::max<uint64_t>(checks, 1) << std::endl;
+	os << std::endl;
+	if(same){
+		os << "  wire: identical, " << listWire.size() << " values" << std::endl;
+	}
+	else{
+		os << "  wire: DIFFERENT at value " << mismatch << " of " << listWire.size() << std::endl;
+	}
+	return same;
+}
+
+bool parseMix(const std::string& value)
+{
+	memset(g_options.mix, 0, sizeof(g_options.mix));
+
+	std::istringstream ss(value);
+	std::string entry;
+	while(std::getline(ss, entry, ',')){
+		std::string::size_type sep = entry.find('=');
+		if(sep == std::string::npos){
+			return false;
+		}
+
+		std::string name = entry.substr(0, sep);
+		int32_t i = 0;
+		for(; i < ACTION_COUNT; ++i){
+			if(name == actionNames[i]){
+				g_options.mix[i] = atoi(entry.substr(sep + 1).c_str());
+				break;
+			}
+		}
+
+		if(i == ACTION_COUNT){
+			return false;
+		}
+	}
+
+	uint32_t total = 0;
+	for(int32_t i = 0; i < ACTION_COUNT; ++i){
+		total += g_options.mix[i];
+	}
+	return total > 0;
+}
+
+void printUsage(const char* name)
+{
+	std::cout << "Usage: " << name << " [options]" << std::endl
+		<< std::endl
+		<< "  --host <ip>               server address (127.0.0.1)" << std::endl
+		<< "  --login-port <port>       login server port (7171)" << std::endl
+		<< "  --game-port <port>        game server port when the login is skipped (7172)" << std::endl
+		<< "  --status-port <port>      status port for server side statistics (7171)" << std::endl
+		<< "  --skip-login              connect straight to the game server" << std::endl
+		<< "  --bots <n>                number of bots (10)" << std::endl
+		<< "  --first <n>               index of the first bot (1)" << std::endl
+		<< "  --duration <s>            run time in seconds (60)" << std::endl
+		<< "  --ramp-up <ms>            delay between bot logins (100)" << std::endl
+		<< "  --think <ms>              mean delay between two actions of a bot (500)" << std::endl
+		<< "  --reply-timeout <ms>      wait this long for an action reply (2000)" << std::endl
+		<< "  --report <s>              progress report interval (10)" << std::endl
+		<< "  --mix <list>              action weights (walk=60,say=20,attack=10,use=10,floor=0)" << std::endl
+		<< "  --use-item <id> <slot>    item used by the use action (1988 3)" << std::endl
+		<< "  --account <format>        account name format (loadgen%d)" << std::endl
+		<< "  --character <format>      character name format (Loadgen %d)" << std::endl
+		<< "  --password <password>     password of every bot account (loadgen)" << std::endl
+		<< "  --rsa-key <file>          file with the RSA p and q used by the server" << std::endl
+		<< "  --sql <n>                 print SQL creating n bot accounts and exit" << std::endl
+		<< "  --group <id>              group of the characters created by --sql (1)" << std::endl
+		<< "  --sql-bans <n>            print SQL creating n IP bans outside 127/8 and exit" << std::endl
+		<< "  --status-bench <n>        query the status port over n connections instead" << std::endl
+		<< "  --accept-bench <n>        open game port connections, n at a time, instead" << std::endl
+		<< "  --known-bench <n>         replay n map descriptions through both known creature lists and exit" << std::endl;
+}
+
+void printSql()
+{
+	// Matches the layout of sql/sampleworld.sql
+	for(uint32_t i = 0; i < g_options.printSql; ++i){
+		uint32_t index = g_options.firstBot + i;
+		uint32_t id = 100000 + index;
+		std::cout << "INSERT INTO `accounts` (`id`, `name`, `password`) VALUES ('" << id << "', '"
+			<< formatName(g_options.accountFormat, index) << "', '" << g_options.password << "');" << std::endl;
+		std::cout << "INSERT INTO `players` (`id`, `world_id`, `name`, `account_id`, `group_id`, `sex`, `town_id`, `conditions`, `cap`) VALUES ('"
+			<< id << "', '1', '" << formatName(g_options.characterFormat, index) << "', '" << id << "', '" << g_options.groupId << "', '0', '1', '', '100');" << std::endl;
+	}
+}
+
+void printBanSql()
+{
+	// Mostly single addresses, some /24 and /16 ranges, like a ban list
+	// that grew over the years. Permanent, issued by the first account.
+	srand(1);
+	std::cout << "BEGIN;" << std::endl;
+	for(uint32_t i = 0; i < g_options.printBanSql; ++i){
+		uint32_t id = 100000 + i + 1;
+		uint32_t length = 32;
+		uint32_t kind = rand() % 100;
+		if(kind < 2){
+			length = 16;
+		}
+		else if(kind < 20){
+			length = 24;
+		}
+
+		uint32_t first = 1 + rand() % 223;
+		if(first == 127){
+			first = 128;
+		}
+
+		uint32_t mask = 0xFFFFFFFF << (32 - length);
+		uint32_t ip = ((first << 24) | ((rand() & 0xFFF) << 12) | (rand() & 0xFFF)) & mask;
+		std::cout << "INSERT INTO `bans` (`id`, `expires`, `added`, `active`, `admin_id`, `comment`) VALUES ('"
+			<< id << "', '0', '0', '1', '1', 'loadgen');" << std::endl;
+		// the server keeps addresses and masks in network byte order
+		std::cout << "INSERT INTO `ip_bans` (`ban_id`, `ip`, `mask`) VALUES ('"
+			<< id << "', '" << htonl(ip) << "', '" << htonl(mask) << "');" << std::endl;
+	}
+	std::cout << "COMMIT;" << std::endl;
+}
+
+bool parseCommandLine(int argc, char* argv[])
+{
+	g_options.host = "127.0.0.1";
+	g_options.loginPort = 7171;
+	g_options.gamePort = 7172;
+	g_options.statusPort = 7171;
+	g_options.bots = 10;
+	g_options.firstBot = 1;
+	g_options.duration = 60;
+	g_options.rampUp = 100;
+	g_options.thinkTime = 500;
+	g_options.replyTimeout = 2000;
+	g_options.reportInterval = 10;
+	parseMix("walk=60,say=20,attack=10,use=10");
+	g_options.useItemId = 1988;
+	g_options.useSlot = 3;
+	g_options.skipLogin = false;
+	g_options.accountFormat = "loadgen%d";
+	g_options.characterFormat = "Loadgen %d";
+	g_options.password = "loadgen";
+	g_options.printSql = 0;
+	g_options.printBanSql = 0;
+	g_options.groupId = 1;
+	g_options.statusBench = 0;
+	g_options.acceptBench = 0;
+	g_options.knownBench = 0;
+
+	for(int32_t i = 1; i < argc; ++i){
+		std::string arg = argv[i];
+		if(arg == "--help"){
+			printUsage(argv[0]);
+			exit(EXIT_SUCCESS);
+		}
+		else if(arg == "--skip-login"){
+			g_options.skipLogin = true;
+			continue;
+		}
+
+		if(i + 1 >= argc){
+			std::cout << "Missing parameter for '" << arg << "'" << std::endl;
+			return false;
+		}
+
+		std::string value = argv[++i];
+		if(arg == "--host")
+			g_options.host = value;
+		else if(arg == "--login-port")
+			g_options.loginPort = atoi(value.c_str());
+		else if(arg == "--game-port")
+			g_options.gamePort = atoi(value.c_str());
+		else if(arg == "--status-port")
+			g_options.statusPort = atoi(value.c_str());
+		else if(arg == "--bots")
+			g_options.bots = std::max(1, atoi(value.c_str()));
+		else if(arg == "--first")
+			g_options.firstBot = atoi(value.c_str());
+		else if(arg == "--duration")
+			g_options.duration = std::max(1, atoi(value.c_str()));
+		else if(arg == "--ramp-up")
+			g_options.rampUp = atoi(value.c_str());
+		else if(arg == "--think")
+			g_options.thinkTime = atoi(value.c_str());
+		else if(arg == "--reply-timeout")
+			g_options.replyTimeout = std::max(1, atoi(value.c_str()));
+		else if(arg == "--report")
+			g_options.reportInterval = std::max(1, atoi(value.c_str()));
+		else if(arg == "--account")
+			g_options.accountFormat = value;
+		else if(arg == "--character")
+			g_options.characterFormat = value;
+		else if(arg == "--password")
+			g_options.password = value;
+		else if(arg == "--rsa-key")
+			g_options.rsaKeyFile = value;
+		else if(arg == "--sql")
+			g_options.printSql = atoi(value.c_str());
+		else if(arg == "--sql-bans")
+			g_options.printBanSql = atoi(value.c_str());
+		else if(arg == "--group")
+			g_options.groupId = atoi(value.c_str());
+		else if(arg == "--status-bench")
+			g_options.statusBench = atoi(value.c_str());
+		else if(arg == "--accept-bench")
+			g_options.acceptBench = atoi(value.c_str());
+		else if(arg == "--known-bench")
+			g_options.knownBench = atoi(value.c_str());
+		else if(arg == "--mix"){
+			if(!parseMix(value)){
+				std::cout << "Invalid action mix '" << value << "'" << std::endl;
+				return false;
+			}
+		}
+		else if(arg == "--use-item"){
+			if(i + 1 >= argc){
+				std::cout << "Missing parameter 2 for '" << arg << "'" << std::endl;
+				return false;
+			}
+			g_options.useItemId = atoi(value.c_str());
+			g_options.useSlot = atoi(argv[++i]);
+		}
+		else{
+			std::cout << "Unknown option '" << arg << "'" << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	if(!parseCommandLine(argc, argv)){
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(g_options.printSql > 0){
+		printSql();
+		return EXIT_SUCCESS;
+	}
+
+	if(g_options.printBanSql > 0){
+		printBanSql();
+		return EXIT_SUCCESS;
+	}
+
+	if(g_options.knownBench > 0){
+		return runKnownBenchmark(std::cout) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if(g_options.rsaKeyFile.empty()){
+		g_RSA.setKey(default_rsa_p, default_rsa_q);
+	}
+	else if(!g_RSA.setKey(g_options.rsaKeyFile)){
+		std::cout << "Could not load RSA key from " << g_options.rsaKeyFile << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	srand((uint32_t)OTSYS_TIME_US());
+
+	if(g_options.statusBench > 0){
+		boost::asio::io_service io_service;
+		StatusBenchmark benchmark(io_service);
+		benchmark.start();
+		io_service.run();
+		benchmark.printReport(std::cout);
+		return EXIT_SUCCESS;
+	}
+
+	if(g_options.acceptBench > 0){
+		boost::asio::io_service io_service;
+		AcceptBenchmark benchmark(io_service);
+		benchmark.start();
+		io_service.run();
+		benchmark.printReport(std::cout);
+		return EXIT_SUCCESS;
+	}
+
+	ServerStats before, after;
+	bool haveServerStats = queryServerStats(g_options.host, g_options.statusPort, before);
+
+	boost::asio::io_service io_service;
+	LoadGenerator generator(io_service);
+	generator.start();
+	io_service.run();
+
+	haveServerStats = haveServerStats && queryServerStats(g_options.host, g_options.statusPort, after);
+	generator.printReport(std::cout, before, after, haveServerStats);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,573 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Loopback benchmark of the network backends, an echo server reads
+// and writes framed packets like Connection does, once through asio
+// and once through io_uring, and reports throughput and syscalls
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+//
+// Built with cmake -DUSE_IO_URING=ON:
+//
+//   otserv-netbench --connections 200 --size 64 --depth 4 --duration 10
+//
+// The clients run in a child process, so the syscalls and the CPU time
+// reported are the server's only.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "../otpch.h"
+#include "../otsystem.h"
+#include "../iouring.h"
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+struct SyscallCounts {
+	SyscallCounts() : recv(0), send(0), poll(0), readWrite(0) {}
+
+	uint64_t recv;
+	uint64_t send;
+	uint64_t poll;
+	uint64_t readWrite;
+};
+
+SyscallCounts g_syscalls;
+
+}
+
+// The socket calls made by asio and the ring are routed through these
+// to count them, io_uring_enter is counted by the ring itself
+extern "C" ssize_t recv(int fd, void* buffer, size_t length, int flags)
+{
+	++g_syscalls.recv;
+	return syscall(SYS_recvfrom, fd, buffer, length, flags, NULL, NULL);
+}
+
+extern "C" ssize_t send(int fd, const void* buffer, size_t length, int flags)
+{
+	++g_syscalls.send;
+	return syscall(SYS_sendto, fd, buffer, length, flags, NULL, 0);
+}
+
+extern "C" ssize_t recvmsg(int fd, struct msghdr* msg, int flags)
+{
+	++g_syscalls.recv;
+	return syscall(SYS_recvmsg, fd, msg, flags);
+}
+
+extern "C" ssize_t sendmsg(int fd, const struct msghdr* msg, int flags)
+{
+	++g_syscalls.send;
+	return syscall(SYS_sendmsg, fd, msg, flags);
+}
+
+extern "C" int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout)
+{
+	++g_syscalls.poll;
+	return syscall(SYS_epoll_pwait, epfd, events, maxevents, timeout, NULL, _NSIG / 8);
+}
+
+extern "C" ssize_t read(int fd, void* buffer, size_t count)
+{
+	++g_syscalls.readWrite;
+	return syscall(SYS_read, fd, buffer, count);
+}
+
+extern "C" ssize_t write(int fd, const void* buffer, size_t count)
+{
+	++g_syscalls.readWrite;
+	return syscall(SYS_write, fd, buffer, count);
+}
+
+namespace {
+
+struct Options {
+	uint32_t connections;
+	uint32_t size;
+	uint32_t depth;
+	uint32_t duration;
+	bool asio;
+	bool ring;
+};
+
+Options g_options;
+
+enum { header_length = 2 };
+
+uint32_t packetLength()
+{
+	return header_length + g_options.size;
+}
+
+// One connection of the echo server, the reply of a packet is written from
+// the connection's slot in the registered block
+class EchoConnection : public boost::enable_shared_from_this<EchoConnection>
+{
+public:
+	EchoConnection(boost::asio::io_service& io_service, IoUring* ring, char* slot, uint64_t& packets) :
+		m_socket(io_service), m_ring(ring), m_slot(slot), m_packets(packets), m_writing(false), m_owed(0)
+	{
+		m_packet.resize(packetLength());
+	}
+
+	boost::asio::ip::tcp::socket& getSocket() {return m_socket;}
+
+	void start()
+	{
+		read();
+	}
+
+	void close()
+	{
+		boost::system::error_code error;
+		m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
+		m_socket.close(error);
+	}
+
+private:
+	void read()
+	{
+		if(m_ring){
+			m_ring->asyncRead(m_socket.native_handle(), &m_packet[0], header_length,
+				boost::bind(&EchoConnection::onHeader, shared_from_this(), _1));
+		}
+		else{
+			boost::asio::async_read(m_socket, boost::asio::buffer(&m_packet[0], header_length),
+				boost::bind(&EchoConnection::onHeader, shared_from_this(), boost::asio::placeholders::error));
+		}
+	}
+
+	void onHeader(const boost::system::error_code& error)
+	{
+		uint16_t size;
+		memcpy(&size, &m_packet[0], 2);
+		if(error || size != g_options.size){
+			return;
+		}
+
+		if(m_ring){
+			m_ring->asyncRead(m_socket.native_handle(), &m_packet[header_length], size,
+				boost::bind(&EchoConnection::onBody, shared_from_this(), _1));
+		}
+		else{
+			boost::asio::async_read(m_socket, boost::asio::buffer(&m_packet[header_length], size),
+				boost::bind(&EchoConnection::onBody, shared_from_this(), boost::asio::placeholders::error));
+		}
+	}
+
+	void onBody(const boost::system::error_code& error)
+	{
+		if(error){
+			return;
+		}
+
+		++m_packets;
+		// Like Connection, replies made during a write go out with the next one
+		++m_owed;
+		if(!m_writing){
+			write();
+		}
+		read();
+	}
+
+	void write()
+	{
+		uint32_t count = std::min<uint32_t>(m_owed, g_options.depth);
+		for(uint32_t i = 0; i < count; ++i){
+			memcpy(m_slot + i * packetLength(), &m_packet[0], packetLength());
+		}
+		m_owed -= count;
+		m_writing = true;
+
+		boost::asio::const_buffer buffer(m_slot, count * packetLength());
+		if(m_ring){
+			m_ring->asyncWrite(m_socket.native_handle(), &buffer, 1,
+				boost::bind(&EchoConnection::onWrite, shared_from_this(), _1));
+		}
+		else{
+			boost::asio::async_write(m_socket, boost::asio::buffer(buffer),
+				boost::bind(&EchoConnection::onWrite, shared_from_this(), boost::asio::placeholders::error));
+		}
+	}
+
+	void onWrite(const boost::system::error_code& error)
+	{
+		m_writing = false;
+		if(!error && m_owed > 0){
+			write();
+		}
+	}
+
+	boost::asio::ip::tcp::socket m_socket;
+	IoUring* m_ring;
+	char* m_slot;
+	uint64_t& m_packets;
+	std::vector<char> m_packet;
+	bool m_writing;
+	uint32_t m_owed;
+};
+
+typedef boost::shared_ptr<EchoConnection> EchoConnection_ptr;
+
+// Keeps depth packets in flight on every connection until the server closes them
+void runClients(uint16_t port)
+{
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+
+	std::vector<char> request(packetLength() * g_options.depth, 'x');
+	for(uint32_t i = 0; i < g_options.depth; ++i){
+		uint16_t size = g_options.size;
+		memcpy(&request[i * packetLength()], &size, 2);
+	}
+
+	std::vector<boost::shared_ptr<boost::asio::ip::tcp::socket> > sockets;
+	for(uint32_t i = 0; i < g_options.connections; ++i){
+		boost::shared_ptr<boost::asio::ip::tcp::socket> socket(new boost::asio::ip::tcp::socket(io_service));
+		boost::system::error_code error;
+		socket->connect(endpoint, error);
+		if(error){
+			std::cout << "connect: " << error.message() << std::endl;
+			_exit(EXIT_FAILURE);
+		}
+		socket->set_option(boost::asio::ip::tcp::no_delay(true));
+		sockets.push_back(socket);
+	}
+
+	// Blocking and single threaded, every reply is answered with a new packet
+	std::vector<char> reply(packetLength() * g_options.depth);
+	for(size_t i = 0; i < sockets.size(); ++i){
+		boost::asio::write(*sockets[i], boost::asio::buffer(request));
+	}
+
+	std::vector<pollfd> fds(sockets.size());
+	for(size_t i = 0; i < sockets.size(); ++i){
+		fds[i].fd = sockets[i]->native_handle();
+		fds[i].events = POLLIN;
+	}
+
+	std::vector<size_t> partial(sockets.size(), 0);
+	while(true){
+		if(poll(&fds[0], fds.size(), -1) <= 0){
+			continue;
+		}
+
+		for(size_t i = 0; i < fds.size(); ++i){
+			if(!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))){
+				continue;
+			}
+
+			boost::system::error_code error;
+			size_t bytes = sockets[i]->read_some(boost::asio::buffer(reply), error);
+			if(error){
+				_exit(EXIT_SUCCESS);
+			}
+
+			partial[i] += bytes;
+			size_t packets = partial[i] / packetLength();
+			partial[i] %= packetLength();
+			if(packets > 0){
+				boost::asio::write(*sockets[i], boost::asio::buffer(&request[0], packets * packetLength()), error);
+			}
+		}
+	}
+}
+
+struct Result {
+	uint64_t packets;
+	double seconds;
+	double cpuTime;
+	SyscallCounts syscalls;
+	uint64_t enters;
+	uint64_t fixedWrites;
+};
+
+double cpuSeconds()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+		(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.;
+}
+
+class EchoServer
+{
+public:
+	EchoServer(boost::asio::io_service& io_service, bool useRing) :
+		m_io_service(io_service),
+		m_acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+		m_timer(io_service),
+		m_ring(NULL),
+		m_packets(0)
+	{
+		m_slots.resize(g_options.connections * packetLength() * g_options.depth);
+		if(useRing){
+			std::string error;
+			m_ring = IoUring::create(io_service, &m_slots[0], m_slots.size(), error);
+			if(!m_ring){
+				std::cout << "io_uring not available: " << error << std::endl;
+			}
+		}
+	}
+
+	~EchoServer()
+	{
+		for(std::vector<EchoConnection_ptr>::iterator it = m_connections.begin(); it != m_connections.end(); ++it){
+			(*it)->close();
+		}
+		m_connections.clear();
+		delete m_ring;
+	}
+
+	bool hasRing() const {return m_ring != NULL;}
+	uint16_t getPort() const {return m_acceptor.local_endpoint().port();}
+
+	void start()
+	{
+		accept();
+	}
+
+	const Result& getResult() const {return m_result;}
+
+private:
+	void accept()
+	{
+		char* slot = &m_slots[m_connections.size() * packetLength() * g_options.depth];
+		EchoConnection_ptr connection(new EchoConnection(m_io_service, m_ring, slot, m_packets));
+		if(m_ring){
+			m_ring->asyncAccept(m_acceptor.native_handle(),
+				boost::bind(&EchoServer::onRingAccept, this, connection, _1, _2));
+		}
+		else{
+			m_acceptor.async_accept(connection->getSocket(),
+				boost::bind(&EchoServer::onAccept, this, connection, boost::asio::placeholders::error));
+		}
+	}
+
+	void onRingAccept(EchoConnection_ptr connection, const boost::system::error_code& error, int fd)
+	{
+		boost::system::error_code assignError = error;
+		if(!error){
+			connection->getSocket().assign(boost::asio::ip::tcp::v4(), fd, assignError);
+		}
+		onAccept(connection, assignError);
+	}
+
+	void onAccept(EchoConnection_ptr connection, const boost::system::error_code& error)
+	{
+		if(error){
+			std::cout << "accept: " << error.message() << std::endl;
+			m_io_service.stop();
+			return;
+		}
+
+		connection->getSocket().set_option(boost::asio::ip::tcp::no_delay(true));
+		m_connections.push_back(connection);
+		connection->start();
+
+		if(m_connections.size() < g_options.connections){
+			accept();
+			return;
+		}
+
+		// Everybody is connected, start measuring
+		m_packets = 0;
+		m_startSyscalls = g_syscalls;
+		m_startEnters = m_ring ? m_ring->getEnters() : 0;
+		m_startFixedWrites = m_ring ? m_ring->getFixedWrites() : 0;
+		m_startTime = OTSYS_TIME_US();
+		m_startCpu = cpuSeconds();
+		m_timer.expires_from_now(boost::posix_time::seconds(g_options.duration));
+		m_timer.async_wait(boost::bind(&EchoServer::onTimer, this));
+	}
+
+	void onTimer()
+	{
+		m_result.packets = m_packets;
+		m_result.seconds = (OTSYS_TIME_US() - m_startTime) / 1000000.;
+		m_result.cpuTime = cpuSeconds() - m_startCpu;
+		m_result.syscalls.recv = g_syscalls.recv - m_startSyscalls.recv;
+		m_result.syscalls.send = g_syscalls.send - m_startSyscalls.send;
+		m_result.syscalls.poll = g_syscalls.poll - m_startSyscalls.poll;
+		m_result.syscalls.readWrite = g_syscalls.readWrite - m_startSyscalls.readWrite;
+		m_result.enters = m_ring ? m_ring->getEnters() - m_startEnters : 0;
+		m_result.fixedWrites = m_ring ? m_ring->getFixedWrites() - m_startFixedWrites : 0;
+		m_io_service.stop();
+	}
+
+	boost::asio::io_service& m_io_service;
+	boost::asio::ip::tcp::acceptor m_acceptor;
+	boost::asio::deadline_timer m_timer;
+	IoUring* m_ring;
+	std::vector<char> m_slots;
+	std::vector<EchoConnection_ptr> m_connections;
+
+	uint64_t m_packets;
+	SyscallCounts m_startSyscalls;
+	uint64_t m_startEnters;
+	uint64_t m_startFixedWrites;
+	int64_t m_startTime;
+	double m_startCpu;
+	Result m_result;
+};
+
+bool runBackend(bool useRing, Result& result)
+{
+	boost::asio::io_service io_service;
+	EchoServer* server = new EchoServer(io_service, useRing);
+	if(useRing && !server->hasRing()){
+		delete server;
+		return false;
+	}
+
+	pid_t child = fork();
+	if(child == 0){
+		runClients(server->getPort());
+		_exit(EXIT_SUCCESS);
+	}
+
+	server->start();
+	io_service.run();
+	result = server->getResult();
+
+	// Closing the sockets ends the clients
+	delete server;
+	int status;
+	waitpid(child, &status, 0);
+	return true;
+}
+
+void printResult(const char* name, const Result& result)
+{
+	double packets = std::max<double>(1, result.packets);
+	uint64_t syscalls = result.syscalls.recv + result.syscalls.send + result.syscalls.poll +
+		result.syscalls.readWrite + result.enters;
+
+	std::cout << std::fixed << std::setprecision(2)
+		<< std::setw(9) << name
+		<< std::setw(12) << (uint64_t)(result.packets / result.seconds)
+		<< std::setw(9) << result.packets * packetLength() * 2 / result.seconds / 1000000.
+		<< std::setw(11) << syscalls / packets
+		<< std::setw(7) << result.syscalls.recv / packets
+		<< std::setw(7) << result.syscalls.send / packets
+		<< std::setw(7) << result.syscalls.poll / packets
+		<< std::setw(7) << result.syscalls.readWrite / packets
+		<< std::setw(7) << result.enters / packets
+		<< std::setw(10) << result.cpuTime * 1000000. / packets
+		<< std::setw(7) << (uint64_t)(100. * result.fixedWrites / packets) << "%"
+		<< std::endl;
+}
+
+void printUsage(const char* name)
+{
+	std::cout << "Usage: " << name << " [options]" << std::endl
+		<< std::endl
+		<< "  --connections <n>         client connections (100)" << std::endl
+		<< "  --size <bytes>            packet body size (64)" << std::endl
+		<< "  --depth <n>               packets in flight per connection (1)" << std::endl
+		<< "  --duration <s>            run time of each backend in seconds (10)" << std::endl
+		<< "  --backend <name>          asio, io_uring or both (both)" << std::endl;
+}
+
+bool parseCommandLine(int argc, char* argv[])
+{
+	g_options.connections = 100;
+	g_options.size = 64;
+	g_options.depth = 1;
+	g_options.duration = 10;
+	g_options.asio = true;
+	g_options.ring = true;
+
+	for(int32_t i = 1; i < argc; ++i){
+		std::string arg = argv[i];
+		if(arg == "--help"){
+			printUsage(argv[0]);
+			exit(EXIT_SUCCESS);
+		}
+
+		if(i + 1 >= argc){
+			std::cout << "Missing parameter for '" << arg << "'" << std::endl;
+			return false;
+		}
+
+		std::string value = argv[++i];
+		if(arg == "--connections")
+			g_options.connections = std::max(1, atoi(value.c_str()));
+		else if(arg == "--size")
+			g_options.size = std::min(60000, std::max(1, atoi(value.c_str())));
+		else if(arg == "--depth")
+			g_options.depth = std::max(1, atoi(value.c_str()));
+		else if(arg == "--duration")
+			g_options.duration = std::max(1, atoi(value.c_str()));
+		else if(arg == "--backend"){
+			g_options.asio = (value == "asio" || value == "both");
+			g_options.ring = (value == "io_uring" || value == "both");
+			if(!g_options.asio && !g_options.ring){
+				std::cout << "Unknown backend '" << value << "'" << std::endl;
+				return false;
+			}
+		}
+		else{
+			std::cout << "Unrecognized command line argument '" << arg << "'" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	if(!parseCommandLine(argc, argv)){
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	std::cout << g_options.connections << " connections, " << g_options.size << " byte packets, "
+		<< g_options.depth << " in flight, " << g_options.duration << "s per backend" << std::endl
+		<< std::endl
+		<< "  backend   packets/s     MB/s   syscalls   recv   send   poll    r/w  enter  cpu us/pkt  fixed" << std::endl;
+
+	Result result;
+	if(g_options.asio && runBackend(false, result)){
+		printResult("asio", result);
+	}
+	if(g_options.ring && runBackend(true, result)){
+		printResult("io_uring", result);
+	}
+	return EXIT_SUCCESS;
+}
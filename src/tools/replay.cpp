@@ -0,0 +1,566 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Replays a packet trace written by the server (packet_trace_file)
+// against a fresh server and compares latency and traffic
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+//
+// Every recorded session logs in again with its recorded account and
+// character, then sends the recorded client packets with the recorded
+// gaps, divided by --speed. The traced accounts and characters have to
+// exist on the replay server, passwords are not part of the trace:
+//
+//   otserv-replay --passwords accounts.txt --speed 2 trace.bin
+//
+// The passwords file holds one "account password" pair per line.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "../otpch.h"
+#include "../otsystem.h"
+#include "../definitions.h"
+#include "../rsa.h"
+#include "../packetrecorder.h"
+#include "gameclient.h"
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+struct Options {
+	std::string host;
+	uint16_t loginPort;
+	uint16_t gamePort;
+	uint16_t statusPort;
+	bool skipLogin;
+	double speed;
+	std::string password;
+	std::string passwordsFile;
+	std::string rsaKeyFile;
+	std::string traceFile;
+};
+
+struct TracePacket {
+	uint32_t time; // ms since the session started
+	std::vector<uint8_t> data;
+};
+
+struct TraceSession {
+	TraceSession() : startTime(0), endTime(0), bytesOut(0) {}
+
+	std::string account;
+	std::string character;
+	uint32_t startTime; // ms since the trace started
+	uint32_t endTime;
+	std::vector<TracePacket> inbound;
+	uint64_t bytesOut;
+	std::vector<uint32_t> latencies; // recorded, microseconds
+};
+
+Options g_options;
+RSA g_RSA;
+std::map<std::string, std::string> g_passwords;
+
+bool loadTrace(const std::string& filename, std::vector<TraceSession>& sessions)
+{
+	FILE* file = fopen(filename.c_str(), "rb");
+	if(!file){
+		std::cout << "Could not open " << filename << std::endl;
+		return false;
+	}
+
+	char magic[4];
+	uint32_t version = 0;
+	uint64_t startTime = 0;
+	if(fread(magic, 1, 4, file) != 4 || memcmp(magic, PACKET_TRACE_MAGIC, 4) != 0 ||
+		fread(&version, sizeof(version), 1, file) != 1 || fread(&startTime, sizeof(startTime), 1, file) != 1){
+		std::cout << filename << " is not a packet trace" << std::endl;
+		fclose(file);
+		return false;
+	}
+
+	if(version != PACKET_TRACE_VERSION){
+		std::cout << filename << " has unsupported trace version " << version << std::endl;
+		fclose(file);
+		return false;
+	}
+
+	// Recorded latency is the time from a client packet to the next
+	// server packet of the same session
+	std::map<uint32_t, size_t> index;
+	std::map<uint32_t, uint32_t> pendingSince;
+	std::vector<uint8_t> payload;
+	uint8_t header[11];
+	while(fread(header, 1, sizeof(header), file) == sizeof(header)){
+		uint8_t type = header[0];
+		uint32_t session, time;
+		uint16_t size;
+		memcpy(&session, header + 1, 4);
+		memcpy(&time, header + 5, 4);
+		memcpy(&size, header + 9, 2);
+
+		payload.resize(size);
+		if(size > 0 && fread(&payload[0], 1, size, file) != size){
+			std::cout << "Warning: " << filename << " is truncated" << std::endl;
+			break;
+		}
+
+		if(type == TRACE_SESSION_START){
+			ServerMessage msg(payload.empty() ? NULL : &payload[0], payload.size());
+			TraceSession traceSession;
+			traceSession.account = msg.getString();
+			traceSession.character = msg.getString();
+			traceSession.startTime = time;
+			traceSession.endTime = time;
+			index[session] = sessions.size();
+			sessions.push_back(traceSession);
+			continue;
+		}
+
+		std::map<uint32_t, size_t>::iterator it = index.find(session);
+		if(it == index.end()){
+			continue;
+		}
+
+		TraceSession& traceSession = sessions[it->second];
+		traceSession.endTime = time;
+		switch(type){
+		case TRACE_SESSION_END:
+			index.erase(it);
+			pendingSince.erase(session);
+			break;
+		case TRACE_INBOUND:
+		{
+			TracePacket packet;
+			packet.time = time - traceSession.startTime;
+			packet.data = payload;
+			traceSession.inbound.push_back(packet);
+			pendingSince.insert(std::make_pair(session, time));
+			break;
+		}
+		case TRACE_OUTBOUND:
+		{
+			traceSession.bytesOut += size;
+			std::map<uint32_t, uint32_t>::iterator pending = pendingSince.find(session);
+			if(pending != pendingSince.end()){
+				traceSession.latencies.push_back((time - pending->second) * 1000);
+				pendingSince.erase(pending);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	fclose(file);
+	return true;
+}
+
+class Replayer;
+
+class ReplayClient : public GameClient
+{
+public:
+	ReplayClient(boost::asio::io_service& io_service, Replayer& replayer, const TraceSession& session);
+
+	void start();
+	const std::vector<uint32_t>& getLatencies() const {return m_latencies;}
+	uint64_t getPayloadIn() const {return m_payloadIn;}
+	uint32_t getPacketsSent() const {return m_next;}
+
+protected:
+	boost::shared_ptr<ReplayClient> self() {return boost::static_pointer_cast<ReplayClient>(shared_from_this());}
+
+	virtual void onLogin(uint32_t creatureId, ServerMessage& msg);
+	virtual void onPacket(ServerMessage& msg);
+	virtual void onError(const std::string& reason, bool wasOnline);
+
+	void scheduleNext();
+	void onTimer(const boost::system::error_code& error);
+
+	boost::asio::deadline_timer m_timer;
+	Replayer& m_replayer;
+	const TraceSession& m_session;
+
+	int64_t m_loginTime;
+	size_t m_next;
+	bool m_waitingReply;
+	int64_t m_sentTime;
+	uint64_t m_payloadIn;
+	std::vector<uint32_t> m_latencies; // microseconds
+};
+
+class Replayer
+{
+public:
+	Replayer(boost::asio::io_service& io_service, const std::vector<TraceSession>& sessions);
+
+	void start();
+	void onClientDone(const std::string& character, const std::string& error);
+
+	void printReport(std::ostream& os, const ServerStats& before, const ServerStats& after, bool haveServerStats) const;
+
+protected:
+	void startClient(size_t index);
+
+	boost::asio::io_service& m_io_service;
+	const std::vector<TraceSession>& m_sessions;
+	std::vector<boost::shared_ptr<ReplayClient> > m_clients;
+	std::vector<boost::asio::deadline_timer*> m_startTimers;
+	uint32_t m_done;
+	uint32_t m_failed;
+	int64_t m_startTime;
+	int64_t m_stopTime;
+};
+
+ReplayClient::ReplayClient(boost::asio::io_service& io_service, Replayer& replayer, const TraceSession& session) :
+	GameClient(io_service, &g_RSA),
+	m_timer(io_service),
+	m_replayer(replayer),
+	m_session(session)
+{
+	m_loginTime = 0;
+	m_next = 0;
+	m_waitingReply = false;
+	m_sentTime = 0;
+	m_payloadIn = 0;
+}
+
+void ReplayClient::start()
+{
+	std::string password = g_options.password;
+	std::map<std::string, std::string>::const_iterator it = g_passwords.find(m_session.account);
+	if(it != g_passwords.end()){
+		password = it->second;
+	}
+
+	connect(g_options.host, g_options.skipLogin ? 0 : g_options.loginPort, g_options.gamePort,
+		m_session.account, m_session.character, password);
+}
+
+void ReplayClient::onLogin(uint32_t creatureId, ServerMessage& msg)
+{
+	// The trace starts after the login, so the recorded gaps are
+	// replayed relative to the moment this login completed
+	m_loginTime = OTSYS_TIME_US();
+	m_payloadIn += msg.getSize();
+	scheduleNext();
+}
+
+void ReplayClient::onPacket(ServerMessage& msg)
+{
+	m_payloadIn += msg.getSize();
+	if(m_waitingReply){
+		m_waitingReply = false;
+		m_latencies.push_back((uint32_t)(OTSYS_TIME_US() - m_sentTime));
+	}
+}
+
+void ReplayClient::onError(const std::string& reason, bool wasOnline)
+{
+	m_timer.cancel();
+	if(wasOnline && m_next >= m_session.inbound.size()){
+		// Closed by the server after our logout
+		m_replayer.onClientDone(getCharacter(), "");
+	}
+	else{
+		m_replayer.onClientDone(getCharacter(), reason);
+	}
+}
+
+void ReplayClient::scheduleNext()
+{
+	// After the last packet wait out the rest of the recorded session
+	uint32_t time = m_session.endTime - m_session.startTime;
+	if(m_next < m_session.inbound.size()){
+		time = m_session.inbound[m_next].time;
+	}
+
+	int64_t due = m_loginTime + (int64_t)(time * 1000 / g_options.speed);
+	int64_t delay = std::max<int64_t>(0, due - OTSYS_TIME_US());
+	m_timer.expires_from_now(boost::posix_time::microseconds(delay));
+	m_timer.async_wait(boost::bind(&ReplayClient::onTimer, self(), boost::asio::placeholders::error));
+}
+
+void ReplayClient::onTimer(const boost::system::error_code& error)
+{
+	if(error || !isOnline()){
+		return;
+	}
+
+	if(m_next >= m_session.inbound.size()){
+		logout();
+		return;
+	}
+
+	const TracePacket& packet = m_session.inbound[m_next++];
+	ClientMessage msg;
+	if(!packet.data.empty()){
+		msg.addBytes(&packet.data[0], packet.data.size());
+	}
+
+	// A packet sent while the previous one is unanswered is not measured
+	if(!m_waitingReply){
+		m_waitingReply = true;
+		m_sentTime = OTSYS_TIME_US();
+	}
+	send(msg);
+	scheduleNext();
+}
+
+Replayer::Replayer(boost::asio::io_service& io_service, const std::vector<TraceSession>& sessions) :
+	m_io_service(io_service),
+	m_sessions(sessions)
+{
+	m_done = 0;
+	m_failed = 0;
+	m_startTime = 0;
+	m_stopTime = 0;
+}
+
+void Replayer::start()
+{
+	m_startTime = OTSYS_TIME_US();
+	m_stopTime = m_startTime;
+	if(m_sessions.empty()){
+		return;
+	}
+
+	// Sessions keep their recorded start offsets to reproduce the
+	// overlap of the original traffic
+	uint32_t first = m_sessions.front().startTime;
+	for(size_t i = 0; i < m_sessions.size(); ++i){
+		m_clients.push_back(boost::shared_ptr<ReplayClient>(new ReplayClient(m_io_service, *this, m_sessions[i])));
+
+		boost::asio::deadline_timer* timer = new boost::asio::deadline_timer(m_io_service);
+		timer->expires_from_now(boost::posix_time::milliseconds((int64_t)((m_sessions[i].startTime - first) / g_options.speed)));
+		timer->async_wait(boost::bind(&Replayer::startClient, this, i));
+		m_startTimers.push_back(timer);
+	}
+}
+
+void Replayer::startClient(size_t index)
+{
+	m_clients[index]->start();
+}
+
+void Replayer::onClientDone(const std::string& character, const std::string& error)
+{
+	++m_done;
+	if(!error.empty()){
+		++m_failed;
+		std::cout << "[" << character << "] " << error << std::endl;
+	}
+
+	if(m_done == m_clients.size()){
+		m_stopTime = OTSYS_TIME_US();
+		for(std::vector<boost::asio::deadline_timer*>::iterator it = m_startTimers.begin(); it != m_startTimers.end(); ++it){
+			delete *it;
+		}
+		m_startTimers.clear();
+	}
+}
+
+void Replayer::printReport(std::ostream& os, const ServerStats& before, const ServerStats& after, bool haveServerStats) const
+{
+	double seconds = (m_stopTime - m_startTime) / 1000000.;
+	if(seconds <= 0){
+		seconds = 1;
+	}
+
+	uint64_t packets = 0, recordedOut = 0, replayedOut = 0;
+	std::vector<uint32_t> recorded, replayed;
+	for(size_t i = 0; i < m_sessions.size(); ++i){
+		recorded.insert(recorded.end(), m_sessions[i].latencies.begin(), m_sessions[i].latencies.end());
+		recordedOut += m_sessions[i].bytesOut;
+	}
+	for(size_t i = 0; i < m_clients.size(); ++i){
+		replayed.insert(replayed.end(), m_clients[i]->getLatencies().begin(), m_clients[i]->getLatencies().end());
+		replayedOut += m_clients[i]->getPayloadIn();
+		packets += m_clients[i]->getPacketsSent();
+	}
+
+	os << std::endl << "Replay, " << std::fixed << std::setprecision(1) << seconds << "s at "
+		<< g_options.speed << "x, " << m_sessions.size() << " sessions, " << m_failed << " failed, "
+		<< packets << " packets sent" << std::endl;
+	os << "  server bytes out: recorded " << recordedOut << ", replayed " << replayedOut << std::endl;
+	os << std::endl;
+	os << "  latency       samples     p50ms     p90ms     p99ms     maxms" << std::endl;
+	os << "  recorded   " << std::setw(10) << recorded.size();
+	printPercentiles(os, recorded);
+	os << std::endl;
+	os << "  replayed   " << std::setw(10) << replayed.size();
+	printPercentiles(os, replayed);
+	os << std::endl;
+
+	if(!haveServerStats){
+		os << std::endl << "Server side statistics unavailable, the status query was refused"
+			" (see status_information_timeout) or the server is too old." << std::endl;
+		return;
+	}
+
+	os << std::endl << "Server side" << std::endl;
+	printServerStats(os, before, after, seconds);
+}
+
+bool loadPasswords(const std::string& filename)
+{
+	std::ifstream file(filename.c_str());
+	if(!file.is_open()){
+		std::cout << "Could not open " << filename << std::endl;
+		return false;
+	}
+
+	std::string line;
+	while(std::getline(file, line)){
+		std::istringstream ss(line);
+		std::string account, password;
+		if(ss >> account >> password){
+			g_passwords[account] = password;
+		}
+	}
+	return true;
+}
+
+void printUsage(const char* name)
+{
+	std::cout << "Usage: " << name << " [options] <trace>" << std::endl
+		<< std::endl
+		<< "  --host <ip>               server address (127.0.0.1)" << std::endl
+		<< "  --login-port <port>       login server port (7171)" << std::endl
+		<< "  --game-port <port>        game server port when the login is skipped (7172)" << std::endl
+		<< "  --status-port <port>      status port for server side statistics (7171)" << std::endl
+		<< "  --skip-login              connect straight to the game server" << std::endl
+		<< "  --speed <factor>          replay this many times faster than recorded (1)" << std::endl
+		<< "  --password <password>     password of every traced account" << std::endl
+		<< "  --passwords <file>        \"account password\" lines, overrides --password" << std::endl
+		<< "  --rsa-key <file>          file with the RSA p and q used by the server" << std::endl;
+}
+
+bool parseCommandLine(int argc, char* argv[])
+{
+	g_options.host = "127.0.0.1";
+	g_options.loginPort = 7171;
+	g_options.gamePort = 7172;
+	g_options.statusPort = 7171;
+	g_options.skipLogin = false;
+	g_options.speed = 1.;
+
+	for(int32_t i = 1; i < argc; ++i){
+		std::string arg = argv[i];
+		if(arg == "--help"){
+			printUsage(argv[0]);
+			exit(EXIT_SUCCESS);
+		}
+		else if(arg == "--skip-login"){
+			g_options.skipLogin = true;
+			continue;
+		}
+		else if(arg.compare(0, 2, "--") != 0){
+			g_options.traceFile = arg;
+			continue;
+		}
+
+		if(i + 1 >= argc){
+			std::cout << "Missing parameter for '" << arg << "'" << std::endl;
+			return false;
+		}
+
+		std::string value = argv[++i];
+		if(arg == "--host")
+			g_options.host = value;
+		else if(arg == "--login-port")
+			g_options.loginPort = atoi(value.c_str());
+		else if(arg == "--game-port")
+			g_options.gamePort = atoi(value.c_str());
+		else if(arg == "--status-port")
+			g_options.statusPort = atoi(value.c_str());
+		else if(arg == "--speed")
+			g_options.speed = atof(value.c_str());
+		else if(arg == "--password")
+			g_options.password = value;
+		else if(arg == "--passwords")
+			g_options.passwordsFile = value;
+		else if(arg == "--rsa-key")
+			g_options.rsaKeyFile = value;
+		else{
+			std::cout << "Unknown option '" << arg << "'" << std::endl;
+			return false;
+		}
+	}
+
+	if(g_options.speed <= 0){
+		std::cout << "Invalid speed" << std::endl;
+		return false;
+	}
+	return !g_options.traceFile.empty();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	if(!parseCommandLine(argc, argv)){
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(!g_options.passwordsFile.empty() && !loadPasswords(g_options.passwordsFile)){
+		return EXIT_FAILURE;
+	}
+
+	if(g_options.rsaKeyFile.empty()){
+		g_RSA.setKey(default_rsa_p, default_rsa_q);
+	}
+	else if(!g_RSA.setKey(g_options.rsaKeyFile)){
+		std::cout << "Could not load RSA key from " << g_options.rsaKeyFile << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<TraceSession> sessions;
+	if(!loadTrace(g_options.traceFile, sessions)){
+		return EXIT_FAILURE;
+	}
+
+	srand((uint32_t)OTSYS_TIME_US());
+
+	ServerStats before, after;
+	bool haveServerStats = queryServerStats(g_options.host, g_options.statusPort, before);
+
+	boost::asio::io_service io_service;
+	Replayer replayer(io_service, sessions);
+	replayer.start();
+	io_service.run();
+
+	haveServerStats = haveServerStats && queryServerStats(g_options.host, g_options.statusPort, after);
+	replayer.printReport(std::cout, before, after, haveServerStats);
+	return EXIT_SUCCESS;
+}